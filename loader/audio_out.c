@@ -0,0 +1,188 @@
+/* audio_out.c -- mixer output at the native device rate with adaptive buffer sizing
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * The file also builds on the host for tools/audio_check.c.
+ */
+
+#ifdef __vita__
+#include <vitasdk.h>
+#endif
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __vita__
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#else
+#define DATA_PATH "."
+#define save_writer_fopen fopen
+#define debugPrintf printf
+#endif
+#include "audio_out.h"
+
+#define AUDIO_CONFIG DATA_PATH "/audio.cfg"
+
+#define NATIVE_FREQUENCY 48000
+#define CHUNK_MIN 512
+#define CHUNK_DEFAULT 1024
+#define CHUNK_MAX 4096
+
+#define WARMUP_CALLBACKS 16 // The first buffers are queued back to back while the port fills up
+#define SUSPEND_US 1000000 // Longer gaps are app suspends, not mixer overruns
+#define WINDOW_US 10000000
+#define WINDOW_OVERRUNS 3 // Overruns in a window before the buffer is grown
+#define SHRINK_AFTER_US (10 * 60 * 1000000ULL) // Clean playback time before a smaller buffer is tried
+
+static int audio_chunk = CHUNK_DEFAULT;
+static audio_out_stats stats; // owned by the mixer thread
+static audio_out_stats published[2];
+static volatile uint32_t published_seq; // published[published_seq & 1] is the last complete copy
+
+static uint64_t last_tick, last_cpu, window_start, clean_since;
+static uint32_t window_overruns;
+static int shrunk = 0;
+
+static void config_load(void) {
+	FILE *f = save_writer_fopen(AUDIO_CONFIG, "r");
+	if (f) {
+		int chunk;
+		if (fscanf(f, "chunk=%d", &chunk) == 1 && chunk >= CHUNK_MIN && chunk <= CHUNK_MAX && !(chunk & (chunk - 1)))
+			audio_chunk = chunk;
+		fclose(f);
+	}
+}
+
+static void config_save(int chunk) {
+	FILE *f = save_writer_fopen(AUDIO_CONFIG, "w");
+	if (f) {
+		fprintf(f, "chunk=%d\n", chunk);
+		fclose(f);
+	}
+}
+
+static uint64_t time_us(void) {
+#ifdef __vita__
+	return sceKernelGetProcessTimeWide();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+#endif
+}
+
+static uint64_t thread_cpu_time(void) {
+#ifdef __vita__
+	SceKernelThreadInfo info;
+	info.size = sizeof(info);
+	if (sceKernelGetThreadInfo(sceKernelGetThreadId(), &info) < 0)
+		return 0;
+	return info.runClocks;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+#endif
+}
+
+static void account(uint64_t now, uint64_t cpu) {
+	if (stats.callbacks++ < WARMUP_CALLBACKS) {
+		last_tick = window_start = clean_since = now;
+		last_cpu = cpu;
+		return;
+	}
+
+	uint32_t period = now - last_tick;
+	uint32_t cost = cpu - last_cpu;
+	last_tick = now;
+	last_cpu = cpu;
+
+	if (period >= SUSPEND_US) {
+		window_start = clean_since = now;
+		window_overruns = 0;
+		return;
+	}
+
+	stats.cpu_us += cost;
+	if (cost > stats.cpu_max_us)
+		stats.cpu_max_us = cost;
+	if (period > stats.period_max_us)
+		stats.period_max_us = period;
+	if (period > stats.latency_us + stats.latency_us / 2) {
+		stats.overruns++;
+		window_overruns++;
+		clean_since = now;
+	}
+
+	// Buffer size changes only apply on the next open, so they're persisted for the next boot
+	if (now - window_start >= WINDOW_US) {
+		if (window_overruns >= WINDOW_OVERRUNS && audio_chunk == stats.chunk && audio_chunk < CHUNK_MAX) {
+			audio_chunk *= 2;
+			config_save(audio_chunk);
+			debugPrintf("audio: %u overruns, buffer raised to %d frames\n", window_overruns, audio_chunk);
+		}
+		window_start = now;
+		window_overruns = 0;
+	}
+	if (!shrunk && now - clean_since >= SHRINK_AFTER_US && stats.chunk > CHUNK_MIN && audio_chunk == stats.chunk) {
+		shrunk = 1;
+		config_save(stats.chunk / 2);
+		debugPrintf("audio: no overruns, trying %d frames next boot\n", stats.chunk / 2);
+	}
+}
+
+// SDL_mixer doesn't say which device it opened so it can't be locked, readers get the copy the mixer isn't writing instead
+static void publish(void) {
+	published[(published_seq + 1) & 1] = stats;
+	__sync_synchronize();
+	published_seq++;
+}
+
+static void audio_postmix(void *udata, Uint8 *stream, int len) {
+	account(time_us(), thread_cpu_time());
+	publish();
+}
+
+int audio_out_open(void) {
+	static int loaded = 0;
+	if (!loaded) {
+		config_load();
+		loaded = 1;
+	}
+
+	// Music is decoded at 44.1 kHz and converted on every callback, keep that conversion cheap
+	SDL_SetHint(SDL_HINT_AUDIO_RESAMPLING_MODE, "fast");
+
+	int res = Mix_OpenAudio(NATIVE_FREQUENCY, AUDIO_S16SYS, 2, audio_chunk);
+	if (res < 0)
+		return Mix_OpenAudio(44100, AUDIO_S16SYS, 2, CHUNK_DEFAULT);
+
+	memset(&stats, 0, sizeof(stats));
+	if (!Mix_QuerySpec(&stats.frequency, NULL, NULL))
+		stats.frequency = NATIVE_FREQUENCY;
+	stats.chunk = audio_chunk;
+	stats.latency_us = (uint64_t)audio_chunk * 1000000 / stats.frequency;
+	publish();
+	Mix_SetPostMix(audio_postmix, NULL);
+
+	return res;
+}
+
+void audio_out_get_stats(audio_out_stats *out) {
+	uint32_t seq;
+	do {
+		seq = published_seq;
+		__sync_synchronize();
+		*out = published[seq & 1];
+		__sync_synchronize();
+	} while (seq != published_seq);
+}
@@ -0,0 +1,20 @@
+#ifndef __AUDIO_OUT_H__
+#define __AUDIO_OUT_H__
+
+#include <stdint.h>
+
+typedef struct {
+	int frequency;       // rate the mixer was opened at
+	int chunk;           // mixer buffer size in sample frames
+	uint32_t latency_us; // time covered by one buffer
+	uint32_t callbacks;  // mixer callbacks since the device was opened
+	uint32_t overruns;   // callbacks that came later than 1.5 buffers after the previous one
+	uint32_t period_max_us;
+	uint64_t cpu_us;     // mixer thread CPU time spent over all callbacks
+	uint32_t cpu_max_us;
+} audio_out_stats;
+
+int audio_out_open(void);
+void audio_out_get_stats(audio_out_stats *stats);
+
+#endif
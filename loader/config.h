@@ -2,10 +2,39 @@
 #define __CONFIG_H__
 
 //#define DEBUG
+//#define IO_TRACE // Records file accesses to DATA_PATH/io_trace.bin
+//#define GL_TRACE // Records GL calls to DATA_PATH/gl_trace.bin, L+R+SELECT captures the next 300 frames
+#define GL_BATCHING // Merges consecutive draws sharing the same state, comment out to compare against unbatched rendering
+#define GL_ATLAS // Packs small textures into shared pages so sprites from different textures batch together
+#define GL_TEXCONV // Stores RGBA8 textures as RGBA5551/RGBA4444 whenever that loses nothing
+//#define TEXTURE_REPORT // Writes texture memory usage to DATA_PATH/texture_report.txt every 10 seconds
+#define GL_STREAMING // Coalesces sub-image updates of streaming textures and applies them once per frame to double-buffered storage
+#define DYNAMIC_RESOLUTION // Renders the game at a lower resolution while the GPU misses the frame time, logged to DATA_PATH/dynres_log.txt
+#define DYNRES_MIN_SCALE 0.6f
+#define DYNRES_MAX_SCALE 1.0f // Native resolution, the game only leaves the screen framebuffer below it
+#define FRAME_PACING // Runs at 60 fps while frames fit and drops to a steady 30 fps when they don't, comment out to stay locked at 30 fps
+#define SDL_BATCHING // Merges SDL_RenderCopy/SDL_RenderFillRect sprites sharing texture and blending into single SDL_RenderGeometry calls
+#define MEM_SLABS // Serves the game's small allocations from size class slabs with per-thread caches instead of newlib's heap
+//#define MEM_TRACE // Records the game's allocations to DATA_PATH/mem_trace.bin, replayable with tools/mem_replay
+//#define MEM_PROFILE // Writes allocation counts, lifetimes and peak live bytes per calling function of the game to DATA_PATH/mem_profile.txt
+//#define MEM_REPORT // Writes allocator usage and slab fragmentation to DATA_PATH/mem_report.txt every 10 seconds
+#define MEM_PLANNER // Sizes the slab region, vitaGL's RAM threshold and thread stacks from the peaks in DATA_PATH/mem_plan.cfg, headroom goes to mem_plan.txt
+#define MEM_OPS // Serves memcpy/memmove/memset with size specialized copies instead of calling into sceClib for every few bytes struct copy
+//#define MEM_OPS_HISTOGRAM // Writes memcpy/memmove/memset calls by size and alignment to DATA_PATH/mem_ops.txt every 10 seconds
+#define MATH_BINDING // Binds sinf, cosf, atan2f, sqrtf, powf, expf and logf to the fastest of newlib, math-neon and the loader's own within MATH_MAX_ULP, measured on the first boot into DATA_PATH/math_bind.txt and kept in DATA_PATH/math_bind.cfg (delete it to measure again)
+#define MATH_MAX_ULP 2 // Largest error, in units in the last place, MATH_BINDING accepts from an implementation
+//#define RNG_THREAD_STREAMS // Gives every thread its own rand stream instead of one shared by all, sequences then depend on the order threads start
+//#define RNG_CAPTURE // Records the seeds the game passes to srand/srand48 to DATA_PATH/rng_seeds.txt
+//#define RNG_REPLAY // Feeds the seeds in DATA_PATH/rng_seeds.txt back to srand/srand48 in order, for deterministic benchmark runs
+//#define SORT_STABLE // Makes the game's qsort keep equal elements in their previous order, for sprites of the same depth flickering between frames
+#define FAST_PRINTF // Formats the game's sprintf/snprintf/vsnprintf calls in the loader, with newlib only for the odd conversion such as %a or inf
+//#define JNI_REPORT // Writes the JNI calls and Java method/field lookups the loader has no answer for to DATA_PATH/jni.txt every 10 seconds
+#define PERF_CALIBRATION // Benchmarks the device on first boot (or with L+R held) and saves clocks, MSAA, render scale and frame cap to DATA_PATH/profile.cfg
 
 #define LOAD_ADDRESS 0x98000000
 
 #define MEMORY_NEWLIB_MB 256
+#define MEMORY_SLAB_MB 32 // Taken from the newlib heap for MEM_SLABS
 #define MEMORY_VITAGL_THRESHOLD_MB 8
 
 #define DATA_PATH "ux0:data/canada"
@@ -0,0 +1,738 @@
+/* fmt.c -- sprintf, snprintf and vsnprintf for the game's imports
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Formats straight into the caller's buffer, with no FILE, lock or locale
+ * lookup. Integers are written two digits at a time, in 32 bit arithmetic
+ * whenever the value allows it. Doubles are split into mantissa and binary
+ * exponent and scaled by a power of ten in 128 bit integer arithmetic, which
+ * gives the exact value's digits, rounded half to even like newlib does, for
+ * any precision up to 19 digits. Everything else (inf and nan, %a, wide
+ * characters, NULL strings and pointers, flags with no defined meaning) goes
+ * to newlib one conversion at a time, so the output never differs from it.
+ * Positional arguments and unknown conversions send the whole format there.
+ *
+ * The file also builds on the host for tools/fmt_check.c.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#ifdef __vita__
+#include "config.h"
+#else
+#define FAST_PRINTF
+#endif
+#include "fmt.h"
+
+#ifdef FAST_PRINTF
+static int fast_enabled = 1;
+#else
+static int fast_enabled = 0;
+#endif
+
+#define MAX_DIGITS 19 // Largest power of ten in 64 bits
+
+enum {
+	LEFT = 1,
+	PLUS = 2,
+	SPACE = 4,
+	ALT = 8,
+	ZERO = 16
+};
+
+enum {
+	LEN_NONE,
+	LEN_HH,
+	LEN_H,
+	LEN_L,
+	LEN_LL,
+	LEN_J,
+	LEN_Z,
+	LEN_T,
+	LEN_LD
+};
+
+typedef struct {
+	int flags;
+	int width;
+	int prec; // -1 when not given
+	int len;
+	const char *len_str; // the length modifier as written, for newlib
+	int len_chars;
+	char conv;
+} spec;
+
+typedef struct {
+	char *buf;
+	size_t cap; // bytes that fit before the terminator
+	size_t len; // bytes the whole output takes
+	int error;
+} sink;
+
+typedef enum {
+	ARG_INT,
+	ARG_WINT,
+	ARG_PTR,
+	ARG_DOUBLE,
+	ARG_LDOUBLE
+} arg_kind;
+
+typedef union {
+	int i;
+	wint_t wc;
+	void *p;
+	double d;
+	long double ld;
+} arg;
+
+typedef struct {
+	uint64_t hi, lo;
+} u128;
+
+static const char pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const uint64_t powers10[MAX_DIGITS + 1] = {
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+	100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+	10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+	100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull
+};
+
+static volatile uint32_t fallbacks = 0;
+
+static inline void put(sink *o, const char *s, size_t n) {
+	if (o->len < o->cap) {
+		size_t room = o->cap - o->len;
+		memcpy(o->buf + o->len, s, n < room ? n : room);
+	}
+	o->len += n;
+}
+
+static inline void fill(sink *o, char c, size_t n) {
+	if (o->len < o->cap) {
+		size_t room = o->cap - o->len;
+		memset(o->buf + o->len, c, n < room ? n : room);
+	}
+	o->len += n;
+}
+
+// Writes v in base 10 ending right before end, returns its first digit
+static char *dec(char *end, uint64_t v) {
+	while (v > 0xFFFFFFFFu) { // Nine digits at a time until the rest fits 32 bits
+		uint64_t q = v / 1000000000;
+		uint32_t r = v - q * 1000000000;
+		for (int i = 0; i < 4; i++) {
+			uint32_t rq = r / 100;
+			memcpy(end -= 2, pairs + (r - rq * 100) * 2, 2);
+			r = rq;
+		}
+		*--end = '0' + r;
+		v = q;
+	}
+	uint32_t w = v;
+	while (w >= 100) {
+		uint32_t q = w / 100;
+		memcpy(end -= 2, pairs + (w - q * 100) * 2, 2);
+		w = q;
+	}
+	if (w >= 10)
+		memcpy(end -= 2, pairs + w * 2, 2);
+	else
+		*--end = '0' + w;
+	return end;
+}
+
+static char *hex(char *end, uint64_t v, int upper) {
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	do {
+		*--end = digits[v & 15];
+		v >>= 4;
+	} while (v);
+	return end;
+}
+
+static char *oct(char *end, uint64_t v) {
+	do {
+		*--end = '0' + (v & 7);
+		v >>= 3;
+	} while (v);
+	return end;
+}
+
+// Pads a formatted conversion to its width, zeros go between prefix and body
+static void emit(sink *o, const spec *s, const char *prefix, int prefix_len, int zeros, const char *body, int body_len) {
+	int total = prefix_len + zeros + body_len;
+	int pad = s->width > total ? s->width - total : 0;
+	if (!(s->flags & LEFT))
+		fill(o, ' ', pad);
+	if (prefix_len)
+		put(o, prefix, prefix_len);
+	fill(o, '0', zeros);
+	put(o, body, body_len);
+	if (s->flags & LEFT)
+		fill(o, ' ', pad);
+}
+
+static void format_int(sink *o, const spec *s, uint64_t v, char sign) {
+	char digits[24], *end = digits + sizeof(digits), *d = end;
+	char prefix[2];
+	int prefix_len = 0;
+	if (sign)
+		prefix[prefix_len++] = sign;
+	if (v || s->prec) {
+		switch (s->conv) {
+		case 'x':
+		case 'X':
+			d = hex(end, v, s->conv == 'X');
+			if ((s->flags & ALT) && v) {
+				prefix[prefix_len++] = '0';
+				prefix[prefix_len++] = s->conv;
+			}
+			break;
+		case 'o':
+			d = oct(end, v);
+			break;
+		default:
+			d = dec(end, v);
+			break;
+		}
+	}
+	int n = end - d;
+	int zeros = s->prec > n ? s->prec - n : 0;
+	if (s->conv == 'o' && (s->flags & ALT) && !zeros && (!n || *d != '0'))
+		zeros = 1;
+	if (s->prec < 0 && (s->flags & (ZERO | LEFT)) == ZERO && s->width > prefix_len + zeros + n)
+		zeros = s->width - prefix_len - n;
+	emit(o, s, prefix, prefix_len, zeros, d, n);
+}
+
+static u128 mul64(uint64_t a, uint64_t b) {
+	uint64_t al = (uint32_t)a, ah = a >> 32, bl = (uint32_t)b, bh = b >> 32;
+	uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+	uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+	u128 r;
+	r.lo = (mid << 32) | (uint32_t)ll;
+	r.hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+	return r;
+}
+
+static inline int bits128(u128 v) {
+	if (v.hi)
+		return 128 - __builtin_clzll(v.hi);
+	return v.lo ? 64 - __builtin_clzll(v.lo) : 0;
+}
+
+static inline uint64_t shr128(u128 v, int s) {
+	if (!s)
+		return v.lo;
+	if (s < 64)
+		return (v.lo >> s) | (v.hi << (64 - s));
+	return s < 128 ? v.hi >> (s - 64) : 0;
+}
+
+// Whether any of the bits below bit b are set
+static inline int below128(u128 v, int b) {
+	if (b <= 64)
+		return b == 64 ? v.lo != 0 : (v.lo & ((1ull << b) - 1)) != 0;
+	return v.lo || (v.hi & ((1ull << (b - 64)) - 1));
+}
+
+// Rounds m * 2^e * 10^n to the nearest integer, ties to even, fails past 63 bits
+static int scaled(uint64_t m, int e, int n, uint64_t *q) {
+	if (n > MAX_DIGITS || n < -MAX_DIGITS)
+		return 0;
+	if (n >= 0) {
+		u128 p = mul64(m, powers10[n]);
+		if (e >= 0) {
+			if (p.hi || e > 62 || p.lo >> (63 - e))
+				return 0;
+			*q = p.lo << e;
+			return 1;
+		}
+		int s = -e;
+		if (s > 128) { // Less than half of the last digit
+			*q = 0;
+			return 1;
+		}
+		if (bits128(p) - s > 63)
+			return 0;
+		uint64_t v = shr128(p, s);
+		int round = shr128(p, s - 1) & 1;
+		*q = v + (round && ((v & 1) || below128(p, s - 1)));
+		return 1;
+	}
+
+	// Dropping digits, the part below the integer only breaks ties
+	uint64_t i;
+	int sticky;
+	if (e >= 0) {
+		if (e >= 64 || (e && m >> (64 - e)))
+			return 0;
+		i = m << e;
+		sticky = 0;
+	} else if (e <= -64) {
+		i = 0;
+		sticky = m != 0;
+	} else {
+		i = m >> -e;
+		sticky = (m & ((1ull << -e) - 1)) != 0;
+	}
+	uint64_t d = powers10[-n], v = i / d, r = i - v * d, half = d / 2;
+	*q = v + (r > half || (r == half && (sticky || (v & 1))));
+	return 1;
+}
+
+// The first digits significant digits of m * 2^e, and the decimal exponent of the first
+static int significant(uint64_t m, int e, int digits, int *exp10, uint64_t *q) {
+	if (!m) {
+		*exp10 = 0;
+		*q = 0;
+		return 1;
+	}
+	int b = e + 63 - __builtin_clzll(m);
+	int x = (b * 78913) >> 18; // floor(b * log10(2)), at most one off
+	for (int tries = 0; tries < 3; tries++) {
+		if (!scaled(m, e, digits - 1 - x, q))
+			return 0;
+		if (*q >= powers10[digits])
+			x++;
+		else if (*q < powers10[digits - 1])
+			x--;
+		else {
+			*exp10 = x;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// q as a fixed point number with frac digits after the point
+static char *fixed_body(char *p, uint64_t q, int frac, int alt) {
+	char digits[24], *end = digits + sizeof(digits), *d = dec(end, q);
+	while (end - d < frac + 1)
+		*--d = '0';
+	int int_len = end - d - frac;
+	memcpy(p, d, int_len);
+	p += int_len;
+	if (frac || alt)
+		*p++ = '.';
+	memcpy(p, d + int_len, frac);
+	return p + frac;
+}
+
+// q, holding prec + 1 digits, as d.ddde+xx
+static char *exp_body(char *p, uint64_t q, int prec, int exp10, char e, int alt) {
+	char digits[24], *end = digits + sizeof(digits), *d = dec(end, q);
+	while (end - d < prec + 1)
+		*--d = '0';
+	*p++ = *d;
+	if (prec || alt)
+		*p++ = '.';
+	memcpy(p, d + 1, prec);
+	p += prec;
+	*p++ = e;
+	*p++ = exp10 < 0 ? '-' : '+';
+	if (exp10 < 0)
+		exp10 = -exp10;
+	if (exp10 < 10)
+		*p++ = '0';
+	char exp_digits[4], *exp_end = exp_digits + sizeof(exp_digits), *x = dec(exp_end, exp10);
+	memcpy(p, x, exp_end - x);
+	return p + (exp_end - x);
+}
+
+static int format_float(sink *o, const spec *s, double v) {
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	int biased = (bits >> 52) & 0x7FF;
+	if (biased == 0x7FF) // inf and nan keep newlib's spelling
+		return 0;
+	uint64_t m = bits & ((1ull << 52) - 1);
+	int e;
+	if (biased) {
+		m |= 1ull << 52;
+		e = biased - 1075;
+	} else
+		e = -1074;
+
+	char body[48], *p = body;
+	int alt = s->flags & ALT;
+	uint64_t q;
+	int exp10;
+	switch (s->conv) {
+	case 'f':
+	case 'F': {
+		int prec = s->prec < 0 ? 6 : s->prec;
+		if (!scaled(m, e, prec, &q))
+			return 0;
+		p = fixed_body(p, q, prec, alt);
+		break;
+	}
+	case 'e':
+	case 'E': {
+		int prec = s->prec < 0 ? 6 : s->prec;
+		if (prec >= MAX_DIGITS || !significant(m, e, prec + 1, &exp10, &q))
+			return 0;
+		p = exp_body(p, q, prec, exp10, s->conv, alt);
+		break;
+	}
+	default: {
+		int prec = s->prec < 0 ? 6 : s->prec ? s->prec : 1;
+		if (prec > MAX_DIGITS || !significant(m, e, prec, &exp10, &q))
+			return 0;
+		char *point;
+		if (exp10 >= -4 && exp10 < prec) {
+			p = fixed_body(p, q, prec - 1 - exp10, alt);
+			point = memchr(body, '.', p - body);
+		} else {
+			p = exp_body(p, q, prec - 1, exp10, s->conv - 2, alt);
+			point = prec > 1 || alt ? body + 1 : NULL;
+		}
+		if (!alt && point) { // Trailing zeros go, and the point with them if nothing's left
+			char *end = point + 1;
+			while (end < p && *end >= '0' && *end <= '9')
+				end++;
+			char *cut = end;
+			while (cut > point + 1 && cut[-1] == '0')
+				cut--;
+			if (cut == point + 1)
+				cut = point;
+			memmove(cut, end, p - end);
+			p -= end - cut;
+		}
+		break;
+	}
+	}
+
+	char sign = bits >> 63 ? '-' : s->flags & PLUS ? '+' : s->flags & SPACE ? ' ' : 0;
+	int n = p - body, zeros = 0;
+	if ((s->flags & (ZERO | LEFT)) == ZERO && s->width > n + !!sign)
+		zeros = s->width - n - !!sign;
+	emit(o, s, &sign, !!sign, zeros, body, n);
+	return 1;
+}
+
+static int newlib_one(char *buf, size_t size, const char *f, arg_kind kind, arg a) {
+	switch (kind) {
+	case ARG_INT:
+		return snprintf(buf, size, f, a.i);
+	case ARG_WINT:
+		return snprintf(buf, size, f, a.wc);
+	case ARG_PTR:
+		return snprintf(buf, size, f, a.p);
+	case ARG_DOUBLE:
+		return snprintf(buf, size, f, a.d);
+	default:
+		return snprintf(buf, size, f, a.ld);
+	}
+}
+
+// Has newlib format a single conversion the fast paths leave alone
+static void fallback(sink *o, const spec *s, arg_kind kind, arg a) {
+	char f[48], *p = f, num[12], *num_end = num + sizeof(num), *d;
+	*p++ = '%';
+	if (s->flags & LEFT)
+		*p++ = '-';
+	if (s->flags & PLUS)
+		*p++ = '+';
+	if (s->flags & SPACE)
+		*p++ = ' ';
+	if (s->flags & ALT)
+		*p++ = '#';
+	if (s->flags & ZERO)
+		*p++ = '0';
+	if (s->width) {
+		d = dec(num_end, s->width);
+		memcpy(p, d, num_end - d);
+		p += num_end - d;
+	}
+	if (s->prec >= 0) {
+		*p++ = '.';
+		d = dec(num_end, s->prec);
+		memcpy(p, d, num_end - d);
+		p += num_end - d;
+	}
+	memcpy(p, s->len_str, s->len_chars);
+	p += s->len_chars;
+	*p++ = s->conv;
+	*p = 0;
+
+	char tmp[256];
+	int n = newlib_one(tmp, sizeof(tmp), f, kind, a);
+	if (n < 0)
+		o->error = 1;
+	else if (n < sizeof(tmp))
+		put(o, tmp, n);
+	else {
+		char *big = malloc(n + 1);
+		if (big) {
+			newlib_one(big, n + 1, f, kind, a);
+			put(o, big, n);
+			free(big);
+		} else
+			o->error = 1;
+	}
+	__atomic_fetch_add(&fallbacks, 1, __ATOMIC_RELAXED);
+}
+
+static int format(char *buf, size_t size, int bounded, const char *fmt, va_list ap) {
+	if (!fast_enabled)
+		return bounded ? vsnprintf(buf, size, fmt, ap) : vsprintf(buf, fmt, ap);
+
+	va_list args, start;
+	va_copy(args, ap);
+	va_copy(start, ap);
+	sink o = { buf, size ? size - 1 : 0, 0, 0 };
+	const char *p = fmt;
+	for (;;) {
+		const char *lit = p;
+		while (*p && *p != '%')
+			p++;
+		put(&o, lit, p - lit);
+		if (!*p++)
+			break;
+
+		spec s = { 0, 0, -1, LEN_NONE, NULL, 0, 0 };
+		for (;; p++) {
+			if (*p == '-')
+				s.flags |= LEFT;
+			else if (*p == '+')
+				s.flags |= PLUS;
+			else if (*p == ' ')
+				s.flags |= SPACE;
+			else if (*p == '#')
+				s.flags |= ALT;
+			else if (*p == '0')
+				s.flags |= ZERO;
+			else
+				break;
+		}
+		if (*p == '*') {
+			s.width = va_arg(args, int);
+			if (s.width < 0) {
+				s.flags |= LEFT;
+				s.width = -s.width;
+			}
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			s.width = s.width * 10 + *p++ - '0';
+		if (*p == '.') {
+			p++;
+			s.prec = 0;
+			if (*p == '*') {
+				s.prec = va_arg(args, int);
+				if (s.prec < 0)
+					s.prec = -1;
+				p++;
+			}
+			while (*p >= '0' && *p <= '9')
+				s.prec = s.prec * 10 + *p++ - '0';
+		}
+		if (*p == '$') // Positional arguments, newlib takes the whole format
+			goto whole;
+
+		s.len_str = p;
+		switch (*p) {
+		case 'h':
+			s.len = *++p == 'h' ? (p++, LEN_HH) : LEN_H;
+			break;
+		case 'l':
+			s.len = *++p == 'l' ? (p++, LEN_LL) : LEN_L;
+			break;
+		case 'q':
+			s.len = LEN_LL;
+			p++;
+			break;
+		case 'j':
+			s.len = LEN_J;
+			p++;
+			break;
+		case 'z':
+			s.len = LEN_Z;
+			p++;
+			break;
+		case 't':
+			s.len = LEN_T;
+			p++;
+			break;
+		case 'L':
+			s.len = LEN_LD;
+			p++;
+			break;
+		}
+		s.len_chars = p - s.len_str;
+		s.conv = *p++;
+
+		arg a;
+		switch (s.conv) {
+		case 'd':
+		case 'i': {
+			int64_t v;
+			switch (s.len) {
+			case LEN_HH: v = (signed char)va_arg(args, int); break;
+			case LEN_H: v = (short)va_arg(args, int); break;
+			case LEN_L: v = va_arg(args, long); break;
+			case LEN_LL: v = va_arg(args, long long); break;
+			case LEN_J: v = va_arg(args, intmax_t); break;
+			case LEN_Z: v = va_arg(args, ptrdiff_t); break;
+			case LEN_T: v = va_arg(args, ptrdiff_t); break;
+			default: v = va_arg(args, int); break;
+			}
+			char sign = v < 0 ? '-' : s.flags & PLUS ? '+' : s.flags & SPACE ? ' ' : 0;
+			format_int(&o, &s, v < 0 ? -(uint64_t)v : (uint64_t)v, sign);
+			break;
+		}
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X': {
+			uint64_t v;
+			switch (s.len) {
+			case LEN_HH: v = (unsigned char)va_arg(args, unsigned int); break;
+			case LEN_H: v = (unsigned short)va_arg(args, unsigned int); break;
+			case LEN_L: v = va_arg(args, unsigned long); break;
+			case LEN_LL: v = va_arg(args, unsigned long long); break;
+			case LEN_J: v = va_arg(args, uintmax_t); break;
+			case LEN_Z: v = va_arg(args, size_t); break;
+			case LEN_T: v = (size_t)va_arg(args, ptrdiff_t); break;
+			default: v = va_arg(args, unsigned int); break;
+			}
+			format_int(&o, &s, v, 0);
+			break;
+		}
+		case 'c':
+			if (s.len == LEN_L) {
+				a.wc = va_arg(args, wint_t);
+				fallback(&o, &s, ARG_WINT, a);
+			} else {
+				a.i = va_arg(args, int);
+				if (s.flags & ZERO)
+					fallback(&o, &s, ARG_INT, a);
+				else {
+					char c = a.i;
+					emit(&o, &s, NULL, 0, 0, &c, 1);
+				}
+			}
+			break;
+		case 's':
+			a.p = va_arg(args, void *);
+			if (!a.p || s.len == LEN_L || (s.flags & ZERO))
+				fallback(&o, &s, ARG_PTR, a);
+			else {
+				const char *str = a.p;
+				const char *nul = s.prec >= 0 ? memchr(str, 0, s.prec) : NULL;
+				int n = s.prec >= 0 ? (nul ? nul - str : s.prec) : strlen(str);
+				emit(&o, &s, NULL, 0, 0, str, n);
+			}
+			break;
+		case 'p':
+			a.p = va_arg(args, void *);
+			if (!a.p || s.flags || s.width || s.prec >= 0)
+				fallback(&o, &s, ARG_PTR, a);
+			else {
+				char digits[20], *end = digits + sizeof(digits), *d = hex(end, (uintptr_t)a.p, 0);
+				emit(&o, &s, "0x", 2, 0, d, end - d);
+			}
+			break;
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (s.len == LEN_LD) {
+				a.ld = va_arg(args, long double);
+				if (sizeof(long double) != sizeof(double) || s.conv == 'a' || s.conv == 'A' || !format_float(&o, &s, a.ld))
+					fallback(&o, &s, ARG_LDOUBLE, a);
+			} else {
+				a.d = va_arg(args, double);
+				if (s.conv == 'a' || s.conv == 'A' || !format_float(&o, &s, a.d))
+					fallback(&o, &s, ARG_DOUBLE, a);
+			}
+			break;
+		case 'n': {
+			void *dst = va_arg(args, void *);
+			switch (s.len) {
+			case LEN_HH: *(signed char *)dst = o.len; break;
+			case LEN_H: *(short *)dst = o.len; break;
+			case LEN_L: *(long *)dst = o.len; break;
+			case LEN_LL: *(long long *)dst = o.len; break;
+			case LEN_J: *(intmax_t *)dst = o.len; break;
+			case LEN_Z: *(size_t *)dst = o.len; break;
+			case LEN_T: *(ptrdiff_t *)dst = o.len; break;
+			default: *(int *)dst = o.len; break;
+			}
+			break;
+		}
+		case '%':
+			if (s.flags || s.width || s.prec >= 0 || s.len_chars)
+				goto whole;
+			put(&o, "%", 1);
+			break;
+		default: // Unknown to us, or a truncated format
+			goto whole;
+		}
+	}
+	va_end(args);
+	va_end(start);
+	if (o.error)
+		return -1;
+	if (size)
+		buf[o.len < o.cap ? o.len : o.cap] = 0;
+	return o.len;
+
+whole:
+	va_end(args);
+	__atomic_fetch_add(&fallbacks, 1, __ATOMIC_RELAXED);
+	int res = bounded ? vsnprintf(buf, size, fmt, start) : vsprintf(buf, fmt, start);
+	va_end(start);
+	return res;
+}
+
+int fmt_vsnprintf(char *buf, size_t size, const char *fmt, va_list ap) {
+	return format(buf, size, 1, fmt, ap);
+}
+
+int fmt_vsprintf(char *buf, const char *fmt, va_list ap) {
+	return format(buf, SIZE_MAX, 0, fmt, ap);
+}
+
+int fmt_snprintf(char *buf, size_t size, const char *fmt, ...) {
+	va_list list;
+	va_start(list, fmt);
+	int res = format(buf, size, 1, fmt, list);
+	va_end(list);
+	return res;
+}
+
+int fmt_sprintf(char *buf, const char *fmt, ...) {
+	va_list list;
+	va_start(list, fmt);
+	int res = format(buf, SIZE_MAX, 0, fmt, list);
+	va_end(list);
+	return res;
+}
+
+uint32_t fmt_fallbacks(void) {
+	return fallbacks;
+}
@@ -0,0 +1,16 @@
+#ifndef __FMT_H__
+#define __FMT_H__
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+int fmt_vsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
+int fmt_vsprintf(char *buf, const char *fmt, va_list ap);
+int fmt_snprintf(char *buf, size_t size, const char *fmt, ...);
+int fmt_sprintf(char *buf, const char *fmt, ...);
+
+// Conversions handed to newlib, for spotting formats worth a fast path
+uint32_t fmt_fallbacks(void);
+
+#endif
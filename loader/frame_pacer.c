@@ -0,0 +1,125 @@
+/* frame_pacer.c -- switches between 60 and 30 fps following the cost of the game's frames
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "gl_dynres.h"
+#include "frame_pacer.h"
+
+#define VBLANK_US 16667
+#define WINDOW_FRAMES 60
+#define HOLD_MIN_US (3 * 1000000)
+#define HOLD_MAX_US (60 * 1000000)
+#define STATS_INTERVAL 600
+
+static uint32_t cost[WINDOW_FRAMES], period[WINDOW_FRAMES];
+static int samples = 0;
+
+static uint64_t last_swap = 0, present_start = 0, last_switch = 0;
+static uint32_t hold_us = HOLD_MIN_US; // Time to spend at 30 fps before trying 60 fps again
+static int min_interval = 1; // 2 when the performance profile caps the game at 30 fps
+
+static frame_pacer_stats stats;
+
+static void set_interval(int interval) {
+	stats.interval = interval;
+	eglSwapInterval(0, interval);
+	gl_dynres_set_target(interval * VBLANK_US);
+}
+
+void frame_pacer_set_cap(int fps) {
+	min_interval = fps >= 60 ? 1 : 2;
+}
+
+void frame_pacer_init(void) {
+#ifdef FRAME_PACING
+	set_interval(min_interval);
+#else
+	set_interval(2);
+#endif
+}
+
+void frame_pacer_present(void) {
+	present_start = sceKernelGetProcessTimeWide();
+}
+
+static uint32_t percentile_90(const uint32_t *values) {
+	uint32_t sorted[WINDOW_FRAMES];
+	memcpy(sorted, values, sizeof(sorted));
+	for (int i = 1; i < WINDOW_FRAMES; i++) {
+		uint32_t v = sorted[i];
+		int j = i;
+		for (; j > 0 && sorted[j - 1] > v; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = v;
+	}
+	return sorted[WINDOW_FRAMES * 9 / 10];
+}
+
+static void update_interval(uint64_t now) {
+	stats.cost_p90_us = percentile_90(cost);
+	stats.period_p90_us = percentile_90(period);
+
+	int missed = 0;
+	for (int i = 0; i < WINDOW_FRAMES; i++) {
+		if (period[i] > stats.interval * VBLANK_US * 23 / 20)
+			missed++;
+	}
+
+#ifdef FRAME_PACING
+	// Frames alternating between one and two vblanks look worse than a steady 30 fps, the gap between thresholds keeps it from flapping
+	if (stats.interval == 1) {
+		if (missed > WINDOW_FRAMES / 10 || stats.cost_p90_us > VBLANK_US * 95 / 100) {
+			// Falling back soon after going up means the last attempt was too early, wait longer next time
+			if (now - last_switch < hold_us * 2)
+				hold_us = hold_us * 2 > HOLD_MAX_US ? HOLD_MAX_US : hold_us * 2;
+			set_interval(2);
+			last_switch = now;
+			stats.switches++;
+		} else if (now - last_switch > HOLD_MAX_US)
+			hold_us = HOLD_MIN_US;
+	} else if (min_interval == 1 && stats.cost_p90_us < VBLANK_US * 70 / 100 && !missed && now - last_switch >= hold_us) {
+		set_interval(1);
+		last_switch = now;
+		stats.switches++;
+	}
+#endif
+}
+
+void frame_pacer_frame(void) {
+	uint64_t now = sceKernelGetProcessTimeWide();
+	if (last_swap && present_start > last_swap) {
+		uint32_t frame_us = now - last_swap;
+		cost[samples] = present_start - last_swap;
+		period[samples] = frame_us;
+		stats.histogram[frame_us / 1000 < FRAME_PACER_BUCKETS ? frame_us / 1000 : FRAME_PACER_BUCKETS - 1]++;
+		if (++samples == WINDOW_FRAMES) {
+			update_interval(now);
+			samples = 0;
+		}
+	}
+	last_swap = now;
+
+	if (++stats.frames % STATS_INTERVAL == 0) {
+		debugPrintf("frame_pacer: %d fps, cost p90 %u us, period p90 %u us, %u switches\n", 60 / stats.interval, stats.cost_p90_us,
+			stats.period_p90_us, stats.switches);
+		for (int i = 0; i < FRAME_PACER_BUCKETS; i++) {
+			if (stats.histogram[i])
+				debugPrintf("  %2d ms: %u\n", i, stats.histogram[i]);
+		}
+	}
+}
+
+void frame_pacer_get_stats(frame_pacer_stats *out) {
+	*out = stats;
+}
@@ -0,0 +1,23 @@
+#ifndef __FRAME_PACER_H__
+#define __FRAME_PACER_H__
+
+#include <stdint.h>
+
+#define FRAME_PACER_BUCKETS 40 // 1 ms wide, the last one also takes every longer frame
+
+typedef struct {
+	uint32_t frames;
+	int interval;       // vblanks per frame, 1 for 60 fps and 2 for 30 fps
+	uint32_t switches;
+	uint32_t cost_p90_us;   // game + submission time per frame, over the last window
+	uint32_t period_p90_us; // time between frames reaching the display, over the last window
+	uint32_t histogram[FRAME_PACER_BUCKETS]; // frame periods since boot
+} frame_pacer_stats;
+
+void frame_pacer_set_cap(int fps);
+void frame_pacer_init(void);
+void frame_pacer_present(void);
+void frame_pacer_frame(void);
+void frame_pacer_get_stats(frame_pacer_stats *stats);
+
+#endif
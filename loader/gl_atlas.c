@@ -0,0 +1,685 @@
+/* gl_atlas.c -- packs the game's small textures into shared atlas pages
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "gl_batch.h"
+#include "gl_trace.h"
+#include "gl_texconv.h"
+#include "gl_stream.h"
+#include "gl_atlas.h"
+
+#define PAGE_SIZE 1024
+#define MAX_PAGES 16
+#define MAX_NODES 512
+#define MAX_TEX_SIZE 128
+#define PAD 1 // Edge texels are replicated around every region so filtering never reads a neighbour
+#define MAX_NAMES 65536
+
+typedef struct {
+	int x, y, w;
+} sky_node;
+
+typedef struct {
+	GLuint tex;
+	GLint min_filter, mag_filter;
+	GLenum type;
+	int live;
+	int nodes_num;
+	sky_node nodes[MAX_NODES];
+} atlas_page;
+
+// The names the game sees are indices in this table, backed either by a page region or a texture of their own
+typedef struct {
+	int used;
+	GLuint real;
+	int page;
+	int x, y, w, h; // Region inside the page, padding excluded
+	float xform[4];
+	uint8_t *pixels; // Copy of an atlased texture, needed to move it out of the atlas later on
+	GLint min_filter, mag_filter, wrap_s, wrap_t;
+	GLenum type; // Pixel type of the real storage once down-converted from RGBA8
+	struct {
+		int w, h;
+	} levels[TEX_MAX_LEVELS]; // Levels uploaded, read back if an update doesn't fit the converted storage
+	gl_stream *stream; // Set for textures updated piecewise, real is then one of stream_tex
+	GLuint stream_tex[2];
+
+} atlas_tex;
+
+static atlas_tex *texs = NULL;
+static int texs_cap = 0;
+static GLuint gen_hint = 1;
+
+static atlas_page pages[MAX_PAGES];
+static int pages_num = 0;
+
+static GLuint cur_virt = 0;
+static int real_known = 0;
+static GLuint cur_real;
+
+static uint8_t *pad_buf = NULL;
+static int pad_cap = 0;
+
+#ifdef GL_ATLAS
+static int atlas_enabled = 1;
+#else
+static int atlas_enabled = 0;
+#endif
+
+#ifdef GL_TEXCONV
+static int texconv_enabled = 1;
+#else
+static int texconv_enabled = 0;
+#endif
+
+static gl_atlas_stats stats;
+
+static atlas_tex *lookup(GLuint name, int create) {
+	if (!name || name >= MAX_NAMES)
+		return NULL;
+	if (name >= texs_cap) {
+		if (!create)
+			return NULL;
+		int cap = texs_cap ? texs_cap : 256;
+		while (cap <= name)
+			cap *= 2;
+		atlas_tex *grown = realloc(texs, cap * sizeof(atlas_tex));
+		if (!grown)
+			return NULL;
+		texs = grown;
+		memset(&texs[texs_cap], 0, (cap - texs_cap) * sizeof(atlas_tex));
+		texs_cap = cap;
+	}
+	atlas_tex *t = &texs[name];
+	if (!t->used) {
+		if (!create)
+			return NULL;
+		t->used = 1;
+		t->page = -1;
+		// GL starts every texture out repeating, only an explicit clamp lets it into a page
+		t->wrap_s = GL_REPEAT;
+		t->wrap_t = GL_REPEAT;
+	}
+	return t;
+}
+
+static void bind_real(GLuint real) {
+	if (real_known && cur_real == real)
+		return;
+	real_known = 1;
+	cur_real = real;
+	glBindTexture_batch(GL_TEXTURE_2D, real);
+}
+
+static void stream_apply(void);
+
+static void apply_binding(void) {
+	atlas_tex *t = lookup(cur_virt, 0);
+	if (t && t->page >= 0) {
+		bind_real(pages[t->page].tex);
+		gl_batch_texcoord_transform(t->xform);
+	} else {
+		// Names the table couldn't hold were never handed out, they'd alias some real texture
+		bind_real(t ? t->real : 0);
+		gl_batch_texcoord_transform(NULL);
+	}
+	gl_batch_before_draw(t && t->stream && gl_stream_pending(t->stream) ? stream_apply : NULL);
+}
+
+static int is_wrapping(GLint wrap) {
+	return wrap != GL_CLAMP_TO_EDGE;
+}
+
+static int is_mipmapped(GLint filter) {
+	return filter && filter != GL_NEAREST && filter != GL_LINEAR;
+}
+
+static int is_converted(GLenum type) {
+	return type == GL_UNSIGNED_SHORT_5_5_5_1 || type == GL_UNSIGNED_SHORT_4_4_4_4;
+}
+
+static GLenum pick_type(const uint8_t *rgba, int width, int height) {
+	return texconv_enabled && rgba ? gl_texconv_pick(rgba, width, height) : GL_UNSIGNED_BYTE;
+}
+
+// Uploads RGBA8 pixels into storage of the given type, converted ones are tightly packed 16 bit texels.
+// Without memory to convert them here, vitaGL gets the RGBA8 pixels and converts them itself
+static void upload_image(GLint level, int width, int height, GLenum type, const uint8_t *rgba) {
+	const void *data = rgba ? gl_texconv_convert(rgba, width, height, width * 4, type) : NULL;
+	glTexImage2D_batch(GL_TEXTURE_2D, level, gl_texconv_internal_format(type), width, height, 0, GL_RGBA, data || !rgba ? type : GL_UNSIGNED_BYTE,
+		data ? data : rgba);
+	gl_texconv_ledger_set(cur_real, level, width, height, GL_RGBA, type, width * height * 4);
+}
+
+static void sub_image(GLint level, int x, int y, int width, int height, GLenum type, const uint8_t *rgba, int pitch) {
+	const void *data = gl_texconv_convert(rgba, width, height, pitch, type);
+	if (data) {
+		glTexSubImage2D_batch(GL_TEXTURE_2D, level, x, y, width, height, GL_RGBA, type, data);
+		return;
+	}
+	for (int i = 0; i < height; i++)
+		glTexSubImage2D_batch(GL_TEXTURE_2D, level, x, y + i, width, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba + i * pitch);
+}
+
+// Skyline bottom-left packer, nodes span the whole page width from left to right
+static int sky_fit(atlas_page *p, int i, int w, int h) {
+	int x = p->nodes[i].x;
+	if (x + w > PAGE_SIZE)
+		return -1;
+	int y = 0;
+	for (int left = w; left > 0; left -= p->nodes[i++].w) {
+		if (p->nodes[i].y > y)
+			y = p->nodes[i].y;
+		if (y + h > PAGE_SIZE)
+			return -1;
+	}
+	return y;
+}
+
+static int sky_insert(atlas_page *p, int w, int h, int *ox, int *oy) {
+	int best = -1, best_y = PAGE_SIZE, best_w = PAGE_SIZE + 1;
+	for (int i = 0; i < p->nodes_num; i++) {
+		int y = sky_fit(p, i, w, h);
+		if (y >= 0 && (y < best_y || (y == best_y && p->nodes[i].w < best_w))) {
+			best = i;
+			best_y = y;
+			best_w = p->nodes[i].w;
+		}
+	}
+	if (best < 0 || p->nodes_num >= MAX_NODES)
+		return 0;
+
+	*ox = p->nodes[best].x;
+	*oy = best_y;
+	memmove(&p->nodes[best + 1], &p->nodes[best], (p->nodes_num - best) * sizeof(sky_node));
+	p->nodes[best].y = best_y + h;
+	p->nodes[best].w = w;
+	p->nodes_num++;
+
+	// Trim the nodes now covered by the new one
+	for (int i = best + 1; i < p->nodes_num;) {
+		sky_node *prev = &p->nodes[i - 1];
+		int shrink = prev->x + prev->w - p->nodes[i].x;
+		if (shrink <= 0)
+			break;
+		p->nodes[i].x += shrink;
+		p->nodes[i].w -= shrink;
+		if (p->nodes[i].w > 0)
+			break;
+		memmove(&p->nodes[i], &p->nodes[i + 1], (p->nodes_num - i - 1) * sizeof(sky_node));
+		p->nodes_num--;
+	}
+
+	for (int i = 0; i < p->nodes_num - 1;) {
+		if (p->nodes[i].y == p->nodes[i + 1].y) {
+			p->nodes[i].w += p->nodes[i + 1].w;
+			memmove(&p->nodes[i + 1], &p->nodes[i + 2], (p->nodes_num - i - 2) * sizeof(sky_node));
+			p->nodes_num--;
+		} else
+			i++;
+	}
+	return 1;
+}
+
+static void page_reset(atlas_page *p) {
+	p->nodes_num = 1;
+	p->nodes[0].x = p->nodes[0].y = 0;
+	p->nodes[0].w = PAGE_SIZE;
+}
+
+static int page_alloc(atlas_tex *t, int w, int h, GLenum type, int *x, int *y) {
+	for (int i = 0; i < pages_num; i++) {
+		atlas_page *p = &pages[i];
+		if (p->min_filter == t->min_filter && p->mag_filter == t->mag_filter && p->type == type && sky_insert(p, w, h, x, y))
+			return i;
+	}
+	if (pages_num == MAX_PAGES)
+		return -1;
+
+	atlas_page *p = &pages[pages_num];
+	glGenTextures(1, &p->tex);
+	bind_real(p->tex);
+	if (t->min_filter)
+		glTexParameteri_batch(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, t->min_filter);
+	if (t->mag_filter)
+		glTexParameteri_batch(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, t->mag_filter);
+	glTexParameteri_batch(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri_batch(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	upload_image(0, PAGE_SIZE, PAGE_SIZE, type, NULL);
+	p->min_filter = t->min_filter;
+	p->mag_filter = t->mag_filter;
+	p->type = type;
+	p->live = 0;
+	page_reset(p);
+	stats.pages = ++pages_num;
+	debugPrintf("gl_atlas: page %d created, %u textures atlased\n", pages_num, stats.atlased);
+
+	return sky_insert(p, w, h, x, y) ? pages_num - 1 : -1;
+}
+
+// Returns 0 if there's no memory to pad the region, the texture then has to leave the atlas
+static int upload_region(atlas_tex *t) {
+	int pw = t->w + PAD * 2, ph = t->h + PAD * 2;
+	if (pw * ph * 4 > pad_cap) {
+		uint8_t *buf = realloc(pad_buf, pw * ph * 4);
+		if (!buf)
+			return 0;
+		pad_buf = buf;
+		pad_cap = pw * ph * 4;
+	}
+
+	uint32_t *dst = (uint32_t *)pad_buf;
+	const uint32_t *src = (const uint32_t *)t->pixels;
+	for (int y = 0; y < ph; y++) {
+		int sy = y - PAD;
+		sy = sy < 0 ? 0 : (sy >= t->h ? t->h - 1 : sy);
+		const uint32_t *row = src + sy * t->w;
+		for (int x = 0; x < PAD; x++)
+			*dst++ = row[0];
+		memcpy(dst, row, t->w * 4);
+		dst += t->w;
+		for (int x = 0; x < PAD; x++)
+			*dst++ = row[t->w - 1];
+	}
+
+	atlas_page *p = &pages[t->page];
+	bind_real(p->tex);
+	sub_image(0, t->x - PAD, t->y - PAD, pw, ph, p->type, pad_buf, pw * 4);
+	return 1;
+}
+
+static void release_region(atlas_tex *t) {
+	atlas_page *p = &pages[t->page];
+	gl_texconv_ledger_copy(-t->w * t->h * 4);
+	stats.used_pixels -= (t->w + PAD * 2) * (t->h + PAD * 2);
+	stats.atlased--;
+	// Regions aren't reclaimed one by one, a page is reused once all its textures are gone
+	if (--p->live == 0)
+		page_reset(p);
+	free(t->pixels);
+	t->pixels = NULL;
+	t->page = -1;
+}
+
+static void apply_params(atlas_tex *t) {
+	if (t->min_filter)
+		glTexParameteri_batch(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, t->min_filter);
+	if (t->mag_filter)
+		glTexParameteri_batch(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, t->mag_filter);
+	if (t->wrap_s)
+		glTexParameteri_batch(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, t->wrap_s);
+	if (t->wrap_t)
+		glTexParameteri_batch(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, t->wrap_t);
+}
+
+static void level_set(atlas_tex *t, GLint level, int width, int height) {
+	if (level == 0)
+		memset(t->levels, 0, sizeof(t->levels));
+	if (level < TEX_MAX_LEVELS) {
+		t->levels[level].w = width;
+		t->levels[level].h = height;
+	}
+}
+
+// Sends converted storage back to RGBA8, for updates the 16 bit format would round. Conversions are lossless, so reading
+// the levels back gives what the game uploaded. They're all read before level 0 is specified again, which drops the others
+static void promote(atlas_tex *t) {
+	size_t size = 0, offs[TEX_MAX_LEVELS];
+	for (int i = 0; i < TEX_MAX_LEVELS; i++) {
+		offs[i] = size;
+		size += t->levels[i].w * t->levels[i].h * 4;
+	}
+	uint8_t *pixels = malloc(size);
+	if (!pixels) {
+		debugPrintf("gl_atlas: no memory to promote texture %u, the update gets rounded\n", t->real);
+		return;
+	}
+	bind_real(t->real);
+	for (int i = 0; i < TEX_MAX_LEVELS; i++)
+		if (t->levels[i].w)
+			glGetTexImage(GL_TEXTURE_2D, i, GL_RGBA, GL_UNSIGNED_BYTE, pixels + offs[i]);
+	for (int i = 0; i < TEX_MAX_LEVELS; i++)
+		if (t->levels[i].w)
+			upload_image(i, t->levels[i].w, t->levels[i].h, GL_UNSIGNED_BYTE, pixels + offs[i]);
+	free(pixels);
+	t->type = GL_UNSIGNED_BYTE;
+	gl_texconv_promotion();
+}
+
+static void make_standalone(atlas_tex *t) {
+	if (t->real)
+		return;
+	glGenTextures(1, &t->real);
+	bind_real(t->real);
+	apply_params(t);
+	stats.standalone++;
+}
+
+static void evict(atlas_tex *t) {
+	uint8_t *pixels = t->pixels;
+	int w = t->w, h = t->h;
+	t->pixels = NULL;
+	release_region(t);
+	make_standalone(t);
+	bind_real(t->real);
+	t->type = pick_type(pixels, w, h);
+	upload_image(0, w, h, t->type, pixels);
+	level_set(t, 0, w, h);
+	free(pixels);
+	stats.evictions++;
+}
+
+static void stream_upload(atlas_tex *t, int buffer) {
+	gl_stream *s = t->stream;
+	gl_stream_rect r;
+	bind_real(t->stream_tex[buffer]);
+	while (gl_stream_next_rect(s, buffer, &r))
+		sub_image(0, r.x, r.y, r.w, r.h, t->type, gl_stream_rect_pixels(s, &r), s->width * 4);
+}
+
+// Lands the updates of the bound streaming texture right before a draw reads it, once per frame in the buffer the GPU is done with
+static void stream_apply(void) {
+	atlas_tex *t = lookup(cur_virt, 0);
+	if (!t || !t->stream || !gl_stream_pending(t->stream))
+		return;
+	gl_stream *s = t->stream;
+	if (!t->stream_tex[1]) {
+		glGenTextures(1, &t->stream_tex[1]);
+		bind_real(t->stream_tex[1]);
+		apply_params(t);
+		upload_image(0, s->width, s->height, t->type, NULL);
+		s->buffers = 2;
+	}
+	int buffer = gl_stream_acquire(s);
+	t->real = t->stream_tex[buffer];
+	stream_upload(t, buffer);
+}
+
+static void stream_release(atlas_tex *t) {
+	for (int i = 0; i < 2; i++) {
+		GLuint tex = t->stream_tex[i];
+		if (!tex || tex == t->real)
+			continue;
+		gl_texconv_ledger_remove(tex);
+		glDeleteTextures_batch(1, &tex);
+		if (real_known && cur_real == tex)
+			cur_real = 0;
+	}
+	gl_texconv_ledger_copy(-t->stream->width * t->stream->height * 4);
+	gl_stream_free(t->stream);
+	t->stream = NULL;
+	t->stream_tex[0] = t->stream_tex[1] = 0;
+}
+
+// Turns a streaming texture back into a plain one holding its current content
+static void stream_drop(atlas_tex *t) {
+	stream_upload(t, t->stream->front);
+	stream_release(t);
+}
+
+void gl_atlas_sync(void) {
+	// Whatever SDL bound is not one of the game's textures, so texcoords must go through untouched
+	cur_virt = 0;
+	real_known = 0;
+	gl_batch_texcoord_transform(NULL);
+	gl_batch_sync();
+}
+
+void gl_atlas_get_stats(gl_atlas_stats *out) {
+	*out = stats;
+}
+
+void glGenTextures_atlas(GLsizei n, GLuint *names) {
+	for (int i = 0; i < n; i++) {
+		GLuint name = gen_hint;
+		while (lookup(name, 0))
+			name++;
+		if (!lookup(name, 1)) {
+			debugPrintf("gl_atlas: no memory for texture name %u\n", name);
+			names[i] = 0;
+			continue;
+		}
+		names[i] = name;
+		gen_hint = name + 1;
+	}
+}
+
+void glDeleteTextures_atlas(GLsizei n, const GLuint *names) {
+	int rebind = 0;
+	for (int i = 0; i < n; i++) {
+		atlas_tex *t = lookup(names[i], 0);
+		if (!t)
+			continue;
+		if (t->page >= 0)
+			release_region(t);
+		if (t->stream)
+			stream_release(t);
+		if (t->real) {
+			gl_texconv_ledger_remove(t->real);
+			glDeleteTextures_batch(1, &t->real);
+			if (real_known && cur_real == t->real)
+				cur_real = 0;
+			stats.standalone--;
+		}
+		memset(t, 0, sizeof(*t));
+		if (names[i] < gen_hint)
+			gen_hint = names[i];
+		if (names[i] == cur_virt) {
+			cur_virt = 0;
+			rebind = 1;
+		}
+	}
+	if (rebind)
+		apply_binding();
+}
+
+void glBindTexture_atlas(GLenum target, GLuint texture) {
+	if (target != GL_TEXTURE_2D) {
+		glBindTexture_batch(target, texture);
+		return;
+	}
+	cur_virt = texture;
+	lookup(texture, 1);
+	apply_binding();
+}
+
+void glTexParameteri_atlas(GLenum target, GLenum pname, GLint param) {
+	atlas_tex *t = target == GL_TEXTURE_2D ? lookup(cur_virt, 0) : NULL;
+	if (!t) {
+		glTexParameteri_batch(target, pname, param);
+		return;
+	}
+
+	// Streams only carry over the parameters tracked here and never have mipmaps
+	if (t->stream && (pname != GL_TEXTURE_MIN_FILTER || is_mipmapped(param)) && pname != GL_TEXTURE_MAG_FILTER &&
+		pname != GL_TEXTURE_WRAP_S && pname != GL_TEXTURE_WRAP_T) {
+		stream_drop(t);
+		apply_binding();
+	}
+
+	switch (pname) {
+	case GL_TEXTURE_MIN_FILTER:
+		t->min_filter = param;
+		break;
+	case GL_TEXTURE_MAG_FILTER:
+		t->mag_filter = param;
+		break;
+	case GL_TEXTURE_WRAP_S:
+		t->wrap_s = param;
+		break;
+	case GL_TEXTURE_WRAP_T:
+		t->wrap_t = param;
+		break;
+	default:
+		// Anything we don't track needs a texture object of its own
+		if (t->page >= 0)
+			evict(t);
+		make_standalone(t);
+		apply_binding();
+		glTexParameteri_batch(target, pname, param);
+		return;
+	}
+
+	if (t->page >= 0) {
+		atlas_page *p = &pages[t->page];
+		if (is_wrapping(t->wrap_s) || is_wrapping(t->wrap_t) || is_mipmapped(t->min_filter) ||
+			t->min_filter != p->min_filter || t->mag_filter != p->mag_filter) {
+			evict(t);
+			apply_binding();
+		}
+	} else if (t->real) {
+		glTexParameteri_batch(target, pname, param);
+		if (t->stream && t->stream_tex[1]) {
+			bind_real(t->stream_tex[t->stream->front ^ 1]);
+			glTexParameteri_batch(target, pname, param);
+			apply_binding();
+		}
+	}
+}
+
+void glTexImage2D_atlas(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data) {
+	atlas_tex *t = target == GL_TEXTURE_2D ? lookup(cur_virt, 0) : NULL;
+	if (!t) {
+		glTexImage2D_batch(target, level, internalFormat, width, height, border, format, type, data);
+		return;
+	}
+
+	if (level == 0 && t->page >= 0)
+		release_region(t);
+	if (t->stream)
+		stream_release(t);
+
+	if (atlas_enabled && level == 0 && !t->real && internalFormat == GL_RGBA && format == GL_RGBA && type == GL_UNSIGNED_BYTE &&
+		width > 0 && height > 0 && width <= MAX_TEX_SIZE && height <= MAX_TEX_SIZE && !border &&
+		!is_wrapping(t->wrap_s) && !is_wrapping(t->wrap_t) && !is_mipmapped(t->min_filter)) {
+		int x, y;
+		GLenum page_type = pick_type(data, width, height);
+		uint8_t *pixels = malloc(width * height * 4);
+		int page = pixels ? page_alloc(t, width + PAD * 2, height + PAD * 2, page_type, &x, &y) : -1;
+		if (page >= 0) {
+			t->pixels = pixels;
+			gl_texconv_ledger_copy(width * height * 4);
+			if (data)
+				memcpy(t->pixels, data, width * height * 4);
+			else
+				memset(t->pixels, 0, width * height * 4);
+			t->page = page;
+			t->x = x + PAD;
+			t->y = y + PAD;
+			t->w = width;
+			t->h = height;
+			t->xform[0] = (float)t->x / PAGE_SIZE;
+			t->xform[1] = (float)t->y / PAGE_SIZE;
+			t->xform[2] = (float)width / PAGE_SIZE;
+			t->xform[3] = (float)height / PAGE_SIZE;
+			pages[page].live++;
+			stats.atlased++;
+			stats.used_pixels += (width + PAD * 2) * (height + PAD * 2);
+			if (!upload_region(t))
+				evict(t);
+			apply_binding();
+			return;
+		}
+		free(pixels);
+	}
+
+	if (t->page >= 0)
+		evict(t);
+	make_standalone(t);
+	apply_binding();
+
+	if (internalFormat == GL_RGBA && format == GL_RGBA && type == GL_UNSIGNED_BYTE && !border) {
+		// Mipmap levels follow whatever storage level 0 got, as long as they fit it
+		if (level == 0)
+			t->type = pick_type(data, width, height);
+		else if (is_converted(t->type) && data && !gl_texconv_fits(data, width, height, width * 4, t->type))
+			promote(t);
+		upload_image(level, width, height, t->type, data);
+		level_set(t, level, width, height);
+
+		// Textures allocated without content are the ones filled piecewise later on
+		if (gl_stream_enabled && level == 0 && !data && !is_mipmapped(t->min_filter)) {
+			t->stream = gl_stream_create(width, height, 4);
+			if (t->stream) {
+				t->stream_tex[0] = t->real;
+				gl_texconv_ledger_copy(width * height * 4);
+			}
+		}
+		return;
+	}
+
+	if (level == 0)
+		t->type = type;
+	glTexImage2D_batch(target, level, internalFormat, width, height, border, format, type, data);
+	gl_texconv_ledger_set(t->real, level, width, height, format, type, gl_trace_pixels_size(format, type, width, height));
+}
+
+void glTexSubImage2D_atlas(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels) {
+	atlas_tex *t = target == GL_TEXTURE_2D ? lookup(cur_virt, 0) : NULL;
+	if (t && t->stream) {
+		if (level == 0 && format == GL_RGBA && type == GL_UNSIGNED_BYTE && xoffset >= 0 && yoffset >= 0 &&
+			xoffset + width <= t->stream->width && yoffset + height <= t->stream->height) {
+			gl_stream_write(t->stream, xoffset, yoffset, width, height, pixels, width * 4);
+			gl_batch_before_draw(stream_apply);
+			return;
+		}
+		stream_drop(t);
+		apply_binding();
+	}
+
+	if (!t || t->page < 0) {
+		if (t && is_converted(t->type)) {
+			// Converted storage takes updates it holds exactly, anything else needs the texture back in RGBA8 first
+			if (level < TEX_MAX_LEVELS && format == GL_RGBA && type == GL_UNSIGNED_BYTE && xoffset >= 0 && yoffset >= 0 &&
+				xoffset + width <= t->levels[level].w && yoffset + height <= t->levels[level].h &&
+				gl_texconv_fits(pixels, width, height, width * 4, t->type)) {
+				sub_image(level, xoffset, yoffset, width, height, t->type, pixels, width * 4);
+				return;
+			}
+			promote(t);
+		}
+		glTexSubImage2D_batch(target, level, xoffset, yoffset, width, height, format, type, pixels);
+		return;
+	}
+
+	if (level != 0 || format != GL_RGBA || type != GL_UNSIGNED_BYTE || xoffset < 0 || yoffset < 0 ||
+		xoffset + width > t->w || yoffset + height > t->h) {
+		evict(t);
+		apply_binding();
+		glTexSubImage2D_batch(target, level, xoffset, yoffset, width, height, format, type, pixels);
+		return;
+	}
+
+	for (int y = 0; y < height; y++)
+		memcpy(t->pixels + ((yoffset + y) * t->w + xoffset) * 4, (const uint8_t *)pixels + y * width * 4, width * 4);
+
+	// A page can't hold texels its format would round, the updated copy moves out and picks a format of its own
+	if (!gl_texconv_fits(pixels, width, height, width * 4, pages[t->page].type)) {
+		evict(t);
+		apply_binding();
+		return;
+	}
+
+	// Updates touching an edge also need the replicated padding refreshed
+	if (xoffset == 0 || yoffset == 0 || xoffset + width == t->w || yoffset + height == t->h) {
+		if (!upload_region(t))
+			evict(t);
+	} else {
+		atlas_page *p = &pages[t->page];
+		bind_real(p->tex);
+		sub_image(0, t->x + xoffset, t->y + yoffset, width, height, p->type, pixels, width * 4);
+	}
+	apply_binding();
+}
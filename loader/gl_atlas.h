@@ -0,0 +1,29 @@
+#ifndef __GL_ATLAS_H__
+#define __GL_ATLAS_H__
+
+#include <stdint.h>
+#ifdef __vita__
+#include <vitaGL.h>
+#else
+#include <GL/gl.h>
+#endif
+
+typedef struct {
+	uint32_t pages;       // atlas pages allocated
+	uint32_t atlased;     // textures living in an atlas page
+	uint32_t standalone;  // textures with a texture object of their own
+	uint32_t evictions;   // textures moved out of the atlas after being packed
+	uint32_t used_pixels; // atlas pixels covered by live textures, padding included
+} gl_atlas_stats;
+
+void gl_atlas_sync(void);
+void gl_atlas_get_stats(gl_atlas_stats *stats);
+
+void glGenTextures_atlas(GLsizei n, GLuint *textures);
+void glDeleteTextures_atlas(GLsizei n, const GLuint *textures);
+void glBindTexture_atlas(GLenum target, GLuint texture);
+void glTexParameteri_atlas(GLenum target, GLenum pname, GLint param);
+void glTexImage2D_atlas(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data);
+void glTexSubImage2D_atlas(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels);
+
+#endif
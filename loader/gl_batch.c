@@ -0,0 +1,437 @@
+/* gl_batch.c -- merges the game's client array draws sharing the same state
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "gl_batch.h"
+#include "gl_dynres.h"
+
+#define BATCH_VERTS 16384
+#define BATCH_INDICES (BATCH_VERTS * 3)
+#define STATS_INTERVAL 600
+
+#define ARRAY_VERTEX 1
+#define ARRAY_COLOR 2
+#define ARRAY_TEXCOORD 4
+#define ARRAY_UNKNOWN -1
+
+typedef struct {
+	GLint size;
+	GLenum type;
+	GLsizei stride;
+	const uint8_t *ptr;
+} client_array;
+
+static client_array vertex_array, color_array, texcoord_array;
+static int client_mask = 0;
+static int gl_client_mask = ARRAY_UNKNOWN; // What vitaGL currently has enabled
+
+// Pending batch
+static float batch_pos[BATCH_VERTS * 3];
+static float batch_tex[BATCH_VERTS * 2];
+static uint8_t batch_col[BATCH_VERTS * 4 * sizeof(float)];
+static uint16_t batch_idx[BATCH_INDICES];
+static int batch_verts = 0, batch_indices = 0;
+static int batch_mask;
+static GLint batch_pos_size;
+static GLenum batch_col_type;
+
+// Maps the game's texcoords into an atlas region, see gl_atlas.c
+static int tex_xform_on = 0;
+static float tex_xform[4];
+static float *remap_buf = NULL;
+static int remap_cap = 0;
+
+// Lets the bound texture bring itself up to date right before it's drawn with, see gl_stream.c
+static void (*before_draw)(void) = NULL;
+
+#ifdef GL_BATCHING
+static int batching = 1;
+#else
+static int batching = 0;
+#endif
+
+static gl_batch_stats stats, frame_stats;
+
+static void apply_client_mask(int mask) {
+	static const GLenum arrays[] = {GL_VERTEX_ARRAY, GL_COLOR_ARRAY, GL_TEXTURE_COORD_ARRAY};
+	for (int i = 0; i < 3; i++) {
+		int bit = 1 << i;
+		if (gl_client_mask == ARRAY_UNKNOWN || (gl_client_mask & bit) != (mask & bit)) {
+			if (mask & bit)
+				glEnableClientState(arrays[i]);
+			else
+				glDisableClientState(arrays[i]);
+		}
+	}
+	gl_client_mask = mask;
+}
+
+static void draw(GLsizei count, GLenum type, const void *indices) {
+	uint64_t t = sceKernelGetProcessTimeWide();
+	glDrawElements(GL_TRIANGLES, count, type, indices);
+	frame_stats.submit_us += sceKernelGetProcessTimeWide() - t;
+	frame_stats.gpu_draws++;
+}
+
+void gl_batch_flush(void) {
+	if (!batch_indices)
+		return;
+
+	apply_client_mask(batch_mask);
+	glVertexPointer(batch_pos_size, GL_FLOAT, 0, batch_pos);
+	if (batch_mask & ARRAY_COLOR)
+		glColorPointer(4, batch_col_type, 0, batch_col);
+	if (batch_mask & ARRAY_TEXCOORD)
+		glTexCoordPointer(2, GL_FLOAT, 0, batch_tex);
+	draw(batch_indices, GL_UNSIGNED_SHORT, batch_idx);
+
+	batch_verts = batch_indices = 0;
+}
+
+void gl_batch_sync(void) {
+	// SDL's renderer drives vitaGL directly, so its client state can't be trusted afterwards
+	gl_batch_flush();
+	gl_client_mask = ARRAY_UNKNOWN;
+	gl_dynres_sync();
+}
+
+void gl_batch_frame(void) {
+	gl_batch_flush();
+	frame_stats.frames = stats.frames + 1;
+	stats = frame_stats;
+	memset(&frame_stats, 0, sizeof(frame_stats));
+	if (stats.frames % STATS_INTERVAL == 0)
+		debugPrintf("gl_batch: %u draws -> %u, submit %u us, batch %u us\n", stats.game_draws, stats.gpu_draws, stats.submit_us, stats.batch_us);
+}
+
+void gl_batch_get_stats(gl_batch_stats *out) {
+	*out = stats;
+}
+
+static int array_supported(const client_array *a, int size_min, int size_max, GLenum type) {
+	return a->ptr && a->size >= size_min && a->size <= size_max && a->type == type;
+}
+
+void gl_batch_before_draw(void (*fn)(void)) {
+	before_draw = fn;
+}
+
+void gl_batch_texcoord_transform(const float *xform) {
+	tex_xform_on = xform != NULL;
+	if (xform)
+		memcpy(tex_xform, xform, sizeof(tex_xform));
+}
+
+static inline float texcoord_at(const uint8_t *src, GLenum type, int i) {
+	switch (type) {
+	case GL_BYTE:
+		return ((const int8_t *)src)[i];
+	case GL_SHORT:
+		return ((const int16_t *)src)[i];
+	case GL_FIXED:
+		return ((const int32_t *)src)[i] / 65536.0f;
+	default:
+		return ((const float *)src)[i];
+	}
+}
+
+static inline void remap_texcoords(float *dst, const uint8_t *src, GLenum type, int size, int stride, int verts) {
+	if (type == GL_FLOAT) {
+		for (int i = 0; i < verts; i++, src += stride, dst += size) {
+			const float *uv = (const float *)src;
+			dst[0] = tex_xform[0] + uv[0] * tex_xform[2];
+			dst[1] = tex_xform[1] + uv[1] * tex_xform[3];
+			for (int j = 2; j < size; j++)
+				dst[j] = uv[j];
+		}
+		return;
+	}
+	// Fixed function texcoords aren't normalized, integers are taken as they are
+	for (int i = 0; i < verts; i++, src += stride, dst += size) {
+		dst[0] = tex_xform[0] + texcoord_at(src, type, 0) * tex_xform[2];
+		dst[1] = tex_xform[1] + texcoord_at(src, type, 1) * tex_xform[3];
+		for (int j = 2; j < size; j++)
+			dst[j] = texcoord_at(src, type, j);
+	}
+}
+
+static const void *remap_passthrough(GLsizei count, GLenum type, const void *indices) {
+	uint32_t hi = 0;
+	if (type == GL_UNSIGNED_SHORT) {
+		for (int i = 0; i < count; i++)
+			if (((const uint16_t *)indices)[i] > hi) hi = ((const uint16_t *)indices)[i];
+	} else if (type == GL_UNSIGNED_BYTE) {
+		for (int i = 0; i < count; i++)
+			if (((const uint8_t *)indices)[i] > hi) hi = ((const uint8_t *)indices)[i];
+	} else {
+		for (int i = 0; i < count; i++)
+			if (((const uint32_t *)indices)[i] > hi) hi = ((const uint32_t *)indices)[i];
+	}
+
+	int size = texcoord_array.size;
+	if ((hi + 1) * size > remap_cap) {
+		float *buf = realloc(remap_buf, (hi + 1) * size * sizeof(float));
+		if (!buf)
+			return NULL;
+		remap_buf = buf;
+		remap_cap = (hi + 1) * size;
+	}
+	int elem = texcoord_array.type == GL_BYTE ? 1 : (texcoord_array.type == GL_SHORT ? 2 : 4);
+	remap_texcoords(remap_buf, texcoord_array.ptr, texcoord_array.type, size, texcoord_array.stride ? texcoord_array.stride : size * elem, hi + 1);
+	return remap_buf;
+}
+
+static void passthrough(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+	gl_batch_flush();
+	apply_client_mask(client_mask);
+	if (client_mask & ARRAY_VERTEX)
+		glVertexPointer(vertex_array.size, vertex_array.type, vertex_array.stride, vertex_array.ptr);
+	if (client_mask & ARRAY_COLOR)
+		glColorPointer(color_array.size, color_array.type, color_array.stride, color_array.ptr);
+	if (client_mask & ARRAY_TEXCOORD) {
+		if (tex_xform_on && texcoord_array.size >= 2) {
+			const void *uv = remap_passthrough(count, type, indices);
+			// Sampling the whole page would draw someone else's texture, better to drop the draw
+			if (!uv)
+				return;
+			glTexCoordPointer(texcoord_array.size, GL_FLOAT, 0, uv);
+		} else
+			glTexCoordPointer(texcoord_array.size, texcoord_array.type, texcoord_array.stride, texcoord_array.ptr);
+	}
+	uint64_t t = sceKernelGetProcessTimeWide();
+	glDrawElements(mode, count, type, indices);
+	frame_stats.submit_us += sceKernelGetProcessTimeWide() - t;
+	frame_stats.gpu_draws++;
+}
+
+void glDrawElements_batch(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+	frame_stats.game_draws++;
+	if (count <= 0)
+		return;
+
+	if (before_draw) {
+		void (*fn)(void) = before_draw;
+		before_draw = NULL;
+		fn();
+	}
+
+	int batchable = batching && mode == GL_TRIANGLES && count <= BATCH_INDICES &&
+		(type == GL_UNSIGNED_SHORT || type == GL_UNSIGNED_BYTE) &&
+		(client_mask & ARRAY_VERTEX) && array_supported(&vertex_array, 2, 3, GL_FLOAT) &&
+		(!(client_mask & ARRAY_COLOR) || array_supported(&color_array, 4, 4, GL_UNSIGNED_BYTE) || array_supported(&color_array, 4, 4, GL_FLOAT)) &&
+		(!(client_mask & ARRAY_TEXCOORD) || array_supported(&texcoord_array, 2, 2, GL_FLOAT));
+	if (!batchable) {
+		passthrough(mode, count, type, indices);
+		return;
+	}
+
+	uint64_t t = sceKernelGetProcessTimeWide();
+
+	// Only the referenced vertex range gets copied
+	int lo = 0xFFFF, hi = 0;
+	if (type == GL_UNSIGNED_SHORT) {
+		const uint16_t *idx = (const uint16_t *)indices;
+		for (int i = 0; i < count; i++) {
+			if (idx[i] < lo) lo = idx[i];
+			if (idx[i] > hi) hi = idx[i];
+		}
+	} else {
+		const uint8_t *idx = (const uint8_t *)indices;
+		for (int i = 0; i < count; i++) {
+			if (idx[i] < lo) lo = idx[i];
+			if (idx[i] > hi) hi = idx[i];
+		}
+	}
+	int verts = hi - lo + 1;
+	if (verts > BATCH_VERTS) {
+		frame_stats.batch_us += sceKernelGetProcessTimeWide() - t;
+		passthrough(mode, count, type, indices);
+		return;
+	}
+
+	GLenum col_type = (client_mask & ARRAY_COLOR) ? color_array.type : 0;
+	if (batch_indices && (batch_mask != client_mask || batch_pos_size != vertex_array.size || batch_col_type != col_type ||
+		batch_verts + verts > BATCH_VERTS || batch_indices + count > BATCH_INDICES))
+		gl_batch_flush();
+	if (!batch_indices) {
+		batch_mask = client_mask;
+		batch_pos_size = vertex_array.size;
+		batch_col_type = col_type;
+	}
+
+	int size = vertex_array.size * sizeof(float);
+	int stride = vertex_array.stride ? vertex_array.stride : size;
+	const uint8_t *src = vertex_array.ptr + lo * stride;
+	float *pos = batch_pos + batch_verts * vertex_array.size;
+	for (int i = 0; i < verts; i++, src += stride, pos += vertex_array.size)
+		memcpy(pos, src, size);
+
+	if (client_mask & ARRAY_COLOR) {
+		size = col_type == GL_FLOAT ? 4 * sizeof(float) : 4;
+		stride = color_array.stride ? color_array.stride : size;
+		src = color_array.ptr + lo * stride;
+		uint8_t *col = batch_col + batch_verts * size;
+		for (int i = 0; i < verts; i++, src += stride, col += size)
+			memcpy(col, src, size);
+	}
+
+	if (client_mask & ARRAY_TEXCOORD) {
+		size = 2 * sizeof(float);
+		stride = texcoord_array.stride ? texcoord_array.stride : size;
+		src = texcoord_array.ptr + lo * stride;
+		float *tex = batch_tex + batch_verts * 2;
+		if (tex_xform_on)
+			remap_texcoords(tex, src, GL_FLOAT, 2, stride, verts);
+		else {
+			for (int i = 0; i < verts; i++, src += stride, tex += 2)
+				memcpy(tex, src, size);
+		}
+	}
+
+	uint16_t *dst = batch_idx + batch_indices;
+	int base = batch_verts - lo;
+	if (type == GL_UNSIGNED_SHORT) {
+		const uint16_t *idx = (const uint16_t *)indices;
+		for (int i = 0; i < count; i++)
+			dst[i] = idx[i] + base;
+	} else {
+		const uint8_t *idx = (const uint8_t *)indices;
+		for (int i = 0; i < count; i++)
+			dst[i] = idx[i] + base;
+	}
+	batch_verts += verts;
+	batch_indices += count;
+
+	frame_stats.batch_us += sceKernelGetProcessTimeWide() - t;
+}
+
+static void set_array(client_array *a, GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	a->size = size;
+	a->type = type;
+	a->stride = stride;
+	a->ptr = (const uint8_t *)pointer;
+}
+
+void glVertexPointer_batch(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	set_array(&vertex_array, size, type, stride, pointer);
+}
+
+void glColorPointer_batch(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	set_array(&color_array, size, type, stride, pointer);
+}
+
+void glTexCoordPointer_batch(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	set_array(&texcoord_array, size, type, stride, pointer);
+}
+
+static int array_bit(GLenum array) {
+	switch (array) {
+	case GL_VERTEX_ARRAY:
+		return ARRAY_VERTEX;
+	case GL_COLOR_ARRAY:
+		return ARRAY_COLOR;
+	case GL_TEXTURE_COORD_ARRAY:
+		return ARRAY_TEXCOORD;
+	default:
+		return 0;
+	}
+}
+
+void glEnableClientState_batch(GLenum array) {
+	int bit = array_bit(array);
+	if (bit)
+		client_mask |= bit;
+	else
+		glEnableClientState(array);
+}
+
+void glDisableClientState_batch(GLenum array) {
+	int bit = array_bit(array);
+	if (bit)
+		client_mask &= ~bit;
+	else
+		glDisableClientState(array);
+}
+
+// State changes reach here only when they differ from the current state, see gl_state.c
+void glBindTexture_batch(GLenum target, GLuint texture) {
+	gl_batch_flush();
+	glBindTexture(target, texture);
+}
+
+void glBlendFunc_batch(GLenum sfactor, GLenum dfactor) {
+	gl_batch_flush();
+	glBlendFunc(sfactor, dfactor);
+}
+
+void glEnable_batch(GLenum cap) {
+	gl_batch_flush();
+	glEnable(cap);
+}
+
+void glDisable_batch(GLenum cap) {
+	gl_batch_flush();
+	glDisable(cap);
+}
+
+void glTexParameteri_batch(GLenum target, GLenum pname, GLint param) {
+	gl_batch_flush();
+	glTexParameteri(target, pname, param);
+}
+
+void glLoadIdentity_batch(void) {
+	gl_batch_flush();
+	glLoadIdentity();
+}
+
+void glScalef_batch(GLfloat x, GLfloat y, GLfloat z) {
+	gl_batch_flush();
+	glScalef(x, y, z);
+}
+
+void glOrthof_batch(GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat nearVal, GLfloat farVal) {
+	gl_batch_flush();
+	glOrthof(left, right, bottom, top, nearVal, farVal);
+}
+
+void glViewport_batch(GLint x, GLint y, GLsizei width, GLsizei height) {
+	gl_batch_flush();
+	gl_dynres_viewport(x, y, width, height);
+}
+
+void glScissor_batch(GLint x, GLint y, GLsizei width, GLsizei height) {
+	gl_batch_flush();
+	gl_dynres_scissor(x, y, width, height);
+}
+
+void glClear_batch(GLbitfield mask) {
+	gl_batch_flush();
+	glClear(mask);
+}
+
+void glTexImage2D_batch(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data) {
+	gl_batch_flush();
+	glTexImage2D(target, level, internalFormat, width, height, border, format, type, data);
+}
+
+void glTexSubImage2D_batch(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels) {
+	gl_batch_flush();
+	glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
+}
+
+void glDeleteTextures_batch(GLsizei n, const GLuint *textures) {
+	gl_batch_flush();
+	glDeleteTextures(n, textures);
+}
@@ -0,0 +1,48 @@
+#ifndef __GL_BATCH_H__
+#define __GL_BATCH_H__
+
+#include <stdint.h>
+#ifdef __vita__
+#include <vitaGL.h>
+#else
+#include <GL/gl.h>
+#endif
+
+typedef struct {
+	uint32_t frames;
+	uint32_t game_draws;   // glDrawElements calls made by the game in the last frame
+	uint32_t gpu_draws;    // glDrawElements calls that reached vitaGL in the last frame
+	uint32_t submit_us;    // time spent in vitaGL draw calls in the last frame
+	uint32_t batch_us;     // time spent copying draws into the batch in the last frame
+} gl_batch_stats;
+
+void gl_batch_flush(void);
+void gl_batch_sync(void);
+void gl_batch_frame(void);
+void gl_batch_get_stats(gl_batch_stats *stats);
+void gl_batch_texcoord_transform(const float *xform);
+void gl_batch_before_draw(void (*fn)(void));
+
+void glVertexPointer_batch(GLint size, GLenum type, GLsizei stride, const void *pointer);
+void glColorPointer_batch(GLint size, GLenum type, GLsizei stride, const void *pointer);
+void glTexCoordPointer_batch(GLint size, GLenum type, GLsizei stride, const void *pointer);
+void glEnableClientState_batch(GLenum array);
+void glDisableClientState_batch(GLenum array);
+void glDrawElements_batch(GLenum mode, GLsizei count, GLenum type, const void *indices);
+
+void glBindTexture_batch(GLenum target, GLuint texture);
+void glBlendFunc_batch(GLenum sfactor, GLenum dfactor);
+void glEnable_batch(GLenum cap);
+void glDisable_batch(GLenum cap);
+void glTexParameteri_batch(GLenum target, GLenum pname, GLint param);
+void glLoadIdentity_batch(void);
+void glScalef_batch(GLfloat x, GLfloat y, GLfloat z);
+void glOrthof_batch(GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat nearVal, GLfloat farVal);
+void glViewport_batch(GLint x, GLint y, GLsizei width, GLsizei height);
+void glScissor_batch(GLint x, GLint y, GLsizei width, GLsizei height);
+void glClear_batch(GLbitfield mask);
+void glTexImage2D_batch(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data);
+void glTexSubImage2D_batch(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels);
+void glDeleteTextures_batch(GLsizei n, const GLuint *textures);
+
+#endif
@@ -0,0 +1,300 @@
+/* gl_dynres.c -- renders the game below native resolution while the GPU can't keep up
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#include "gl_dynres.h"
+
+#define SCALE_STEP 0.05f
+#define WINDOW_FRAMES 30
+#define RAISE_COOLDOWN 120 // Frames to wait after lowering the scale before raising it again
+#define LOG_ENTRIES 512
+#define LOG_INTERVAL_US (10 * 1000000)
+
+#ifndef DYNRES_MIN_SCALE
+#define DYNRES_MIN_SCALE 0.6f
+#endif
+#ifndef DYNRES_MAX_SCALE
+#define DYNRES_MAX_SCALE 1.0f
+#endif
+
+typedef struct {
+	uint32_t time_ms;
+	float scale;
+	uint32_t frame_us, cpu_us;
+} log_entry;
+
+#ifdef DYNAMIC_RESOLUTION
+static int dynres_enabled = 1;
+#else
+static int dynres_enabled = 0;
+#endif
+
+static GLuint fbo = 0, fbo_tex;
+static int fbo_w, fbo_h;
+static int active = 0; // Whether the game is drawing into fbo in the current frame
+static float frame_scale = 1.0f, scale = DYNRES_MAX_SCALE;
+static float min_scale = DYNRES_MIN_SCALE, max_scale = DYNRES_MAX_SCALE;
+
+// What the game asked for, the rects given to vitaGL are scaled from these
+static GLint game_viewport[4] = {0, 0, SCREEN_W, SCREEN_H};
+static GLint game_scissor[4] = {0, 0, SCREEN_W, SCREEN_H};
+
+static uint32_t target_us = 16667;
+static uint64_t last_swap = 0, swap_start = 0;
+static uint32_t window_frames = 0, cooldown = 0;
+static uint64_t window_frame_us = 0, window_cpu_us = 0;
+
+static log_entry scale_log[LOG_ENTRIES];
+static int log_num = 0, log_dirty = 0;
+static uint64_t last_log_write = 0;
+
+static gl_dynres_stats stats = {1.0f};
+
+void gl_dynres_set_target(uint32_t frame_us) {
+	target_us = frame_us;
+}
+
+void gl_dynres_set_max_scale(float max) {
+	max_scale = max;
+	if (min_scale > max)
+		min_scale = max;
+	scale = max;
+}
+
+static void scale_rect(const GLint *r, GLint *out) {
+	float s = active ? frame_scale : 1.0f;
+	// Edges are rounded rather than sizes so that adjacent rects stay adjacent
+	out[0] = (GLint)(r[0] * s + 0.5f);
+	out[1] = (GLint)(r[1] * s + 0.5f);
+	out[2] = (GLint)((r[0] + r[2]) * s + 0.5f) - out[0];
+	out[3] = (GLint)((r[1] + r[3]) * s + 0.5f) - out[1];
+}
+
+static void apply_rects(void) {
+	GLint r[4];
+	scale_rect(game_viewport, r);
+	glViewport(r[0], r[1], r[2], r[3]);
+	scale_rect(game_scissor, r);
+	glScissor(r[0], r[1], r[2], r[3]);
+}
+
+void gl_dynres_viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+	game_viewport[0] = x;
+	game_viewport[1] = y;
+	game_viewport[2] = width;
+	game_viewport[3] = height;
+	GLint r[4];
+	scale_rect(game_viewport, r);
+	glViewport(r[0], r[1], r[2], r[3]);
+}
+
+void gl_dynres_scissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+	game_scissor[0] = x;
+	game_scissor[1] = y;
+	game_scissor[2] = width;
+	game_scissor[3] = height;
+	GLint r[4];
+	scale_rect(game_scissor, r);
+	glScissor(r[0], r[1], r[2], r[3]);
+}
+
+static void fbo_create(void) {
+	GLint bound;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+	fbo_w = (int)(SCREEN_W * max_scale + 0.5f);
+	fbo_h = (int)(SCREEN_H * max_scale + 0.5f);
+	glGenTextures(1, &fbo_tex);
+	glBindTexture(GL_TEXTURE_2D, fbo_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, fbo_w, fbo_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, bound);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fbo_tex, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	debugPrintf("gl_dynres: %dx%d render target created\n", fbo_w, fbo_h);
+}
+
+// Stretches what the game drew so far over the whole screen, leaving the game's GL state as it was
+static void composite(void) {
+	static const GLenum caps[] = {GL_BLEND, GL_SCISSOR_TEST, GL_ALPHA_TEST, GL_DEPTH_TEST, GL_CULL_FACE, GL_TEXTURE_2D};
+	static const GLenum arrays[] = {GL_VERTEX_ARRAY, GL_COLOR_ARRAY, GL_TEXTURE_COORD_ARRAY};
+	static const float pos[] = {-1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f};
+	static const uint8_t white[16] = {255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255};
+	GLboolean caps_on[sizeof(caps) / sizeof(*caps)], arrays_on[sizeof(arrays) / sizeof(*arrays)];
+	GLint bound, mode;
+
+	float u = (float)(int)(SCREEN_W * frame_scale + 0.5f) / fbo_w;
+	float v = (float)(int)(SCREEN_H * frame_scale + 0.5f) / fbo_h;
+	float uv[] = {0.0f, 0.0f, u, 0.0f, 0.0f, v, u, v};
+
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+	glGetIntegerv(GL_MATRIX_MODE, &mode);
+	for (int i = 0; i < sizeof(caps) / sizeof(*caps); i++) {
+		caps_on[i] = glIsEnabled(caps[i]);
+		if (caps[i] == GL_TEXTURE_2D)
+			glEnable(caps[i]);
+		else
+			glDisable(caps[i]);
+	}
+	for (int i = 0; i < sizeof(arrays) / sizeof(*arrays); i++) {
+		arrays_on[i] = glIsEnabled(arrays[i]);
+		glEnableClientState(arrays[i]);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, SCREEN_W, SCREEN_H);
+	glBindTexture(GL_TEXTURE_2D, fbo_tex);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+	glVertexPointer(2, GL_FLOAT, 0, pos);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, white);
+	glTexCoordPointer(2, GL_FLOAT, 0, uv);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(mode);
+
+	glBindTexture(GL_TEXTURE_2D, bound);
+	for (int i = 0; i < sizeof(caps) / sizeof(*caps); i++) {
+		if (caps_on[i])
+			glEnable(caps[i]);
+		else
+			glDisable(caps[i]);
+	}
+	for (int i = 0; i < sizeof(arrays) / sizeof(*arrays); i++) {
+		if (!arrays_on[i])
+			glDisableClientState(arrays[i]);
+	}
+}
+
+static void leave(void) {
+	if (!active)
+		return;
+	composite();
+	active = 0;
+	apply_rects();
+}
+
+void gl_dynres_sync(void) {
+	// SDL's renderer draws on the screen, the rest of the frame goes there too
+	leave();
+}
+
+void gl_dynres_resolve(void) {
+	swap_start = sceKernelGetProcessTimeWide();
+	leave();
+}
+
+static void log_scale(uint64_t now, uint32_t frame_us, uint32_t cpu_us) {
+	if (log_num == LOG_ENTRIES) {
+		memmove(scale_log, scale_log + 1, (LOG_ENTRIES - 1) * sizeof(log_entry));
+		log_num--;
+	}
+	log_entry *e = &scale_log[log_num++];
+	e->time_ms = now / 1000;
+	e->scale = scale;
+	e->frame_us = frame_us;
+	e->cpu_us = cpu_us;
+	log_dirty = 1;
+}
+
+static void log_write(uint64_t now) {
+	if (!log_dirty || now - last_log_write < LOG_INTERVAL_US)
+		return;
+	FILE *f = save_writer_fopen(DATA_PATH "/dynres_log.txt", "w");
+	if (f) {
+		fprintf(f, "# time_ms scale frame_us cpu_us\n");
+		for (int i = 0; i < log_num; i++)
+			fprintf(f, "%u %.2f %u %u\n", scale_log[i].time_ms, scale_log[i].scale, scale_log[i].frame_us, scale_log[i].cpu_us);
+		fclose(f);
+	}
+	log_dirty = 0;
+	last_log_write = now;
+}
+
+static void update_scale(uint64_t now) {
+	uint32_t frame_us = window_frame_us / window_frames;
+	uint32_t cpu_us = window_cpu_us / window_frames;
+	window_frames = 0;
+	window_frame_us = window_cpu_us = 0;
+	stats.frame_us = frame_us;
+	stats.cpu_us = cpu_us;
+
+	// Fewer pixels only help when the time goes in waiting for the GPU, not in the game's own code
+	float next = scale;
+	if (frame_us > target_us * 11 / 10 && cpu_us < target_us * 9 / 10) {
+		next = scale - SCALE_STEP;
+		cooldown = RAISE_COOLDOWN;
+	} else if (!cooldown && frame_us <= target_us * 51 / 50 && frame_us - cpu_us > target_us * 3 / 10)
+		next = scale + SCALE_STEP;
+
+	if (next < min_scale)
+		next = min_scale;
+	if (next > max_scale)
+		next = max_scale;
+	if (next != scale) {
+		scale = next;
+		stats.changes++;
+		log_scale(now, frame_us, cpu_us);
+	}
+}
+
+static void control(void) {
+	uint64_t now = sceKernelGetProcessTimeWide();
+	if (last_swap) {
+		window_frame_us += now - last_swap;
+		window_cpu_us += swap_start - last_swap;
+		if (cooldown)
+			cooldown--;
+		if (++window_frames == WINDOW_FRAMES)
+			update_scale(now);
+	}
+	last_swap = now;
+	log_write(now);
+}
+
+void gl_dynres_frame(void) {
+	// Without the controller the scale stays where the performance profile put it
+	if (dynres_enabled)
+		control();
+
+	stats.scale = 1.0f;
+	// At full scale the game draws straight to the screen and keeps its MSAA
+	if (scale >= 1.0f)
+		return;
+	if (!fbo)
+		fbo_create();
+
+	frame_scale = scale;
+	stats.scale = scale;
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	active = 1;
+	apply_rects();
+}
+
+void gl_dynres_get_stats(gl_dynres_stats *out) {
+	*out = stats;
+}
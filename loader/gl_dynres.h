@@ -0,0 +1,23 @@
+#ifndef __GL_DYNRES_H__
+#define __GL_DYNRES_H__
+
+#include <stdint.h>
+#include <vitaGL.h>
+
+typedef struct {
+	float scale;       // Render scale used for the last frame, 1.0 means native resolution
+	uint32_t frame_us; // Averages over the last controller window
+	uint32_t cpu_us;
+	uint32_t changes;  // Scale changes since boot
+} gl_dynres_stats;
+
+void gl_dynres_set_target(uint32_t frame_us);
+void gl_dynres_set_max_scale(float max);
+void gl_dynres_viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void gl_dynres_scissor(GLint x, GLint y, GLsizei width, GLsizei height);
+void gl_dynres_sync(void);
+void gl_dynres_resolve(void);
+void gl_dynres_frame(void);
+void gl_dynres_get_stats(gl_dynres_stats *stats);
+
+#endif
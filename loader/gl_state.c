@@ -0,0 +1,257 @@
+/* gl_state.c -- shadow copy of the GL state set by the game, drops redundant calls
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * The file also builds on the host for tools/gl_state_check.c.
+ */
+
+#ifdef __vita__
+#include <vitasdk.h>
+#include <vitaGL.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __vita__
+#include "main.h"
+#include "config.h"
+#else
+#define debugPrintf printf
+#endif
+#include "gl_batch.h"
+#include "gl_atlas.h"
+#include "gl_state.h"
+
+#define MAX_CAPS 16
+#define MAX_TEXTURES 8192
+#define STATS_INTERVAL 600
+
+typedef struct {
+	GLenum cap;
+	int enabled;
+} cap_state;
+
+// Filter and wrap modes are never 0, so 0 marks a parameter that wasn't set yet
+typedef struct {
+	uint32_t gen;
+	GLint min_filter, mag_filter, wrap_s, wrap_t;
+} tex_state;
+
+static int texture_known = 0;
+static GLuint bound_texture;
+static cap_state caps[MAX_CAPS];
+static int caps_num = 0;
+static int blend_known = 0;
+static GLenum blend_src, blend_dst;
+static int client_known = 0, client_mask = 0; // Bits of the arrays whose state is known, and of the enabled ones
+static int matrix_known = 0;
+static GLenum matrix_mode;
+static int viewport_known = 0, scissor_known = 0;
+static GLint viewport[4], scissor[4];
+
+// Entries from an older generation are stale, bumping it forgets every texture at once
+static tex_state textures[MAX_TEXTURES];
+static uint32_t tex_gen = 1;
+
+static gl_state_stats stats, frame_stats;
+
+static inline int redundant(int kind, int same) {
+	frame_stats.calls[kind]++;
+	if (same)
+		frame_stats.redundant[kind]++;
+	return same;
+}
+
+void gl_state_sync(void) {
+	// SDL's renderer drives vitaGL directly, so nothing we tracked can be trusted afterwards
+	texture_known = 0;
+	caps_num = 0;
+	blend_known = 0;
+	client_known = 0;
+	matrix_known = 0;
+	viewport_known = scissor_known = 0;
+	tex_gen++;
+	gl_atlas_sync();
+}
+
+void gl_state_frame(void) {
+	frame_stats.frames = stats.frames + 1;
+	stats = frame_stats;
+	memset(&frame_stats, 0, sizeof(frame_stats));
+	if (stats.frames % STATS_INTERVAL == 0) {
+		uint32_t calls = 0, dropped = 0;
+		for (int i = 0; i < GL_STATE_NUM; i++) {
+			calls += stats.calls[i];
+			dropped += stats.redundant[i];
+		}
+		debugPrintf("gl_state: %u of %u state calls redundant\n", dropped, calls);
+	}
+}
+
+void gl_state_get_stats(gl_state_stats *out) {
+	*out = stats;
+}
+
+void glBindTexture_state(GLenum target, GLuint texture) {
+	if (target != GL_TEXTURE_2D) {
+		glBindTexture_atlas(target, texture);
+		return;
+	}
+	if (redundant(GL_STATE_BIND_TEXTURE, texture_known && bound_texture == texture))
+		return;
+	texture_known = 1;
+	bound_texture = texture;
+	glBindTexture_atlas(target, texture);
+}
+
+void glDeleteTextures_state(GLsizei n, const GLuint *names) {
+	for (int i = 0; i < n; i++) {
+		// Deleting the bound texture rebinds the default one
+		if (texture_known && bound_texture == names[i])
+			bound_texture = 0;
+		if (names[i] < MAX_TEXTURES)
+			textures[names[i]].gen = 0;
+	}
+	glDeleteTextures_atlas(n, names);
+}
+
+static int set_cap(GLenum cap, int enabled) {
+	for (int i = 0; i < caps_num; i++) {
+		if (caps[i].cap == cap) {
+			if (caps[i].enabled == enabled)
+				return 0;
+			caps[i].enabled = enabled;
+			return 1;
+		}
+	}
+	if (caps_num < MAX_CAPS) {
+		caps[caps_num].cap = cap;
+		caps[caps_num++].enabled = enabled;
+	}
+	return 1;
+}
+
+void glEnable_state(GLenum cap) {
+	if (redundant(GL_STATE_ENABLE, !set_cap(cap, 1)))
+		return;
+	glEnable_batch(cap);
+}
+
+void glDisable_state(GLenum cap) {
+	if (redundant(GL_STATE_ENABLE, !set_cap(cap, 0)))
+		return;
+	glDisable_batch(cap);
+}
+
+void glBlendFunc_state(GLenum sfactor, GLenum dfactor) {
+	if (redundant(GL_STATE_BLEND_FUNC, blend_known && blend_src == sfactor && blend_dst == dfactor))
+		return;
+	blend_known = 1;
+	blend_src = sfactor;
+	blend_dst = dfactor;
+	glBlendFunc_batch(sfactor, dfactor);
+}
+
+void glTexParameteri_state(GLenum target, GLenum pname, GLint param) {
+	GLint *value = NULL;
+	if (target == GL_TEXTURE_2D && texture_known && bound_texture < MAX_TEXTURES) {
+		tex_state *t = &textures[bound_texture];
+		if (t->gen != tex_gen) {
+			memset(t, 0, sizeof(*t));
+			t->gen = tex_gen;
+		}
+		switch (pname) {
+		case GL_TEXTURE_MIN_FILTER:
+			value = &t->min_filter;
+			break;
+		case GL_TEXTURE_MAG_FILTER:
+			value = &t->mag_filter;
+			break;
+		case GL_TEXTURE_WRAP_S:
+			value = &t->wrap_s;
+			break;
+		case GL_TEXTURE_WRAP_T:
+			value = &t->wrap_t;
+			break;
+		default:
+			break;
+		}
+	}
+	if (redundant(GL_STATE_TEX_PARAMETER, value && *value == param))
+		return;
+	if (value)
+		*value = param;
+	glTexParameteri_atlas(target, pname, param);
+}
+
+static int array_bit(GLenum array) {
+	switch (array) {
+	case GL_VERTEX_ARRAY:
+		return 1;
+	case GL_COLOR_ARRAY:
+		return 2;
+	case GL_TEXTURE_COORD_ARRAY:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+static int set_client(GLenum array, int enabled) {
+	int bit = array_bit(array);
+	if (!bit)
+		return 1;
+	int same = (client_known & bit) && !(client_mask & bit) == !enabled;
+	client_known |= bit;
+	if (enabled)
+		client_mask |= bit;
+	else
+		client_mask &= ~bit;
+	return !same;
+}
+
+void glEnableClientState_state(GLenum array) {
+	if (redundant(GL_STATE_CLIENT_STATE, !set_client(array, 1)))
+		return;
+	glEnableClientState_batch(array);
+}
+
+void glDisableClientState_state(GLenum array) {
+	if (redundant(GL_STATE_CLIENT_STATE, !set_client(array, 0)))
+		return;
+	glDisableClientState_batch(array);
+}
+
+void glMatrixMode_state(GLenum mode) {
+	if (redundant(GL_STATE_MATRIX_MODE, matrix_known && matrix_mode == mode))
+		return;
+	matrix_known = 1;
+	matrix_mode = mode;
+	glMatrixMode(mode);
+}
+
+void glViewport_state(GLint x, GLint y, GLsizei width, GLsizei height) {
+	if (redundant(GL_STATE_VIEWPORT, viewport_known && viewport[0] == x && viewport[1] == y && viewport[2] == width && viewport[3] == height))
+		return;
+	viewport_known = 1;
+	viewport[0] = x;
+	viewport[1] = y;
+	viewport[2] = width;
+	viewport[3] = height;
+	glViewport_batch(x, y, width, height);
+}
+
+void glScissor_state(GLint x, GLint y, GLsizei width, GLsizei height) {
+	if (redundant(GL_STATE_SCISSOR, scissor_known && scissor[0] == x && scissor[1] == y && scissor[2] == width && scissor[3] == height))
+		return;
+	scissor_known = 1;
+	scissor[0] = x;
+	scissor[1] = y;
+	scissor[2] = width;
+	scissor[3] = height;
+	glScissor_batch(x, y, width, height);
+}
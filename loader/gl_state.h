@@ -0,0 +1,45 @@
+#ifndef __GL_STATE_H__
+#define __GL_STATE_H__
+
+#include <stdint.h>
+#ifdef __vita__
+#include <vitaGL.h>
+#else
+#include <GL/gl.h>
+#endif
+
+enum {
+	GL_STATE_BIND_TEXTURE,
+	GL_STATE_ENABLE,
+	GL_STATE_BLEND_FUNC,
+	GL_STATE_TEX_PARAMETER,
+	GL_STATE_CLIENT_STATE,
+	GL_STATE_MATRIX_MODE,
+	GL_STATE_VIEWPORT,
+	GL_STATE_SCISSOR,
+	GL_STATE_NUM
+};
+
+typedef struct {
+	uint32_t frames;
+	uint32_t calls[GL_STATE_NUM];     // state calls made by the game in the last frame
+	uint32_t redundant[GL_STATE_NUM]; // calls among them that were dropped
+} gl_state_stats;
+
+void gl_state_sync(void);
+void gl_state_frame(void);
+void gl_state_get_stats(gl_state_stats *stats);
+
+void glBindTexture_state(GLenum target, GLuint texture);
+void glDeleteTextures_state(GLsizei n, const GLuint *textures);
+void glEnable_state(GLenum cap);
+void glDisable_state(GLenum cap);
+void glBlendFunc_state(GLenum sfactor, GLenum dfactor);
+void glTexParameteri_state(GLenum target, GLenum pname, GLint param);
+void glEnableClientState_state(GLenum array);
+void glDisableClientState_state(GLenum array);
+void glMatrixMode_state(GLenum mode);
+void glViewport_state(GLint x, GLint y, GLsizei width, GLsizei height);
+void glScissor_state(GLint x, GLint y, GLsizei width, GLsizei height);
+
+#endif
@@ -0,0 +1,241 @@
+/* gl_stream.c -- coalesces sub-image updates of streaming textures into double-buffered storage
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <SDL2/SDL.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "gl_stream.h"
+
+#define MAX_SDL_STREAMS 64
+#define STATS_INTERVAL 600
+
+// A streaming SDL texture, the game keeps drawing with texture while buf[front] is what really gets drawn
+typedef struct {
+	SDL_Texture *texture;
+	SDL_Texture *buf[2];
+	SDL_Renderer *renderer;
+	Uint32 format;
+	int access;
+	gl_stream *s;
+} sdl_stream;
+
+static sdl_stream sdl_streams[MAX_SDL_STREAMS];
+static int sdl_streams_num = 0;
+
+static uint32_t stream_frame = 0;
+static gl_stream_stats stats, frame_stats;
+
+#ifdef GL_STREAMING
+int gl_stream_enabled = 1;
+#else
+int gl_stream_enabled = 0;
+#endif
+
+gl_stream *gl_stream_create(int width, int height, int bpp) {
+	gl_stream *s = calloc(1, sizeof(gl_stream));
+	if (!s)
+		return NULL;
+	s->pixels = calloc(width * height, bpp);
+	if (!s->pixels) {
+		free(s);
+		return NULL;
+	}
+	s->width = width;
+	s->height = height;
+	s->bpp = bpp;
+	s->buffers = 1;
+	s->swap_frame = stream_frame;
+	// The second buffer is created on first use and needs everything
+	s->rects_num[1] = 1;
+	s->rects[1][0] = (gl_stream_rect){0, 0, width, height};
+	frame_stats.streams++;
+	return s;
+}
+
+void gl_stream_free(gl_stream *s) {
+	free(s->pixels);
+	free(s);
+	frame_stats.streams--;
+}
+
+static int rect_area(const gl_stream_rect *r) {
+	return r->w * r->h;
+}
+
+static gl_stream_rect rect_union(const gl_stream_rect *a, const gl_stream_rect *b) {
+	int x0 = a->x < b->x ? a->x : b->x;
+	int y0 = a->y < b->y ? a->y : b->y;
+	int x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+	int y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+	return (gl_stream_rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+static void add_rect(gl_stream_rect *rects, int *num, gl_stream_rect r) {
+	for (int i = 0; i < *num;) {
+		// Rects are merged as long as the union doesn't re-upload much that's clean
+		gl_stream_rect u = rect_union(&rects[i], &r);
+		if (rect_area(&u) * 4 <= (rect_area(&rects[i]) + rect_area(&r)) * 5) {
+			r = u;
+			rects[i] = rects[--(*num)];
+			i = 0;
+		} else
+			i++;
+	}
+
+	if (*num == GL_STREAM_RECTS) {
+		int best = 0, best_growth = 0x7FFFFFFF;
+		for (int i = 0; i < *num; i++) {
+			gl_stream_rect u = rect_union(&rects[i], &r);
+			int growth = rect_area(&u) - rect_area(&rects[i]);
+			if (growth < best_growth) {
+				best = i;
+				best_growth = growth;
+			}
+		}
+		r = rect_union(&rects[best], &r);
+		rects[best] = rects[--(*num)];
+		add_rect(rects, num, r);
+		return;
+	}
+	rects[(*num)++] = r;
+}
+
+void gl_stream_write(gl_stream *s, int x, int y, int w, int h, const void *pixels, int pitch) {
+	for (int i = 0; i < h; i++)
+		memcpy(s->pixels + ((y + i) * s->width + x) * s->bpp, (const uint8_t *)pixels + i * pitch, w * s->bpp);
+	gl_stream_rect r = {x, y, w, h};
+	add_rect(s->rects[0], &s->rects_num[0], r);
+	add_rect(s->rects[1], &s->rects_num[1], r);
+	frame_stats.updates++;
+}
+
+int gl_stream_pending(gl_stream *s) {
+	return s->rects_num[s->front] > 0;
+}
+
+int gl_stream_acquire(gl_stream *s) {
+	// The buffer drawn from in an earlier frame is the one the GPU is done with
+	if (s->buffers > 1 && s->swap_frame != stream_frame) {
+		s->front ^= 1;
+		frame_stats.swaps++;
+	}
+	s->swap_frame = stream_frame;
+	return s->front;
+}
+
+int gl_stream_next_rect(gl_stream *s, int buffer, gl_stream_rect *rect) {
+	if (!s->rects_num[buffer])
+		return 0;
+	*rect = s->rects[buffer][--s->rects_num[buffer]];
+	frame_stats.uploads++;
+	return 1;
+}
+
+const uint8_t *gl_stream_rect_pixels(gl_stream *s, const gl_stream_rect *rect) {
+	return s->pixels + (rect->y * s->width + rect->x) * s->bpp;
+}
+
+void gl_stream_frame(void) {
+	stream_frame++;
+	frame_stats.frames = stats.frames + 1;
+	stats = frame_stats;
+	memset(&frame_stats, 0, sizeof(frame_stats));
+	frame_stats.streams = stats.streams;
+	if (stats.streams && stats.frames % STATS_INTERVAL == 0)
+		debugPrintf("gl_stream: %u streams, %u updates -> %u uploads, %u swaps\n", stats.streams, stats.updates, stats.uploads, stats.swaps);
+}
+
+void gl_stream_get_stats(gl_stream_stats *out) {
+	*out = stats;
+}
+
+static sdl_stream *sdl_lookup(SDL_Texture *texture) {
+	for (int i = 0; i < sdl_streams_num; i++) {
+		if (sdl_streams[i].texture == texture)
+			return &sdl_streams[i];
+	}
+	return NULL;
+}
+
+void gl_stream_sdl_created(SDL_Renderer *renderer, SDL_Texture *texture, Uint32 format, int access, int w, int h) {
+	// Only streaming textures are updated piecewise, static ones are filled once and planar formats have no single pitch
+	if (!gl_stream_enabled || !texture || access != SDL_TEXTUREACCESS_STREAMING || SDL_ISPIXELFORMAT_FOURCC(format) ||
+		sdl_streams_num == MAX_SDL_STREAMS)
+		return;
+	gl_stream *s = gl_stream_create(w, h, SDL_BYTESPERPIXEL(format));
+	if (!s)
+		return;
+	sdl_stream *st = &sdl_streams[sdl_streams_num++];
+	st->texture = texture;
+	st->buf[0] = texture;
+	st->buf[1] = NULL;
+	st->renderer = renderer;
+	st->format = format;
+	st->access = access;
+	st->s = s;
+}
+
+int gl_stream_sdl_update(SDL_Texture *texture, const SDL_Rect *rect, const void *pixels, int pitch) {
+	sdl_stream *st = sdl_lookup(texture);
+	if (!st)
+		return 0;
+	gl_stream *s = st->s;
+	SDL_Rect r = rect ? *rect : (SDL_Rect){0, 0, s->width, s->height};
+	if (r.x < 0 || r.y < 0 || r.w <= 0 || r.h <= 0 || r.x + r.w > s->width || r.y + r.h > s->height)
+		return 0;
+	gl_stream_write(s, r.x, r.y, r.w, r.h, pixels, pitch);
+	return 1;
+}
+
+SDL_Texture *gl_stream_sdl_front(SDL_Texture *texture) {
+	sdl_stream *st = sdl_lookup(texture);
+	if (!st)
+		return texture;
+	gl_stream *s = st->s;
+
+	if (gl_stream_pending(s)) {
+		if (!st->buf[1]) {
+			st->buf[1] = SDL_CreateTexture(st->renderer, st->format, st->access, s->width, s->height);
+			if (st->buf[1])
+				s->buffers = 2;
+		}
+		int b = gl_stream_acquire(s);
+		gl_stream_rect r;
+		while (gl_stream_next_rect(s, b, &r)) {
+			SDL_Rect sr = {r.x, r.y, r.w, r.h};
+			SDL_UpdateTexture(st->buf[b], &sr, gl_stream_rect_pixels(s, &r), s->width * s->bpp);
+		}
+	}
+
+	SDL_Texture *front = st->buf[s->front];
+	if (front != texture) {
+		// Modulation is set on the game's texture, the one drawn from has to follow it
+		SDL_BlendMode mode;
+		Uint8 r, g, b;
+		SDL_GetTextureBlendMode(texture, &mode);
+		SDL_SetTextureBlendMode(front, mode);
+		SDL_GetTextureColorMod(texture, &r, &g, &b);
+		SDL_SetTextureColorMod(front, r, g, b);
+	}
+	return front;
+}
+
+void gl_stream_sdl_destroy(SDL_Texture *texture) {
+	sdl_stream *st = sdl_lookup(texture);
+	if (!st)
+		return;
+	if (st->buf[1])
+		SDL_DestroyTexture(st->buf[1]);
+	gl_stream_free(st->s);
+	*st = sdl_streams[--sdl_streams_num];
+}
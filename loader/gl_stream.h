@@ -0,0 +1,49 @@
+#ifndef __GL_STREAM_H__
+#define __GL_STREAM_H__
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#define GL_STREAM_RECTS 8
+
+typedef struct {
+	int x, y, w, h;
+} gl_stream_rect;
+
+// CPU copy of a texture updated piecewise, every buffer backing it keeps the list of regions it's missing
+typedef struct {
+	int width, height, bpp;
+	uint8_t *pixels;
+	int buffers;
+	int front; // Buffer draws read from
+	uint32_t swap_frame;
+	int rects_num[2];
+	gl_stream_rect rects[2][GL_STREAM_RECTS];
+} gl_stream;
+
+typedef struct {
+	uint32_t frames;
+	uint32_t updates;  // sub-image updates made by the game in the last frame
+	uint32_t uploads;  // regions sent to the GPU in the last frame
+	uint32_t swaps;    // buffer swaps in the last frame
+	uint32_t streams;  // textures handled as streams
+} gl_stream_stats;
+
+extern int gl_stream_enabled;
+
+gl_stream *gl_stream_create(int width, int height, int bpp);
+void gl_stream_free(gl_stream *s);
+void gl_stream_write(gl_stream *s, int x, int y, int w, int h, const void *pixels, int pitch);
+int gl_stream_pending(gl_stream *s);
+int gl_stream_acquire(gl_stream *s);
+int gl_stream_next_rect(gl_stream *s, int buffer, gl_stream_rect *rect);
+const uint8_t *gl_stream_rect_pixels(gl_stream *s, const gl_stream_rect *rect);
+void gl_stream_frame(void);
+void gl_stream_get_stats(gl_stream_stats *stats);
+
+void gl_stream_sdl_created(SDL_Renderer *renderer, SDL_Texture *texture, Uint32 format, int access, int w, int h);
+int gl_stream_sdl_update(SDL_Texture *texture, const SDL_Rect *rect, const void *pixels, int pitch);
+SDL_Texture *gl_stream_sdl_front(SDL_Texture *texture);
+void gl_stream_sdl_destroy(SDL_Texture *texture);
+
+#endif
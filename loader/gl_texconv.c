@@ -0,0 +1,294 @@
+/* gl_texconv.c -- lossless texture format down-conversion and texture memory ledger
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#include "gl_trace.h"
+#include "gl_texconv.h"
+
+#define PALETTE_SLOTS 512
+#define REPORT_TOP 24
+#define REPORT_INTERVAL_US (10 * 1000000)
+
+typedef struct {
+	int used;
+	int width, height;
+	GLenum type;
+	uint32_t bytes[TEX_MAX_LEVELS];
+	uint32_t original_bytes[TEX_MAX_LEVELS];
+} ledger_entry;
+
+static ledger_entry *ledger = NULL;
+static int ledger_cap = 0;
+static int ledger_dirty = 0;
+static uint64_t last_report = 0;
+
+static uint8_t *conv_buf = NULL;
+static int conv_cap = 0;
+
+static gl_texconv_stats stats;
+
+// A channel survives the round trip if expanding its top bits by replication gives it back
+static inline int fits_4(uint8_t v) {
+	return v == (v >> 4) * 0x11;
+}
+
+static inline int fits_5(uint8_t v) {
+	return v == (((v >> 3) << 3) | (v >> 5));
+}
+
+static int palette_add(uint32_t *slots, int *num, uint32_t color) {
+	uint32_t h = (color * 2654435761u) >> 23;
+	while (slots[h] != color) {
+		if (!slots[h] && color) {
+			slots[h] = color;
+			return ++(*num) <= 256;
+		}
+		h = (h + 1) & (PALETTE_SLOTS - 1);
+	}
+	return 1;
+}
+
+GLenum gl_texconv_pick(const uint8_t *rgba, int width, int height) {
+	int ok5551 = 1, ok4444 = 1, ok_palette = 1, colors = 0, has_zero = 0;
+	uint32_t slots[PALETTE_SLOTS];
+	memset(slots, 0, sizeof(slots));
+
+	const uint32_t *px = (const uint32_t *)rgba;
+	for (int i = 0; i < width * height && (ok5551 || ok4444 || ok_palette); i++) {
+		uint32_t c = px[i];
+		uint8_t r = c, g = c >> 8, b = c >> 16, a = c >> 24;
+		if (ok5551)
+			ok5551 = (a == 0 || a == 0xFF) && fits_5(r) && fits_5(g) && fits_5(b);
+		if (ok4444)
+			ok4444 = fits_4(r) && fits_4(g) && fits_4(b) && fits_4(a);
+		if (ok_palette) {
+			if (c)
+				ok_palette = palette_add(slots, &colors, c);
+			else if (!has_zero) {
+				has_zero = 1;
+				ok_palette = ++colors <= 256;
+			}
+		}
+	}
+
+	if (ok5551)
+		return GL_UNSIGNED_SHORT_5_5_5_1;
+	if (ok4444)
+		return GL_UNSIGNED_SHORT_4_4_4_4;
+	// vitaGL has no 8 bit paletted upload path for the game's fixed function textures, only count them
+	if (ok_palette)
+		stats.palette_candidates++;
+	return GL_UNSIGNED_BYTE;
+}
+
+int gl_texconv_fits(const uint8_t *rgba, int width, int height, int pitch, GLenum type) {
+	if (type == GL_UNSIGNED_BYTE)
+		return 1;
+	for (int y = 0; y < height; y++) {
+		const uint32_t *px = (const uint32_t *)(rgba + y * pitch);
+		for (int x = 0; x < width; x++) {
+			uint32_t c = px[x];
+			uint8_t r = c, g = c >> 8, b = c >> 16, a = c >> 24;
+			if (type == GL_UNSIGNED_SHORT_5_5_5_1) {
+				if ((a != 0 && a != 0xFF) || !fits_5(r) || !fits_5(g) || !fits_5(b))
+					return 0;
+			} else if (!fits_4(r) || !fits_4(g) || !fits_4(b) || !fits_4(a))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+// Tightly packed texels of the given type, NULL if there's no memory to convert them
+const void *gl_texconv_convert(const uint8_t *rgba, int width, int height, int pitch, GLenum type) {
+	if (type == GL_UNSIGNED_BYTE && pitch == width * 4)
+		return rgba;
+
+	// Rows of 16 bit texels stay 4 bytes aligned for the default unpack alignment
+	int dst_pitch = type == GL_UNSIGNED_BYTE ? width * 4 : (width * 2 + 3) & ~3;
+	if (dst_pitch * height > conv_cap) {
+		uint8_t *buf = realloc(conv_buf, dst_pitch * height);
+		if (!buf)
+			return NULL;
+		conv_buf = buf;
+		conv_cap = dst_pitch * height;
+	}
+
+	for (int y = 0; y < height; y++) {
+		const uint32_t *src = (const uint32_t *)(rgba + y * pitch);
+		uint16_t *dst = (uint16_t *)(conv_buf + y * dst_pitch);
+		if (type == GL_UNSIGNED_BYTE) {
+			memcpy(conv_buf + y * dst_pitch, src, width * 4);
+		} else if (type == GL_UNSIGNED_SHORT_5_5_5_1) {
+			for (int x = 0; x < width; x++) {
+				uint32_t c = src[x];
+				dst[x] = ((c & 0xF8) << 8) | ((c & 0xF800) >> 5) | ((c & 0xF80000) >> 18) | (c >> 31);
+			}
+		} else {
+			for (int x = 0; x < width; x++) {
+				uint32_t c = src[x];
+				dst[x] = ((c & 0xF0) << 8) | ((c & 0xF000) >> 4) | ((c & 0xF00000) >> 16) | (c >> 28);
+			}
+		}
+	}
+	return conv_buf;
+}
+
+GLint gl_texconv_internal_format(GLenum type) {
+	switch (type) {
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+		return GL_RGB5_A1;
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+		return GL_RGBA4;
+	default:
+		return GL_RGBA;
+	}
+}
+
+void gl_texconv_ledger_set(GLuint texture, GLint level, int width, int height, GLenum format, GLenum type, uint32_t original_bytes) {
+	if (level < 0 || level >= TEX_MAX_LEVELS)
+		return;
+	if (texture >= ledger_cap) {
+		int cap = ledger_cap ? ledger_cap : 256;
+		while (cap <= texture)
+			cap *= 2;
+		// Without memory the texture just goes untracked
+		ledger_entry *grown = realloc(ledger, cap * sizeof(ledger_entry));
+		if (!grown)
+			return;
+		ledger = grown;
+		memset(&ledger[ledger_cap], 0, (cap - ledger_cap) * sizeof(ledger_entry));
+		ledger_cap = cap;
+	}
+
+	ledger_entry *e = &ledger[texture];
+	if (!e->used) {
+		e->used = 1;
+		stats.textures++;
+	}
+	if (level == 0) {
+		if (e->type != type) {
+			if (type == GL_UNSIGNED_SHORT_5_5_5_1)
+				stats.converted_5551++;
+			else if (type == GL_UNSIGNED_SHORT_4_4_4_4)
+				stats.converted_4444++;
+		}
+		e->width = width;
+		e->height = height;
+		e->type = type;
+	}
+
+	stats.bytes -= e->bytes[level];
+	stats.original_bytes -= e->original_bytes[level];
+	e->bytes[level] = gl_trace_pixels_size(format, type, width, height);
+	e->original_bytes[level] = original_bytes;
+	stats.bytes += e->bytes[level];
+	stats.original_bytes += e->original_bytes[level];
+	ledger_dirty = 1;
+}
+
+void gl_texconv_ledger_remove(GLuint texture) {
+	if (texture >= ledger_cap || !ledger[texture].used)
+		return;
+	ledger_entry *e = &ledger[texture];
+	for (int i = 0; i < TEX_MAX_LEVELS; i++) {
+		stats.bytes -= e->bytes[i];
+		stats.original_bytes -= e->original_bytes[i];
+	}
+	memset(e, 0, sizeof(*e));
+	stats.textures--;
+	ledger_dirty = 1;
+}
+
+void gl_texconv_ledger_copy(int32_t bytes) {
+	stats.copy_bytes += bytes;
+	ledger_dirty = 1;
+}
+
+void gl_texconv_promotion(void) {
+	stats.promotions++;
+}
+
+void gl_texconv_get_stats(gl_texconv_stats *out) {
+	*out = stats;
+}
+
+static uint32_t entry_bytes(const ledger_entry *e) {
+	uint32_t total = 0;
+	for (int i = 0; i < TEX_MAX_LEVELS; i++)
+		total += e->bytes[i];
+	return total;
+}
+
+static const char *type_name(GLenum type) {
+	switch (type) {
+	case GL_UNSIGNED_SHORT_5_5_5_1:
+		return "RGBA5551";
+	case GL_UNSIGNED_SHORT_4_4_4_4:
+		return "RGBA4444";
+	case GL_UNSIGNED_SHORT_5_6_5:
+		return "RGB565";
+	default:
+		return "8 bit";
+	}
+}
+
+static void ledger_report(void) {
+	int top[REPORT_TOP], top_num = 0;
+	for (int i = 0; i < ledger_cap; i++) {
+		if (!ledger[i].used)
+			continue;
+		uint32_t bytes = entry_bytes(&ledger[i]);
+		int pos = top_num < REPORT_TOP ? top_num++ : REPORT_TOP - 1;
+		if (pos == REPORT_TOP - 1 && top_num == REPORT_TOP && entry_bytes(&ledger[top[pos]]) >= bytes)
+			continue;
+		while (pos > 0 && entry_bytes(&ledger[top[pos - 1]]) < bytes) {
+			top[pos] = top[pos - 1];
+			pos--;
+		}
+		top[pos] = i;
+	}
+
+	FILE *f = save_writer_fopen(DATA_PATH "/texture_report.txt", "w");
+	if (!f)
+		return;
+	fprintf(f, "textures: %u\n", stats.textures);
+	// The loader's own copies of texture content count against what the conversions saved
+	fprintf(f, "memory: %u KB (%u KB as uploaded, %d KB saved)\n", (uint32_t)(stats.bytes / 1024), (uint32_t)(stats.original_bytes / 1024),
+		(int)(((int64_t)stats.original_bytes - (int64_t)stats.bytes - (int64_t)stats.copy_bytes) / 1024));
+	fprintf(f, "CPU copies: %u KB (atlased and streamed textures)\n", (uint32_t)(stats.copy_bytes / 1024));
+	fprintf(f, "converted: %u to RGBA5551, %u to RGBA4444, %u promoted back\n", stats.converted_5551, stats.converted_4444, stats.promotions);
+	fprintf(f, "paletted candidates: %u\n", stats.palette_candidates);
+	fprintf(f, "vitaGL free: %u KB RAM, %u KB VRAM\n", (unsigned)(vglMemFree(VGL_MEM_RAM) / 1024), (unsigned)(vglMemFree(VGL_MEM_VRAM) / 1024));
+	fprintf(f, "\nbiggest textures:\n");
+	for (int i = 0; i < top_num; i++) {
+		ledger_entry *e = &ledger[top[i]];
+		fprintf(f, "%6d: %4dx%-4d %-8s %6u KB\n", top[i], e->width, e->height, type_name(e->type), entry_bytes(e) / 1024);
+	}
+	fclose(f);
+}
+
+void gl_texconv_frame(void) {
+#ifdef TEXTURE_REPORT
+	uint64_t now = sceKernelGetProcessTimeWide();
+	if (ledger_dirty && now - last_report >= REPORT_INTERVAL_US) {
+		ledger_report();
+		ledger_dirty = 0;
+		last_report = now;
+	}
+#endif
+}
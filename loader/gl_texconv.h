@@ -0,0 +1,32 @@
+#ifndef __GL_TEXCONV_H__
+#define __GL_TEXCONV_H__
+
+#include <stdint.h>
+#include <vitaGL.h>
+
+#define TEX_MAX_LEVELS 13 // Mipmap levels tracked per texture, enough for 4096x4096
+
+typedef struct {
+	uint32_t textures;       // texture objects alive
+	uint64_t bytes;          // memory used by their storage
+	uint64_t original_bytes; // memory they'd use with the formats the game asked for
+	uint64_t copy_bytes;     // CPU copies of texture content kept by the loader
+	uint32_t converted_5551;
+	uint32_t converted_4444;
+	uint32_t palette_candidates; // RGBA8 textures with 256 colors or less that didn't fit a 16 bit format
+	uint32_t promotions;         // converted textures sent back to RGBA8 by an update their format couldn't hold
+} gl_texconv_stats;
+
+GLenum gl_texconv_pick(const uint8_t *rgba, int width, int height);
+int gl_texconv_fits(const uint8_t *rgba, int width, int height, int pitch, GLenum type);
+const void *gl_texconv_convert(const uint8_t *rgba, int width, int height, int pitch, GLenum type);
+GLint gl_texconv_internal_format(GLenum type);
+
+void gl_texconv_ledger_set(GLuint texture, GLint level, int width, int height, GLenum format, GLenum type, uint32_t original_bytes);
+void gl_texconv_ledger_remove(GLuint texture);
+void gl_texconv_ledger_copy(int32_t bytes);
+void gl_texconv_promotion(void);
+void gl_texconv_get_stats(gl_texconv_stats *stats);
+void gl_texconv_frame(void);
+
+#endif
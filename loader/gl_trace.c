@@ -0,0 +1,425 @@
+/* gl_trace.c -- recorder for the GL calls performed by the game
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "gl_trace.h"
+
+#ifdef GL_TRACE
+
+#define TRACE_BUF_SIZE (256 * 1024)
+#define CAPTURE_FRAMES 300
+#define CAPTURE_BUTTONS (SCE_CTRL_LTRIGGER | SCE_CTRL_RTRIGGER | SCE_CTRL_SELECT)
+#define MAX_CAPS 16
+#define MAX_MATRIX_OPS 8
+
+typedef struct {
+	GLint size;
+	GLenum type;
+	GLsizei stride;
+	const uint8_t *ptr;
+} trace_array;
+
+typedef struct {
+	uint16_t op;
+	uint16_t argc;
+	uint32_t args[6];
+} trace_matrix_op;
+
+static SceUID trace_fd = -1;
+static uint8_t trace_buf[TRACE_BUF_SIZE];
+static size_t trace_len = 0;
+static int capturing = 0, frames_left = CAPTURE_FRAMES;
+
+// Last known state, replayed as a snapshot when the capture starts
+static GLuint bound_texture = 0;
+static GLenum caps[MAX_CAPS];
+static int caps_enabled[MAX_CAPS], caps_num = 0;
+static uint32_t blend[2], viewport[4], scissor[4], clear_color[4];
+static int blend_known = 0, viewport_known = 0, scissor_known = 0, clear_color_known = 0;
+static int client_mask = 0;
+static GLenum matrix_mode = GL_MODELVIEW;
+static trace_matrix_op matrix_ops[3][MAX_MATRIX_OPS];
+static int matrix_ops_num[3];
+
+static trace_array arrays[3];
+
+static inline uint32_t fbits(float f) {
+	uint32_t u;
+	memcpy(&u, &f, 4);
+	return u;
+}
+
+static void trace_write(const void *data, size_t size) {
+	if (trace_len + size > TRACE_BUF_SIZE) {
+		sceIoWrite(trace_fd, trace_buf, trace_len);
+		trace_len = 0;
+		if (size > TRACE_BUF_SIZE) {
+			sceIoWrite(trace_fd, data, size);
+			return;
+		}
+	}
+	memcpy(&trace_buf[trace_len], data, size);
+	trace_len += size;
+}
+
+static void trace_pad(size_t size) {
+	static const uint8_t zero[4] = {0};
+	if (size & 3)
+		trace_write(zero, 4 - (size & 3));
+}
+
+static void trace_record(int op, int argc, const uint32_t *args, const void *data, uint32_t size) {
+	gl_trace_record r = { op, argc, size };
+	trace_write(&r, sizeof(r));
+	trace_write(args, argc * 4);
+	if (size) {
+		trace_write(data, size);
+		trace_pad(size);
+	}
+}
+
+static inline int active(void) {
+	return capturing && trace_fd >= 0;
+}
+
+static int matrix_slot(GLenum mode) {
+	return mode == GL_PROJECTION ? 1 : (mode == GL_TEXTURE ? 2 : 0);
+}
+
+static void matrix_op(int op, int argc, const uint32_t *args) {
+	int slot = matrix_slot(matrix_mode);
+	if (op == GL_OP_LOAD_IDENTITY)
+		matrix_ops_num[slot] = 0;
+	if (matrix_ops_num[slot] < MAX_MATRIX_OPS) {
+		trace_matrix_op *m = &matrix_ops[slot][matrix_ops_num[slot]++];
+		m->op = op;
+		m->argc = argc;
+		memcpy(m->args, args, argc * 4);
+	}
+	if (active())
+		trace_record(op, argc, args, NULL, 0);
+}
+
+static void capture_start(void) {
+	static const GLenum client_arrays[] = {GL_VERTEX_ARRAY, GL_COLOR_ARRAY, GL_TEXTURE_COORD_ARRAY};
+	static const GLenum modes[] = {GL_MODELVIEW, GL_PROJECTION, GL_TEXTURE};
+	uint32_t arg;
+
+	trace_record(GL_OP_CAPTURE_START, 0, NULL, NULL, 0);
+	trace_record(GL_OP_BIND_TEXTURE, 1, &bound_texture, NULL, 0);
+	for (int i = 0; i < caps_num; i++)
+		trace_record(caps_enabled[i] ? GL_OP_ENABLE : GL_OP_DISABLE, 1, &caps[i], NULL, 0);
+	if (blend_known)
+		trace_record(GL_OP_BLEND_FUNC, 2, blend, NULL, 0);
+	for (int i = 0; i < 3; i++) {
+		arg = client_arrays[i];
+		trace_record(client_mask & (1 << i) ? GL_OP_ENABLE_CLIENT_STATE : GL_OP_DISABLE_CLIENT_STATE, 1, &arg, NULL, 0);
+	}
+	if (viewport_known)
+		trace_record(GL_OP_VIEWPORT, 4, viewport, NULL, 0);
+	if (scissor_known)
+		trace_record(GL_OP_SCISSOR, 4, scissor, NULL, 0);
+	if (clear_color_known)
+		trace_record(GL_OP_CLEAR_COLOR, 4, clear_color, NULL, 0);
+	for (int i = 0; i < 3; i++) {
+		arg = modes[i];
+		trace_record(GL_OP_MATRIX_MODE, 1, &arg, NULL, 0);
+		trace_record(GL_OP_LOAD_IDENTITY, 0, NULL, NULL, 0);
+		for (int j = 0; j < matrix_ops_num[i]; j++)
+			trace_record(matrix_ops[i][j].op, matrix_ops[i][j].argc, matrix_ops[i][j].args, NULL, 0);
+	}
+	arg = matrix_mode;
+	trace_record(GL_OP_MATRIX_MODE, 1, &arg, NULL, 0);
+
+	capturing = 1;
+	debugPrintf("gl_trace: capturing %d frames\n", CAPTURE_FRAMES);
+}
+
+void gl_trace_frame(void) {
+	if (trace_fd < 0)
+		return;
+
+	if (!capturing) {
+		SceCtrlData pad;
+		sceCtrlPeekBufferPositive(0, &pad, 1);
+		if ((pad.buttons & CAPTURE_BUTTONS) == CAPTURE_BUTTONS)
+			capture_start();
+		return;
+	}
+
+	trace_record(GL_OP_FRAME, 0, NULL, NULL, 0);
+	sceIoWrite(trace_fd, trace_buf, trace_len);
+	trace_len = 0;
+	if (--frames_left == 0) {
+		sceIoClose(trace_fd);
+		trace_fd = -1;
+		capturing = 0;
+		debugPrintf("gl_trace: capture done\n");
+	}
+}
+
+void glGenTextures_trace(GLsizei n, GLuint *textures) {
+	glGenTextures_atlas(n, textures);
+	if (trace_fd >= 0)
+		trace_record(GL_OP_GEN_TEXTURES, n, textures, NULL, 0);
+}
+
+void glDeleteTextures_trace(GLsizei n, const GLuint *textures) {
+	if (trace_fd >= 0)
+		trace_record(GL_OP_DELETE_TEXTURES, n, textures, NULL, 0);
+	for (int i = 0; i < n; i++) {
+		if (textures[i] == bound_texture)
+			bound_texture = 0;
+	}
+	glDeleteTextures_state(n, textures);
+}
+
+void glBindTexture_trace(GLenum target, GLuint texture) {
+	if (target == GL_TEXTURE_2D) {
+		bound_texture = texture;
+		if (active())
+			trace_record(GL_OP_BIND_TEXTURE, 1, &texture, NULL, 0);
+	}
+	glBindTexture_state(target, texture);
+}
+
+void glTexParameteri_trace(GLenum target, GLenum pname, GLint param) {
+	if (trace_fd >= 0 && target == GL_TEXTURE_2D) {
+		uint32_t args[] = { bound_texture, pname, param };
+		trace_record(GL_OP_TEX_PARAMETERI, 3, args, NULL, 0);
+	}
+	glTexParameteri_state(target, pname, param);
+}
+
+void glTexImage2D_trace(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data) {
+	if (trace_fd >= 0 && target == GL_TEXTURE_2D) {
+		uint32_t args[] = { bound_texture, level, internalFormat, width, height, format, type, data != NULL };
+		trace_record(GL_OP_TEX_IMAGE_2D, 8, args, data, data ? gl_trace_pixels_size(format, type, width, height) : 0);
+	}
+	glTexImage2D_atlas(target, level, internalFormat, width, height, border, format, type, data);
+}
+
+void glTexSubImage2D_trace(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels) {
+	if (trace_fd >= 0 && target == GL_TEXTURE_2D) {
+		uint32_t args[] = { bound_texture, level, xoffset, yoffset, width, height, format, type };
+		trace_record(GL_OP_TEX_SUB_IMAGE_2D, 8, args, pixels, gl_trace_pixels_size(format, type, width, height));
+	}
+	glTexSubImage2D_atlas(target, level, xoffset, yoffset, width, height, format, type, pixels);
+}
+
+static void set_cap(GLenum cap, int enabled) {
+	int i;
+	for (i = 0; i < caps_num && caps[i] != cap; i++);
+	if (i == MAX_CAPS)
+		return;
+	caps[i] = cap;
+	caps_enabled[i] = enabled;
+	if (i == caps_num)
+		caps_num++;
+}
+
+void glEnable_trace(GLenum cap) {
+	set_cap(cap, 1);
+	if (active())
+		trace_record(GL_OP_ENABLE, 1, &cap, NULL, 0);
+	glEnable_state(cap);
+}
+
+void glDisable_trace(GLenum cap) {
+	set_cap(cap, 0);
+	if (active())
+		trace_record(GL_OP_DISABLE, 1, &cap, NULL, 0);
+	glDisable_state(cap);
+}
+
+void glBlendFunc_trace(GLenum sfactor, GLenum dfactor) {
+	blend_known = 1;
+	blend[0] = sfactor;
+	blend[1] = dfactor;
+	if (active())
+		trace_record(GL_OP_BLEND_FUNC, 2, blend, NULL, 0);
+	glBlendFunc_state(sfactor, dfactor);
+}
+
+static int array_index(GLenum array) {
+	switch (array) {
+	case GL_VERTEX_ARRAY:
+		return 0;
+	case GL_COLOR_ARRAY:
+		return 1;
+	case GL_TEXTURE_COORD_ARRAY:
+		return 2;
+	default:
+		return -1;
+	}
+}
+
+void glEnableClientState_trace(GLenum array) {
+	int i = array_index(array);
+	if (i >= 0)
+		client_mask |= 1 << i;
+	if (active())
+		trace_record(GL_OP_ENABLE_CLIENT_STATE, 1, &array, NULL, 0);
+	glEnableClientState_state(array);
+}
+
+void glDisableClientState_trace(GLenum array) {
+	int i = array_index(array);
+	if (i >= 0)
+		client_mask &= ~(1 << i);
+	if (active())
+		trace_record(GL_OP_DISABLE_CLIENT_STATE, 1, &array, NULL, 0);
+	glDisableClientState_state(array);
+}
+
+void glMatrixMode_trace(GLenum mode) {
+	matrix_mode = mode;
+	if (active())
+		trace_record(GL_OP_MATRIX_MODE, 1, &mode, NULL, 0);
+	glMatrixMode_state(mode);
+}
+
+void glLoadIdentity_trace(void) {
+	matrix_op(GL_OP_LOAD_IDENTITY, 0, NULL);
+	glLoadIdentity_batch();
+}
+
+void glScalef_trace(GLfloat x, GLfloat y, GLfloat z) {
+	uint32_t args[] = { fbits(x), fbits(y), fbits(z) };
+	matrix_op(GL_OP_SCALEF, 3, args);
+	glScalef_batch(x, y, z);
+}
+
+void glOrthof_trace(GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat nearVal, GLfloat farVal) {
+	uint32_t args[] = { fbits(left), fbits(right), fbits(bottom), fbits(top), fbits(nearVal), fbits(farVal) };
+	matrix_op(GL_OP_ORTHOF, 6, args);
+	glOrthof_batch(left, right, bottom, top, nearVal, farVal);
+}
+
+void glViewport_trace(GLint x, GLint y, GLsizei width, GLsizei height) {
+	viewport_known = 1;
+	viewport[0] = x;
+	viewport[1] = y;
+	viewport[2] = width;
+	viewport[3] = height;
+	if (active())
+		trace_record(GL_OP_VIEWPORT, 4, viewport, NULL, 0);
+	glViewport_state(x, y, width, height);
+}
+
+void glScissor_trace(GLint x, GLint y, GLsizei width, GLsizei height) {
+	scissor_known = 1;
+	scissor[0] = x;
+	scissor[1] = y;
+	scissor[2] = width;
+	scissor[3] = height;
+	if (active())
+		trace_record(GL_OP_SCISSOR, 4, scissor, NULL, 0);
+	glScissor_state(x, y, width, height);
+}
+
+void glClear_trace(GLbitfield mask) {
+	if (active())
+		trace_record(GL_OP_CLEAR, 1, &mask, NULL, 0);
+	glClear_batch(mask);
+}
+
+void glClearColor_trace(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+	clear_color_known = 1;
+	clear_color[0] = fbits(red);
+	clear_color[1] = fbits(green);
+	clear_color[2] = fbits(blue);
+	clear_color[3] = fbits(alpha);
+	if (active())
+		trace_record(GL_OP_CLEAR_COLOR, 4, clear_color, NULL, 0);
+	glClearColor(red, green, blue, alpha);
+}
+
+static void set_array(int i, GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	arrays[i].size = size;
+	arrays[i].type = type;
+	arrays[i].stride = stride;
+	arrays[i].ptr = (const uint8_t *)pointer;
+}
+
+void glVertexPointer_trace(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	set_array(0, size, type, stride, pointer);
+	glVertexPointer_batch(size, type, stride, pointer);
+}
+
+void glColorPointer_trace(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	set_array(1, size, type, stride, pointer);
+	glColorPointer_batch(size, type, stride, pointer);
+}
+
+void glTexCoordPointer_trace(GLint size, GLenum type, GLsizei stride, const void *pointer) {
+	set_array(2, size, type, stride, pointer);
+	glTexCoordPointer_batch(size, type, stride, pointer);
+}
+
+void glDrawElements_trace(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+	if (active() && count > 0 && (type == GL_UNSIGNED_SHORT || type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_INT)) {
+		uint32_t lo = 0xFFFFFFFF, hi = 0;
+		for (int i = 0; i < count; i++) {
+			uint32_t idx;
+			if (type == GL_UNSIGNED_INT)
+				idx = ((const uint32_t *)indices)[i];
+			else
+				idx = type == GL_UNSIGNED_SHORT ? ((const uint16_t *)indices)[i] : ((const uint8_t *)indices)[i];
+			if (idx < lo) lo = idx;
+			if (idx > hi) hi = idx;
+		}
+		uint32_t verts = hi - lo + 1;
+
+		uint32_t args[11] = { mode, count, type, lo, verts };
+		uint32_t size = count * gl_trace_type_size(type);
+		size = (size + 3) & ~3;
+		for (int i = 0; i < 3; i++) {
+			if ((client_mask & (1 << i)) && arrays[i].ptr) {
+				args[5 + i * 2] = arrays[i].size;
+				args[6 + i * 2] = arrays[i].type;
+				size += (verts * arrays[i].size * gl_trace_type_size(arrays[i].type) + 3) & ~3;
+			}
+		}
+
+		gl_trace_record r = { GL_OP_DRAW_ELEMENTS, 11, size };
+		trace_write(&r, sizeof(r));
+		trace_write(args, sizeof(args));
+		trace_write(indices, count * gl_trace_type_size(type));
+		trace_pad(count * gl_trace_type_size(type));
+		for (int i = 0; i < 3; i++) {
+			if (!args[5 + i * 2])
+				continue;
+			uint32_t elem = arrays[i].size * gl_trace_type_size(arrays[i].type);
+			uint32_t stride = arrays[i].stride ? arrays[i].stride : elem;
+			const uint8_t *src = arrays[i].ptr + lo * stride;
+			for (uint32_t v = 0; v < verts; v++, src += stride)
+				trace_write(src, elem);
+			trace_pad(verts * elem);
+		}
+	}
+	glDrawElements_batch(mode, count, type, indices);
+}
+
+void gl_trace_init(void) {
+	trace_fd = sceIoOpen(DATA_PATH "/gl_trace.bin", SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (trace_fd < 0)
+		return;
+	gl_trace_header hdr = { GL_TRACE_MAGIC, GL_TRACE_VERSION };
+	sceIoWrite(trace_fd, &hdr, sizeof(hdr));
+}
+
+#endif
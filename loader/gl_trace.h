@@ -0,0 +1,168 @@
+#ifndef __GL_TRACE_H__
+#define __GL_TRACE_H__
+
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * Trace file layout (little endian):
+ *   gl_trace_header, followed by a stream of gl_trace_record. Every record
+ *   is followed by argc 32 bit arguments (floats stored as their bits) and
+ *   size bytes of payload, padded to a multiple of 4.
+ *
+ *   Texture operations are recorded from boot so that a replay knows every
+ *   texture used by the captured frames, they carry the texture name as first
+ *   argument instead of relying on the binding. Everything else is recorded
+ *   only from GL_OP_CAPTURE_START, which is followed by a snapshot of the
+ *   current state, until the last GL_OP_FRAME.
+ *
+ *   Client array pointers aren't recorded as such: GL_OP_DRAW_ELEMENTS carries
+ *   the indices followed by the vertex range they reference of every enabled
+ *   array, tightly packed.
+ */
+
+#define GL_TRACE_MAGIC 0x52544C47 // "GLTR"
+#define GL_TRACE_VERSION 1
+
+enum {
+	GL_OP_FRAME = 0,
+	GL_OP_CAPTURE_START,
+	GL_OP_GEN_TEXTURES,          // name...
+	GL_OP_DELETE_TEXTURES,       // name...
+	GL_OP_TEX_PARAMETERI,        // name, pname, param
+	GL_OP_TEX_IMAGE_2D,          // name, level, internalformat, width, height, format, type, has_data | data
+	GL_OP_TEX_SUB_IMAGE_2D,      // name, level, x, y, width, height, format, type | data
+	GL_OP_BIND_TEXTURE,          // name
+	GL_OP_ENABLE,                // cap
+	GL_OP_DISABLE,               // cap
+	GL_OP_BLEND_FUNC,            // sfactor, dfactor
+	GL_OP_ENABLE_CLIENT_STATE,   // array
+	GL_OP_DISABLE_CLIENT_STATE,  // array
+	GL_OP_MATRIX_MODE,           // mode
+	GL_OP_LOAD_IDENTITY,
+	GL_OP_SCALEF,                // x, y, z
+	GL_OP_ORTHOF,                // left, right, bottom, top, near, far
+	GL_OP_VIEWPORT,              // x, y, width, height
+	GL_OP_SCISSOR,               // x, y, width, height
+	GL_OP_CLEAR,                 // mask
+	GL_OP_CLEAR_COLOR,           // r, g, b, a
+	GL_OP_DRAW_ELEMENTS,         // mode, count, type, first, verts, vertex size/type, color size/type, texcoord size/type | data
+	GL_OP_NUM
+};
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint32_t version;
+} gl_trace_header;
+
+typedef struct __attribute__((packed)) {
+	uint16_t op;
+	uint16_t argc;
+	uint32_t size;
+} gl_trace_record;
+
+// Size in bytes of a glTexImage2D/glTexSubImage2D payload with the default unpack alignment of 4
+static inline uint32_t gl_trace_pixels_size(uint32_t format, uint32_t type, uint32_t width, uint32_t height) {
+	uint32_t bpp;
+	switch (type) {
+	case 0x8033: // GL_UNSIGNED_SHORT_4_4_4_4
+	case 0x8034: // GL_UNSIGNED_SHORT_5_5_5_1
+	case 0x8363: // GL_UNSIGNED_SHORT_5_6_5
+		bpp = 2;
+		break;
+	default:
+		switch (format) {
+		case 0x1908: // GL_RGBA
+			bpp = 4;
+			break;
+		case 0x1907: // GL_RGB
+			bpp = 3;
+			break;
+		case 0x190A: // GL_LUMINANCE_ALPHA
+			bpp = 2;
+			break;
+		default:
+			bpp = 1;
+			break;
+		}
+		break;
+	}
+	return ((width * bpp + 3) & ~3) * height;
+}
+
+static inline uint32_t gl_trace_type_size(uint32_t type) {
+	switch (type) {
+	case 0x1400: // GL_BYTE
+	case 0x1401: // GL_UNSIGNED_BYTE
+		return 1;
+	case 0x1402: // GL_SHORT
+	case 0x1403: // GL_UNSIGNED_SHORT
+		return 2;
+	default:
+		return 4;
+	}
+}
+
+#ifdef __vita__
+#include "gl_batch.h"
+#include "gl_state.h"
+#include "gl_atlas.h"
+
+#ifdef GL_TRACE
+
+void gl_trace_init(void);
+void gl_trace_frame(void);
+
+void glGenTextures_trace(GLsizei n, GLuint *textures);
+void glDeleteTextures_trace(GLsizei n, const GLuint *textures);
+void glBindTexture_trace(GLenum target, GLuint texture);
+void glTexParameteri_trace(GLenum target, GLenum pname, GLint param);
+void glTexImage2D_trace(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data);
+void glTexSubImage2D_trace(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels);
+void glEnable_trace(GLenum cap);
+void glDisable_trace(GLenum cap);
+void glBlendFunc_trace(GLenum sfactor, GLenum dfactor);
+void glEnableClientState_trace(GLenum array);
+void glDisableClientState_trace(GLenum array);
+void glMatrixMode_trace(GLenum mode);
+void glLoadIdentity_trace(void);
+void glScalef_trace(GLfloat x, GLfloat y, GLfloat z);
+void glOrthof_trace(GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat nearVal, GLfloat farVal);
+void glViewport_trace(GLint x, GLint y, GLsizei width, GLsizei height);
+void glScissor_trace(GLint x, GLint y, GLsizei width, GLsizei height);
+void glClear_trace(GLbitfield mask);
+void glClearColor_trace(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void glVertexPointer_trace(GLint size, GLenum type, GLsizei stride, const void *pointer);
+void glColorPointer_trace(GLint size, GLenum type, GLsizei stride, const void *pointer);
+void glTexCoordPointer_trace(GLint size, GLenum type, GLsizei stride, const void *pointer);
+void glDrawElements_trace(GLenum mode, GLsizei count, GLenum type, const void *indices);
+#else
+#define gl_trace_init()
+#define gl_trace_frame()
+#define glGenTextures_trace glGenTextures_atlas
+#define glDeleteTextures_trace glDeleteTextures_state
+#define glBindTexture_trace glBindTexture_state
+#define glTexParameteri_trace glTexParameteri_state
+#define glTexImage2D_trace glTexImage2D_atlas
+#define glTexSubImage2D_trace glTexSubImage2D_atlas
+#define glEnable_trace glEnable_state
+#define glDisable_trace glDisable_state
+#define glBlendFunc_trace glBlendFunc_state
+#define glEnableClientState_trace glEnableClientState_state
+#define glDisableClientState_trace glDisableClientState_state
+#define glMatrixMode_trace glMatrixMode_state
+#define glLoadIdentity_trace glLoadIdentity_batch
+#define glScalef_trace glScalef_batch
+#define glOrthof_trace glOrthof_batch
+#define glViewport_trace glViewport_state
+#define glScissor_trace glScissor_state
+#define glClear_trace glClear_batch
+#define glClearColor_trace glClearColor
+#define glVertexPointer_trace glVertexPointer_batch
+#define glColorPointer_trace glColorPointer_batch
+#define glTexCoordPointer_trace glTexCoordPointer_batch
+#define glDrawElements_trace glDrawElements_batch
+#endif
+#endif
+
+#endif
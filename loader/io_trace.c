@@ -0,0 +1,187 @@
+/* io_trace.c -- recorder for the file operations performed by the game
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "io_trace.h"
+
+#ifdef IO_TRACE
+
+#define TRACE_BUF_SIZE (64 * 1024)
+#define TRACE_FLUSH_US (1000 * 1000)
+#define MAX_PATHS 4096
+#define MAX_FILES 256
+
+typedef struct {
+	uint32_t hash;
+	uint16_t id;
+	char *path;
+} trace_path;
+
+typedef struct {
+	FILE *f;
+	uint16_t path_id;
+} trace_file;
+
+static SceUID trace_fd = -1, trace_mtx;
+static uint8_t trace_buf[TRACE_BUF_SIZE];
+static size_t trace_len = 0;
+static uint64_t trace_last_flush = 0;
+
+static trace_path paths[MAX_PATHS];
+static uint16_t num_paths = 0;
+static trace_file files[MAX_FILES];
+
+static uint32_t path_hash(const char *path) {
+	uint32_t h = 2166136261u;
+	while (*path)
+		h = (h ^ (uint8_t)*path++) * 16777619u;
+	return h ? h : 1;
+}
+
+static void trace_write(const void *data, size_t size) {
+	if (trace_len + size > TRACE_BUF_SIZE) {
+		sceIoWrite(trace_fd, trace_buf, trace_len);
+		trace_len = 0;
+	}
+	memcpy(&trace_buf[trace_len], data, size);
+	trace_len += size;
+}
+
+static uint16_t trace_path_id(const char *path, uint64_t now) {
+	uint32_t h = path_hash(path);
+	uint32_t slot = h % MAX_PATHS;
+	while (paths[slot].hash) {
+		if (paths[slot].hash == h && !strcmp(paths[slot].path, path))
+			return paths[slot].id;
+		slot = (slot + 1) % MAX_PATHS;
+	}
+	if (num_paths == MAX_PATHS - 1)
+		return 0xFFFF;
+	char *copy = strdup(path);
+	if (!copy)
+		return 0xFFFF;
+
+	paths[slot].hash = h;
+	paths[slot].path = copy;
+	paths[slot].id = num_paths++;
+
+	io_trace_record r = {0};
+	r.timestamp = now;
+	r.path_id = paths[slot].id;
+	r.op = IO_OP_PATH;
+	r.size = strlen(path);
+	trace_write(&r, sizeof(r));
+	trace_write(path, r.size);
+	return paths[slot].id;
+}
+
+static trace_file *trace_file_slot(FILE *f, int create) {
+	uint32_t slot = ((uintptr_t)f >> 4) % MAX_FILES;
+	for (int i = 0; i < MAX_FILES; i++) {
+		trace_file *t = &files[(slot + i) % MAX_FILES];
+		if (t->f == f)
+			return t;
+		if (create && !t->f) {
+			t->f = f;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+void io_trace(int op, const char *path, FILE *f, uint32_t offset, uint32_t size, int flags) {
+	if (trace_fd < 0)
+		return;
+
+	io_trace_record r;
+	r.timestamp = sceKernelGetProcessTimeWide();
+	r.thread = sceKernelGetThreadId();
+	r.op = op;
+	r.flags = flags;
+	r.offset = offset;
+	r.size = size;
+
+	sceKernelLockMutex(trace_mtx, 1, NULL);
+	if (path) {
+		r.path_id = trace_path_id(path, r.timestamp);
+		if (f) {
+			trace_file *t = trace_file_slot(f, 1);
+			if (t)
+				t->path_id = r.path_id;
+		}
+	} else {
+		trace_file *t = trace_file_slot(f, 0);
+		if (!t) {
+			sceKernelUnlockMutex(trace_mtx, 1);
+			return;
+		}
+		r.path_id = t->path_id;
+		if (op == IO_OP_FCLOSE)
+			t->f = NULL;
+	}
+	trace_write(&r, sizeof(r));
+
+	if (r.timestamp - trace_last_flush > TRACE_FLUSH_US) {
+		sceIoWrite(trace_fd, trace_buf, trace_len);
+		trace_len = 0;
+		trace_last_flush = r.timestamp;
+	}
+	sceKernelUnlockMutex(trace_mtx, 1);
+}
+
+size_t fread_trace(void *ptr, size_t size, size_t nmemb, FILE *f) {
+	long offset = ftell(f);
+	size_t res = fread(ptr, size, nmemb, f);
+	io_trace(IO_OP_FREAD, NULL, f, offset, res * size, 0);
+	return res;
+}
+
+int fseek_trace(FILE *f, long offset, int whence) {
+	int res = fseek(f, offset, whence);
+	io_trace(IO_OP_FSEEK, NULL, f, ftell(f), 0, res ? IO_FLAG_FAILED : 0);
+	return res;
+}
+
+int fseeko_trace(FILE *f, off_t offset, int whence) {
+	int res = fseeko(f, offset, whence);
+	io_trace(IO_OP_FSEEK, NULL, f, ftello(f), 0, res ? IO_FLAG_FAILED : 0);
+	return res;
+}
+
+int fclose_trace(FILE *f) {
+	io_trace(IO_OP_FCLOSE, NULL, f, 0, 0, 0);
+	return fclose(f);
+}
+
+void io_trace_flush(void) {
+	if (trace_fd < 0)
+		return;
+	sceKernelLockMutex(trace_mtx, 1, NULL);
+	sceIoWrite(trace_fd, trace_buf, trace_len);
+	trace_len = 0;
+	sceKernelUnlockMutex(trace_mtx, 1);
+}
+
+void io_trace_init(void) {
+	trace_mtx = sceKernelCreateMutex("io_trace mutex", 0, 0, NULL);
+	trace_fd = sceIoOpen(DATA_PATH "/io_trace.bin", SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (trace_fd < 0)
+		return;
+	io_trace_header hdr = { IO_TRACE_MAGIC, IO_TRACE_VERSION };
+	sceIoWrite(trace_fd, &hdr, sizeof(hdr));
+	atexit(io_trace_flush);
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __IO_TRACE_H__
+#define __IO_TRACE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * Trace file layout (little endian):
+ *   io_trace_header, followed by a stream of io_trace_record.
+ *   IO_OP_PATH records introduce a path: path_id is the new id and size
+ *   is the length of the path string that immediately follows the record.
+ *   Every other record refers to a previously introduced path_id.
+ */
+
+#define IO_TRACE_MAGIC 0x52544F49 // "IOTR"
+#define IO_TRACE_VERSION 1
+
+enum {
+	IO_OP_PATH = 0,
+	IO_OP_FOPEN,
+	IO_OP_FREAD,
+	IO_OP_FSEEK,
+	IO_OP_FCLOSE,
+	IO_OP_RWOPEN,
+	IO_OP_IMG_LOAD,
+	IO_OP_MUS_LOAD,
+	IO_OP_OPENDIR,
+	IO_OP_STAT,
+};
+
+#define IO_FLAG_FAILED 0x01
+#define IO_FLAG_WRITE  0x02
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint32_t version;
+} io_trace_header;
+
+typedef struct __attribute__((packed)) {
+	uint64_t timestamp; // microseconds since process start
+	uint32_t thread;
+	uint16_t path_id;
+	uint8_t op;
+	uint8_t flags;
+	uint32_t offset;
+	uint32_t size;
+} io_trace_record;
+
+#ifdef IO_TRACE
+void io_trace_init(void);
+void io_trace_flush(void);
+void io_trace(int op, const char *path, FILE *f, uint32_t offset, uint32_t size, int flags);
+
+size_t fread_trace(void *ptr, size_t size, size_t nmemb, FILE *f);
+int fseek_trace(FILE *f, long offset, int whence);
+int fseeko_trace(FILE *f, off_t offset, int whence);
+int fclose_trace(FILE *f);
+#else
+#define io_trace_init()
+#define io_trace(...)
+#define fread_trace fread
+#define fseek_trace fseek
+#define fseeko_trace fseeko
+#define fclose_trace fclose
+#endif
+
+#endif
@@ -0,0 +1,693 @@
+/* jni_env.c -- the fake JNIEnv and JavaVM handed to the game
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Both function tables are generated in full from the JNI 1.6 layout below,
+ * so no slot is ever left pointing at garbage. Slots the loader has no
+ * answer for go to a stub that counts the call and returns zero.
+ *
+ * Java methods and fields the game looks up are declared once, in
+ * JNI_METHODS and JNI_FIELDS, with what they return. GetMethodID and
+ * friends hash the name into an open addressed registry, so lookups are
+ * constant time and silent. Names that aren't declared get an entry of
+ * their own the first time they're asked for, which counts further
+ * lookups. Every Call<Type>Method flavour dispatches on the method ID and
+ * converts the declared return type to the one asked for.
+ *
+ * With JNI_REPORT whatever went unanswered is written to DATA_PATH/jni.txt.
+ */
+
+#include <vitasdk.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#include "jni_env.h"
+
+#define REPORT_INTERVAL_US (10 * 1000000)
+#define REGISTRY_SIZE 128 // Power of two, declared names plus the unknown ones the game asks for
+
+#define JNI_VERSION_1_6 0x00010006
+#define JNI_OK 0
+
+typedef union {
+	uint8_t z;
+	int8_t b;
+	uint16_t c;
+	int16_t s;
+	int32_t i;
+	int64_t j;
+	float f;
+	double d;
+	void *l;
+} jni_value;
+
+// Arguments of a call, from a va_list or from the jvalue array of the A flavours
+typedef struct {
+	const jni_value *array;
+	va_list list;
+} jni_args;
+
+typedef jni_value (*jni_method)(void *obj, jni_args *args);
+typedef jni_value (*jni_field)(void *obj);
+
+typedef struct {
+	const char *name;
+	char type; // as in a JNI signature, 'L' for any object
+	jni_method handler; // NULL returns zero
+} method_info;
+
+typedef struct {
+	const char *name;
+	char type;
+	jni_field getter; // NULL reads zero
+} field_info;
+
+typedef struct {
+	jni_value v;
+	char type;
+} jni_result;
+
+typedef struct {
+	volatile uint32_t hash; // 0 while free, set last
+	const char *name;
+	int id;
+	volatile uint32_t lookups; // only counted for names that have no ID
+} registry_entry;
+
+typedef struct {
+	registry_entry entries[REGISTRY_SIZE];
+	volatile int lock; // only taken to add an unknown name
+	volatile uint32_t overflow;
+} registry;
+
+static jni_value get_screen_width_dpi(void *obj, jni_args *args) {
+	jni_value v = { .j = 200 };
+	return v;
+}
+
+// ID, name, return type, handler
+#define JNI_METHODS(X) \
+	X(INIT, "<init>", 'V', NULL) \
+	X(GET_SCREEN_WIDTH_DPI, "getScreenWidthDPI", 'J', get_screen_width_dpi)
+
+// ID, name, type, getter
+#define JNI_FIELDS(X)
+
+enum {
+	METHOD_UNKNOWN,
+#define METHOD_ID(id, name, type, handler) id,
+	JNI_METHODS(METHOD_ID)
+	METHODS_NUM
+};
+
+enum {
+	FIELD_UNKNOWN,
+#define FIELD_ID(id, name, type, getter) id,
+	JNI_FIELDS(FIELD_ID)
+	FIELDS_NUM
+};
+
+static const method_info methods[] = {
+	{ NULL, 'V', NULL },
+#define METHOD_INFO(id, name, type, handler) { name, type, handler },
+	JNI_METHODS(METHOD_INFO)
+};
+
+static const field_info fields[] = {
+	{ NULL, 'V', NULL },
+#define FIELD_INFO(id, name, type, getter) { name, type, getter },
+	JNI_FIELDS(FIELD_INFO)
+};
+
+// The JNINativeInterface layout, one entry per pointer sized slot
+#define JNI_CALL_SLOTS(X, Kind) \
+	X(Kind##ObjectMethod) X(Kind##ObjectMethodV) X(Kind##ObjectMethodA) \
+	X(Kind##BooleanMethod) X(Kind##BooleanMethodV) X(Kind##BooleanMethodA) \
+	X(Kind##ByteMethod) X(Kind##ByteMethodV) X(Kind##ByteMethodA) \
+	X(Kind##CharMethod) X(Kind##CharMethodV) X(Kind##CharMethodA) \
+	X(Kind##ShortMethod) X(Kind##ShortMethodV) X(Kind##ShortMethodA) \
+	X(Kind##IntMethod) X(Kind##IntMethodV) X(Kind##IntMethodA) \
+	X(Kind##LongMethod) X(Kind##LongMethodV) X(Kind##LongMethodA) \
+	X(Kind##FloatMethod) X(Kind##FloatMethodV) X(Kind##FloatMethodA) \
+	X(Kind##DoubleMethod) X(Kind##DoubleMethodV) X(Kind##DoubleMethodA) \
+	X(Kind##VoidMethod) X(Kind##VoidMethodV) X(Kind##VoidMethodA)
+
+#define JNI_FIELD_SLOTS(X, Kind) \
+	X(Kind##ObjectField) X(Kind##BooleanField) X(Kind##ByteField) X(Kind##CharField) X(Kind##ShortField) \
+	X(Kind##IntField) X(Kind##LongField) X(Kind##FloatField) X(Kind##DoubleField)
+
+#define JNI_ARRAY_SLOTS(X, Kind, Suffix) \
+	X(Kind##Boolean##Suffix) X(Kind##Byte##Suffix) X(Kind##Char##Suffix) X(Kind##Short##Suffix) \
+	X(Kind##Int##Suffix) X(Kind##Long##Suffix) X(Kind##Float##Suffix) X(Kind##Double##Suffix)
+
+#define JNI_FUNCTIONS(X) \
+	X(reserved0) X(reserved1) X(reserved2) X(reserved3) \
+	X(GetVersion) X(DefineClass) X(FindClass) X(FromReflectedMethod) X(FromReflectedField) \
+	X(ToReflectedMethod) X(GetSuperclass) X(IsAssignableFrom) X(ToReflectedField) X(Throw) \
+	X(ThrowNew) X(ExceptionOccurred) X(ExceptionDescribe) X(ExceptionClear) X(FatalError) \
+	X(PushLocalFrame) X(PopLocalFrame) X(NewGlobalRef) X(DeleteGlobalRef) X(DeleteLocalRef) \
+	X(IsSameObject) X(NewLocalRef) X(EnsureLocalCapacity) X(AllocObject) X(NewObject) \
+	X(NewObjectV) X(NewObjectA) X(GetObjectClass) X(IsInstanceOf) X(GetMethodID) \
+	JNI_CALL_SLOTS(X, Call) JNI_CALL_SLOTS(X, CallNonvirtual) \
+	X(GetFieldID) JNI_FIELD_SLOTS(X, Get) JNI_FIELD_SLOTS(X, Set) \
+	X(GetStaticMethodID) JNI_CALL_SLOTS(X, CallStatic) \
+	X(GetStaticFieldID) JNI_FIELD_SLOTS(X, GetStatic) JNI_FIELD_SLOTS(X, SetStatic) \
+	X(NewString) X(GetStringLength) X(GetStringChars) X(ReleaseStringChars) \
+	X(NewStringUTF) X(GetStringUTFLength) X(GetStringUTFChars) X(ReleaseStringUTFChars) \
+	X(GetArrayLength) X(NewObjectArray) X(GetObjectArrayElement) X(SetObjectArrayElement) \
+	JNI_ARRAY_SLOTS(X, New, Array) JNI_ARRAY_SLOTS(X, Get, ArrayElements) \
+	JNI_ARRAY_SLOTS(X, Release, ArrayElements) JNI_ARRAY_SLOTS(X, Get, ArrayRegion) \
+	JNI_ARRAY_SLOTS(X, Set, ArrayRegion) \
+	X(RegisterNatives) X(UnregisterNatives) X(MonitorEnter) X(MonitorExit) X(GetJavaVM) \
+	X(GetStringRegion) X(GetStringUTFRegion) X(GetPrimitiveArrayCritical) \
+	X(ReleasePrimitiveArrayCritical) X(GetStringCritical) X(ReleaseStringCritical) \
+	X(NewWeakGlobalRef) X(DeleteWeakGlobalRef) X(ExceptionCheck) X(NewDirectByteBuffer) \
+	X(GetDirectBufferAddress) X(GetDirectBufferCapacity) X(GetObjectRefType)
+
+// The JNIInvokeInterface layout
+#define JNI_VM_FUNCTIONS(X) \
+	X(vm_reserved0) X(vm_reserved1) X(vm_reserved2) X(DestroyJavaVM) \
+	X(AttachCurrentThread) X(DetachCurrentThread) X(GetEnv) X(AttachCurrentThreadAsDaemon)
+
+enum {
+#define SLOT(name) SLOT_##name,
+	JNI_FUNCTIONS(SLOT)
+	JNI_SLOTS
+};
+
+enum {
+	JNI_VM_FUNCTIONS(SLOT)
+	VM_SLOTS
+};
+
+_Static_assert(JNI_SLOTS == 233, "JNINativeInterface has 233 slots");
+_Static_assert(SLOT_GetStringUTFRegion * 4 == 0x374, "JNINativeInterface layout is off");
+
+#ifdef JNI_REPORT
+static int report_enabled = 1;
+#else
+static int report_enabled = 0;
+#endif
+
+static uintptr_t env_functions[JNI_SLOTS], vm_functions[VM_SLOTS];
+static uintptr_t *env = env_functions, *vm = vm_functions;
+
+static registry method_ids, field_ids;
+static volatile uint32_t unexpected[JNI_SLOTS];
+static volatile uint32_t unknown_calls = 0, unknown_reads = 0;
+static volatile int report_dirty = 0;
+static uint64_t last_report = 0;
+
+static const char *slot_names[JNI_SLOTS] = {
+#define SLOT_NAME(name) #name,
+	JNI_FUNCTIONS(SLOT_NAME)
+};
+
+static void count(volatile uint32_t *counter) {
+	__sync_fetch_and_add(counter, 1);
+	report_dirty = 1;
+}
+
+#define STUB(name) \
+	static uintptr_t stub_##name(void) { \
+		count(&unexpected[SLOT_##name]); \
+		return 0; \
+	}
+JNI_FUNCTIONS(STUB)
+
+static const uintptr_t stubs[JNI_SLOTS] = {
+#define STUB_ENTRY(name) (uintptr_t)&stub_##name,
+	JNI_FUNCTIONS(STUB_ENTRY)
+};
+
+static uint32_t hash_name(const char *s) {
+	uint32_t h = 2166136261u;
+	while (*s)
+		h = (h ^ (uint8_t)*s++) * 16777619u;
+	return h ? h : 1;
+}
+
+// The entry holding name, or the free one it would go to, NULL when full
+static registry_entry *registry_probe(registry *r, const char *name, uint32_t h) {
+	for (uint32_t i = 0; i < REGISTRY_SIZE; i++) {
+		registry_entry *e = &r->entries[(h + i) & (REGISTRY_SIZE - 1)];
+		uint32_t eh = __atomic_load_n(&e->hash, __ATOMIC_ACQUIRE);
+		if (!eh || (eh == h && !strcmp(e->name, name)))
+			return e;
+	}
+	return NULL;
+}
+
+static void registry_add(registry *r, const char *name, int id) {
+	uint32_t h = hash_name(name);
+	registry_entry *e = registry_probe(r, name, h);
+	if (!e || e->hash) // Full, or already there
+		return;
+	e->name = name;
+	e->id = id;
+	e->lookups = 0;
+	__atomic_store_n(&e->hash, h, __ATOMIC_RELEASE);
+}
+
+static int registry_lookup(registry *r, const char *name) {
+	uint32_t h = hash_name(name);
+	registry_entry *e = registry_probe(r, name, h);
+	if (e && e->hash) {
+		if (e->id)
+			return e->id;
+		count(&e->lookups);
+		return 0;
+	}
+
+	// First time the game asks for this name, remember it to count the next ones
+	while (__sync_lock_test_and_set(&r->lock, 1))
+		;
+	e = registry_probe(r, name, h);
+	if (!e)
+		count(&r->overflow);
+	else if (e->hash)
+		count(&e->lookups);
+	else {
+		e->name = strdup(name);
+		e->id = 0;
+		e->lookups = 1;
+		__atomic_store_n(&e->hash, h, __ATOMIC_RELEASE);
+		report_dirty = 1;
+	}
+	__sync_lock_release(&r->lock);
+	return 0;
+}
+
+// Readers for the handlers, types as in the method's signature
+static inline int32_t arg_int(jni_args *a) {
+	return a->array ? (a->array++)->i : va_arg(a->list, int32_t);
+}
+
+static inline int64_t arg_long(jni_args *a) {
+	return a->array ? (a->array++)->j : va_arg(a->list, int64_t);
+}
+
+static inline float arg_float(jni_args *a) {
+	return a->array ? (a->array++)->f : (float)va_arg(a->list, double);
+}
+
+static inline double arg_double(jni_args *a) {
+	return a->array ? (a->array++)->d : va_arg(a->list, double);
+}
+
+static inline void *arg_object(jni_args *a) {
+	return a->array ? (a->array++)->l : va_arg(a->list, void *);
+}
+
+static jni_result call(int id, void *obj, jni_args *args) {
+	jni_result r = { { .j = 0 }, 'V' };
+	if (id <= METHOD_UNKNOWN || id >= METHODS_NUM) {
+		count(&unknown_calls);
+		return r;
+	}
+	r.type = methods[id].type;
+	if (methods[id].handler)
+		r.v = methods[id].handler(obj, args);
+	return r;
+}
+
+static jni_result call_list(int id, void *obj, va_list list) {
+	jni_args a = { NULL };
+	va_copy(a.list, list);
+	jni_result r = call(id, obj, &a);
+	va_end(a.list);
+	return r;
+}
+
+static jni_result call_array(int id, void *obj, const jni_value *array) {
+	jni_args a = { array };
+	return call(id, obj, &a);
+}
+
+static jni_result read_field(int id, void *obj) {
+	jni_result r = { { .j = 0 }, 'V' };
+	if (id <= FIELD_UNKNOWN || id >= FIELDS_NUM) {
+		count(&unknown_reads);
+		return r;
+	}
+	r.type = fields[id].type;
+	if (fields[id].getter)
+		r.v = fields[id].getter(obj);
+	return r;
+}
+
+static int64_t as_long(jni_result r) {
+	switch (r.type) {
+	case 'Z': return r.v.z;
+	case 'B': return r.v.b;
+	case 'C': return r.v.c;
+	case 'S': return r.v.s;
+	case 'I': return r.v.i;
+	case 'J': return r.v.j;
+	case 'F': return r.v.f;
+	case 'D': return r.v.d;
+	default: return 0;
+	}
+}
+
+static double as_double(jni_result r) {
+	if (r.type == 'F')
+		return r.v.f;
+	return r.type == 'D' ? r.v.d : as_long(r);
+}
+
+static inline void *as_Object(jni_result r) { return r.type == 'L' ? r.v.l : NULL; }
+static inline uint8_t as_Boolean(jni_result r) { return as_long(r) != 0; }
+static inline int8_t as_Byte(jni_result r) { return as_long(r); }
+static inline uint16_t as_Char(jni_result r) { return as_long(r); }
+static inline int16_t as_Short(jni_result r) { return as_long(r); }
+static inline int32_t as_Int(jni_result r) { return as_long(r); }
+// The old fake env answered -1 to every CallLongMethod, games may still test for it on methods it doesn't know
+static inline int64_t as_Long(jni_result r) { return r.type == 'V' ? -1 : as_long(r); }
+static inline float as_Float(jni_result r) { return as_double(r); }
+static inline double as_Double(jni_result r) { return as_double(r); }
+
+#define JNI_TYPES(X) \
+	X(Object, void *) X(Boolean, uint8_t) X(Byte, int8_t) X(Char, uint16_t) X(Short, int16_t) \
+	X(Int, int32_t) X(Long, int64_t) X(Float, float) X(Double, double)
+
+#define CALLS(Type, type) \
+	static type Call##Type##Method(void *env, void *obj, int id, ...) { \
+		va_list list; \
+		va_start(list, id); \
+		type res = as_##Type(call_list(id, obj, list)); \
+		va_end(list); \
+		return res; \
+	} \
+	static type Call##Type##MethodV(void *env, void *obj, int id, va_list list) { \
+		return as_##Type(call_list(id, obj, list)); \
+	} \
+	static type Call##Type##MethodA(void *env, void *obj, int id, const jni_value *array) { \
+		return as_##Type(call_array(id, obj, array)); \
+	} \
+	static type CallNonvirtual##Type##Method(void *env, void *obj, void *clazz, int id, ...) { \
+		va_list list; \
+		va_start(list, id); \
+		type res = as_##Type(call_list(id, obj, list)); \
+		va_end(list); \
+		return res; \
+	} \
+	static type CallNonvirtual##Type##MethodV(void *env, void *obj, void *clazz, int id, va_list list) { \
+		return as_##Type(call_list(id, obj, list)); \
+	} \
+	static type CallNonvirtual##Type##MethodA(void *env, void *obj, void *clazz, int id, const jni_value *array) { \
+		return as_##Type(call_array(id, obj, array)); \
+	} \
+	static type CallStatic##Type##Method(void *env, void *clazz, int id, ...) { \
+		va_list list; \
+		va_start(list, id); \
+		type res = as_##Type(call_list(id, NULL, list)); \
+		va_end(list); \
+		return res; \
+	} \
+	static type CallStatic##Type##MethodV(void *env, void *clazz, int id, va_list list) { \
+		return as_##Type(call_list(id, NULL, list)); \
+	} \
+	static type CallStatic##Type##MethodA(void *env, void *clazz, int id, const jni_value *array) { \
+		return as_##Type(call_array(id, NULL, array)); \
+	} \
+	static type Get##Type##Field(void *env, void *obj, int id) { \
+		return as_##Type(read_field(id, obj)); \
+	} \
+	static type GetStatic##Type##Field(void *env, void *clazz, int id) { \
+		return as_##Type(read_field(id, NULL)); \
+	}
+JNI_TYPES(CALLS)
+
+static void CallVoidMethod(void *env, void *obj, int id, ...) {
+	va_list list;
+	va_start(list, id);
+	call_list(id, obj, list);
+	va_end(list);
+}
+
+static void CallVoidMethodV(void *env, void *obj, int id, va_list list) {
+	call_list(id, obj, list);
+}
+
+static void CallVoidMethodA(void *env, void *obj, int id, const jni_value *array) {
+	call_array(id, obj, array);
+}
+
+static void CallNonvirtualVoidMethod(void *env, void *obj, void *clazz, int id, ...) {
+	va_list list;
+	va_start(list, id);
+	call_list(id, obj, list);
+	va_end(list);
+}
+
+static void CallNonvirtualVoidMethodV(void *env, void *obj, void *clazz, int id, va_list list) {
+	call_list(id, obj, list);
+}
+
+static void CallNonvirtualVoidMethodA(void *env, void *obj, void *clazz, int id, const jni_value *array) {
+	call_array(id, obj, array);
+}
+
+static void CallStaticVoidMethod(void *env, void *clazz, int id, ...) {
+	va_list list;
+	va_start(list, id);
+	call_list(id, NULL, list);
+	va_end(list);
+}
+
+static void CallStaticVoidMethodV(void *env, void *clazz, int id, va_list list) {
+	call_list(id, NULL, list);
+}
+
+static void CallStaticVoidMethodA(void *env, void *clazz, int id, const jni_value *array) {
+	call_array(id, NULL, array);
+}
+
+static int GetMethodID(void *env, void *clazz, const char *name, const char *sig) {
+	return registry_lookup(&method_ids, name);
+}
+
+static int GetStaticMethodID(void *env, void *clazz, const char *name, const char *sig) {
+	return registry_lookup(&method_ids, name);
+}
+
+static int GetFieldID(void *env, void *clazz, const char *name, const char *sig) {
+	return registry_lookup(&field_ids, name);
+}
+
+static int GetStaticFieldID(void *env, void *clazz, const char *name, const char *sig) {
+	return registry_lookup(&field_ids, name);
+}
+
+static int GetVersion(void *env) {
+	return JNI_VERSION_1_6;
+}
+
+static void *FindClass(void *env, const char *name) {
+	return (void *)0x41414141;
+}
+
+static void *NewGlobalRef(void *env, void *obj) {
+	return (void *)0x42424242;
+}
+
+static void DeleteGlobalRef(void *env, void *obj) {
+}
+
+static void DeleteLocalRef(void *env, void *obj) {
+}
+
+static void *NewLocalRef(void *env, void *obj) {
+	return obj;
+}
+
+static int IsSameObject(void *env, void *a, void *b) {
+	return a == b;
+}
+
+static int PushLocalFrame(void *env, int capacity) {
+	return JNI_OK;
+}
+
+static void *PopLocalFrame(void *env, void *result) {
+	return result;
+}
+
+static int EnsureLocalCapacity(void *env, int capacity) {
+	return JNI_OK;
+}
+
+static void *NewObjectV(void *env, void *clazz, int id, va_list list) {
+	return (void *)0x43434343;
+}
+
+static void *NewObject(void *env, void *clazz, int id, ...) {
+	return (void *)0x43434343;
+}
+
+static void *NewObjectA(void *env, void *clazz, int id, const jni_value *array) {
+	return (void *)0x43434343;
+}
+
+static void *GetObjectClass(void *env, void *obj) {
+	return (void *)0x44444444;
+}
+
+static void *ExceptionOccurred(void *env) {
+	return NULL;
+}
+
+static void ExceptionDescribe(void *env) {
+}
+
+static void ExceptionClear(void *env) {
+}
+
+static int ExceptionCheck(void *env) {
+	return 0;
+}
+
+static char *NewStringUTF(void *env, char *bytes) {
+	return bytes;
+}
+
+static char *GetStringUTFChars(void *env, char *string, uint8_t *is_copy) {
+	if (is_copy)
+		*is_copy = 0;
+	return string;
+}
+
+static void ReleaseStringUTFChars(void *env, char *string, const char *chars) {
+}
+
+static int GetStringUTFLength(void *env, char *string) {
+	return strlen(string);
+}
+
+static void GetStringUTFRegion(void *env, char *string, int start, int len, char *buf) {
+	memcpy(buf, &string[start], len);
+	buf[len] = 0;
+}
+
+static int RegisterNatives(void *env, void *clazz, const void *natives, int num) {
+	return JNI_OK;
+}
+
+static int MonitorEnter(void *env, void *obj) {
+	return JNI_OK;
+}
+
+static int MonitorExit(void *env, void *obj) {
+	return JNI_OK;
+}
+
+static int GetJavaVM(void *env, void **out) {
+	*out = jni_env_vm();
+	return JNI_OK;
+}
+
+static int GetEnv(void *vm, void **out, int version) {
+	*out = jni_env_get();
+	return JNI_OK;
+}
+
+static int AttachCurrentThread(void *vm, void **out, void *args) {
+	*out = jni_env_get();
+	return JNI_OK;
+}
+
+static int DetachCurrentThread(void *vm) {
+	return JNI_OK;
+}
+
+static int DestroyJavaVM(void *vm) {
+	return JNI_OK;
+}
+
+#define IMPL(name) [SLOT_##name] = (uintptr_t)&name,
+
+static const uintptr_t implemented[JNI_SLOTS] = {
+	IMPL(GetVersion) IMPL(FindClass) IMPL(ExceptionOccurred) IMPL(ExceptionDescribe) IMPL(ExceptionClear)
+	IMPL(PushLocalFrame) IMPL(PopLocalFrame) IMPL(NewGlobalRef) IMPL(DeleteGlobalRef) IMPL(DeleteLocalRef)
+	IMPL(IsSameObject) IMPL(NewLocalRef) IMPL(EnsureLocalCapacity) IMPL(NewObject) IMPL(NewObjectV)
+	IMPL(NewObjectA) IMPL(GetObjectClass) IMPL(GetMethodID) IMPL(GetFieldID) IMPL(GetStaticMethodID)
+	IMPL(GetStaticFieldID) IMPL(NewStringUTF) IMPL(GetStringUTFLength) IMPL(GetStringUTFChars)
+	IMPL(ReleaseStringUTFChars) IMPL(RegisterNatives) IMPL(MonitorEnter) IMPL(MonitorExit)
+	IMPL(GetJavaVM) IMPL(GetStringUTFRegion) IMPL(ExceptionCheck)
+	JNI_CALL_SLOTS(IMPL, Call) JNI_CALL_SLOTS(IMPL, CallNonvirtual) JNI_CALL_SLOTS(IMPL, CallStatic)
+	JNI_FIELD_SLOTS(IMPL, Get) JNI_FIELD_SLOTS(IMPL, GetStatic)
+};
+
+void *jni_env_get(void) {
+	return &env;
+}
+
+void *jni_env_vm(void) {
+	return &vm;
+}
+
+void jni_env_init(void) {
+	for (int i = 0; i < JNI_SLOTS; i++)
+		env_functions[i] = implemented[i] ? implemented[i] : stubs[i];
+	env_functions[SLOT_reserved0] = env_functions[SLOT_reserved1] = 0;
+	env_functions[SLOT_reserved2] = env_functions[SLOT_reserved3] = 0;
+
+	vm_functions[SLOT_DestroyJavaVM] = (uintptr_t)&DestroyJavaVM;
+	vm_functions[SLOT_AttachCurrentThread] = (uintptr_t)&AttachCurrentThread;
+	vm_functions[SLOT_DetachCurrentThread] = (uintptr_t)&DetachCurrentThread;
+	vm_functions[SLOT_GetEnv] = (uintptr_t)&GetEnv;
+	vm_functions[SLOT_AttachCurrentThreadAsDaemon] = (uintptr_t)&AttachCurrentThread;
+
+	for (int i = 1; i < METHODS_NUM; i++)
+		registry_add(&method_ids, methods[i].name, i);
+	for (int i = 1; i < FIELDS_NUM; i++)
+		registry_add(&field_ids, fields[i].name, i);
+}
+
+static void report_names(FILE *f, const char *what, registry *r) {
+	fprintf(f, "\nunknown %s:\n", what);
+	for (int i = 0; i < REGISTRY_SIZE; i++) {
+		registry_entry *e = &r->entries[i];
+		if (e->hash && !e->id)
+			fprintf(f, "  %-40s %u lookups\n", e->name, e->lookups);
+	}
+	if (r->overflow)
+		fprintf(f, "  (%u lookups past a full registry)\n", r->overflow);
+}
+
+static void report(void) {
+	FILE *f = save_writer_fopen(DATA_PATH "/jni.txt", "w");
+	if (!f)
+		return;
+	fprintf(f, "unexpected calls:\n");
+	for (int i = 0; i < JNI_SLOTS; i++) {
+		if (unexpected[i])
+			fprintf(f, "  %-40s %u\n", slot_names[i], unexpected[i]);
+	}
+	fprintf(f, "  %-40s %u\n", "(calls with an unknown method ID)", unknown_calls);
+	fprintf(f, "  %-40s %u\n", "(reads with an unknown field ID)", unknown_reads);
+	report_names(f, "methods", &method_ids);
+	report_names(f, "fields", &field_ids);
+	fclose(f);
+}
+
+void jni_env_frame(void) {
+	if (!report_enabled || !report_dirty)
+		return;
+	uint64_t now = sceKernelGetProcessTimeWide();
+	if (now - last_report >= REPORT_INTERVAL_US) {
+		report_dirty = 0;
+		last_report = now;
+		report();
+	}
+}
@@ -0,0 +1,11 @@
+#ifndef __JNI_ENV_H__
+#define __JNI_ENV_H__
+
+void jni_env_init(void);
+void jni_env_frame(void);
+
+// The JNIEnv and JavaVM handed to the game and to SDL's Android glue
+void *jni_env_get(void);
+void *jni_env_vm(void);
+
+#endif
@@ -42,6 +42,31 @@
 #include "dialog.h"
 #include "so_util.h"
 #include "sha1.h"
+#include "save_writer.h"
+#include "io_trace.h"
+#include "zlib_fast.h"
+#include "music_stream.h"
+#include "audio_out.h"
+#include "gl_batch.h"
+#include "gl_state.h"
+#include "gl_atlas.h"
+#include "gl_trace.h"
+#include "gl_texconv.h"
+#include "gl_stream.h"
+#include "gl_dynres.h"
+#include "frame_pacer.h"
+#include "sdl_batch.h"
+#include "perf_profile.h"
+#include "mem_alloc.h"
+#include "mem_profile.h"
+#include "mem_plan.h"
+#include "mem_ops.h"
+#include "str_ops.h"
+#include "math_bind.h"
+#include "rng.h"
+#include "sort.h"
+#include "fmt.h"
+#include "jni_env.h"
 
 #ifdef DEBUG
 #define dlog printf
@@ -53,10 +78,6 @@ extern const char *BIONIC_ctype_;
 extern const short *BIONIC_tolower_tab_;
 extern const short *BIONIC_toupper_tab_;
 
-uint8_t force_30fps = 1;
-
-static char fake_vm[0x1000];
-static char fake_env[0x1000];
 
 int file_exists(const char *path) {
 	SceIoStat stat;
@@ -70,15 +91,15 @@ unsigned int _pthread_stack_default_user = 1 * 1024 * 1024;
 so_module canada_mod;
 
 void *__wrap_memcpy(void *dest, const void *src, size_t n) {
-	return sceClibMemcpy(dest, src, n);
+	return mem_ops_memcpy(dest, src, n);
 }
 
 void *__wrap_memmove(void *dest, const void *src, size_t n) {
-	return sceClibMemmove(dest, src, n);
+	return mem_ops_memmove(dest, src, n);
 }
 
 void *__wrap_memset(void *s, int c, size_t n) {
-	return sceClibMemset(s, c, n);
+	return mem_ops_memset(s, c, n);
 }
 
 char *getcwd_hook(char *buf, size_t size) {
@@ -334,7 +355,7 @@ int pthread_cond_timedwait_relative_np_fake(pthread_cond_t **cnd, pthread_mutex_
 }
 
 int pthread_create_fake(pthread_t *thread, const void *unused, void *entry, void *arg) {
-	return pthread_create(thread, NULL, entry, arg);
+	return mem_plan_create_thread(thread, entry, arg);
 }
 
 int pthread_once_fake(volatile int *once_control, void (*init_routine)(void)) {
@@ -351,15 +372,10 @@ int GetCurrentThreadId(void) {
 
 extern void *__aeabi_ldiv0;
 
-int GetEnv(void *vm, void **env, int r2) {
-	*env = fake_env;
-	return 0;
-}
-
 int doesSharedPreferenceExistJNI(const char *pref) {
 	char fname[256];
 	sprintf(fname, "ux0:data/canada/prefs/%s.bin", pref);
-	FILE *f = fopen(fname, "r");
+	FILE *f = save_writer_fopen(fname, "r");
 	if (f) {
 		int ret = 0;
 		fread(&ret, 1, sizeof(ret), f);
@@ -372,7 +388,7 @@ int doesSharedPreferenceExistJNI(const char *pref) {
 int setSharedPreferenceBoolJNI(const char *pref, int val) {
 	char fname[256];
 	sprintf(fname, "ux0:data/canada/prefs/%s.bin", pref);
-	FILE *f = fopen(fname, "w");
+	FILE *f = save_writer_fopen(fname, "w");
 	fwrite(&val, 1, sizeof(val), f);
 	fclose(f);
 	return 0;
@@ -863,12 +879,30 @@ static FILE __sF_fake[0x1000][3];
 int stat_hook(const char *pathname, void *statbuf) {
 	//dlog("stat(%s)\n", pathname);
 	struct stat st;
+	size_t pending_size;
+	if (save_writer_pending_size(pathname, &pending_size)) {
+		*(uint64_t *)(statbuf + 0x30) = pending_size;
+		io_trace(IO_OP_STAT, pathname, NULL, 0, pending_size, 0);
+		return 0;
+	}
+	if (save_writer_is_save_path(pathname))
+		save_writer_recover(pathname);
 	int res = stat(pathname, &st);
 	if (res == 0)
 		*(uint64_t *)(statbuf + 0x30) = st.st_size;
+	io_trace(IO_OP_STAT, pathname, NULL, 0, res ? 0 : st.st_size, res ? IO_FLAG_FAILED : 0);
 	return res;
 }
 
+int access_hook(const char *pathname, int mode) {
+	size_t pending_size;
+	if (save_writer_pending_size(pathname, &pending_size))
+		return 0;
+	if (save_writer_is_save_path(pathname))
+		save_writer_recover(pathname);
+	return access(pathname, mode);
+}
+
 void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
 	return memalign(length, 0x1000);
 }
@@ -901,16 +935,8 @@ char *basename(char *path) {
 	return p;
 }
 
-void *sceClibMemclr(void *dst, SceSize len) {
-	return sceClibMemset(dst, 0, len);
-}
-
-void *sceClibMemset2(void *dst, SceSize len, int ch) {
-	return sceClibMemset(dst, ch, len);
-}
-
 void *Android_JNI_GetEnv() {
-	return fake_env;
+	return jni_env_get();
 }
 
 char *SDL_AndroidGetExternalStoragePath() {
@@ -930,6 +956,11 @@ void abort_hook() {
 	p[0] = 1;
 }
 
+void exit_hook(int status) {
+	save_writer_flush();
+	exit(status);
+}
+
 int ret99() {
 	return 99;
 }
@@ -948,19 +979,7 @@ static so_default_dynlib gl_hook[] = {
 };
 static size_t gl_numhook = sizeof(gl_hook) / sizeof(*gl_hook);
 
-void *SDL_GL_GetProcAddress_fake(const char *symbol) {
-	dlog("looking for symbol %s\n", symbol);
-	for (size_t i = 0; i < gl_numhook; ++i) {
-		if (!strcmp(symbol, gl_hook[i].symbol)) {
-			return (void *)gl_hook[i].func;
-		}
-	}
-	void *r = vglGetProcAddress(symbol);
-	if (!r) {
-		dlog("Cannot find symbol %s\n", symbol);
-	}
-	return r;
-}
+void *SDL_GL_GetProcAddress_fake(const char *symbol);
 
 ssize_t readlink(const char *pathname, char *buf, size_t bufsiz) {
 	//dlog("readlink(%s)\n", pathname);
@@ -1007,6 +1026,7 @@ int closedir_fake(android_DIR *dirp) {
 android_DIR *opendir_fake(const char *dirname) {
 	//dlog("opendir(%s)\n", dirname);
 	SceUID uid = sceIoDopen(dirname);
+	io_trace(IO_OP_OPENDIR, dirname, NULL, 0, 0, uid < 0 ? IO_FLAG_FAILED : 0);
 
 	if (uid < 0) {
 		errno = uid & SCE_ERRNO_MASK;
@@ -1052,13 +1072,16 @@ struct android_dirent *readdir_fake(android_DIR *dirp) {
 }
 
 SDL_Surface *IMG_Load_hook(const char *file) {
+	SDL_Surface *s;
 	char real_fname[256];
 	//printf("loading %s\n", file);
 	if (strncmp(file, "ux0:", 4)) {
 		sprintf(real_fname, "ux0:data/canada/assets/%s", file);
-		return IMG_Load(real_fname);
+		file = real_fname;
 	}
-	return IMG_Load(file);
+	s = IMG_Load(file);
+	io_trace(IO_OP_IMG_LOAD, file, NULL, 0, 0, s ? 0 : IO_FLAG_FAILED);
+	return s;
 }
 
 SDL_RWops *SDL_RWFromFile_hook(const char *fname, const char *mode) {
@@ -1069,9 +1092,17 @@ SDL_RWops *SDL_RWFromFile_hook(const char *fname, const char *mode) {
 		sprintf(real_fname, "ux0:data/canada/assets/%s", fname);
 		//printf("SDL_RWFromFile patched to %s\n", real_fname);
 		f = SDL_RWFromFile(real_fname, mode);
+		fname = real_fname;
+	} else if (save_writer_is_save_path(fname)) {
+		// Same route as the game's fopen, a save still queued would be missed on disk
+		FILE *fp = save_writer_fopen(fname, mode);
+		f = fp ? SDL_RWFromFP(fp, SDL_TRUE) : NULL;
+		if (fp && !f)
+			fclose(fp);
 	} else {
 		f = SDL_RWFromFile(fname, mode);
 	}
+	io_trace(IO_OP_RWOPEN, fname, NULL, 0, 0, (f ? 0 : IO_FLAG_FAILED) | (mode[0] != 'r' ? IO_FLAG_WRITE : 0));
 	return f;
 }
 
@@ -1081,10 +1112,13 @@ FILE *fopen_hook(char *fname, char *mode) {
 	//printf("fopen(%s,%s)\n", fname, mode);
 	if (strncmp(fname, "ux0:", 4)) {
 		sprintf(real_fname, "ux0:data/canada/%s", fname);
-		f = fopen(real_fname, mode);
-	} else {
-		f = fopen(fname, mode);
+		fname = real_fname;
 	}
+	if (save_writer_is_save_path(fname))
+		f = save_writer_fopen(fname, mode);
+	else
+		f = fopen(fname, mode);
+	io_trace(IO_OP_FOPEN, fname, f, 0, 0, (f ? 0 : IO_FLAG_FAILED) | (mode[0] != 'r' || strchr(mode, '+') ? IO_FLAG_WRITE : 0));
 	return f;
 }
 
@@ -1094,22 +1128,158 @@ Mix_Music *Mix_LoadMUS_hook(const char *fname) {
 	//printf("Mix_LoadMUS(%s)\n", fname);
 	if (strncmp(fname, "ux0:", 4)) {
 		sprintf(real_fname, "ux0:data/canada/assets/%s", fname);
-		f = Mix_LoadMUS(real_fname);
-	} else {
-		f = Mix_LoadMUS(fname);
+		fname = real_fname;
 	}
+	f = music_stream_load(fname);
+	if (!f)
+		f = Mix_LoadMUS(fname);
+	io_trace(IO_OP_MUS_LOAD, fname, NULL, 0, 0, f ? 0 : IO_FLAG_FAILED);
 	return f;
 }
 
 int Mix_OpenAudio_hook(int frequency, Uint16 format, int channels, int chunksize) {
-	return Mix_OpenAudio(44100, AUDIO_S16SYS, 2, 1024);
+	return audio_out_open();
 }
 
 SDL_GLContext SDL_GL_CreateContext_fake(SDL_Window * window) {
-	eglSwapInterval(0, force_30fps ? 2 : 1);
+	frame_pacer_init();
 	return SDL_GL_CreateContext(window);
 }
 
+static void frame_end(void) {
+	gl_batch_frame();
+	gl_state_frame();
+	gl_trace_frame();
+	gl_texconv_frame();
+	gl_stream_frame();
+	frame_pacer_frame();
+	sdl_batch_frame();
+	mem_alloc_frame();
+	mem_profile_frame();
+	mem_plan_frame();
+	mem_ops_frame();
+	rng_frame();
+	jni_env_frame();
+}
+
+// SDL's renderer uses vitaGL behind the back of the GL layers, so pending draws go out first
+SDL_Texture *SDL_CreateTexture_hook(SDL_Renderer *renderer, Uint32 format, int access, int w, int h) {
+	gl_state_sync();
+	SDL_Texture *texture = SDL_CreateTexture(renderer, format, access, w, h);
+	gl_stream_sdl_created(renderer, texture, format, access, w, h);
+	return texture;
+}
+
+SDL_Texture *SDL_CreateTextureFromSurface_hook(SDL_Renderer *renderer, SDL_Surface *surface) {
+	gl_state_sync();
+	return SDL_CreateTextureFromSurface(renderer, surface);
+}
+
+int SDL_UpdateTexture_hook(SDL_Texture *texture, const SDL_Rect *rect, const void *pixels, int pitch) {
+	sdl_batch_texture_changed(texture);
+	// Streaming textures only get a CPU copy updated here, it reaches the GPU when the texture is drawn
+	if (gl_stream_sdl_update(texture, rect, pixels, pitch))
+		return 0;
+	gl_state_sync();
+	return SDL_UpdateTexture(texture, rect, pixels, pitch);
+}
+
+int SDL_SetRenderTarget_hook(SDL_Renderer *renderer, SDL_Texture *texture) {
+	sdl_batch_flush();
+	gl_state_sync();
+	return SDL_SetRenderTarget(renderer, texture);
+}
+
+int SDL_GL_BindTexture_hook(SDL_Texture *texture, float *texw, float *texh) {
+	sdl_batch_flush();
+	gl_state_sync();
+	return SDL_GL_BindTexture(gl_stream_sdl_front(texture), texw, texh);
+}
+
+int SDL_RenderClear_hook(SDL_Renderer *renderer) {
+	sdl_batch_flush();
+	gl_state_sync();
+	return SDL_RenderClear(renderer);
+}
+
+// Sprites are queued and reach SDL at the next flush point, any GL call the game makes is one so it lands after them
+int SDL_RenderCopy_hook(SDL_Renderer *renderer, SDL_Texture *texture, const SDL_Rect *srcrect, const SDL_Rect *dstrect) {
+	return sdl_batch_copy(renderer, texture, srcrect, dstrect);
+}
+
+#define GL_AFTER_SPRITES(name, params, args) \
+	void name##_ordered params { \
+		sdl_batch_flush(); \
+		name##_trace args; \
+	}
+
+GL_AFTER_SPRITES(glClearColor, (GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha), (red, green, blue, alpha))
+GL_AFTER_SPRITES(glTexSubImage2D, (GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels),
+	(target, level, xoffset, yoffset, width, height, format, type, pixels))
+GL_AFTER_SPRITES(glTexImage2D, (GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *data),
+	(target, level, internalFormat, width, height, border, format, type, data))
+GL_AFTER_SPRITES(glDeleteTextures, (GLsizei n, const GLuint *textures), (n, textures))
+GL_AFTER_SPRITES(glBindTexture, (GLenum target, GLuint texture), (target, texture))
+GL_AFTER_SPRITES(glTexParameteri, (GLenum target, GLenum pname, GLint param), (target, pname, param))
+GL_AFTER_SPRITES(glMatrixMode, (GLenum mode), (mode))
+GL_AFTER_SPRITES(glLoadIdentity, (void), ())
+GL_AFTER_SPRITES(glScalef, (GLfloat x, GLfloat y, GLfloat z), (x, y, z))
+GL_AFTER_SPRITES(glClear, (GLbitfield mask), (mask))
+GL_AFTER_SPRITES(glOrthof, (GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat nearVal, GLfloat farVal), (left, right, bottom, top, nearVal, farVal))
+GL_AFTER_SPRITES(glViewport, (GLint x, GLint y, GLsizei width, GLsizei height), (x, y, width, height))
+GL_AFTER_SPRITES(glScissor, (GLint x, GLint y, GLsizei width, GLsizei height), (x, y, width, height))
+GL_AFTER_SPRITES(glEnable, (GLenum cap), (cap))
+GL_AFTER_SPRITES(glDisable, (GLenum cap), (cap))
+GL_AFTER_SPRITES(glEnableClientState, (GLenum array), (array))
+GL_AFTER_SPRITES(glDisableClientState, (GLenum array), (array))
+GL_AFTER_SPRITES(glBlendFunc, (GLenum sfactor, GLenum dfactor), (sfactor, dfactor))
+GL_AFTER_SPRITES(glColorPointer, (GLint size, GLenum type, GLsizei stride, const void *pointer), (size, type, stride, pointer))
+GL_AFTER_SPRITES(glVertexPointer, (GLint size, GLenum type, GLsizei stride, const void *pointer), (size, type, stride, pointer))
+GL_AFTER_SPRITES(glTexCoordPointer, (GLint size, GLenum type, GLsizei stride, const void *pointer), (size, type, stride, pointer))
+GL_AFTER_SPRITES(glDrawElements, (GLenum mode, GLsizei count, GLenum type, const void *indices), (mode, count, type, indices))
+
+int SDL_RenderFillRect_hook(SDL_Renderer *renderer, const SDL_Rect *rect) {
+	return sdl_batch_fill(renderer, rect);
+}
+
+int SDL_SetRenderDrawColor_hook(SDL_Renderer *renderer, Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
+	return sdl_batch_set_draw_color(renderer, r, g, b, a);
+}
+
+int SDL_SetRenderDrawBlendMode_hook(SDL_Renderer *renderer, SDL_BlendMode mode) {
+	return sdl_batch_set_draw_blend_mode(renderer, mode);
+}
+
+void SDL_DestroyTexture_hook(SDL_Texture *texture) {
+	sdl_batch_texture_changed(texture);
+	gl_state_sync();
+	gl_stream_sdl_destroy(texture);
+	SDL_DestroyTexture(texture);
+}
+
+void SDL_RenderPresent_hook(SDL_Renderer *renderer) {
+	sdl_batch_flush();
+	gl_state_sync();
+	frame_pacer_present();
+	SDL_RenderPresent(renderer);
+	frame_end();
+}
+
+void SDL_Quit_hook(void) {
+	save_writer_flush();
+	SDL_Quit();
+}
+
+void SDL_GL_SwapWindow_hook(SDL_Window *window) {
+	sdl_batch_flush();
+	gl_batch_flush();
+	gl_dynres_resolve();
+	frame_pacer_present();
+	SDL_GL_SwapWindow(window);
+	gl_dynres_frame();
+	frame_end();
+}
+
 extern void SDL_ResetKeyboard(void);
 
 static so_default_dynlib default_dynlib[] = {
@@ -1119,18 +1289,18 @@ static so_default_dynlib default_dynlib[] = {
 	{ "readlink", (uintptr_t)&readlink },
 	{ "g_SDL_BufferGeometry_w", (uintptr_t)&g_SDL_BufferGeometry_w },
 	{ "g_SDL_BufferGeometry_h", (uintptr_t)&g_SDL_BufferGeometry_h },
-	{ "__aeabi_memclr", (uintptr_t)&sceClibMemclr },
-	{ "__aeabi_memclr4", (uintptr_t)&sceClibMemclr },
-	{ "__aeabi_memclr8", (uintptr_t)&sceClibMemclr },
-	{ "__aeabi_memcpy4", (uintptr_t)&sceClibMemcpy },
-	{ "__aeabi_memcpy8", (uintptr_t)&sceClibMemcpy },
-	{ "__aeabi_memmove4", (uintptr_t)&sceClibMemmove },
-	{ "__aeabi_memmove8", (uintptr_t)&sceClibMemmove },
-	{ "__aeabi_memcpy", (uintptr_t)&sceClibMemcpy },
-	{ "__aeabi_memmove", (uintptr_t)&sceClibMemmove },
-	{ "__aeabi_memset", (uintptr_t)&sceClibMemset2 },
-	{ "__aeabi_memset4", (uintptr_t)&sceClibMemset2 },
-	{ "__aeabi_memset8", (uintptr_t)&sceClibMemset2 },
+	{ "__aeabi_memclr", (uintptr_t)&mem_ops_aeabi_memclr },
+	{ "__aeabi_memclr4", (uintptr_t)&mem_ops_aeabi_memclr },
+	{ "__aeabi_memclr8", (uintptr_t)&mem_ops_aeabi_memclr },
+	{ "__aeabi_memcpy4", (uintptr_t)&mem_ops_aeabi_memcpy4 },
+	{ "__aeabi_memcpy8", (uintptr_t)&mem_ops_aeabi_memcpy4 },
+	{ "__aeabi_memmove4", (uintptr_t)&mem_ops_aeabi_memmove },
+	{ "__aeabi_memmove8", (uintptr_t)&mem_ops_aeabi_memmove },
+	{ "__aeabi_memcpy", (uintptr_t)&mem_ops_aeabi_memcpy },
+	{ "__aeabi_memmove", (uintptr_t)&mem_ops_aeabi_memmove },
+	{ "__aeabi_memset", (uintptr_t)&mem_ops_aeabi_memset },
+	{ "__aeabi_memset4", (uintptr_t)&mem_ops_aeabi_memset },
+	{ "__aeabi_memset8", (uintptr_t)&mem_ops_aeabi_memset },
 	{ "__aeabi_atexit", (uintptr_t)&__aeabi_atexit },
 	{ "__android_log_print", (uintptr_t)&__android_log_print },
 	{ "__android_log_vprint", (uintptr_t)&__android_log_vprint },
@@ -1153,7 +1323,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "_tolower_tab_", (uintptr_t)&BIONIC_tolower_tab_},
 	{ "_toupper_tab_", (uintptr_t)&BIONIC_toupper_tab_},
 	{ "abort", (uintptr_t)&abort_hook },
-	{ "access", (uintptr_t)&access },
+	{ "access", (uintptr_t)&access_hook },
 	{ "acos", (uintptr_t)&acos },
 	{ "acosh", (uintptr_t)&acosh },
 	{ "asctime", (uintptr_t)&asctime },
@@ -1171,9 +1341,9 @@ static so_default_dynlib default_dynlib[] = {
 	{ "atoll", (uintptr_t)&atoll },
 	{ "basename", (uintptr_t)&basename },
 	// { "bind", (uintptr_t)&bind },
-	{ "bsearch", (uintptr_t)&bsearch },
+	{ "bsearch", (uintptr_t)&sort_bsearch },
 	{ "btowc", (uintptr_t)&btowc },
-	{ "calloc", (uintptr_t)&calloc },
+	{ "calloc", (uintptr_t)&mem_calloc },
 	{ "ceil", (uintptr_t)&ceil },
 	{ "ceilf", (uintptr_t)&ceilf },
 	{ "chdir", (uintptr_t)&chdir_hook },
@@ -1184,7 +1354,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "cos", (uintptr_t)&cos },
 	{ "cosf", (uintptr_t)&cosf },
 	{ "cosh", (uintptr_t)&cosh },
-	{ "crc32", (uintptr_t)&crc32 },
+	{ "crc32", (uintptr_t)&zfast_crc32 },
 	{ "deflate", (uintptr_t)&deflate },
 	{ "deflateEnd", (uintptr_t)&deflateEnd },
 	{ "deflateInit_", (uintptr_t)&deflateInit_ },
@@ -1192,12 +1362,12 @@ static so_default_dynlib default_dynlib[] = {
 	{ "deflateReset", (uintptr_t)&deflateReset },
 	{ "dlopen", (uintptr_t)&ret0 },
 	// { "dlsym", (uintptr_t)&dlsym_hook },
-	{ "exit", (uintptr_t)&exit },
+	{ "exit", (uintptr_t)&exit_hook },
 	{ "exp", (uintptr_t)&exp },
 	{ "exp2", (uintptr_t)&exp2 },
 	{ "expf", (uintptr_t)&expf },
 	{ "fabsf", (uintptr_t)&fabsf },
-	{ "fclose", (uintptr_t)&fclose },
+	{ "fclose", (uintptr_t)&fclose_trace },
 	{ "fcntl", (uintptr_t)&ret0 },
 	// { "fdopen", (uintptr_t)&fdopen },
 	{ "ferror", (uintptr_t)&ferror },
@@ -1212,13 +1382,13 @@ static so_default_dynlib default_dynlib[] = {
 	{ "fputc", (uintptr_t)&fputc },
 	// { "fputwc", (uintptr_t)&fputwc },
 	// { "fputs", (uintptr_t)&fputs },
-	{ "fread", (uintptr_t)&fread },
-	{ "free", (uintptr_t)&free },
+	{ "fread", (uintptr_t)&fread_trace },
+	{ "free", (uintptr_t)&mem_free },
 	{ "frexp", (uintptr_t)&frexp },
 	{ "frexpf", (uintptr_t)&frexpf },
 	// { "fscanf", (uintptr_t)&fscanf },
-	{ "fseek", (uintptr_t)&fseek },
-	{ "fseeko", (uintptr_t)&fseeko },
+	{ "fseek", (uintptr_t)&fseek_trace },
+	{ "fseeko", (uintptr_t)&fseeko_trace },
 	{ "fstat", (uintptr_t)&fstat },
 	{ "ftell", (uintptr_t)&ftell },
 	{ "ftello", (uintptr_t)&ftello },
@@ -1231,11 +1401,11 @@ static so_default_dynlib default_dynlib[] = {
 	{ "getwc", (uintptr_t)&getwc },
 	{ "gettimeofday", (uintptr_t)&gettimeofday },
 	{ "gzopen", (uintptr_t)&gzopen },
-	{ "inflate", (uintptr_t)&inflate },
+	{ "inflate", (uintptr_t)&zfast_inflate },
 	{ "inflateEnd", (uintptr_t)&inflateEnd },
-	{ "inflateInit_", (uintptr_t)&inflateInit_ },
-	{ "inflateInit2_", (uintptr_t)&inflateInit2_ },
-	{ "inflateReset", (uintptr_t)&inflateReset },
+	{ "inflateInit_", (uintptr_t)&zfast_inflateInit_ },
+	{ "inflateInit2_", (uintptr_t)&zfast_inflateInit2_ },
+	{ "inflateReset", (uintptr_t)&zfast_inflateReset },
 	{ "isascii", (uintptr_t)&isascii },
 	{ "isalnum", (uintptr_t)&isalnum },
 	{ "isalpha", (uintptr_t)&isalpha },
@@ -1268,18 +1438,18 @@ static so_default_dynlib default_dynlib[] = {
 	{ "log10", (uintptr_t)&log10 },
 	{ "log10f", (uintptr_t)&log10f },
 	{ "longjmp", (uintptr_t)&longjmp },
-	{ "lrand48", (uintptr_t)&lrand48 },
+	{ "lrand48", (uintptr_t)&rng_lrand48 },
 	{ "lrint", (uintptr_t)&lrint },
 	{ "lrintf", (uintptr_t)&lrintf },
 	{ "lseek", (uintptr_t)&lseek },
-	{ "malloc", (uintptr_t)&malloc },
+	{ "malloc", (uintptr_t)&mem_malloc },
 	{ "mbrtowc", (uintptr_t)&mbrtowc },
-	{ "memalign", (uintptr_t)&memalign },
-	{ "memchr", (uintptr_t)&sceClibMemchr },
-	{ "memcmp", (uintptr_t)&sceClibMemcmp },
-	{ "memcpy", (uintptr_t)&sceClibMemcpy },
-	{ "memmove", (uintptr_t)&sceClibMemmove },
-	{ "memset", (uintptr_t)&sceClibMemset },
+	{ "memalign", (uintptr_t)&mem_memalign },
+	{ "memchr", (uintptr_t)&str_ops_memchr },
+	{ "memcmp", (uintptr_t)&str_ops_memcmp },
+	{ "memcpy", (uintptr_t)&mem_ops_memcpy },
+	{ "memmove", (uintptr_t)&mem_ops_memmove },
+	{ "memset", (uintptr_t)&mem_ops_memset },
 	{ "mkdir", (uintptr_t)&mkdir },
 	// { "mmap", (uintptr_t)&mmap},
 	// { "munmap", (uintptr_t)&munmap},
@@ -1324,11 +1494,11 @@ static so_default_dynlib default_dynlib[] = {
 	{ "putc", (uintptr_t)&putc },
 	{ "puts", (uintptr_t)&puts },
 	{ "putwc", (uintptr_t)&putwc },
-	{ "qsort", (uintptr_t)&qsort },
-	{ "rand", (uintptr_t)&rand },
+	{ "qsort", (uintptr_t)&sort_qsort },
+	{ "rand", (uintptr_t)&rng_rand },
 	{ "read", (uintptr_t)&read },
 	{ "realpath", (uintptr_t)&realpath },
-	{ "realloc", (uintptr_t)&realloc },
+	{ "realloc", (uintptr_t)&mem_realloc },
 	// { "recv", (uintptr_t)&recv },
 	{ "roundf", (uintptr_t)&roundf },
 	{ "rint", (uintptr_t)&rint },
@@ -1344,35 +1514,35 @@ static so_default_dynlib default_dynlib[] = {
 	{ "sinf", (uintptr_t)&sinf },
 	{ "sinh", (uintptr_t)&sinh },
 	//{ "sincos", (uintptr_t)&sincos },
-	{ "snprintf", (uintptr_t)&snprintf },
+	{ "snprintf", (uintptr_t)&fmt_snprintf },
 	// { "socket", (uintptr_t)&socket },
-	{ "sprintf", (uintptr_t)&sprintf },
+	{ "sprintf", (uintptr_t)&fmt_sprintf },
 	{ "sqrt", (uintptr_t)&sqrt },
 	{ "sqrtf", (uintptr_t)&sqrtf },
-	{ "srand", (uintptr_t)&srand },
-	{ "srand48", (uintptr_t)&srand48 },
+	{ "srand", (uintptr_t)&rng_srand },
+	{ "srand48", (uintptr_t)&rng_srand48 },
 	{ "sscanf", (uintptr_t)&sscanf },
 	{ "stat", (uintptr_t)&stat_hook },
-	{ "strcasecmp", (uintptr_t)&strcasecmp },
-	{ "strcasestr", (uintptr_t)&strstr },
-	{ "strcat", (uintptr_t)&strcat },
-	{ "strchr", (uintptr_t)&strchr },
-	{ "strcmp", (uintptr_t)&sceClibStrcmp },
+	{ "strcasecmp", (uintptr_t)&str_ops_strcasecmp },
+	{ "strcasestr", (uintptr_t)&str_ops_strcasestr },
+	{ "strcat", (uintptr_t)&str_ops_strcat },
+	{ "strchr", (uintptr_t)&str_ops_strchr },
+	{ "strcmp", (uintptr_t)&str_ops_strcmp },
 	{ "strcoll", (uintptr_t)&strcoll },
-	{ "strcpy", (uintptr_t)&strcpy },
-	{ "strcspn", (uintptr_t)&strcspn },
-	{ "strdup", (uintptr_t)&strdup },
+	{ "strcpy", (uintptr_t)&str_ops_strcpy },
+	{ "strcspn", (uintptr_t)&str_ops_strcspn },
+	{ "strdup", (uintptr_t)&mem_strdup },
 	{ "strerror", (uintptr_t)&strerror },
 	{ "strftime", (uintptr_t)&strftime },
-	{ "strlcpy", (uintptr_t)&strlcpy },
-	{ "strlen", (uintptr_t)&strlen },
-	{ "strncasecmp", (uintptr_t)&sceClibStrncasecmp },
-	{ "strncat", (uintptr_t)&sceClibStrncat },
-	{ "strncmp", (uintptr_t)&sceClibStrncmp },
-	{ "strncpy", (uintptr_t)&sceClibStrncpy },
-	{ "strpbrk", (uintptr_t)&strpbrk },
-	{ "strrchr", (uintptr_t)&sceClibStrrchr },
-	{ "strstr", (uintptr_t)&sceClibStrstr },
+	{ "strlcpy", (uintptr_t)&str_ops_strlcpy },
+	{ "strlen", (uintptr_t)&str_ops_strlen },
+	{ "strncasecmp", (uintptr_t)&str_ops_strncasecmp },
+	{ "strncat", (uintptr_t)&str_ops_strncat },
+	{ "strncmp", (uintptr_t)&str_ops_strncmp },
+	{ "strncpy", (uintptr_t)&str_ops_strncpy },
+	{ "strpbrk", (uintptr_t)&str_ops_strpbrk },
+	{ "strrchr", (uintptr_t)&str_ops_strrchr },
+	{ "strstr", (uintptr_t)&str_ops_strstr },
 	{ "strtod", (uintptr_t)&strtod },
 	{ "strtol", (uintptr_t)&strtol },
 	{ "strtoul", (uintptr_t)&strtoul },
@@ -1393,49 +1563,49 @@ static so_default_dynlib default_dynlib[] = {
 	{ "usleep", (uintptr_t)&usleep },
 	{ "vfprintf", (uintptr_t)&vfprintf },
 	{ "vprintf", (uintptr_t)&vprintf },
-	{ "vsnprintf", (uintptr_t)&vsnprintf },
-	{ "vsprintf", (uintptr_t)&vsprintf },
+	{ "vsnprintf", (uintptr_t)&fmt_vsnprintf },
+	{ "vsprintf", (uintptr_t)&fmt_vsprintf },
 	{ "vswprintf", (uintptr_t)&vswprintf },
 	{ "wcrtomb", (uintptr_t)&wcrtomb },
 	{ "wcscoll", (uintptr_t)&wcscoll },
-	{ "wcscmp", (uintptr_t)&wcscmp },
-	{ "wcsncpy", (uintptr_t)&wcsncpy },
+	{ "wcscmp", (uintptr_t)&str_ops_wcscmp },
+	{ "wcsncpy", (uintptr_t)&str_ops_wcsncpy },
 	{ "wcsftime", (uintptr_t)&wcsftime },
-	{ "wcslen", (uintptr_t)&wcslen },
+	{ "wcslen", (uintptr_t)&str_ops_wcslen },
 	{ "wcsxfrm", (uintptr_t)&wcsxfrm },
 	{ "wctob", (uintptr_t)&wctob },
 	{ "wctype", (uintptr_t)&wctype },
-	{ "wmemchr", (uintptr_t)&wmemchr },
-	{ "wmemcmp", (uintptr_t)&wmemcmp },
-	{ "wmemcpy", (uintptr_t)&wmemcpy },
-	{ "wmemmove", (uintptr_t)&wmemmove },
-	{ "wmemset", (uintptr_t)&wmemset },
+	{ "wmemchr", (uintptr_t)&str_ops_wmemchr },
+	{ "wmemcmp", (uintptr_t)&str_ops_wmemcmp },
+	{ "wmemcpy", (uintptr_t)&str_ops_wmemcpy },
+	{ "wmemmove", (uintptr_t)&str_ops_wmemmove },
+	{ "wmemset", (uintptr_t)&str_ops_wmemset },
 	{ "write", (uintptr_t)&write },
 	// { "writev", (uintptr_t)&writev },
-	{ "glClearColor", (uintptr_t)&glClearColor },
-	{ "glTexSubImage2D", (uintptr_t)&glTexSubImage2D },
-	{ "glTexImage2D", (uintptr_t)&glTexImage2D },
-	{ "glDeleteTextures", (uintptr_t)&glDeleteTextures },
-	{ "glGenTextures", (uintptr_t)&glGenTextures },
-	{ "glBindTexture", (uintptr_t)&glBindTexture },
-	{ "glTexParameteri", (uintptr_t)&glTexParameteri },
+	{ "glClearColor", (uintptr_t)&glClearColor_ordered },
+	{ "glTexSubImage2D", (uintptr_t)&glTexSubImage2D_ordered },
+	{ "glTexImage2D", (uintptr_t)&glTexImage2D_ordered },
+	{ "glDeleteTextures", (uintptr_t)&glDeleteTextures_ordered },
+	{ "glGenTextures", (uintptr_t)&glGenTextures_trace },
+	{ "glBindTexture", (uintptr_t)&glBindTexture_ordered },
+	{ "glTexParameteri", (uintptr_t)&glTexParameteri_ordered },
 	{ "glGetError", (uintptr_t)&glGetError },
-	{ "glMatrixMode", (uintptr_t)&glMatrixMode },
-	{ "glLoadIdentity", (uintptr_t)&glLoadIdentity },
-	{ "glScalef", (uintptr_t)&glScalef },
-	{ "glClear", (uintptr_t)&glClear },
-	{ "glOrthof", (uintptr_t)&glOrthof },
-	{ "glViewport", (uintptr_t)&glViewport },
-	{ "glScissor", (uintptr_t)&glScissor },
-	{ "glEnable", (uintptr_t)&glEnable },
-	{ "glDisable", (uintptr_t)&glDisable },
-	{ "glEnableClientState", (uintptr_t)&glEnableClientState },
-	{ "glDisableClientState", (uintptr_t)&glDisableClientState },
-	{ "glBlendFunc", (uintptr_t)&glBlendFunc },
-	{ "glColorPointer", (uintptr_t)&glColorPointer },
-	{ "glVertexPointer", (uintptr_t)&glVertexPointer },
-	{ "glTexCoordPointer", (uintptr_t)&glTexCoordPointer },
-	{ "glDrawElements", (uintptr_t)&glDrawElements },
+	{ "glMatrixMode", (uintptr_t)&glMatrixMode_ordered },
+	{ "glLoadIdentity", (uintptr_t)&glLoadIdentity_ordered },
+	{ "glScalef", (uintptr_t)&glScalef_ordered },
+	{ "glClear", (uintptr_t)&glClear_ordered },
+	{ "glOrthof", (uintptr_t)&glOrthof_ordered },
+	{ "glViewport", (uintptr_t)&glViewport_ordered },
+	{ "glScissor", (uintptr_t)&glScissor_ordered },
+	{ "glEnable", (uintptr_t)&glEnable_ordered },
+	{ "glDisable", (uintptr_t)&glDisable_ordered },
+	{ "glEnableClientState", (uintptr_t)&glEnableClientState_ordered },
+	{ "glDisableClientState", (uintptr_t)&glDisableClientState_ordered },
+	{ "glBlendFunc", (uintptr_t)&glBlendFunc_ordered },
+	{ "glColorPointer", (uintptr_t)&glColorPointer_ordered },
+	{ "glVertexPointer", (uintptr_t)&glVertexPointer_ordered },
+	{ "glTexCoordPointer", (uintptr_t)&glTexCoordPointer_ordered },
+	{ "glDrawElements", (uintptr_t)&glDrawElements_ordered },
 	{ "SDL_IsTextInputActive", (uintptr_t)&SDL_IsTextInputActive },
 	{ "SDL_GameControllerEventState", (uintptr_t)&SDL_GameControllerEventState },
 	{ "SDL_WarpMouseInWindow", (uintptr_t)&SDL_WarpMouseInWindow },
@@ -1450,14 +1620,14 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_CreateMutex", (uintptr_t)&SDL_CreateMutex },
 	{ "SDL_CreateRenderer", (uintptr_t)&SDL_CreateRenderer },
 	{ "SDL_CreateRGBSurface", (uintptr_t)&SDL_CreateRGBSurface },
-	{ "SDL_CreateTexture", (uintptr_t)&SDL_CreateTexture },
-	{ "SDL_CreateTextureFromSurface", (uintptr_t)&SDL_CreateTextureFromSurface },
+	{ "SDL_CreateTexture", (uintptr_t)&SDL_CreateTexture_hook },
+	{ "SDL_CreateTextureFromSurface", (uintptr_t)&SDL_CreateTextureFromSurface_hook },
 	{ "SDL_CreateThread", (uintptr_t)&SDL_CreateThread },
 	{ "SDL_CreateWindow", (uintptr_t)&SDL_CreateWindow },
 	{ "SDL_Delay", (uintptr_t)&SDL_Delay },
 	{ "SDL_DestroyMutex", (uintptr_t)&SDL_DestroyMutex },
 	{ "SDL_DestroyRenderer", (uintptr_t)&SDL_DestroyRenderer },
-	{ "SDL_DestroyTexture", (uintptr_t)&SDL_DestroyTexture },
+	{ "SDL_DestroyTexture", (uintptr_t)&SDL_DestroyTexture_hook },
 	{ "SDL_DestroyWindow", (uintptr_t)&SDL_DestroyWindow },
 	{ "SDL_FillRect", (uintptr_t)&SDL_FillRect },
 	{ "SDL_FreeSurface", (uintptr_t)&SDL_FreeSurface },
@@ -1475,7 +1645,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_GetTextureColorMod", (uintptr_t)&SDL_GetTextureColorMod },
 	{ "SDL_GetTicks", (uintptr_t)&SDL_GetTicks },
 	{ "SDL_GetVersion", (uintptr_t)&SDL_GetVersion },
-	{ "SDL_GL_BindTexture", (uintptr_t)&SDL_GL_BindTexture },
+	{ "SDL_GL_BindTexture", (uintptr_t)&SDL_GL_BindTexture_hook },
 	{ "SDL_GL_GetCurrentContext", (uintptr_t)&SDL_GL_GetCurrentContext },
 	{ "SDL_GL_MakeCurrent", (uintptr_t)&SDL_GL_MakeCurrent },
 	{ "SDL_GL_SetAttribute", (uintptr_t)&SDL_GL_SetAttribute },
@@ -1496,12 +1666,12 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_PushEvent", (uintptr_t)&SDL_PushEvent },
 	{ "SDL_PollEvent", (uintptr_t)&SDL_PollEvent },
 	{ "SDL_QueryTexture", (uintptr_t)&SDL_QueryTexture },
-	{ "SDL_Quit", (uintptr_t)&SDL_Quit },
+	{ "SDL_Quit", (uintptr_t)&SDL_Quit_hook },
 	{ "SDL_RemoveTimer", (uintptr_t)&SDL_RemoveTimer },
-	{ "SDL_RenderClear", (uintptr_t)&SDL_RenderClear },
-	{ "SDL_RenderCopy", (uintptr_t)&SDL_RenderCopy },
-	{ "SDL_RenderFillRect", (uintptr_t)&SDL_RenderFillRect },
-	{ "SDL_RenderPresent", (uintptr_t)&SDL_RenderPresent },
+	{ "SDL_RenderClear", (uintptr_t)&SDL_RenderClear_hook },
+	{ "SDL_RenderCopy", (uintptr_t)&SDL_RenderCopy_hook },
+	{ "SDL_RenderFillRect", (uintptr_t)&SDL_RenderFillRect_hook },
+	{ "SDL_RenderPresent", (uintptr_t)&SDL_RenderPresent_hook },
 	{ "SDL_RWFromFile", (uintptr_t)&SDL_RWFromFile_hook },
 	{ "SDL_RWread", (uintptr_t)&SDL_RWread },
 	{ "SDL_RWwrite", (uintptr_t)&SDL_RWwrite },
@@ -1512,9 +1682,9 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_SetEventFilter", (uintptr_t)&SDL_SetEventFilter },
 	{ "SDL_SetHint", (uintptr_t)&SDL_SetHint },
 	{ "SDL_SetMainReady_REAL", (uintptr_t)&SDL_SetMainReady },
-	{ "SDL_SetRenderDrawBlendMode", (uintptr_t)&SDL_SetRenderDrawBlendMode },
-	{ "SDL_SetRenderDrawColor", (uintptr_t)&SDL_SetRenderDrawColor },
-	{ "SDL_SetRenderTarget", (uintptr_t)&SDL_SetRenderTarget },
+	{ "SDL_SetRenderDrawBlendMode", (uintptr_t)&SDL_SetRenderDrawBlendMode_hook },
+	{ "SDL_SetRenderDrawColor", (uintptr_t)&SDL_SetRenderDrawColor_hook },
+	{ "SDL_SetRenderTarget", (uintptr_t)&SDL_SetRenderTarget_hook },
 	{ "SDL_SetTextureBlendMode", (uintptr_t)&SDL_SetTextureBlendMode },
 	{ "SDL_SetTextureColorMod", (uintptr_t)&SDL_SetTextureColorMod },
 	{ "SDL_ShowCursor", (uintptr_t)&SDL_ShowCursor },
@@ -1524,7 +1694,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_strdup", (uintptr_t)&SDL_strdup },
 	{ "SDL_UnlockMutex", (uintptr_t)&SDL_UnlockMutex },
 	{ "SDL_UnlockSurface", (uintptr_t)&SDL_UnlockSurface },
-	{ "SDL_UpdateTexture", (uintptr_t)&SDL_UpdateTexture },
+	{ "SDL_UpdateTexture", (uintptr_t)&SDL_UpdateTexture_hook },
 	{ "SDL_UpperBlit", (uintptr_t)&SDL_UpperBlit },
 	{ "SDL_WaitThread", (uintptr_t)&SDL_WaitThread },
 	{ "SDL_GetKeyFromScancode", (uintptr_t)&SDL_GetKeyFromScancode },
@@ -1566,7 +1736,7 @@ static so_default_dynlib default_dynlib[] = {
 	{ "SDL_JoystickGetDeviceGUID", (uintptr_t)&SDL_JoystickGetDeviceGUID },
 	{ "SDL_GameControllerNameForIndex", (uintptr_t)&SDL_GameControllerNameForIndex },
 	{ "SDL_GetWindowFromID", (uintptr_t)&SDL_GetWindowFromID },
-	{ "SDL_GL_SwapWindow", (uintptr_t)&SDL_GL_SwapWindow },
+	{ "SDL_GL_SwapWindow", (uintptr_t)&SDL_GL_SwapWindow_hook },
 	{ "SDL_SetMainReady", (uintptr_t)&SDL_SetMainReady },
 	{ "SDL_NumAccelerometers", (uintptr_t)&ret0 },
 	{ "SDL_AndroidGetJNIEnv", (uintptr_t)&Android_JNI_GetEnv },
@@ -1588,182 +1758,29 @@ static so_default_dynlib default_dynlib[] = {
 };
 static size_t numhooks = sizeof(default_dynlib) / sizeof(*default_dynlib);
 
-int check_kubridge(void) {
-	int search_unk[2];
-	return _vshKernelSearchModuleByName("kubridge", search_unk);
-}
-
-enum MethodIDs {
-	UNKNOWN = 0,
-	INIT,
-	GET_SCREEN_WIDTH_DPI,
-} MethodIDs;
-
-typedef struct {
-	char *name;
-	enum MethodIDs id;
-} NameToMethodID;
-
-static NameToMethodID name_to_method_ids[] = {
-	{ "<init>", INIT },
-	{ "getScreenWidthDPI", GET_SCREEN_WIDTH_DPI },
-};
-
-int GetMethodID(void *env, void *class, const char *name, const char *sig) {
-	printf("GetMethodID: %s\n", name);
-
-	for (int i = 0; i < sizeof(name_to_method_ids) / sizeof(NameToMethodID); i++) {
-		if (strcmp(name, name_to_method_ids[i].name) == 0) {
-			return name_to_method_ids[i].id;
+// Entry points fetched at runtime have to land on the same hooks as the imported ones
+void *SDL_GL_GetProcAddress_fake(const char *symbol) {
+	dlog("looking for symbol %s\n", symbol);
+	for (size_t i = 0; i < gl_numhook; ++i) {
+		if (!strcmp(symbol, gl_hook[i].symbol)) {
+			return (void *)gl_hook[i].func;
 		}
 	}
-
-	return UNKNOWN;
-}
-
-int GetStaticMethodID(void *env, void *class, const char *name, const char *sig) {
-	printf("GetStaticMethodID: %s\n", name);
-	
-	for (int i = 0; i < sizeof(name_to_method_ids) / sizeof(NameToMethodID); i++) {
-		if (strcmp(name, name_to_method_ids[i].name) == 0)
-			return name_to_method_ids[i].id;
-	}
-
-	return UNKNOWN;
-}
-
-void CallStaticVoidMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-}
-
-int CallStaticBooleanMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-	switch (methodID) {
-	default:
-		return 0;
-	}
-}
-
-int CallStaticIntMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-	switch (methodID) {
-	default:
-		return 0;	
-	}
-}
-
-int64_t CallStaticLongMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-	switch (methodID) {
-	case GET_SCREEN_WIDTH_DPI:
-		return 200;
-	default:
-		return 0;	
-	}
-}
-
-uint64_t CallLongMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-	return -1;
-}
-
-void *FindClass(void) {
-	return (void *)0x41414141;
-}
-
-void *NewGlobalRef(void *env, char *str) {
-	return (void *)0x42424242;
-}
-
-void DeleteGlobalRef(void *env, char *str) {
-}
-
-void *NewObjectV(void *env, void *clazz, int methodID, uintptr_t args) {
-	return (void *)0x43434343;
-}
-
-void *GetObjectClass(void *env, void *obj) {
-	return (void *)0x44444444;
-}
-
-char *NewStringUTF(void *env, char *bytes) {
-	return bytes;
-}
-
-char *GetStringUTFChars(void *env, char *string, int *isCopy) {
-	return string;
-}
-
-size_t GetStringUTFLength(void *env, char *string) {
-	return strlen(string);	
-}
-
-int GetJavaVM(void *env, void **vm) {
-	*vm = fake_vm;
-	return 0;
-}
-
-int GetFieldID(void *env, void *clazz, const char *name, const char *sig) {
-	return 0;
-}
-
-int GetBooleanField(void *env, void *obj, int fieldID) {
-	return 0;
-}
-
-void *CallObjectMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-	switch (methodID) {
-	default:
-		return NULL;
-	}
-}
-
-int CallBooleanMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-	switch (methodID) {
-	default:
-		return 0;
-	}
-}
-
-void CallVoidMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-	switch (methodID) {
-	default:
-		break;
-	}
-}
-
-int GetStaticFieldID(void *env, void *clazz, const char *name, const char *sig) {
-	return 0;
-}
-
-void *GetStaticObjectField(void *env, void *clazz, int fieldID) {
-	switch (fieldID) {
-	default:
-		return NULL;
+	for (size_t i = 0; i < numhooks; ++i) {
+		if (!strcmp(symbol, default_dynlib[i].symbol)) {
+			return (void *)default_dynlib[i].func;
+		}
 	}
-}
-
-void GetStringUTFRegion(void *env, char *str, size_t start, size_t len, char *buf) {
-	sceClibMemcpy(buf, &str[start], len);
-	buf[len] = 0;
-}
-
-void *CallStaticObjectMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-	return NULL;
-}
-
-int GetIntField(void *env, void *obj, int fieldID) { return 0; }
-
-float GetFloatField(void *env, void *obj, int fieldID) {
-	switch (fieldID) {
-	default:
-		return 0.0f;
+	void *r = vglGetProcAddress(symbol);
+	if (!r) {
+		dlog("Cannot find symbol %s\n", symbol);
 	}
+	return r;
 }
 
-float CallStaticFloatMethodV(void *env, void *obj, int methodID, uintptr_t *args) {
-	switch (methodID) {
-	default:
-		if (methodID != UNKNOWN) {
-			dlog("CallStaticDoubleMethodV(%d)\n", methodID);
-		}
-		return 0;
-	}
+int check_kubridge(void) {
+	int search_unk[2];
+	return _vshKernelSearchModuleByName("kubridge", search_unk);
 }
 
 /*int crasher(unsigned int argc, void *argv) {
@@ -1809,13 +1826,20 @@ int main(int argc, char *argv[]) {
 	//sceSysmoduleLoadModule(SCE_SYSMODULE_RAZOR_CAPTURE);
 	
 	sceIoMkdir("ux0:data/canada/prefs", 0777);
+	save_writer_init();
+	mem_plan plan;
+	mem_plan_load(&plan);
+	mem_alloc_init(plan.slab_bytes);
+	io_trace_init();
+	music_stream_init();
+	gl_trace_init();
+	rng_init();
 	
 	sceTouchSetSamplingState(SCE_TOUCH_PORT_FRONT, SCE_TOUCH_SAMPLING_STATE_START);
 
-	scePowerSetArmClockFrequency(444);
-	scePowerSetBusClockFrequency(222);
-	scePowerSetGpuClockFrequency(222);
-	scePowerSetGpuXbarClockFrequency(166);
+	perf_profile profile;
+	int has_profile = perf_profile_load(&profile);
+	perf_profile_apply_clocks(&profile);
 
 	if (check_kubridge() < 0)
 		fatal_error("Error kubridge.skprx is not installed.");
@@ -1827,52 +1851,28 @@ int main(int argc, char *argv[]) {
 	if (so_file_load(&canada_mod, DATA_PATH "/libmain.so", LOAD_ADDRESS) < 0)
 		fatal_error("Error could not load %s.", DATA_PATH "/libmain.so");
 	so_relocate(&canada_mod);
+	math_bind_apply(default_dynlib, numhooks);
 	so_resolve(&canada_mod, default_dynlib, sizeof(default_dynlib), 0);
-
-	vglInitExtended(0, SCREEN_W, SCREEN_H, MEMORY_VITAGL_THRESHOLD_MB * 1024 * 1024, SCE_GXM_MULTISAMPLE_4X);
+	mem_profile_init(&canada_mod);
+
+#ifdef PERF_CALIBRATION
+	// Holding L+R at boot runs the calibration again
+	SceCtrlData pad;
+	sceCtrlPeekBufferPositive(0, &pad, 1);
+	if (!has_profile || (pad.buttons & (SCE_CTRL_LTRIGGER | SCE_CTRL_RTRIGGER)) == (SCE_CTRL_LTRIGGER | SCE_CTRL_RTRIGGER)) {
+		perf_profile_calibrate(&profile);
+		perf_profile_apply_clocks(&profile);
+	}
+#endif
+	vglInitExtended(0, SCREEN_W, SCREEN_H, plan.vgl_threshold, profile.msaa);
+	gl_dynres_set_max_scale(profile.scale);
+	frame_pacer_set_cap(profile.fps);
 	
 	patch_game();
 	so_flush_caches(&canada_mod);
 	so_initialize(&canada_mod);
 	
-	memset(fake_vm, 'A', sizeof(fake_vm));
-	*(uintptr_t *)(fake_vm + 0x00) = (uintptr_t)fake_vm; // just point to itself...
-	*(uintptr_t *)(fake_vm + 0x10) = (uintptr_t)ret0;
-	*(uintptr_t *)(fake_vm + 0x14) = (uintptr_t)ret0;
-	*(uintptr_t *)(fake_vm + 0x18) = (uintptr_t)GetEnv;
-
-	memset(fake_env, 'A', sizeof(fake_env));
-	*(uintptr_t *)(fake_env + 0x00) = (uintptr_t)fake_env; // just point to itself...
-	*(uintptr_t *)(fake_env + 0x18) = (uintptr_t)FindClass;
-	*(uintptr_t *)(fake_env + 0x54) = (uintptr_t)NewGlobalRef;
-	*(uintptr_t *)(fake_env + 0x58) = (uintptr_t)DeleteGlobalRef;
-	*(uintptr_t *)(fake_env + 0x5C) = (uintptr_t)ret0; // DeleteLocalRef
-	*(uintptr_t *)(fake_env + 0x74) = (uintptr_t)NewObjectV;
-	*(uintptr_t *)(fake_env + 0x7C) = (uintptr_t)GetObjectClass;
-	*(uintptr_t *)(fake_env + 0x84) = (uintptr_t)GetMethodID;
-	*(uintptr_t *)(fake_env + 0x8C) = (uintptr_t)CallObjectMethodV;
-	*(uintptr_t *)(fake_env + 0x98) = (uintptr_t)CallBooleanMethodV;
-	*(uintptr_t *)(fake_env + 0xD4) = (uintptr_t)CallLongMethodV;
-	*(uintptr_t *)(fake_env + 0xF8) = (uintptr_t)CallVoidMethodV;
-	*(uintptr_t *)(fake_env + 0x178) = (uintptr_t)GetFieldID;
-	*(uintptr_t *)(fake_env + 0x17C) = (uintptr_t)GetBooleanField;
-	*(uintptr_t *)(fake_env + 0x190) = (uintptr_t)GetIntField;
-	*(uintptr_t *)(fake_env + 0x198) = (uintptr_t)GetFloatField;
-	*(uintptr_t *)(fake_env + 0x1C4) = (uintptr_t)GetStaticMethodID;
-	*(uintptr_t *)(fake_env + 0x1CC) = (uintptr_t)CallStaticObjectMethodV;
-	*(uintptr_t *)(fake_env + 0x1D8) = (uintptr_t)CallStaticBooleanMethodV;
-	*(uintptr_t *)(fake_env + 0x208) = (uintptr_t)CallStaticIntMethodV;
-	*(uintptr_t *)(fake_env + 0x21C) = (uintptr_t)CallStaticLongMethodV;
-	*(uintptr_t *)(fake_env + 0x220) = (uintptr_t)CallStaticFloatMethodV;
-	*(uintptr_t *)(fake_env + 0x238) = (uintptr_t)CallStaticVoidMethodV;
-	*(uintptr_t *)(fake_env + 0x240) = (uintptr_t)GetStaticFieldID;
-	*(uintptr_t *)(fake_env + 0x244) = (uintptr_t)GetStaticObjectField;
-	*(uintptr_t *)(fake_env + 0x29C) = (uintptr_t)NewStringUTF;
-	*(uintptr_t *)(fake_env + 0x2A0) = (uintptr_t)GetStringUTFLength;
-	*(uintptr_t *)(fake_env + 0x2A4) = (uintptr_t)GetStringUTFChars;
-	*(uintptr_t *)(fake_env + 0x2A8) = (uintptr_t)ret0;
-	*(uintptr_t *)(fake_env + 0x36C) = (uintptr_t)GetJavaVM;
-	*(uintptr_t *)(fake_env + 0x374) = (uintptr_t)GetStringUTFRegion;
+	jni_env_init();
 	
 	// Disabling touchpads
 	SDL_setenv("VITA_DISABLE_TOUCH_BACK", "1", 1);
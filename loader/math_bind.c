@@ -0,0 +1,473 @@
+/* math_bind.c -- binds the game's float math to the fastest accurate enough implementation
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * On the first boot every candidate (newlib, math-neon and the versions
+ * below) runs over the same inputs. Its largest error is measured against
+ * libm's double precision result, over the range games use and over random
+ * bit patterns from the whole float range, and its speed is timed on the
+ * former. The fastest candidate within MATH_MAX_ULP on both gets bound, and
+ * the choices are kept in math_bind.cfg for the next boots. Polynomials for sinf, cosf, atanf, expf and logf
+ * come from Cephes, with the range reductions of the first three done in
+ * doubles. powf works in doubles so its error stays under an ulp whatever
+ * the exponent.
+ *
+ * The file also builds on the host for tools/math_check.c.
+ */
+
+#ifdef __vita__
+#include <vitasdk.h>
+#include <math_neon.h>
+#endif
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __vita__
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#else
+#define MATH_MAX_ULP 2
+#endif
+#include "math_bind.h"
+
+#define MAX_IMPLS 4
+#define BOOT_SAMPLES 2048
+#define BOOT_REPS 4
+
+#define FOPI 1.27323954473516f // 4 / pi
+#define LOG2EF 1.44269504088896341f
+#define LN2_HI 0.693359375f
+#define LN2_LO -2.12194440e-4f
+#define SQRTHF 0.707106781186547524f
+#define PI 3.14159265358979323846
+#define PIO2 1.57079632679489661923
+#define PIO4 0.78539816339744830962
+#define PIO4_HI 0x1.921fb544p-1 // pi / 4 in 32 bits, and the rest
+#define PIO4_LO 3.038550253253096e-11
+#define LN2 0.69314718055994530942
+#define LOG2E 1.44269504088896340736
+
+typedef struct {
+	const char *name;
+	uintptr_t func;
+	float range_ulp; // over the timed inputs
+	float max_ulp;   // anywhere
+	float ns;        // per call
+} math_impl;
+
+typedef struct {
+	const char *symbol;
+	int args;
+	double (*exact1)(double);
+	double (*exact2)(double, double);
+	float lo, hi;   // first argument
+	int log_scale;  // sampled evenly in magnitude rather than value
+	float lo2, hi2; // second argument
+	math_impl impls[MAX_IMPLS];
+	int chosen;
+} math_func;
+
+#ifdef __vita__
+#define NEON_IMPL(f) { "math-neon", (uintptr_t)&f##_neon },
+#define LIBM_NAME "newlib"
+#else
+#define NEON_IMPL(f)
+#define LIBM_NAME "glibc"
+#endif
+
+static math_func funcs[] = {
+	{ "sinf", 1, sin, NULL, -100.0f, 100.0f, 0, 0, 0,
+		{ { LIBM_NAME, (uintptr_t)&sinf }, NEON_IMPL(sinf) { "loader", (uintptr_t)&math_bind_sinf } } },
+	{ "cosf", 1, cos, NULL, -100.0f, 100.0f, 0, 0, 0,
+		{ { LIBM_NAME, (uintptr_t)&cosf }, NEON_IMPL(cosf) { "loader", (uintptr_t)&math_bind_cosf } } },
+	{ "atan2f", 2, NULL, atan2, -1000.0f, 1000.0f, 0, -1000.0f, 1000.0f,
+		{ { LIBM_NAME, (uintptr_t)&atan2f }, NEON_IMPL(atan2f) { "loader", (uintptr_t)&math_bind_atan2f } } },
+	{ "sqrtf", 1, sqrt, NULL, 1e-6f, 1e6f, 1, 0, 0,
+		{ { LIBM_NAME, (uintptr_t)&sqrtf }, NEON_IMPL(sqrtf) { "vfp", (uintptr_t)&math_bind_sqrtf } } },
+	{ "powf", 2, NULL, pow, 1e-3f, 1e3f, 1, -8.0f, 8.0f,
+		{ { LIBM_NAME, (uintptr_t)&powf }, NEON_IMPL(powf) { "loader", (uintptr_t)&math_bind_powf } } },
+	{ "expf", 1, exp, NULL, -80.0f, 80.0f, 0, 0, 0,
+		{ { LIBM_NAME, (uintptr_t)&expf }, NEON_IMPL(expf) { "loader", (uintptr_t)&math_bind_expf } } },
+	{ "logf", 1, log, NULL, 1e-20f, 1e20f, 1, 0, 0,
+		{ { LIBM_NAME, (uintptr_t)&logf }, NEON_IMPL(logf) { "loader", (uintptr_t)&math_bind_logf } } },
+};
+#define FUNCS_NUM (sizeof(funcs) / sizeof(*funcs))
+
+static inline uint32_t float_bits(float f) {
+	union { float f; uint32_t i; } u = { f };
+	return u.i;
+}
+
+static inline float bits_float(uint32_t i) {
+	union { uint32_t i; float f; } u = { i };
+	return u.f;
+}
+
+// Polynomials on [-pi/4, pi/4], after the argument was brought there
+static inline float sin_poly(float x, float z) {
+	return ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * x + x;
+}
+
+static inline float cos_poly(float z) {
+	return ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z - 0.5f * z + 1.0f;
+}
+
+// Octant of |x| and what's left of it in [-pi/4, pi/4]. j * PIO4_HI is exact up to 8192,
+// so results near a zero crossing keep their bits
+static inline int reduce(float x, float *r) {
+	int j = FOPI * x;
+	if (j & 1)
+		j++;
+	*r = ((double)x - j * PIO4_HI) - j * PIO4_LO;
+	return j & 7;
+}
+
+float math_bind_sinf(float x) {
+	float a = fabsf(x);
+	if (!(a <= 8192.0f)) // Past this the reduction loses bits, also catches NaN
+		return sinf(x);
+	int j = reduce(a, &a);
+	int neg = x < 0.0f;
+	if (j > 3) {
+		neg = !neg;
+		j -= 4;
+	}
+	float z = a * a;
+	float r = (j == 1 || j == 2) ? cos_poly(z) : sin_poly(a, z);
+	return neg ? -r : r;
+}
+
+float math_bind_cosf(float x) {
+	float a = fabsf(x);
+	if (!(a <= 8192.0f))
+		return cosf(x);
+	int j = reduce(a, &a);
+	int neg = 0;
+	if (j > 3) {
+		neg = 1;
+		j -= 4;
+	}
+	if (j > 1)
+		neg = !neg;
+	float z = a * a;
+	float r = (j == 1 || j == 2) ? sin_poly(a, z) : cos_poly(z);
+	return neg ? -r : r;
+}
+
+float math_bind_atan2f(float y, float x) {
+	// Zeros, infinities and NaNs have their own rules
+	if (y == 0.0f || x == 0.0f || !isfinite(x) || !isfinite(y))
+		return atan2f(y, x);
+
+	// The quotient, the reduction and the final sum are in doubles, only the polynomial isn't
+	double q = (double)y / x, a = fabs(q), base = 0.0;
+	if (a > 2.414213562373095) {
+		base = PIO2;
+		a = -1.0 / a;
+	} else if (a > 0.4142135623730950) {
+		base = PIO4;
+		a = (a - 1.0) / (a + 1.0);
+	}
+	float f = a, z = f * f;
+	double r = base + (double)((((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * f) + a;
+	if (q < 0.0)
+		r = -r;
+	if (x < 0.0f)
+		r += y < 0.0f ? -PI : PI;
+	return r;
+}
+
+// With math errno GCC still emits vsqrt and only calls sqrtf for negative inputs
+float math_bind_sqrtf(float x) {
+	return __builtin_sqrtf(x);
+}
+
+float math_bind_expf(float x) {
+	if (!(x >= -87.0f && x <= 88.0f)) // Denormal results, overflow and NaN
+		return expf(x);
+	float t = LOG2EF * x + 0.5f;
+	int n = t;
+	if (t < n)
+		n--;
+	x = x - n * LN2_HI - n * LN2_LO;
+	float z = x * x;
+	float p = (((((1.9875691500e-4f * x + 1.3981999507e-3f) * x + 8.3334519073e-3f) * x + 4.1665795894e-2f) * x + 1.6666665459e-1f) * x +
+		5.0000001201e-1f) * z + x + 1.0f;
+	return p * bits_float((uint32_t)(n + 127) << 23);
+}
+
+float math_bind_logf(float x) {
+	uint32_t i = float_bits(x);
+	if (i - 0x00800000u >= 0x7F000000u) // Zero, negatives, denormals, infinity and NaN
+		return logf(x);
+	int e = (int)(i >> 23) - 126;
+	x = bits_float((i & 0x007FFFFF) | 0x3F000000); // [0.5, 1)
+	if (x < SQRTHF) {
+		e--;
+		x = x + x - 1.0f;
+	} else
+		x = x - 1.0f;
+	float z = x * x;
+	float y = ((((((((7.0376836292e-2f * x - 1.1514610310e-1f) * x + 1.1676998740e-1f) * x - 1.2420140846e-1f) * x + 1.4249322787e-1f) * x -
+		1.6668057665e-1f) * x + 2.0000714765e-1f) * x - 2.4999993993e-1f) * x + 3.3333331174e-1f) * x * z;
+	float fe = e;
+	y += LN2_LO * fe;
+	y += -0.5f * z;
+	z = x + y;
+	z += LN2_HI * fe;
+	return z;
+}
+
+float math_bind_powf(float x, float y) {
+	uint32_t i = float_bits(x);
+	if (i - 0x00800000u >= 0x7F000000u || !isfinite(y))
+		return powf(x, y);
+
+	// ln(x) = e ln 2 + 2 atanh(s) with s = (m - 1) / (m + 1), m in [sqrt(0.5), sqrt(2)]
+	int e = (int)(i >> 23) - 127;
+	double m = bits_float((i & 0x007FFFFF) | 0x3F800000);
+	if (m > 1.41421356237309504880) {
+		m *= 0.5;
+		e++;
+	}
+	double s = (m - 1.0) / (m + 1.0), s2 = s * s;
+	double l = s * (2.0 + s2 * (2.0 / 3 + s2 * (2.0 / 5 + s2 * (2.0 / 7 + s2 * (2.0 / 9 + s2 * (2.0 / 11 + s2 * (2.0 / 13)))))));
+	double t = y * (l + e * LN2);
+	if (!(t > -87.0 && t < 88.0))
+		return powf(x, y);
+
+	// exp(t) = 2^k exp(r), |r| <= ln(2) / 2
+	int k = t * LOG2E + (t < 0.0 ? -0.5 : 0.5);
+	double r = t - k * LN2;
+	double p = 1.0 + r * (1.0 + r * (1.0 / 2 + r * (1.0 / 6 + r * (1.0 / 24 + r * (1.0 / 120 + r * (1.0 / 720 + r * (1.0 / 5040 +
+		r * (1.0 / 40320 + r * (1.0 / 362880)))))))));
+	union { uint64_t i; double d; } scale = { (uint64_t)(k + 1023) << 52 };
+	return p * scale.d;
+}
+
+float math_bind_ulp(float r, double exact) {
+	if (isnan(exact))
+		return isnan(r) ? 0.0f : INFINITY;
+	if (isinf((float)exact) || isinf(r))
+		return r == (float)exact ? 0.0f : INFINITY;
+	int e = exact != 0.0 ? ilogb(exact) : -126;
+	if (e < -126)
+		e = -126;
+	return fabs(r - exact) / ldexp(1.0, e - 23);
+}
+
+static uint64_t now_ns(void) {
+#ifdef __vita__
+	return sceKernelGetProcessTimeWide() * 1000;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// Inputs every candidate must handle, besides random bit patterns
+static const float specials[] = { 0.0f, -0.0f, 1e-45f, -1e-45f, 1.17549435e-38f, 1.0f, -1.0f, 8192.0f, -8192.0f, 88.0f, -87.0f, 3.40282347e38f,
+	-3.40282347e38f, INFINITY, -INFINITY, NAN };
+#define SPECIALS_NUM (sizeof(specials) / sizeof(*specials))
+
+static inline uint32_t random_bits(uint32_t *seed) {
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	return *seed;
+}
+
+static float sample(uint32_t *seed, float lo, float hi, int log_scale) {
+	*seed = *seed * 1664525 + 1013904223;
+	float u = (*seed >> 8) * (1.0f / 16777216.0f);
+	if (log_scale)
+		return expf(logf(lo) + u * (logf(hi) - logf(lo)));
+	return lo + u * (hi - lo);
+}
+
+static void measure(math_func *f, math_impl *impl, const float *xs, const float *ys, const double *exact, int samples, int reps) {
+	volatile float sink = 0.0f;
+	float worst = 0.0f;
+	uint64_t start;
+	if (f->args == 1) {
+		float (*fn)(float) = (float (*)(float))impl->func;
+		for (int i = 0; i < samples; i++) {
+			float err = math_bind_ulp(fn(xs[i]), exact[i]);
+			if (err > worst)
+				worst = err;
+		}
+		start = now_ns();
+		for (int r = 0; r < reps; r++) {
+			for (int i = 0; i < samples; i++)
+				sink = fn(xs[i]);
+		}
+	} else {
+		float (*fn)(float, float) = (float (*)(float, float))impl->func;
+		for (int i = 0; i < samples; i++) {
+			float err = math_bind_ulp(fn(xs[i], ys[i]), exact[i]);
+			if (err > worst)
+				worst = err;
+		}
+		start = now_ns();
+		for (int r = 0; r < reps; r++) {
+			for (int i = 0; i < samples; i++)
+				sink = fn(xs[i], ys[i]);
+		}
+	}
+	impl->ns = (float)(now_ns() - start) / ((uint64_t)samples * reps);
+	impl->range_ulp = worst;
+	(void)sink;
+}
+
+// Largest error anywhere: the special values, then random bit patterns of every sign and magnitude
+static float domain_error(math_func *f, math_impl *impl, int samples) {
+	uint32_t seed = 0x9E3779B9;
+	float worst = 0.0f;
+	if (f->args == 1) {
+		float (*fn)(float) = (float (*)(float))impl->func;
+		for (int i = 0; i < SPECIALS_NUM + samples; i++) {
+			float x = i < SPECIALS_NUM ? specials[i] : bits_float(random_bits(&seed));
+			float err = math_bind_ulp(fn(x), f->exact1(x));
+			if (err > worst)
+				worst = err;
+		}
+	} else {
+		float (*fn)(float, float) = (float (*)(float, float))impl->func;
+		for (int i = 0; i < SPECIALS_NUM * SPECIALS_NUM + samples; i++) {
+			float x, y;
+			if (i < SPECIALS_NUM * SPECIALS_NUM) {
+				x = specials[i / SPECIALS_NUM];
+				y = specials[i % SPECIALS_NUM];
+			} else {
+				x = bits_float(random_bits(&seed));
+				y = bits_float(random_bits(&seed));
+			}
+			float err = math_bind_ulp(fn(x, y), f->exact2(x, y));
+			if (err > worst)
+				worst = err;
+		}
+	}
+	return worst;
+}
+
+void math_bind_select(int samples, int reps) {
+	float *xs = malloc(samples * sizeof(float)), *ys = malloc(samples * sizeof(float));
+	double *exact = malloc(samples * sizeof(double));
+	for (int n = 0; n < FUNCS_NUM; n++) {
+		math_func *f = &funcs[n];
+		uint32_t seed = n + 1;
+		for (int i = 0; i < samples; i++) {
+			xs[i] = sample(&seed, f->lo, f->hi, f->log_scale);
+			ys[i] = f->args == 2 ? sample(&seed, f->lo2, f->hi2, 0) : 0.0f;
+			exact[i] = f->args == 1 ? f->exact1(xs[i]) : f->exact2(xs[i], ys[i]);
+		}
+
+		// Falls back on libm when nothing else is accurate enough
+		f->chosen = 0;
+		for (int i = 0; i < MAX_IMPLS && f->impls[i].name; i++) {
+			measure(f, &f->impls[i], xs, ys, exact, samples, reps);
+			float anywhere = domain_error(f, &f->impls[i], samples * 4);
+			f->impls[i].max_ulp = anywhere > f->impls[i].range_ulp ? anywhere : f->impls[i].range_ulp;
+			if (f->impls[i].max_ulp <= MATH_MAX_ULP && f->impls[i].ns < f->impls[f->chosen].ns)
+				f->chosen = i;
+		}
+	}
+	free(xs);
+	free(ys);
+	free(exact);
+}
+
+void math_bind_report(FILE *f) {
+	fprintf(f, "function  implementation  range ulp    max ulp   ns/call\n");
+	for (int n = 0; n < FUNCS_NUM; n++) {
+		math_func *fn = &funcs[n];
+		for (int i = 0; i < MAX_IMPLS && fn->impls[i].name; i++) {
+			math_impl *impl = &fn->impls[i];
+			fprintf(f, "%-9s %-14s %10.2f %10.2f %9.1f%s\n", i ? "" : fn->symbol, impl->name, impl->range_ulp, impl->max_ulp, impl->ns,
+				i == fn->chosen ? "  <- bound" : (impl->max_ulp > MATH_MAX_ULP ? "  (not accurate enough)" : ""));
+		}
+	}
+	fprintf(f, "\naccepted error: %d ulp, anywhere in the float range\n", MATH_MAX_ULP);
+}
+
+#ifdef __vita__
+#define MATH_CONFIG DATA_PATH "/math_bind.cfg"
+
+#ifdef MATH_BINDING
+static int binding_enabled = 1;
+#else
+static int binding_enabled = 0;
+#endif
+
+// Timings vary from boot to boot, the first choices are kept so that every session runs the same math
+static int choices_load(void) {
+	FILE *f = save_writer_fopen(MATH_CONFIG, "r");
+	if (!f)
+		return 0;
+	uint32_t found = 0;
+	char line[64], name[32];
+	while (fgets(line, sizeof(line), f)) {
+		char *eq = strchr(line, '=');
+		if (!eq || sscanf(eq + 1, "%31s", name) != 1)
+			continue;
+		*eq = 0;
+		for (int n = 0; n < FUNCS_NUM; n++) {
+			if (strcmp(funcs[n].symbol, line))
+				continue;
+			for (int i = 0; i < MAX_IMPLS && funcs[n].impls[i].name; i++) {
+				if (!strcmp(funcs[n].impls[i].name, name)) {
+					funcs[n].chosen = i;
+					found |= 1 << n;
+				}
+			}
+		}
+	}
+	fclose(f);
+	return found == (1 << FUNCS_NUM) - 1;
+}
+
+static void choices_save(void) {
+	FILE *f = save_writer_fopen(MATH_CONFIG, "w");
+	if (!f)
+		return;
+	for (int n = 0; n < FUNCS_NUM; n++)
+		fprintf(f, "%s=%s\n", funcs[n].symbol, funcs[n].impls[funcs[n].chosen].name);
+	fclose(f);
+}
+
+void math_bind_apply(so_default_dynlib *dynlib, size_t num) {
+	if (!binding_enabled)
+		return;
+
+	if (choices_load()) {
+		debugPrintf("math_bind: using the choices in %s\n", MATH_CONFIG);
+	} else {
+		uint64_t start = sceKernelGetProcessTimeWide();
+		math_bind_select(BOOT_SAMPLES, BOOT_REPS);
+		debugPrintf("math_bind: measured in %llu ms\n", (sceKernelGetProcessTimeWide() - start) / 1000);
+		choices_save();
+		FILE *f = save_writer_fopen(DATA_PATH "/math_bind.txt", "w");
+		if (f) {
+			math_bind_report(f);
+			fclose(f);
+		}
+	}
+
+	for (int n = 0; n < FUNCS_NUM; n++) {
+		for (size_t i = 0; i < num; i++) {
+			if (!strcmp(dynlib[i].symbol, funcs[n].symbol))
+				dynlib[i].func = funcs[n].impls[funcs[n].chosen].func;
+		}
+	}
+}
+#endif
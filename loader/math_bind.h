@@ -0,0 +1,26 @@
+#ifndef __MATH_BIND_H__
+#define __MATH_BIND_H__
+
+#include <stdio.h>
+
+#ifdef __vita__
+#include "so_util.h"
+#endif
+
+// The loader's own versions, they go back to libm for inputs outside their range
+float math_bind_sinf(float x);
+float math_bind_cosf(float x);
+float math_bind_atan2f(float y, float x);
+float math_bind_sqrtf(float x);
+float math_bind_powf(float x, float y);
+float math_bind_expf(float x);
+float math_bind_logf(float x);
+
+float math_bind_ulp(float r, double exact);
+void math_bind_select(int samples, int reps);
+void math_bind_report(FILE *f);
+#ifdef __vita__
+void math_bind_apply(so_default_dynlib *dynlib, size_t num);
+#endif
+
+#endif
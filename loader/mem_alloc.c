@@ -0,0 +1,612 @@
+/* mem_alloc.c -- size class slab allocator behind the game's malloc family
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Blocks up to SMALL_MAX bytes come from 64 KB slabs carved out of a single
+ * region, each slab serving one size class. Threads keep a few free blocks of
+ * every class for themselves and only lock to trade them in batches. Anything
+ * bigger goes to newlib, which then only sees long lived large blocks.
+ *
+ * The file also builds on the host for tools/mem_replay.c.
+ */
+
+#ifdef __vita__
+#include <vitasdk.h>
+#endif
+#include <pthread.h>
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __vita__
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#include "mem_profile.h"
+#endif
+#include "mem_alloc.h"
+
+#define SLAB_SIZE (64 * 1024)
+#define SMALL_MAX 2048
+#define CLASSES_NUM 24
+#define CLASS_NONE 0xFFFF
+#define MAX_THREAD_CACHES 32
+#define CACHE_BATCH_BYTES 4096 // What a thread cache takes from the slabs at once, it gives back as much past twice that
+#define TRACE_BUF_SIZE (64 * 1024)
+#define TRACE_FLUSH_US (1000 * 1000)
+#define STATS_INTERVAL 600
+#define REPORT_INTERVAL_US (10 * 1000000)
+
+#ifndef MEMORY_SLAB_MB
+#define MEMORY_SLAB_MB 32
+#endif
+
+#ifdef __vita__
+#ifdef MEM_SLABS
+static int slabs_enabled = 1;
+#else
+static int slabs_enabled = 0;
+#endif
+static SceUID central_mtx;
+static pthread_key_t cache_key; // hands a thread's cache back when the thread exits
+#define central_lock() sceKernelLockMutex(central_mtx, 1, NULL)
+#define central_unlock() sceKernelUnlockMutex(central_mtx, 1)
+#define thread_id() ((uint32_t)sceKernelGetThreadId())
+#else
+// The replay tool tells which of the traced threads is allocating
+uint32_t mem_replay_thread(void);
+static int slabs_enabled = 1;
+static pthread_mutex_t central_mtx = PTHREAD_MUTEX_INITIALIZER;
+#define central_lock() pthread_mutex_lock(&central_mtx)
+#define central_unlock() pthread_mutex_unlock(&central_mtx)
+#define thread_id() mem_replay_thread()
+#define mem_profile_alloc(...)
+#define mem_profile_free(ptr)
+#endif
+
+typedef struct {
+	void *free;         // blocks given back
+	uint16_t cls;
+	uint16_t used;      // blocks out of the slab, thread caches included
+	uint16_t carved;    // blocks ever handed out, the rest of the slab was never touched
+	uint16_t capacity;
+	int16_t prev, next; // partial list of its class, or the list of empty slabs
+} slab;
+
+typedef struct {
+	void *head;
+	uint32_t count;
+} cache_bin;
+
+typedef struct {
+	volatile uint32_t owner;
+	uint32_t allocs, frees;
+	cache_bin bins[CLASSES_NUM];
+} thread_cache;
+
+// Multiples of 16 so that every block keeps malloc's alignment
+static const uint16_t class_size[CLASSES_NUM] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+	320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+static uint8_t size_class[SMALL_MAX / 16 + 1]; // by (size + 15) / 16
+static uint32_t class_batch[CLASSES_NUM];
+
+static uint8_t *region = NULL;
+static uint32_t region_size = 0;
+static slab *slabs;
+static int slabs_total = 0, slabs_carved = 0, slabs_empty = 0;
+static int16_t partial[CLASSES_NUM]; // slabs with free blocks left
+static int16_t empty = -1;
+static uint32_t central_allocs = 0, central_frees = 0, fallbacks = 0;
+
+static thread_cache caches[MAX_THREAD_CACHES];
+
+static volatile uint32_t large_allocs = 0, large_frees = 0;
+static volatile int64_t large_bytes = 0;
+
+#if defined(__vita__) && defined(MEM_TRACE)
+static SceUID trace_fd = -1, trace_mtx;
+static uint8_t trace_buf[TRACE_BUF_SIZE];
+static size_t trace_len = 0;
+static uint64_t trace_last_flush = 0;
+
+static void trace(int op, void *ptr, uint32_t arg, uint32_t size) {
+	if (trace_fd < 0)
+		return;
+	mem_trace_record r = { thread_id(), (uint32_t)(uintptr_t)ptr, arg, size, op };
+	uint64_t now = sceKernelGetProcessTimeWide();
+	sceKernelLockMutex(trace_mtx, 1, NULL);
+	memcpy(&trace_buf[trace_len], &r, sizeof(r));
+	trace_len += sizeof(r);
+	if (trace_len + sizeof(r) > TRACE_BUF_SIZE || now - trace_last_flush > TRACE_FLUSH_US) {
+		sceIoWrite(trace_fd, trace_buf, trace_len);
+		trace_len = 0;
+		trace_last_flush = now;
+	}
+	sceKernelUnlockMutex(trace_mtx, 1);
+}
+
+static void trace_flush(void) {
+	sceKernelLockMutex(trace_mtx, 1, NULL);
+	sceIoWrite(trace_fd, trace_buf, trace_len);
+	trace_len = 0;
+	sceKernelUnlockMutex(trace_mtx, 1);
+}
+
+static void trace_init(void) {
+	trace_mtx = sceKernelCreateMutex("mem_trace mutex", 0, 0, NULL);
+	trace_fd = sceIoOpen(DATA_PATH "/mem_trace.bin", SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (trace_fd < 0)
+		return;
+	mem_trace_header hdr = { MEM_TRACE_MAGIC, MEM_TRACE_VERSION };
+	sceIoWrite(trace_fd, &hdr, sizeof(hdr));
+	atexit(trace_flush);
+}
+#else
+#define trace(...)
+#endif
+
+static inline int is_small(void *p) {
+	return (uintptr_t)p - (uintptr_t)region < region_size;
+}
+
+static inline slab *slab_of(void *p) {
+	return &slabs[((uint8_t *)p - region) / SLAB_SIZE];
+}
+
+static void partial_push(slab *s) {
+	int16_t idx = s - slabs;
+	s->prev = -1;
+	s->next = partial[s->cls];
+	if (s->next >= 0)
+		slabs[s->next].prev = idx;
+	partial[s->cls] = idx;
+}
+
+static void partial_unlink(slab *s) {
+	if (s->prev >= 0)
+		slabs[s->prev].next = s->next;
+	else
+		partial[s->cls] = s->next;
+	if (s->next >= 0)
+		slabs[s->next].prev = s->prev;
+}
+
+static slab *slab_take(int cls) {
+	int16_t idx;
+	if (empty >= 0) {
+		idx = empty;
+		empty = slabs[idx].next;
+		slabs_empty--;
+	} else if (slabs_carved < slabs_total)
+		idx = slabs_carved++;
+	else
+		return NULL;
+
+	slab *s = &slabs[idx];
+	s->free = NULL;
+	s->cls = cls;
+	s->used = s->carved = 0;
+	s->capacity = SLAB_SIZE / class_size[cls];
+	partial_push(s);
+	return s;
+}
+
+// Links up to n blocks of a class into a list, with central_mtx held
+static uint32_t central_take(int cls, uint32_t n, void **head) {
+	uint32_t got = 0;
+	void *list = NULL;
+	while (got < n) {
+		slab *s = partial[cls] >= 0 ? &slabs[partial[cls]] : slab_take(cls);
+		if (!s)
+			break;
+		while (got < n && s->used < s->capacity) {
+			void *b;
+			if (s->free) {
+				b = s->free;
+				s->free = *(void **)b;
+			} else
+				b = region + (s - slabs) * SLAB_SIZE + s->carved++ * class_size[cls];
+			*(void **)b = list;
+			list = b;
+			s->used++;
+			got++;
+		}
+		if (s->used == s->capacity)
+			partial_unlink(s);
+	}
+	*head = list;
+	return got;
+}
+
+static void central_give(void *b) {
+	slab *s = slab_of(b);
+	if (s->used == s->capacity)
+		partial_push(s);
+	*(void **)b = s->free;
+	s->free = b;
+	// An empty slab can serve any class afterwards, which is what keeps the region from fragmenting
+	if (--s->used == 0) {
+		partial_unlink(s);
+		s->cls = CLASS_NONE;
+		s->next = empty;
+		empty = s - slabs;
+		slabs_empty++;
+	}
+}
+
+static thread_cache *cache_get(void) {
+	uint32_t tid = thread_id();
+	uint32_t slot = (tid * 2654435761u) % MAX_THREAD_CACHES;
+	for (int i = 0; i < MAX_THREAD_CACHES; i++) {
+		thread_cache *c = &caches[(slot + i) % MAX_THREAD_CACHES];
+		if (c->owner == tid)
+			return c;
+		if (!c->owner && __sync_bool_compare_and_swap(&c->owner, 0, tid)) {
+#ifdef __vita__
+			// Owner is set first, so an allocation inside pthread_setspecific finds this cache
+			pthread_setspecific(cache_key, c);
+#endif
+			return c;
+		}
+	}
+	return NULL; // More threads than caches, the rest lock for every block
+}
+
+// Gives every block a cache holds back to the slabs and frees the cache for another thread
+static void cache_release(void *p) {
+	thread_cache *c = p;
+	central_lock();
+	for (int cls = 0; cls < CLASSES_NUM; cls++) {
+		cache_bin *b = &c->bins[cls];
+		while (b->head) {
+			void *n = b->head;
+			b->head = *(void **)n;
+			central_give(n);
+		}
+		b->count = 0;
+	}
+	central_allocs += c->allocs;
+	central_frees += c->frees;
+	c->allocs = c->frees = 0;
+	central_unlock();
+	__sync_lock_release(&c->owner);
+}
+
+void mem_alloc_thread_exit(void) {
+	uint32_t tid = thread_id();
+	for (int i = 0; i < MAX_THREAD_CACHES; i++) {
+		if (caches[i].owner == tid) {
+			cache_release(&caches[i]);
+			return;
+		}
+	}
+}
+
+static void *small_alloc(int cls) {
+	thread_cache *c = cache_get();
+	void *p;
+	if (!c) {
+		central_lock();
+		if (central_take(cls, 1, &p))
+			central_allocs++;
+		central_unlock();
+		return p;
+	}
+
+	cache_bin *b = &c->bins[cls];
+	if (!b->head) {
+		central_lock();
+		b->count = central_take(cls, class_batch[cls], &b->head);
+		central_unlock();
+		if (!b->head)
+			return NULL;
+	}
+	p = b->head;
+	b->head = *(void **)p;
+	b->count--;
+	c->allocs++;
+	return p;
+}
+
+static void small_free(void *p) {
+	thread_cache *c = cache_get();
+	if (!c) {
+		central_lock();
+		central_give(p);
+		central_frees++;
+		central_unlock();
+		return;
+	}
+
+	// A slab with blocks out never changes class, reading it unlocked is fine
+	int cls = slab_of(p)->cls;
+	cache_bin *b = &c->bins[cls];
+	*(void **)p = b->head;
+	b->head = p;
+	c->frees++;
+	if (++b->count > class_batch[cls] * 2) {
+		central_lock();
+		for (uint32_t i = 0; i < class_batch[cls]; i++) {
+			void *n = b->head;
+			b->head = *(void **)n;
+			central_give(n);
+		}
+		central_unlock();
+		b->count -= class_batch[cls];
+	}
+}
+
+static void *large_alloc(size_t size, size_t alignment) {
+	void *p = alignment ? memalign(alignment, size) : malloc(size);
+	if (p) {
+		__sync_fetch_and_add(&large_allocs, 1);
+		__sync_fetch_and_add(&large_bytes, (int64_t)malloc_usable_size(p));
+	}
+	return p;
+}
+
+static void large_free(void *p) {
+	__sync_fetch_and_add(&large_frees, 1);
+	__sync_fetch_and_sub(&large_bytes, (int64_t)malloc_usable_size(p));
+	free(p);
+}
+
+static void *alloc(size_t size) {
+	if (size <= SMALL_MAX && region_size) {
+		void *p = small_alloc(size_class[(size + 15) >> 4]);
+		if (p)
+			return p;
+		__sync_fetch_and_add(&fallbacks, 1);
+	}
+	return large_alloc(size, 0);
+}
+
+void *mem_malloc(size_t size) {
+	void *p = alloc(size);
+	trace(MEM_OP_MALLOC, p, 0, size);
+	mem_profile_alloc(__builtin_return_address(0), p, size);
+	return p;
+}
+
+void *mem_calloc(size_t nmemb, size_t size) {
+	if (size && nmemb > SIZE_MAX / size)
+		return NULL;
+	void *p = alloc(nmemb * size);
+	if (p)
+		memset(p, 0, nmemb * size);
+	trace(MEM_OP_CALLOC, p, 0, nmemb * size);
+	mem_profile_alloc(__builtin_return_address(0), p, nmemb * size);
+	return p;
+}
+
+static void *resize(void *ptr, size_t size) {
+	if (!ptr)
+		return alloc(size);
+
+	void *p;
+	if (is_small(ptr)) {
+		int cls = slab_of(ptr)->cls;
+		size_t have = class_size[cls];
+		// Shrinking keeps the block unless a class half its size would do
+		if (size <= have && (size > have / 2 || cls == 0))
+			return ptr;
+		p = alloc(size);
+		if (!p)
+			return NULL;
+		memcpy(p, ptr, size < have ? size : have);
+		small_free(ptr);
+		return p;
+	}
+
+	if (size > SMALL_MAX || !region_size) {
+		int64_t have = malloc_usable_size(ptr);
+		p = realloc(ptr, size);
+		if (p)
+			__sync_fetch_and_add(&large_bytes, (int64_t)malloc_usable_size(p) - have);
+		return p;
+	}
+	// A large block shrunk to a small size moves to the slabs, it may have come from newlib smaller than that
+	p = alloc(size);
+	if (!p)
+		return NULL;
+	size_t have = malloc_usable_size(ptr);
+	memcpy(p, ptr, size < have ? size : have);
+	large_free(ptr);
+	return p;
+}
+
+void *mem_realloc(void *ptr, size_t size) {
+	void *p = resize(ptr, size);
+	trace(MEM_OP_REALLOC, p, (uint32_t)(uintptr_t)ptr, size);
+	if (p) {
+		mem_profile_free(ptr);
+		mem_profile_alloc(__builtin_return_address(0), p, size);
+	}
+	return p;
+}
+
+void *mem_memalign(size_t alignment, size_t size) {
+	void *p = NULL;
+	if (alignment <= 16)
+		p = alloc(size);
+	else if (size <= SMALL_MAX && region_size && !(alignment & (alignment - 1))) {
+		// Slabs are SLAB_SIZE aligned, so a class that is a multiple of the alignment keeps it for every block
+		for (int cls = size_class[(size + 15) >> 4]; cls < CLASSES_NUM && !p; cls++) {
+			if (class_size[cls] % alignment == 0)
+				p = small_alloc(cls);
+		}
+	}
+	if (!p)
+		p = large_alloc(size, alignment);
+	trace(MEM_OP_MEMALIGN, p, alignment, size);
+	mem_profile_alloc(__builtin_return_address(0), p, size);
+	return p;
+}
+
+void mem_free(void *ptr) {
+	if (!ptr)
+		return;
+	trace(MEM_OP_FREE, ptr, 0, 0);
+	mem_profile_free(ptr);
+	if (is_small(ptr))
+		small_free(ptr);
+	else
+		large_free(ptr);
+}
+
+char *mem_strdup(const char *s) {
+	size_t len = strlen(s) + 1;
+	char *p = alloc(len);
+	if (p)
+		memcpy(p, s, len);
+	trace(MEM_OP_MALLOC, p, 0, len);
+	mem_profile_alloc(__builtin_return_address(0), p, len);
+	return p;
+}
+
+void mem_alloc_init(uint32_t size) {
+	for (int cls = 0, i = 0; i <= SMALL_MAX / 16; i++) {
+		while (class_size[cls] < i * 16)
+			cls++;
+		size_class[i] = cls;
+	}
+	for (int cls = 0; cls < CLASSES_NUM; cls++) {
+		class_batch[cls] = CACHE_BATCH_BYTES / class_size[cls];
+		if (class_batch[cls] < 2)
+			class_batch[cls] = 2;
+		partial[cls] = -1;
+	}
+#ifdef __vita__
+	central_mtx = sceKernelCreateMutex("mem_alloc mutex", 0, 0, NULL);
+	pthread_key_create(&cache_key, cache_release);
+#endif
+#if defined(__vita__) && defined(MEM_TRACE)
+	trace_init();
+#endif
+	if (!slabs_enabled)
+		return;
+
+	slabs_total = (size ? size : MEMORY_SLAB_MB * 1024 * 1024) / SLAB_SIZE;
+	slabs = calloc(slabs_total, sizeof(slab));
+	region = memalign(SLAB_SIZE, slabs_total * SLAB_SIZE);
+	if (!slabs || !region) {
+		free(slabs);
+		free(region);
+		region = NULL;
+		slabs_total = 0;
+		return;
+	}
+	region_size = slabs_total * SLAB_SIZE;
+}
+
+typedef struct {
+	uint32_t slabs, capacity, used, cached;
+} class_usage;
+
+static void gather(mem_alloc_stats *out, class_usage *usage) {
+	memset(out, 0, sizeof(*out));
+	memset(usage, 0, CLASSES_NUM * sizeof(class_usage));
+	central_lock();
+	for (int i = 0; i < slabs_carved; i++) {
+		if (slabs[i].cls == CLASS_NONE)
+			continue;
+		class_usage *u = &usage[slabs[i].cls];
+		u->slabs++;
+		u->capacity += slabs[i].capacity;
+		u->used += slabs[i].used;
+	}
+	for (int i = 0; i < MAX_THREAD_CACHES; i++) {
+		if (!caches[i].owner)
+			continue;
+		out->small_allocs += caches[i].allocs;
+		out->small_frees += caches[i].frees;
+		for (int cls = 0; cls < CLASSES_NUM; cls++)
+			usage[cls].cached += caches[i].bins[cls].count;
+	}
+	out->small_allocs += central_allocs;
+	out->small_frees += central_frees;
+	out->fallbacks = fallbacks;
+	out->slabs_used = slabs_carved - slabs_empty;
+	out->slabs_free = slabs_total - out->slabs_used;
+	out->slabs_total = slabs_total;
+	central_unlock();
+
+	for (int cls = 0; cls < CLASSES_NUM; cls++) {
+		usage[cls].used -= usage[cls].cached;
+		out->small_blocks += usage[cls].used;
+		out->small_bytes += (uint64_t)usage[cls].used * class_size[cls];
+		out->cached_blocks += usage[cls].cached;
+	}
+	out->large_allocs = large_allocs;
+	out->large_frees = large_frees;
+	out->large_blocks = large_allocs - large_frees;
+	out->large_bytes = large_bytes;
+}
+
+void mem_alloc_get_stats(mem_alloc_stats *out) {
+	class_usage usage[CLASSES_NUM];
+	gather(out, usage);
+}
+
+void mem_alloc_report(FILE *f) {
+	mem_alloc_stats s;
+	class_usage usage[CLASSES_NUM];
+	gather(&s, usage);
+
+	fprintf(f, "slabs: %u used, %u free of %u (%u KB each)\n", s.slabs_used, s.slabs_free, s.slabs_total, SLAB_SIZE / 1024);
+	fprintf(f, "small: %u blocks, %u KB held, %u blocks cached, %u allocs, %u frees, %u fallbacks\n", s.small_blocks,
+		(uint32_t)(s.small_bytes / 1024), s.cached_blocks, s.small_allocs, s.small_frees, s.fallbacks);
+	fprintf(f, "large: %u blocks, %d KB, %u allocs, %u frees\n", s.large_blocks, (int)(s.large_bytes / 1024), s.large_allocs, s.large_frees);
+
+	// Slack is memory the class's slabs hold without the game using it, only whole empty slabs go back to the region
+	uint64_t slack = 0;
+	fprintf(f, "\nclass  slabs   blocks    in use   cached  fill\n");
+	for (int cls = 0; cls < CLASSES_NUM; cls++) {
+		class_usage *u = &usage[cls];
+		if (!u->slabs)
+			continue;
+		slack += (uint64_t)u->slabs * SLAB_SIZE - (uint64_t)u->used * class_size[cls];
+		fprintf(f, "%5u %6u %8u %9u %8u %4u%%\n", class_size[cls], u->slabs, u->capacity, u->used, u->cached, u->used * 100 / u->capacity);
+	}
+	uint64_t held = (uint64_t)s.slabs_used * SLAB_SIZE;
+	fprintf(f, "\nslab fragmentation: %u KB of %u KB unused (%u%%)\n", (uint32_t)(slack / 1024), (uint32_t)(held / 1024),
+		held ? (uint32_t)(slack * 100 / held) : 0);
+
+#ifdef __vita__
+	struct mallinfo mi = mallinfo();
+	fprintf(f, "newlib heap: %u KB arena, %u KB in use, %u KB free\n", (uint32_t)mi.arena / 1024, (uint32_t)mi.uordblks / 1024,
+		(uint32_t)mi.fordblks / 1024);
+#endif
+}
+
+#ifdef __vita__
+void mem_alloc_frame(void) {
+	static uint32_t frames = 0;
+	if (++frames % STATS_INTERVAL == 0) {
+		mem_alloc_stats s;
+		mem_alloc_get_stats(&s);
+		debugPrintf("mem_alloc: %u small blocks (%u KB) in %u slabs, %u large blocks (%d KB), %u fallbacks\n", s.small_blocks,
+			(uint32_t)(s.small_bytes / 1024), s.slabs_used, s.large_blocks, (int)(s.large_bytes / 1024), s.fallbacks);
+	}
+
+#ifdef MEM_REPORT
+	static uint64_t last_report = 0;
+	uint64_t now = sceKernelGetProcessTimeWide();
+	if (now - last_report >= REPORT_INTERVAL_US) {
+		FILE *f = save_writer_fopen(DATA_PATH "/mem_report.txt", "w");
+		if (f) {
+			mem_alloc_report(f);
+			fclose(f);
+		}
+		last_report = now;
+	}
+#endif
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef __MEM_ALLOC_H__
+#define __MEM_ALLOC_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Trace file layout (little endian):
+ *   mem_trace_header, followed by a stream of mem_trace_record in the order
+ *   the calls returned. A failed allocation is recorded with a null ptr.
+ */
+
+#define MEM_TRACE_MAGIC 0x52544D4D // "MMTR"
+#define MEM_TRACE_VERSION 1
+
+enum {
+	MEM_OP_MALLOC = 0,
+	MEM_OP_CALLOC,
+	MEM_OP_REALLOC,
+	MEM_OP_MEMALIGN,
+	MEM_OP_FREE,
+};
+
+typedef struct __attribute__((packed)) {
+	uint32_t magic;
+	uint32_t version;
+} mem_trace_header;
+
+typedef struct __attribute__((packed)) {
+	uint32_t thread;
+	uint32_t ptr;  // block returned, or the one given back for MEM_OP_FREE
+	uint32_t arg;  // previous block for MEM_OP_REALLOC, alignment for MEM_OP_MEMALIGN
+	uint32_t size;
+	uint8_t op;
+} mem_trace_record;
+
+typedef struct {
+	uint32_t small_allocs, small_frees; // since boot
+	uint32_t large_allocs, large_frees;
+	uint32_t fallbacks;     // small requests that went to newlib because the slab region was full
+	uint32_t small_blocks;  // blocks the game holds from the slabs
+	uint64_t small_bytes;   // their class sizes
+	uint32_t cached_blocks; // free blocks parked in thread caches
+	uint32_t slabs_used, slabs_free, slabs_total;
+	uint32_t large_blocks;  // blocks the game holds from newlib
+	int64_t large_bytes;    // their usable sizes
+} mem_alloc_stats;
+
+void mem_alloc_init(uint32_t size);
+void *mem_malloc(size_t size);
+void *mem_calloc(size_t nmemb, size_t size);
+void *mem_realloc(void *ptr, size_t size);
+void *mem_memalign(size_t alignment, size_t size);
+void mem_free(void *ptr);
+char *mem_strdup(const char *s);
+
+// Gives the calling thread's cached blocks back, threads created through pthread do it on exit
+void mem_alloc_thread_exit(void);
+
+void mem_alloc_get_stats(mem_alloc_stats *stats);
+void mem_alloc_report(FILE *f);
+void mem_alloc_frame(void);
+
+#endif
@@ -0,0 +1,319 @@
+/* mem_ops.c -- memcpy, memmove and memset specialized by size
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Most of the game's copies are a few bytes long struct assignments, where
+ * the call into sceClib costs more than the copy. Up to 16 bytes two possibly
+ * overlapping loads and stores cover any size, past that 16 byte vectors do,
+ * with the destination aligned and 64 bytes per iteration for long runs.
+ *
+ * The file also builds on the host for tools/mem_ops_check.c.
+ */
+
+// These loops must not be turned back into calls to memcpy/memset
+#pragma GCC optimize("no-tree-loop-distribute-patterns")
+
+#ifdef __vita__
+#include <vitasdk.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __vita__
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#else
+#define MEM_OPS
+#define sceClibMemcpy memcpy
+#define sceClibMemmove memmove
+#define sceClibMemset memset
+#endif
+#include "mem_ops.h"
+
+#define BULK_MIN 128 // From here the destination gets aligned first
+#define SIZE_BUCKETS 14 // 0, then one per power of two up to 4 KB and more
+#define REPORT_INTERVAL_US (10 * 1000000)
+
+enum {
+	OP_MEMCPY,
+	OP_MEMMOVE,
+	OP_MEMSET,
+	OPS_NUM
+};
+
+#ifdef __ARM_NEON
+typedef uint8x16_t chunk;
+#define load16(p) vld1q_u8((const uint8_t *)(p))
+#define store16(p, v) vst1q_u8((uint8_t *)(p), v)
+#define splat16(c) vdupq_n_u8(c)
+#else
+typedef struct {
+	uint64_t lo, hi;
+} chunk;
+
+static inline chunk load16(const void *p) {
+	chunk v;
+	__builtin_memcpy(&v, p, 16);
+	return v;
+}
+
+static inline void store16(void *p, chunk v) {
+	__builtin_memcpy(p, &v, 16);
+}
+
+static inline chunk splat16(uint8_t c) {
+	uint64_t v = 0x0101010101010101ull * c;
+	return (chunk){v, v};
+}
+#endif
+
+static inline uint64_t load8(const void *p) {
+	uint64_t v;
+	__builtin_memcpy(&v, p, 8);
+	return v;
+}
+
+static inline void store8(void *p, uint64_t v) {
+	__builtin_memcpy(p, &v, 8);
+}
+
+static inline uint32_t load4(const void *p) {
+	uint32_t v;
+	__builtin_memcpy(&v, p, 4);
+	return v;
+}
+
+static inline void store4(void *p, uint32_t v) {
+	__builtin_memcpy(p, &v, 4);
+}
+
+#ifdef MEM_OPS_HISTOGRAM
+static uint32_t histogram[OPS_NUM][SIZE_BUCKETS][3]; // by 8 byte aligned, 4 byte aligned and unaligned pointers
+static uint64_t last_report = 0;
+
+// Counters aren't atomic, a few increments racing between threads don't matter here
+static inline void count(int op, const void *dst, const void *src, size_t n) {
+	int bucket = n < 4096 ? (n ? 32 - __builtin_clz((uint32_t)n) : 0) : SIZE_BUCKETS - 1;
+	uintptr_t a = (uintptr_t)dst | (uintptr_t)src;
+	histogram[op][bucket][(a & 7) ? ((a & 3) ? 2 : 1) : 0]++;
+}
+#else
+#define count(...)
+#endif
+
+// Every load happens before the first store, which also makes it safe for overlapping moves
+static inline void copy_small(uint8_t *d, const uint8_t *s, size_t n) {
+	if (n >= 8) {
+		uint64_t a = load8(s), b = load8(s + n - 8);
+		store8(d, a);
+		store8(d + n - 8, b);
+	} else if (n >= 4) {
+		uint32_t a = load4(s), b = load4(s + n - 4);
+		store4(d, a);
+		store4(d + n - 4, b);
+	} else if (n) {
+		uint8_t a = s[0], b = s[n >> 1], c = s[n - 1];
+		d[0] = a;
+		d[n >> 1] = b;
+		d[n - 1] = c;
+	}
+}
+
+// For n > 16 and buffers that don't overlap
+static void copy_forward(uint8_t *d, const uint8_t *s, size_t n) {
+	chunk tail = load16(s + n - 16);
+	uint8_t *end = d + n - 16;
+	if (n >= BULK_MIN) {
+		size_t skew = 16 - ((uintptr_t)d & 15);
+		store16(d, load16(s));
+		d += skew;
+		s += skew;
+		while (d + 64 <= end) {
+			__builtin_prefetch(s + 256);
+			chunk a = load16(s), b = load16(s + 16), c = load16(s + 32), e = load16(s + 48);
+			store16(d, a);
+			store16(d + 16, b);
+			store16(d + 32, c);
+			store16(d + 48, e);
+			d += 64;
+			s += 64;
+		}
+	}
+	while (d < end) {
+		store16(d, load16(s));
+		d += 16;
+		s += 16;
+	}
+	store16(end, tail);
+}
+
+static void set_bytes(uint8_t *d, uint8_t c, size_t n) {
+	if (n <= 16) {
+		if (n >= 8) {
+			uint64_t v = 0x0101010101010101ull * c;
+			store8(d, v);
+			store8(d + n - 8, v);
+		} else if (n >= 4) {
+			uint32_t v = 0x01010101u * c;
+			store4(d, v);
+			store4(d + n - 4, v);
+		} else if (n) {
+			d[0] = c;
+			d[n >> 1] = c;
+			d[n - 1] = c;
+		}
+		return;
+	}
+
+	chunk v = splat16(c);
+	uint8_t *end = d + n - 16;
+	if (n >= BULK_MIN) {
+		store16(d, v);
+		d += 16 - ((uintptr_t)d & 15);
+		while (d + 64 <= end) {
+			store16(d, v);
+			store16(d + 16, v);
+			store16(d + 32, v);
+			store16(d + 48, v);
+			d += 64;
+		}
+	}
+	while (d < end) {
+		store16(d, v);
+		d += 16;
+	}
+	store16(end, v);
+}
+
+static inline void copy(void *dst, const void *src, size_t n) {
+#ifdef MEM_OPS
+	if (n <= 16)
+		copy_small(dst, src, n);
+	else
+		copy_forward(dst, src, n);
+#else
+	sceClibMemcpy(dst, src, n);
+#endif
+}
+
+static inline void move(void *dst, const void *src, size_t n) {
+#ifdef MEM_OPS
+	if (n <= 16)
+		copy_small(dst, src, n);
+	else if ((uintptr_t)dst - (uintptr_t)src >= n && (uintptr_t)src - (uintptr_t)dst >= n)
+		copy_forward(dst, src, n);
+	else
+		sceClibMemmove(dst, src, n); // Long overlapping moves are rare enough
+#else
+	sceClibMemmove(dst, src, n);
+#endif
+}
+
+static inline void set(void *dst, int c, size_t n) {
+#ifdef MEM_OPS
+	set_bytes(dst, c, n);
+#else
+	sceClibMemset(dst, c, n);
+#endif
+}
+
+void *mem_ops_memcpy(void *dst, const void *src, size_t n) {
+	count(OP_MEMCPY, dst, src, n);
+	copy(dst, src, n);
+	return dst;
+}
+
+void *mem_ops_memmove(void *dst, const void *src, size_t n) {
+	count(OP_MEMMOVE, dst, src, n);
+	move(dst, src, n);
+	return dst;
+}
+
+void *mem_ops_memset(void *dst, int c, size_t n) {
+	count(OP_MEMSET, dst, NULL, n);
+	set(dst, c, n);
+	return dst;
+}
+
+void mem_ops_aeabi_memcpy(void *dst, const void *src, size_t n) {
+	count(OP_MEMCPY, dst, src, n);
+	copy(dst, src, n);
+}
+
+void mem_ops_aeabi_memcpy4(void *dst, const void *src, size_t n) {
+	count(OP_MEMCPY, dst, src, n);
+#ifdef MEM_OPS
+	// Word aligned struct copies, whole words need neither the overlapping tricks nor byte accesses
+	if (n <= 64 && !(n & 3)) {
+		uint32_t *d = dst;
+		const uint32_t *s = src;
+		for (; n; n -= 4)
+			*d++ = *s++;
+		return;
+	}
+#endif
+	copy(dst, src, n);
+}
+
+void mem_ops_aeabi_memmove(void *dst, const void *src, size_t n) {
+	count(OP_MEMMOVE, dst, src, n);
+	move(dst, src, n);
+}
+
+void mem_ops_aeabi_memset(void *dst, size_t n, int c) {
+	count(OP_MEMSET, dst, NULL, n);
+	set(dst, c, n);
+}
+
+void mem_ops_aeabi_memclr(void *dst, size_t n) {
+	count(OP_MEMSET, dst, NULL, n);
+	set(dst, 0, n);
+}
+
+#ifdef __vita__
+void mem_ops_frame(void) {
+#ifdef MEM_OPS_HISTOGRAM
+	static const char *op_names[OPS_NUM] = {"memcpy", "memmove", "memset"};
+	uint64_t now = sceKernelGetProcessTimeWide();
+	if (now - last_report < REPORT_INTERVAL_US)
+		return;
+	last_report = now;
+
+	FILE *f = save_writer_fopen(DATA_PATH "/mem_ops.txt", "w");
+	if (!f)
+		return;
+	for (int op = 0; op < OPS_NUM; op++) {
+		uint64_t total = 0;
+		for (int i = 0; i < SIZE_BUCKETS; i++)
+			total += histogram[op][i][0] + histogram[op][i][1] + histogram[op][i][2];
+		fprintf(f, "%s: %llu calls\n", op_names[op], total);
+		fprintf(f, "  size        align 8    align 4  unaligned  share\n");
+		for (int i = 0; i < SIZE_BUCKETS; i++) {
+			uint32_t *h = histogram[op][i];
+			uint32_t calls = h[0] + h[1] + h[2];
+			if (!calls)
+				continue;
+			char range[16];
+			if (i == 0)
+				snprintf(range, sizeof(range), "0");
+			else if (i == SIZE_BUCKETS - 1)
+				snprintf(range, sizeof(range), "%u+", 1u << (i - 1));
+			else
+				snprintf(range, sizeof(range), "%u-%u", 1u << (i - 1), (1u << i) - 1);
+			fprintf(f, "  %-10s %10u %10u %10u %5.1f%%\n", range, h[0], h[1], h[2], calls * 100.0 / total);
+		}
+		fprintf(f, "\n");
+	}
+	fclose(f);
+#endif
+}
+#endif
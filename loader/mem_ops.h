@@ -0,0 +1,19 @@
+#ifndef __MEM_OPS_H__
+#define __MEM_OPS_H__
+
+#include <stddef.h>
+
+void *mem_ops_memcpy(void *dst, const void *src, size_t n);
+void *mem_ops_memmove(void *dst, const void *src, size_t n);
+void *mem_ops_memset(void *dst, int c, size_t n);
+
+// Run-time ABI variants, memset takes its arguments in a different order and none of them return anything
+void mem_ops_aeabi_memcpy(void *dst, const void *src, size_t n);
+void mem_ops_aeabi_memcpy4(void *dst, const void *src, size_t n);
+void mem_ops_aeabi_memmove(void *dst, const void *src, size_t n);
+void mem_ops_aeabi_memset(void *dst, size_t n, int c);
+void mem_ops_aeabi_memclr(void *dst, size_t n);
+
+void mem_ops_frame(void);
+
+#endif
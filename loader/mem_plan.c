@@ -0,0 +1,303 @@
+/* mem_plan.c -- sizes the memory pools from the peaks of previous sessions
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Peaks are kept across sessions, a pool only shrinks once the profile file
+ * is deleted, and thread stacks never go below the 1 MB default. The newlib
+ * heap is set up before main() runs, so its size is only recommended in the
+ * report and needs a rebuild with MEMORY_NEWLIB_MB.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#include "mem_alloc.h"
+#include "mem_plan.h"
+
+#define PLAN_CONFIG DATA_PATH "/mem_plan.cfg"
+#define PLAN_REPORT DATA_PATH "/mem_plan.txt"
+
+#define SAMPLE_INTERVAL 60 // Frames between samples of the pools
+#define WRITE_INTERVAL 30  // Samples between stack scans and profile writes
+#define MAX_THREADS 32
+#define STACK_PATTERN 0xCAFEF00D
+#define MB (1024 * 1024)
+
+extern int _newlib_heap_size_user;
+extern unsigned int _pthread_stack_default_user;
+
+typedef struct {
+	uint32_t newlib;  // highest the newlib heap reached
+	uint32_t slab;    // slabs in use in mem_alloc's region
+	uint32_t other;   // RAM outside vitaGL's pool that isn't the stacks of the game's threads
+	uint32_t stack;   // deepest stack of the game's threads
+	uint32_t threads; // most game threads alive at once
+} pool_peaks;
+
+typedef struct {
+	int used;
+	uint32_t *low, *high; // painted range, high is where the thread's entry point started
+	uint32_t peak;
+	int saturated;        // the paint ran out, the thread may need more than this
+} stack_watch;
+
+typedef struct {
+	void *(*entry)(void *);
+	void *arg;
+} thread_start;
+
+#ifdef MEM_PLANNER
+static int planner_enabled = 1;
+#else
+static int planner_enabled = 0;
+#endif
+
+static mem_plan plan;
+static pool_peaks peaks, saved;
+static uint32_t vgl_free_low = 0xFFFFFFFF, newlib_used_peak = 0;
+static stack_watch stacks[MAX_THREADS];
+static SceUID plan_mtx;
+static uint32_t frames = 0, samples = 0;
+
+static uint32_t round_up(uint32_t v, uint32_t unit) {
+	return (v + unit - 1) / unit * unit;
+}
+
+static void peaks_load(pool_peaks *p) {
+	FILE *f = save_writer_fopen(PLAN_CONFIG, "r");
+	if (!f)
+		return;
+	char line[128];
+	uint32_t kb;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "newlib_kb=%u", &kb) == 1)
+			p->newlib = kb * 1024;
+		else if (sscanf(line, "slab_kb=%u", &kb) == 1)
+			p->slab = kb * 1024;
+		else if (sscanf(line, "other_kb=%u", &kb) == 1)
+			p->other = kb * 1024;
+		else if (sscanf(line, "stack_kb=%u", &kb) == 1)
+			p->stack = kb * 1024;
+		else
+			sscanf(line, "threads=%u", &p->threads);
+	}
+	fclose(f);
+}
+
+// Margins cover what a session can reach that the previous ones didn't
+static void plan_from_peaks(const pool_peaks *p, mem_plan *out) {
+	out->slab_bytes = MEMORY_SLAB_MB * MB;
+	out->vgl_threshold = MEMORY_VITAGL_THRESHOLD_MB * MB;
+	out->stack_bytes = _pthread_stack_default_user;
+	if (p->slab)
+		out->slab_bytes = round_up(p->slab * 5 / 4 + 4 * MB, MB);
+	// A stack that's too small crashes where no session measured it, so the default is only ever grown
+	if (p->stack) {
+		uint32_t stack = round_up(p->stack * 2, 64 * 1024);
+		if (stack > 2 * MB)
+			stack = 2 * MB;
+		if (stack > out->stack_bytes)
+			out->stack_bytes = stack;
+	}
+	if (p->other)
+		out->vgl_threshold = round_up(p->other * 3 / 2 + p->threads * out->stack_bytes + 2 * MB, MB);
+}
+
+void mem_plan_load(mem_plan *out) {
+	plan_mtx = sceKernelCreateMutex("mem_plan mutex", 0, 0, NULL);
+	if (planner_enabled)
+		peaks_load(&peaks);
+	saved = peaks;
+	plan_from_peaks(&peaks, &plan);
+	if (planner_enabled)
+		debugPrintf("mem_plan: slabs %u KB, vitaGL threshold %u KB, stacks %u KB\n", plan.slab_bytes / 1024, plan.vgl_threshold / 1024,
+			plan.stack_bytes / 1024);
+	*out = plan;
+}
+
+// Finds how deep the thread went into the painted range, with plan_mtx held
+static void stack_scan(stack_watch *w) {
+	uint32_t *q = w->low;
+	while (q < w->high && *q == STACK_PATTERN)
+		q++;
+	uint32_t depth = (w->high - q) * 4;
+	if (q == w->low) {
+		w->saturated = 1;
+		depth = plan.stack_bytes;
+	}
+	if (depth > w->peak)
+		w->peak = depth;
+	if (w->peak > peaks.stack)
+		peaks.stack = w->peak;
+}
+
+// Also runs when the thread leaves through pthread_exit
+static void stack_release(void *p) {
+	stack_watch *w = (stack_watch *)p;
+	if (!w)
+		return;
+	sceKernelLockMutex(plan_mtx, 1, NULL);
+	stack_scan(w);
+	w->used = 0;
+	sceKernelUnlockMutex(plan_mtx, 1);
+}
+
+static void *thread_trampoline(void *p) {
+	thread_start start = *(thread_start *)p;
+	free(p);
+
+	SceKernelThreadInfo info;
+	info.size = sizeof(info);
+	stack_watch *w = NULL;
+	if (sceKernelGetThreadInfo(sceKernelGetThreadId(), &info) >= 0) {
+		sceKernelLockMutex(plan_mtx, 1, NULL);
+		for (int i = 0; i < MAX_THREADS; i++) {
+			if (!stacks[i].used) {
+				w = &stacks[i];
+				w->used = 1;
+				break;
+			}
+		}
+		sceKernelUnlockMutex(plan_mtx, 1);
+	}
+
+	if (w) {
+		// Everything between the stack base and this frame is unused yet, the last 1 KB is left to the paint loop itself
+		uint32_t *frame = __builtin_frame_address(0);
+		w->high = frame;
+		w->low = (uint32_t *)info.stack;
+		w->peak = 0;
+		w->saturated = 0;
+		for (volatile uint32_t *q = w->low; q < frame - 256; q++)
+			*q = STACK_PATTERN;
+	}
+
+	void *res;
+	pthread_cleanup_push(stack_release, w);
+	res = start.entry(start.arg);
+	pthread_cleanup_pop(1);
+	return res;
+}
+
+int mem_plan_create_thread(pthread_t *thread, void *(*entry)(void *), void *arg) {
+	if (!planner_enabled)
+		return pthread_create(thread, NULL, entry, arg);
+
+	thread_start *start = malloc(sizeof(thread_start));
+	if (!start)
+		return EAGAIN;
+	start->entry = entry;
+	start->arg = arg;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, plan.stack_bytes);
+	int res = pthread_create(thread, &attr, thread_trampoline, start);
+	pthread_attr_destroy(&attr);
+	if (res)
+		free(start);
+	return res;
+}
+
+static void sample(void) {
+	struct mallinfo mi = mallinfo();
+	if (mi.arena > peaks.newlib)
+		peaks.newlib = mi.arena;
+	if (mi.uordblks > newlib_used_peak)
+		newlib_used_peak = mi.uordblks;
+
+	mem_alloc_stats s;
+	mem_alloc_get_stats(&s);
+	if (s.slabs_used * 64 * 1024 > peaks.slab)
+		peaks.slab = s.slabs_used * 64 * 1024;
+
+	uint32_t threads = 0;
+	sceKernelLockMutex(plan_mtx, 1, NULL);
+	for (int i = 0; i < MAX_THREADS; i++)
+		threads += stacks[i].used;
+	sceKernelUnlockMutex(plan_mtx, 1);
+	if (threads > peaks.threads)
+		peaks.threads = threads;
+
+	// vitaGL took all user RAM but the threshold, whatever isn't free of it now went elsewhere
+	SceKernelFreeMemorySizeInfo info;
+	info.size = sizeof(info);
+	sceKernelGetFreeMemorySize(&info);
+	int32_t other = (int32_t)plan.vgl_threshold - info.size_user - (int32_t)(threads * plan.stack_bytes);
+	if (other > (int32_t)peaks.other)
+		peaks.other = other;
+
+	uint32_t vgl_free = vglMemFree(VGL_MEM_RAM);
+	if (vgl_free < vgl_free_low)
+		vgl_free_low = vgl_free;
+}
+
+static void plan_write(void) {
+	FILE *f = save_writer_fopen(PLAN_CONFIG, "w");
+	if (f) {
+		fprintf(f, "newlib_kb=%u\nslab_kb=%u\nother_kb=%u\nstack_kb=%u\nthreads=%u\n", peaks.newlib / 1024, peaks.slab / 1024,
+			peaks.other / 1024, peaks.stack / 1024, peaks.threads);
+		fclose(f);
+	}
+
+	f = save_writer_fopen(PLAN_REPORT, "w");
+	if (!f)
+		return;
+	mem_alloc_stats s;
+	mem_alloc_get_stats(&s);
+	uint32_t slab_size = s.slabs_total * 64 * 1024;
+	uint32_t outside = peaks.other + peaks.threads * plan.stack_bytes;
+	int saturated = 0;
+	for (int i = 0; i < MAX_THREADS; i++)
+		saturated |= stacks[i].saturated;
+
+	fprintf(f, "pool               size KB    peak KB  headroom KB\n");
+	fprintf(f, "newlib heap     %10u %10u %12d\n", _newlib_heap_size_user / 1024, peaks.newlib / 1024,
+		(int)(_newlib_heap_size_user - peaks.newlib) / 1024);
+	fprintf(f, "slab region     %10u %10u %12d\n", slab_size / 1024, peaks.slab / 1024, (int)(slab_size - peaks.slab) / 1024);
+	fprintf(f, "outside vitaGL  %10u %10u %12d\n", plan.vgl_threshold / 1024, outside / 1024, (int)(plan.vgl_threshold - outside) / 1024);
+	fprintf(f, "thread stack    %10u %10u %12d%s\n", plan.stack_bytes / 1024, peaks.stack / 1024, (int)(plan.stack_bytes - peaks.stack) / 1024,
+		saturated ? " (overflowed the painted range)" : "");
+	fprintf(f, "\nnewlib heap in use at most: %u KB\n", newlib_used_peak / 1024);
+	fprintf(f, "game threads alive at most: %u\n", peaks.threads);
+	fprintf(f, "vitaGL pool free at lowest: %u KB\n", vgl_free_low / 1024);
+
+	mem_plan next;
+	plan_from_peaks(&peaks, &next);
+	fprintf(f, "\nnext boot: slabs %u KB, vitaGL threshold %u KB, stacks %u KB\n", next.slab_bytes / 1024, next.vgl_threshold / 1024,
+		next.stack_bytes / 1024);
+	fprintf(f, "MEMORY_NEWLIB_MB could be %u, the rest would go to vitaGL's pool (needs a rebuild)\n",
+		round_up(peaks.newlib * 5 / 4 + 16 * MB, 16 * MB) / MB);
+	fclose(f);
+}
+
+void mem_plan_frame(void) {
+	if (!planner_enabled || ++frames % SAMPLE_INTERVAL)
+		return;
+	sample();
+	if (++samples % WRITE_INTERVAL)
+		return;
+
+	sceKernelLockMutex(plan_mtx, 1, NULL);
+	for (int i = 0; i < MAX_THREADS; i++) {
+		if (stacks[i].used)
+			stack_scan(&stacks[i]);
+	}
+	sceKernelUnlockMutex(plan_mtx, 1);
+	if (memcmp(&peaks, &saved, sizeof(peaks))) {
+		plan_write();
+		saved = peaks;
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef __MEM_PLAN_H__
+#define __MEM_PLAN_H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+typedef struct {
+	uint32_t slab_bytes;    // region of mem_alloc
+	uint32_t vgl_threshold; // RAM vitaGL leaves outside its pool, thread stacks come from there
+	uint32_t stack_bytes;   // stack of every pthread the game creates
+} mem_plan;
+
+void mem_plan_load(mem_plan *plan);
+int mem_plan_create_thread(pthread_t *thread, void *(*entry)(void *), void *arg);
+void mem_plan_frame(void);
+
+#endif
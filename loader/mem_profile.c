@@ -0,0 +1,206 @@
+/* mem_profile.c -- heap usage of the game broken down by the code that allocates
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#include "mem_profile.h"
+
+#ifdef MEM_PROFILE
+
+#define MAX_SITES 4096
+#define MAX_LIVE (128 * 1024) // Blocks tracked at once, newer ones go unaccounted past that
+#define LIFETIME_BUCKETS 5
+#define REPORT_INTERVAL_US (30 * 1000000)
+
+// Upper bounds of the lifetime buckets, the last one takes everything longer
+static const uint32_t lifetime_ms[LIFETIME_BUCKETS - 1] = {16, 1000, 10000, 60000};
+static const char *lifetime_names[LIFETIME_BUCKETS] = {"<16ms", "<1s", "<10s", "<60s", "longer"};
+
+typedef struct {
+	uintptr_t addr; // return address in the game, 0 for an empty slot
+	uint32_t allocs, frees;
+	uint64_t bytes;
+	uint32_t live_bytes, peak_bytes;
+	uint32_t lifetimes[LIFETIME_BUCKETS];
+} call_site;
+
+typedef struct {
+	uintptr_t ptr; // 0 for an empty slot
+	uint32_t size;
+	uint32_t time_ms;
+	uint16_t site;
+} live_block;
+
+static so_module *profile_mod;
+static SceUID profile_mtx;
+static call_site sites[MAX_SITES];
+static uint32_t sites_num = 0;
+static live_block *live;
+static uint32_t live_num = 0, untracked = 0;
+static uint64_t last_report = 0;
+static int dirty = 0;
+
+static call_site snapshot[MAX_SITES]; // Copy the report works on while the game keeps allocating
+
+static inline uint32_t hash_ptr(uintptr_t p) {
+	return (p >> 2) * 2654435761u;
+}
+
+static call_site *site_get(uintptr_t addr) {
+	uint32_t slot = hash_ptr(addr) % MAX_SITES;
+	while (sites[slot].addr) {
+		if (sites[slot].addr == addr)
+			return &sites[slot];
+		slot = (slot + 1) % MAX_SITES;
+	}
+	if (sites_num == MAX_SITES - 1)
+		return NULL;
+	sites_num++;
+	sites[slot].addr = addr;
+	return &sites[slot];
+}
+
+static uint32_t live_slot(uintptr_t ptr) {
+	uint32_t slot = hash_ptr(ptr) % MAX_LIVE;
+	while (live[slot].ptr && live[slot].ptr != ptr)
+		slot = (slot + 1) % MAX_LIVE;
+	return slot;
+}
+
+void mem_profile_alloc(void *caller, void *ptr, uint32_t size) {
+	if (!live || !ptr)
+		return;
+	uint32_t now = sceKernelGetProcessTimeWide() / 1000;
+
+	sceKernelLockMutex(profile_mtx, 1, NULL);
+	call_site *s = site_get((uintptr_t)caller & ~1);
+	// Past three quarters full the probe chains get long, the rest is only counted
+	if (!s || live_num >= MAX_LIVE * 3 / 4) {
+		untracked++;
+		sceKernelUnlockMutex(profile_mtx, 1);
+		return;
+	}
+	s->allocs++;
+	s->bytes += size;
+	s->live_bytes += size;
+	if (s->live_bytes > s->peak_bytes)
+		s->peak_bytes = s->live_bytes;
+
+	live_block *b = &live[live_slot((uintptr_t)ptr)];
+	b->ptr = (uintptr_t)ptr;
+	b->size = size;
+	b->time_ms = now;
+	b->site = s - sites;
+	live_num++;
+	dirty = 1;
+	sceKernelUnlockMutex(profile_mtx, 1);
+}
+
+void mem_profile_free(void *ptr) {
+	if (!live || !ptr)
+		return;
+	uint32_t now = sceKernelGetProcessTimeWide() / 1000;
+
+	sceKernelLockMutex(profile_mtx, 1, NULL);
+	uint32_t slot = live_slot((uintptr_t)ptr);
+	if (!live[slot].ptr) {
+		sceKernelUnlockMutex(profile_mtx, 1);
+		return;
+	}
+	live_block *b = &live[slot];
+	call_site *s = &sites[b->site];
+	s->frees++;
+	s->live_bytes -= b->size;
+	int bucket = 0;
+	while (bucket < LIFETIME_BUCKETS - 1 && now - b->time_ms >= lifetime_ms[bucket])
+		bucket++;
+	s->lifetimes[bucket]++;
+
+	// Backward shift deletion keeps the probe chains intact without tombstones
+	uint32_t hole = slot;
+	for (uint32_t i = (hole + 1) % MAX_LIVE; live[i].ptr; i = (i + 1) % MAX_LIVE) {
+		uint32_t home = hash_ptr(live[i].ptr) % MAX_LIVE;
+		if ((i - home + MAX_LIVE) % MAX_LIVE >= (i - hole + MAX_LIVE) % MAX_LIVE) {
+			live[hole] = live[i];
+			hole = i;
+		}
+	}
+	live[hole].ptr = 0;
+	live_num--;
+	dirty = 1;
+	sceKernelUnlockMutex(profile_mtx, 1);
+}
+
+static int compare_sites(const void *a, const void *b) {
+	const call_site *x = &snapshot[*(const uint16_t *)a], *y = &snapshot[*(const uint16_t *)b];
+	if (x->peak_bytes != y->peak_bytes)
+		return x->peak_bytes < y->peak_bytes ? 1 : -1;
+	return x->bytes < y->bytes ? 1 : (x->bytes > y->bytes ? -1 : 0);
+}
+
+static void report(void) {
+	static uint16_t order[MAX_SITES];
+	int num = 0;
+
+	sceKernelLockMutex(profile_mtx, 1, NULL);
+	memcpy(snapshot, sites, sizeof(sites));
+	uint32_t tracked = live_num, lost = untracked;
+	sceKernelUnlockMutex(profile_mtx, 1);
+
+	for (int i = 0; i < MAX_SITES; i++) {
+		if (snapshot[i].addr)
+			order[num++] = i;
+	}
+	qsort(order, num, sizeof(*order), compare_sites);
+
+	FILE *f = save_writer_fopen(DATA_PATH "/mem_profile.txt", "w");
+	if (!f)
+		return;
+	fprintf(f, "call sites: %d, live blocks: %u, untracked allocations: %u\n", num, tracked, lost);
+	fprintf(f, "sorted by peak live bytes, lifetimes of freed blocks: %s %s %s %s %s\n\n", lifetime_names[0], lifetime_names[1],
+		lifetime_names[2], lifetime_names[3], lifetime_names[4]);
+	fprintf(f, "%-48s %9s %9s %10s %10s %10s  lifetimes\n", "caller", "allocs", "frees", "total KB", "live KB", "peak KB");
+	for (int i = 0; i < num; i++) {
+		call_site *s = &snapshot[order[i]];
+		char name[64];
+		uintptr_t offset;
+		const char *sym = so_symbol_at(profile_mod, s->addr, &offset);
+		if (sym)
+			snprintf(name, sizeof(name), "%s+0x%X", sym, (unsigned)offset);
+		else
+			snprintf(name, sizeof(name), "0x%08X", (unsigned)s->addr);
+		fprintf(f, "%-48s %9u %9u %10u %10u %10u  %u %u %u %u %u\n", name, s->allocs, s->frees, (uint32_t)(s->bytes / 1024),
+			s->live_bytes / 1024, s->peak_bytes / 1024, s->lifetimes[0], s->lifetimes[1], s->lifetimes[2], s->lifetimes[3],
+			s->lifetimes[4]);
+	}
+	fclose(f);
+}
+
+void mem_profile_frame(void) {
+	uint64_t now = sceKernelGetProcessTimeWide();
+	if (dirty && now - last_report >= REPORT_INTERVAL_US) {
+		dirty = 0;
+		report();
+		last_report = now;
+	}
+}
+
+void mem_profile_init(so_module *mod) {
+	profile_mod = mod;
+	profile_mtx = sceKernelCreateMutex("mem_profile mutex", 0, 0, NULL);
+	live = calloc(MAX_LIVE, sizeof(live_block));
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef __MEM_PROFILE_H__
+#define __MEM_PROFILE_H__
+
+#include <stdint.h>
+#include "config.h"
+#include "so_util.h"
+
+#ifdef MEM_PROFILE
+void mem_profile_init(so_module *mod);
+void mem_profile_alloc(void *caller, void *ptr, uint32_t size);
+void mem_profile_free(void *ptr);
+void mem_profile_frame(void);
+#else
+#define mem_profile_init(mod)
+#define mem_profile_alloc(...)
+#define mem_profile_free(ptr)
+#define mem_profile_frame()
+#endif
+
+#endif
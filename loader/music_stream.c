@@ -0,0 +1,442 @@
+/* music_stream.c -- background streaming and preloading of music tracks
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "music_stream.h"
+
+#define MAX_TRACKS 48
+#define MAX_SCANS 8
+#define CHUNK_SIZE (64 * 1024)
+#define HEAD_SIZE (256 * 1024) // A few seconds of audio, enough to start playback
+#define TAIL_SIZE (128 * 1024) // Decoders seek to the end of the stream on open to get its length
+#define CACHE_BUDGET (16 * 1024 * 1024)
+
+typedef struct {
+	char path[256];
+	int used;
+	uint32_t size;
+	uint8_t *data;
+	uint32_t cap;
+	volatile uint32_t filled;
+	uint8_t *tail;
+	uint32_t tail_len;
+	volatile int tail_ready;
+	volatile int error;
+	volatile int direct; // No memory to buffer it, readers go to the file for what isn't buffered
+	int busy;
+	SceUID fd;
+	int refs;
+	uint64_t last_use;
+} music_track;
+
+typedef struct {
+	music_track *track;
+	uint32_t pos;
+	SDL_RWops *file; // Opened once the track turns out to be direct
+} music_rw;
+
+static music_track tracks[MAX_TRACKS];
+static char scans[MAX_SCANS][256];
+static int num_scans = 0;
+static music_stream_stats stats;
+
+static SceUID music_mtx = -1, music_sema, music_thd;
+
+static void music_lock(void) {
+	sceKernelLockMutex(music_mtx, 1, NULL);
+}
+
+static void music_unlock(void) {
+	sceKernelUnlockMutex(music_mtx, 1);
+}
+
+static int is_music_file(const char *name) {
+	const char *ext = strrchr(name, '.');
+	return ext && (!strcasecmp(ext, ".ogg") || !strcasecmp(ext, ".mp3") || !strcasecmp(ext, ".wav"));
+}
+
+static uint32_t cache_usage(void) {
+	uint32_t total = 0;
+	for (int i = 0; i < MAX_TRACKS; i++) {
+		if (tracks[i].used)
+			total += tracks[i].cap + (tracks[i].tail ? TAIL_SIZE : 0);
+	}
+	return total;
+}
+
+static music_track *track_find(const char *path) {
+	for (int i = 0; i < MAX_TRACKS; i++) {
+		if (tracks[i].used && !strcmp(tracks[i].path, path))
+			return &tracks[i];
+	}
+	return NULL;
+}
+
+// Must be called with the lock held
+static music_track *track_create(const char *path, uint32_t size) {
+	music_track *t = NULL;
+	for (int i = 0; i < MAX_TRACKS; i++) {
+		if (!tracks[i].used) {
+			t = &tracks[i];
+			break;
+		}
+		// Recycle the least recently used idle track
+		if (!tracks[i].refs && !tracks[i].busy && (!t || tracks[i].last_use < t->last_use))
+			t = &tracks[i];
+	}
+	if (!t || (t->used && (t->refs || t->busy)))
+		return NULL;
+
+	if (t->fd >= 0)
+		sceIoClose(t->fd);
+	free(t->data);
+	free(t->tail);
+	memset(t, 0, sizeof(music_track));
+	strncpy(t->path, path, sizeof(t->path) - 1);
+	t->used = 1;
+	t->size = size;
+	t->fd = -1;
+	t->tail_len = size > HEAD_SIZE + TAIL_SIZE ? TAIL_SIZE : 0;
+	t->tail_ready = !t->tail_len;
+	return t;
+}
+
+static void track_scan_dir(const char *dir) {
+	SceUID d = sceIoDopen(dir);
+	if (d < 0)
+		return;
+	SceIoDirent entry;
+	char path[256];
+	while (sceIoDread(d, &entry) > 0 && cache_usage() < CACHE_BUDGET) {
+		if (SCE_S_ISDIR(entry.d_stat.st_mode) || !is_music_file(entry.d_name))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry.d_name);
+		music_lock();
+		if (!track_find(path))
+			track_create(path, entry.d_stat.st_size);
+		music_unlock();
+	}
+	sceIoDclose(d);
+}
+
+// Picks the next track to read, active tracks first. Must be called with the lock held
+static music_track *track_pick(uint32_t *target) {
+	music_track *preload = NULL;
+	for (int i = 0; i < MAX_TRACKS; i++) {
+		music_track *t = &tracks[i];
+		if (!t->used || t->error || t->direct)
+			continue;
+		if (t->refs && (t->filled < t->size || !t->tail_ready)) {
+			*target = t->size;
+			return t;
+		}
+		uint32_t head = t->size < HEAD_SIZE ? t->size : HEAD_SIZE;
+		if (!preload && !t->refs && (t->filled < head || !t->tail_ready))
+			preload = t;
+	}
+	if (preload)
+		*target = preload->size < HEAD_SIZE ? preload->size : HEAD_SIZE;
+	return preload;
+}
+
+static void track_trim(void) {
+	for (;;) {
+		music_track *victim = NULL;
+		for (int i = 0; i < MAX_TRACKS; i++) {
+			music_track *t = &tracks[i];
+			if (t->used && !t->refs && t->cap > HEAD_SIZE && (!victim || t->last_use < victim->last_use))
+				victim = t;
+		}
+		if (!victim || cache_usage() <= CACHE_BUDGET)
+			return;
+		uint8_t *data = realloc(victim->data, HEAD_SIZE);
+		if (!data)
+			return;
+		victim->data = data;
+		victim->cap = HEAD_SIZE;
+		if (victim->filled > HEAD_SIZE)
+			victim->filled = HEAD_SIZE;
+	}
+}
+
+static int track_read(music_track *t, uint8_t *dst, uint32_t offs, uint32_t len) {
+	if (t->fd < 0) {
+		t->fd = sceIoOpen(t->path, SCE_O_RDONLY, 0777);
+		if (t->fd < 0)
+			return -1;
+	}
+	sceIoLseek(t->fd, offs, SCE_SEEK_SET);
+	int res = sceIoRead(t->fd, dst, len);
+	if (res > 0)
+		stats.bytes_read += res;
+	return res;
+}
+
+static int music_reader_thread(SceSize args, void *argp) {
+	for (;;) {
+		uint32_t target;
+		music_lock();
+		music_track *t = track_pick(&target);
+		if (!t) {
+			for (int i = 0; i < MAX_TRACKS; i++) {
+				if (tracks[i].used && !tracks[i].refs && tracks[i].fd >= 0) {
+					sceIoClose(tracks[i].fd);
+					tracks[i].fd = -1;
+				}
+			}
+			track_trim();
+			char dir[256];
+			int scan = num_scans > 0;
+			if (scan)
+				strcpy(dir, scans[--num_scans]);
+			music_unlock();
+			if (scan)
+				track_scan_dir(dir);
+			else
+				sceKernelWaitSema(music_sema, 1, NULL);
+			continue;
+		}
+		if (t->cap < target) {
+			uint8_t *data = realloc(t->data, target);
+			if (!data) {
+				// What's buffered stays, the rest is read from the file
+				debugPrintf("music_stream: no memory to buffer %s, streaming it\n", t->path);
+				t->direct = 1;
+				music_unlock();
+				continue;
+			}
+			t->data = data;
+			t->cap = target;
+		}
+		if (t->filled >= CHUNK_SIZE && !t->tail_ready && !t->tail) {
+			t->tail = malloc(TAIL_SIZE);
+			if (!t->tail) {
+				t->direct = 1;
+				music_unlock();
+				continue;
+			}
+		}
+		t->busy = 1;
+		music_unlock();
+
+		// Only this thread resizes the buffers, so they can be filled without holding the lock
+		if (t->filled >= CHUNK_SIZE && !t->tail_ready) {
+			if (track_read(t, t->tail, t->size - t->tail_len, t->tail_len) != t->tail_len)
+				t->error = 1;
+			__sync_synchronize();
+			t->tail_ready = 1;
+		} else {
+			uint32_t len = target - t->filled;
+			if (len > CHUNK_SIZE)
+				len = CHUNK_SIZE;
+			int res = track_read(t, t->data + t->filled, t->filled, len);
+			if (res <= 0) {
+				t->error = 1;
+			} else {
+				__sync_synchronize();
+				t->filled += res;
+			}
+		}
+
+		music_lock();
+		t->busy = 0;
+		music_unlock();
+	}
+	return 0;
+}
+
+static Sint64 music_rw_size(SDL_RWops *rw) {
+	music_rw *ctx = (music_rw *)rw->hidden.unknown.data1;
+	return ctx->track->size;
+}
+
+static Sint64 music_rw_seek(SDL_RWops *rw, Sint64 offset, int whence) {
+	music_rw *ctx = (music_rw *)rw->hidden.unknown.data1;
+	Sint64 pos = offset;
+	if (whence == RW_SEEK_CUR)
+		pos += ctx->pos;
+	else if (whence == RW_SEEK_END)
+		pos += ctx->track->size;
+	if (pos < 0)
+		pos = 0;
+	if (pos > ctx->track->size)
+		pos = ctx->track->size;
+	ctx->pos = pos;
+	return pos;
+}
+
+static size_t music_rw_read(SDL_RWops *rw, void *ptr, size_t size, size_t maxnum) {
+	music_rw *ctx = (music_rw *)rw->hidden.unknown.data1;
+	music_track *t = ctx->track;
+	if (!size || ctx->pos >= t->size)
+		return 0;
+	uint32_t want = size * maxnum;
+	if (want > t->size - ctx->pos)
+		want = t->size - ctx->pos;
+
+	uint32_t done = 0;
+	uint64_t wait_start = 0;
+	while (done < want) {
+		uint32_t p = ctx->pos + done, n = 0;
+		int error, direct;
+		music_lock();
+		if (p < t->filled) {
+			n = t->filled - p;
+			if (n > want - done)
+				n = want - done;
+			sceClibMemcpy((uint8_t *)ptr + done, t->data + p, n);
+		} else if (t->tail_ready && t->tail_len && p >= t->size - t->tail_len) {
+			n = want - done;
+			sceClibMemcpy((uint8_t *)ptr + done, t->tail + (p - (t->size - t->tail_len)), n);
+		}
+		error = t->error;
+		direct = t->direct;
+		music_unlock();
+
+		if (n) {
+			done += n;
+		} else if (error) {
+			break;
+		} else if (direct) {
+			if (!ctx->file)
+				ctx->file = SDL_RWFromFile(t->path, "rb");
+			if (!ctx->file || SDL_RWseek(ctx->file, p, RW_SEEK_SET) < 0)
+				break;
+			// Up to where the buffer may pick up again
+			uint32_t len = want - done;
+			if (p < t->size - t->tail_len && len > t->size - t->tail_len - p)
+				len = t->size - t->tail_len - p;
+			n = SDL_RWread(ctx->file, (uint8_t *)ptr + done, 1, len);
+			if (!n)
+				break;
+			done += n;
+		} else {
+			if (!wait_start) {
+				wait_start = sceKernelGetProcessTimeWide();
+				stats.underruns++;
+			}
+			sceKernelSignalSema(music_sema, 1);
+			sceKernelDelayThread(500);
+		}
+	}
+	if (wait_start)
+		stats.underrun_us += sceKernelGetProcessTimeWide() - wait_start;
+
+	// Keep whole objects only, as SDL_RWread callers expect
+	done -= done % size;
+	ctx->pos += done;
+	return done / size;
+}
+
+static size_t music_rw_write(SDL_RWops *rw, const void *ptr, size_t size, size_t num) {
+	return 0;
+}
+
+static int music_rw_close(SDL_RWops *rw) {
+	music_rw *ctx = (music_rw *)rw->hidden.unknown.data1;
+	music_lock();
+	ctx->track->refs--;
+	ctx->track->last_use = sceKernelGetProcessTimeWide();
+	music_unlock();
+	sceKernelSignalSema(music_sema, 1);
+	if (ctx->file)
+		SDL_RWclose(ctx->file);
+	free(ctx);
+	SDL_FreeRW(rw);
+	return 0;
+}
+
+Mix_Music *music_stream_load(const char *path) {
+	if (music_mtx < 0)
+		return NULL;
+
+	music_lock();
+	music_track *t = track_find(path);
+	if (t && t->error) {
+		if (t->refs || t->busy) {
+			music_unlock();
+			return NULL;
+		}
+		t->used = 0;
+		t = NULL;
+	}
+	if (t) {
+		// Memory may have freed up since the track was last streamed, buffer it again
+		if (t->direct && !t->refs)
+			t->direct = 0;
+		uint32_t head = t->size < HEAD_SIZE ? t->size : HEAD_SIZE;
+		if (t->filled >= head && t->tail_ready)
+			stats.cached_loads++;
+	} else {
+		SceIoStat st;
+		if (sceIoGetstat(path, &st) >= 0)
+			t = track_create(path, st.st_size);
+		if (t) {
+			// Tracks next to this one are the likely candidates for the next road event
+			const char *slash = strrchr(path, '/');
+			if (slash && num_scans < MAX_SCANS && slash - path < sizeof(scans[0])) {
+				memcpy(scans[num_scans], path, slash - path);
+				scans[num_scans++][slash - path] = 0;
+			}
+		}
+	}
+	if (!t) {
+		music_unlock();
+		return NULL;
+	}
+	t->refs++;
+	t->last_use = sceKernelGetProcessTimeWide();
+	stats.loads++;
+	music_unlock();
+	debugPrintf("music_stream: %s (%u loads, %u cached, %u underruns, %llu us waited)\n", path,
+		stats.loads, stats.cached_loads, stats.underruns, stats.underrun_us);
+	sceKernelSignalSema(music_sema, 1);
+
+	music_rw *ctx = calloc(1, sizeof(music_rw));
+	SDL_RWops *rw = ctx ? SDL_AllocRW() : NULL;
+	if (!rw) {
+		// The caller loads the track from the file instead
+		free(ctx);
+		music_lock();
+		t->refs--;
+		music_unlock();
+		return NULL;
+	}
+	ctx->track = t;
+	rw->size = music_rw_size;
+	rw->seek = music_rw_seek;
+	rw->read = music_rw_read;
+	rw->write = music_rw_write;
+	rw->close = music_rw_close;
+	rw->type = SDL_RWOPS_UNKNOWN;
+	rw->hidden.unknown.data1 = ctx;
+
+	// With freesrc set SDL_mixer closes the stream, dropping our reference, also on failure
+	return Mix_LoadMUS_RW(rw, 1);
+}
+
+void music_stream_get_stats(music_stream_stats *out) {
+	*out = stats;
+}
+
+void music_stream_init(void) {
+	music_mtx = sceKernelCreateMutex("music mutex", 0, 0, NULL);
+	music_sema = sceKernelCreateSema("music sema", 0, 0, 1, NULL);
+	music_thd = sceKernelCreateThread("music reader", &music_reader_thread, 0x10000100 - 10, 0x4000, 0, 0, NULL);
+	sceKernelStartThread(music_thd, 0, NULL);
+}
@@ -0,0 +1,19 @@
+#ifndef __MUSIC_STREAM_H__
+#define __MUSIC_STREAM_H__
+
+#include <stdint.h>
+#include <SDL2/SDL_mixer.h>
+
+typedef struct {
+	uint32_t underruns;    // reads that had to wait for the reader thread
+	uint64_t underrun_us;  // total time spent waiting
+	uint32_t loads;        // tracks opened
+	uint32_t cached_loads; // tracks opened with head and tail already in memory
+	uint64_t bytes_read;   // bytes read from the memory card
+} music_stream_stats;
+
+void music_stream_init(void);
+Mix_Music *music_stream_load(const char *path);
+void music_stream_get_stats(music_stream_stats *stats);
+
+#endif
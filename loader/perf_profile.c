@@ -0,0 +1,244 @@
+/* perf_profile.c -- boot time calibration of MSAA, render scale and frame cap
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <vitaGL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#include "perf_profile.h"
+
+#define PROFILE_CONFIG DATA_PATH "/profile.cfg"
+
+#define WARMUP_FRAMES 20
+#define MEASURED_FRAMES 120
+#define SCENE_SPRITES 1536
+#define SCENE_BATCH 64 // Sprites per draw, about what the game sends once batched
+#define SCENE_TEX_SIZE 64
+
+static float pos[SCENE_BATCH * 4 * 2], uv[SCENE_BATCH * 4 * 2];
+static uint8_t col[SCENE_BATCH * 4 * 4];
+static uint16_t idx[SCENE_BATCH * 6];
+
+typedef struct {
+	SceGxmMultisampleMode msaa;
+	float scale;
+	int fps;
+} candidate;
+
+// In order of preference, the first one holding its frame rate wins and the last one is taken when none does
+static const candidate candidates[] = {
+	{SCE_GXM_MULTISAMPLE_4X, 1.0f, 60},
+	{SCE_GXM_MULTISAMPLE_2X, 1.0f, 60},
+	{SCE_GXM_MULTISAMPLE_NONE, 1.0f, 60},
+	{SCE_GXM_MULTISAMPLE_NONE, 0.8f, 60},
+	{SCE_GXM_MULTISAMPLE_4X, 1.0f, 30},
+	{SCE_GXM_MULTISAMPLE_NONE, 0.8f, 30},
+};
+
+static const perf_profile default_profile = {SCE_GXM_MULTISAMPLE_4X, 1.0f, 60, 444, 222, 222, 166};
+
+// The scene only loads the GPU while the game also needs the CPU, so every candidate runs at the stock clocks
+static void candidate_profile(const candidate *c, perf_profile *p) {
+	*p = default_profile;
+	p->msaa = c->msaa;
+	p->scale = c->scale;
+	p->fps = c->fps;
+}
+
+static int msaa_samples(SceGxmMultisampleMode msaa) {
+	return msaa == SCE_GXM_MULTISAMPLE_4X ? 4 : (msaa == SCE_GXM_MULTISAMPLE_2X ? 2 : 1);
+}
+
+int perf_profile_load(perf_profile *p) {
+	*p = default_profile;
+	FILE *f = save_writer_fopen(PROFILE_CONFIG, "r");
+	if (!f)
+		return 0;
+
+	char line[128];
+	int samples;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "msaa=%d", &samples) == 1)
+			p->msaa = samples >= 4 ? SCE_GXM_MULTISAMPLE_4X : (samples >= 2 ? SCE_GXM_MULTISAMPLE_2X : SCE_GXM_MULTISAMPLE_NONE);
+		else if (sscanf(line, "scale=%f", &p->scale) == 1) {
+			if (p->scale < 0.5f || p->scale > 1.0f)
+				p->scale = default_profile.scale;
+		} else if (sscanf(line, "fps=%d", &p->fps) == 1)
+			p->fps = p->fps >= 60 ? 60 : 30;
+		else if (!sscanf(line, "arm=%d", &p->arm) && !sscanf(line, "bus=%d", &p->bus) && !sscanf(line, "gpu=%d", &p->gpu))
+			sscanf(line, "xbar=%d", &p->xbar);
+	}
+	fclose(f);
+
+	// Older calibrations could settle below the stock clocks
+	if (p->arm < default_profile.arm)
+		p->arm = default_profile.arm;
+	if (p->bus < default_profile.bus)
+		p->bus = default_profile.bus;
+	if (p->gpu < default_profile.gpu)
+		p->gpu = default_profile.gpu;
+	if (p->xbar < default_profile.xbar)
+		p->xbar = default_profile.xbar;
+	return 1;
+}
+
+static void profile_save(const perf_profile *p, const uint32_t (*results)[3], int tested) {
+	FILE *f = save_writer_fopen(PROFILE_CONFIG, "w");
+	if (!f)
+		return;
+	fprintf(f, "msaa=%d\nscale=%.2f\nfps=%d\narm=%d\nbus=%d\ngpu=%d\nxbar=%d\n", msaa_samples(p->msaa), p->scale, p->fps, p->arm, p->bus, p->gpu, p->xbar);
+	fprintf(f, "# calibration: msaa scale fps p50_us p90_us p99_us\n");
+	for (int i = 0; i < tested; i++) {
+		const candidate *c = &candidates[i];
+		fprintf(f, "# %d %.2f %d %u %u %u\n", msaa_samples(c->msaa), c->scale, c->fps, results[i][0], results[i][1], results[i][2]);
+	}
+	fclose(f);
+}
+
+void perf_profile_apply_clocks(const perf_profile *p) {
+	scePowerSetArmClockFrequency(p->arm);
+	scePowerSetBusClockFrequency(p->bus);
+	scePowerSetGpuClockFrequency(p->gpu);
+	scePowerSetGpuXbarClockFrequency(p->xbar);
+}
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : (x > y);
+}
+
+static GLuint scene_texture(void) {
+	static uint32_t pixels[SCENE_TEX_SIZE * SCENE_TEX_SIZE];
+	for (int y = 0; y < SCENE_TEX_SIZE; y++) {
+		for (int x = 0; x < SCENE_TEX_SIZE; x++) {
+			int dx = x - SCENE_TEX_SIZE / 2, dy = y - SCENE_TEX_SIZE / 2;
+			int a = 255 - (dx * dx + dy * dy) * 255 / (SCENE_TEX_SIZE * SCENE_TEX_SIZE / 4);
+			pixels[y * SCENE_TEX_SIZE + x] = ((a < 0 ? 0 : a) << 24) | (((x ^ y) & 8) ? 0x40A0FF : 0xFFC040);
+		}
+	}
+	GLuint tex;
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCENE_TEX_SIZE, SCENE_TEX_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	return tex;
+}
+
+// A fixed stand-in for a busy battle: overlapping blended sprites moving along scripted paths
+static void scene_frame(int frame, float scale) {
+	glViewport(0, 0, (GLsizei)(SCREEN_W * scale + 0.5f), (GLsizei)(SCREEN_H * scale + 0.5f));
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	uint32_t seed = 0x2545F491;
+	for (int i = 0; i < SCENE_SPRITES; i++) {
+		int n = i % SCENE_BATCH;
+		seed = seed * 1664525 + 1013904223;
+		float size = 24.0f + (seed >> 27) * 4.0f;
+		float x = (float)((seed >> 8) % SCREEN_W) + (float)((frame * (int)(seed & 7)) % 64);
+		float y = (float)((seed >> 4) % SCREEN_H) + (float)((frame * (int)((seed >> 3) & 7)) % 48);
+		float *p = &pos[n * 8], *t = &uv[n * 8];
+		p[0] = x; p[1] = y; p[2] = x + size; p[3] = y;
+		p[4] = x; p[5] = y + size; p[6] = x + size; p[7] = y + size;
+		t[0] = 0.0f; t[1] = 0.0f; t[2] = 1.0f; t[3] = 0.0f;
+		t[4] = 0.0f; t[5] = 1.0f; t[6] = 1.0f; t[7] = 1.0f;
+		memset(&col[n * 16], (seed >> 24) | 0x80, 16);
+		uint16_t *q = &idx[n * 6];
+		q[0] = n * 4; q[1] = n * 4 + 1; q[2] = n * 4 + 2;
+		q[3] = n * 4 + 1; q[4] = n * 4 + 3; q[5] = n * 4 + 2;
+		if (n == SCENE_BATCH - 1)
+			glDrawElements(GL_TRIANGLES, SCENE_BATCH * 6, GL_UNSIGNED_SHORT, idx);
+	}
+	vglSwapBuffers(GL_FALSE);
+}
+
+static void run_candidate(const candidate *c, uint32_t *result) {
+	static uint32_t times[MEASURED_FRAMES];
+	uint64_t last = 0;
+
+	for (int i = 0; i < WARMUP_FRAMES + MEASURED_FRAMES; i++) {
+		scene_frame(i, c->scale);
+		uint64_t now = sceKernelGetProcessTimeWide();
+		if (i >= WARMUP_FRAMES)
+			times[i - WARMUP_FRAMES] = now - last;
+		last = now;
+	}
+
+	qsort(times, MEASURED_FRAMES, sizeof(uint32_t), compare_u32);
+	result[0] = times[MEASURED_FRAMES / 2];
+	result[1] = times[MEASURED_FRAMES * 9 / 10];
+	result[2] = times[MEASURED_FRAMES * 99 / 100];
+}
+
+static void scene_begin(SceGxmMultisampleMode msaa, GLuint *tex) {
+	vglInitExtended(0, SCREEN_W, SCREEN_H, MEMORY_VITAGL_THRESHOLD_MB * 1024 * 1024, msaa);
+	// Frames are timed unthrottled, the cost decides which cap a profile can hold
+	eglSwapInterval(0, 0);
+	glClearColor(0.1f, 0.1f, 0.15f, 1.0f);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrthof(0, SCREEN_W, SCREEN_H, 0, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	glEnable(GL_TEXTURE_2D);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, pos);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, col);
+	glTexCoordPointer(2, GL_FLOAT, 0, uv);
+	*tex = scene_texture();
+}
+
+static void scene_end(GLuint tex) {
+	glDeleteTextures(1, &tex);
+	vglEnd();
+}
+
+void perf_profile_calibrate(perf_profile *p) {
+	static const int candidates_num = sizeof(candidates) / sizeof(*candidates);
+	uint32_t results[sizeof(candidates) / sizeof(*candidates)][3];
+	SceGxmMultisampleMode msaa = -1;
+	GLuint tex = 0;
+	int chosen = candidates_num - 1, tested = 0;
+
+	perf_profile_apply_clocks(&default_profile);
+	for (int i = 0; i < candidates_num; i++) {
+		const candidate *c = &candidates[i];
+		// The MSAA mode belongs to the screen framebuffer, changing it takes a new vitaGL instance
+		if (c->msaa != msaa) {
+			if (tex)
+				scene_end(tex);
+			scene_begin(c->msaa, &tex);
+			msaa = c->msaa;
+		}
+
+		run_candidate(c, results[i]);
+		tested = i + 1;
+		debugPrintf("perf_profile: msaa %d scale %.2f fps %d: p50 %u p90 %u p99 %u us\n", msaa_samples(c->msaa), c->scale, c->fps, results[i][0],
+			results[i][1], results[i][2]);
+
+		// Some margin is left for what the game does besides drawing
+		if (results[i][1] <= 1000000 / c->fps * 9 / 10) {
+			chosen = i;
+			break;
+		}
+	}
+	scene_end(tex);
+
+	candidate_profile(&candidates[chosen], p);
+	profile_save(p, results, tested);
+}
@@ -0,0 +1,17 @@
+#ifndef __PERF_PROFILE_H__
+#define __PERF_PROFILE_H__
+
+#include <vitasdk.h>
+
+typedef struct {
+	SceGxmMultisampleMode msaa;
+	float scale; // Highest render scale, see gl_dynres.c
+	int fps;     // 60 lets the frame pacer go up to 60 fps, 30 locks it there
+	int arm, bus, gpu, xbar; // Clock frequencies in MHz
+} perf_profile;
+
+int perf_profile_load(perf_profile *profile);
+void perf_profile_calibrate(perf_profile *profile);
+void perf_profile_apply_clocks(const perf_profile *profile);
+
+#endif
@@ -0,0 +1,202 @@
+/* rng.c -- lock free random numbers behind the game's rand and lrand48
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * The generator is PCG32: 64 bits of state, one multiply and add per number.
+ * The shared stream advances with a compare and swap on its state, so
+ * concurrent callers never wait on each other and never get the same number.
+ * With RNG_THREAD_STREAMS each thread gets its own stream instead, picked by
+ * the order threads first ask for a number.
+ *
+ * rand and lrand48 share the generator, as do srand and srand48, the game
+ * only relies on their range.
+ */
+
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "save_writer.h"
+#include "rng.h"
+
+#define SEEDS_FILE DATA_PATH "/rng_seeds.txt"
+
+#define PCG_MULT 6364136223846793005ull
+#define PCG_INC 1442695040888963407ull
+#define DEFAULT_SEED 1 // What newlib starts with when the game never seeds
+#define MAX_STREAMS 32
+#define MAX_SEEDS 256
+
+typedef struct {
+	volatile uint32_t owner;
+	uint32_t index; // in the order threads showed up, picks the stream
+	uint32_t generation;
+	uint64_t state, inc;
+} thread_stream;
+
+typedef struct {
+	uint32_t frame;
+	uint32_t seed;
+} seed_event;
+
+#ifdef RNG_THREAD_STREAMS
+static int thread_streams = 1;
+#else
+static int thread_streams = 0;
+#endif
+
+#ifdef RNG_CAPTURE
+static int capture_enabled = 1;
+#else
+static int capture_enabled = 0;
+#endif
+
+#ifdef RNG_REPLAY
+static int replay_enabled = 1;
+#else
+static int replay_enabled = 0;
+#endif
+
+static uint64_t shared_state;
+static volatile uint32_t seed = DEFAULT_SEED, generation = 0;
+static thread_stream streams[MAX_STREAMS];
+static volatile uint32_t streams_num = 0;
+
+static seed_event seeds[MAX_SEEDS];
+static volatile uint32_t seeds_num = 0, replay_pos = 0, replay_num = 0;
+static volatile int seeds_dirty = 0;
+static uint32_t frames = 0;
+
+static inline uint32_t pcg_output(uint64_t s) {
+	uint32_t x = ((s >> 18) ^ s) >> 27, rot = s >> 59;
+	return (x >> rot) | (x << (-rot & 31));
+}
+
+static void pcg_seed(uint64_t *state, uint64_t inc, uint32_t s) {
+	*state = (inc + s) * PCG_MULT + inc;
+}
+
+static uint32_t next_shared(void) {
+	uint64_t old = __atomic_load_n(&shared_state, __ATOMIC_RELAXED), next;
+	do {
+		next = old * PCG_MULT + PCG_INC;
+	} while (!__atomic_compare_exchange_n(&shared_state, &old, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return pcg_output(old);
+}
+
+static thread_stream *stream_get(void) {
+	uint32_t tid = sceKernelGetThreadId();
+	uint32_t slot = (tid * 2654435761u) % MAX_STREAMS;
+	for (int i = 0; i < MAX_STREAMS; i++) {
+		thread_stream *t = &streams[(slot + i) % MAX_STREAMS];
+		if (t->owner == tid)
+			return t;
+		if (!t->owner && __sync_bool_compare_and_swap(&t->owner, 0, tid)) {
+			t->index = __sync_fetch_and_add(&streams_num, 1);
+			t->generation = generation - 1;
+			return t;
+		}
+	}
+	return NULL; // More threads than streams, the rest share one
+}
+
+static uint32_t next(void) {
+	thread_stream *t = thread_streams ? stream_get() : NULL;
+	if (!t)
+		return next_shared();
+	if (t->generation != generation) {
+		t->generation = generation;
+		t->inc = ((uint64_t)t->index << 1) | 1;
+		pcg_seed(&t->state, t->inc, seed);
+	}
+	uint64_t old = t->state;
+	t->state = old * PCG_MULT + t->inc;
+	return pcg_output(old);
+}
+
+uint32_t rng_get_seed(void) {
+	return seed;
+}
+
+void rng_set_seed(uint32_t s) {
+	uint64_t state;
+	pcg_seed(&state, PCG_INC, s);
+	seed = s;
+	__atomic_store_n(&shared_state, state, __ATOMIC_RELAXED);
+	__sync_fetch_and_add(&generation, 1);
+}
+
+static void game_seed(uint32_t s) {
+	if (replay_enabled) {
+		uint32_t i = __sync_fetch_and_add(&replay_pos, 1);
+		if (i < replay_num)
+			s = seeds[i].seed;
+	} else if (capture_enabled) {
+		uint32_t i = __sync_fetch_and_add(&seeds_num, 1);
+		if (i < MAX_SEEDS) {
+			seeds[i].frame = frames;
+			seeds[i].seed = s;
+			seeds_dirty = 1;
+		}
+	}
+	rng_set_seed(s);
+}
+
+int rng_rand(void) {
+	return next() >> 1;
+}
+
+void rng_srand(unsigned int s) {
+	game_seed(s);
+}
+
+long rng_lrand48(void) {
+	return next() >> 1;
+}
+
+void rng_srand48(long s) {
+	game_seed(s);
+}
+
+static void seeds_load(void) {
+	FILE *f = save_writer_fopen(SEEDS_FILE, "r");
+	if (!f) {
+		debugPrintf("rng: no %s to replay\n", SEEDS_FILE);
+		return;
+	}
+	while (replay_num < MAX_SEEDS && fscanf(f, "%u %u", &seeds[replay_num].frame, &seeds[replay_num].seed) == 2)
+		replay_num++;
+	fclose(f);
+	debugPrintf("rng: replaying %u seeds\n", replay_num);
+}
+
+static void seeds_write(void) {
+	FILE *f = save_writer_fopen(SEEDS_FILE, "w");
+	if (!f)
+		return;
+	uint32_t num = seeds_num < MAX_SEEDS ? seeds_num : MAX_SEEDS;
+	for (uint32_t i = 0; i < num; i++)
+		fprintf(f, "%u %u\n", seeds[i].frame, seeds[i].seed);
+	fclose(f);
+}
+
+void rng_init(void) {
+	rng_set_seed(DEFAULT_SEED);
+	if (replay_enabled)
+		seeds_load();
+}
+
+void rng_frame(void) {
+	frames++;
+	if (seeds_dirty) {
+		seeds_dirty = 0;
+		seeds_write();
+	}
+}
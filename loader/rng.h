@@ -0,0 +1,18 @@
+#ifndef __RNG_H__
+#define __RNG_H__
+
+#include <stdint.h>
+
+void rng_init(void);
+void rng_frame(void);
+
+// Seed capture and injection, for replaying a session's random sequences
+uint32_t rng_get_seed(void);
+void rng_set_seed(uint32_t seed);
+
+int rng_rand(void);
+void rng_srand(unsigned int seed);
+long rng_lrand48(void);
+void rng_srand48(long seed);
+
+#endif
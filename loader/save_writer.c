@@ -0,0 +1,425 @@
+/* save_writer.c -- asynchronous and atomic writer for save files
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#define _GNU_SOURCE
+#include <vitasdk.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "sha1.h"
+#include "save_writer.h"
+
+#define MAX_COMMITTED 64
+
+typedef struct {
+	int refs;
+	size_t size;
+	uint8_t data[];
+} save_buf;
+
+typedef struct save_entry {
+	struct save_entry *next;
+	char path[256];
+	save_buf *buf;
+	int dirty;
+} save_entry;
+
+typedef struct {
+	char path[256];
+	uint8_t *data;
+	size_t size, cap, pos;
+} save_stream;
+
+typedef struct {
+	save_buf *buf;
+	size_t pos;
+} save_view;
+
+typedef struct {
+	char path[256];
+	BYTE hash[SHA1_BLOCK_SIZE];
+} save_digest;
+
+static save_entry *pending = NULL;
+static save_digest committed[MAX_COMMITTED];
+static int committed_idx = 0;
+
+static SceUID save_mtx = -1, save_sema = -1, save_thd = -1;
+
+static void buf_release(save_buf *buf) {
+	if (--buf->refs == 0)
+		free(buf);
+}
+
+static save_entry *entry_find(const char *path) {
+	for (save_entry *e = pending; e; e = e->next) {
+		if (!strcmp(e->path, path))
+			return e;
+	}
+	return NULL;
+}
+
+static void entry_remove(save_entry *entry) {
+	save_entry **p = &pending;
+	while (*p != entry)
+		p = &(*p)->next;
+	*p = entry->next;
+	buf_release(entry->buf);
+	free(entry);
+}
+
+static save_digest *digest_find(const char *path) {
+	for (int i = 0; i < MAX_COMMITTED; i++) {
+		if (!strcmp(committed[i].path, path))
+			return &committed[i];
+	}
+	return NULL;
+}
+
+static int commit_file(const char *path, const uint8_t *data, size_t size) {
+	char tmp_path[260];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	SceUID fd = sceIoOpen(tmp_path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+	if (fd < 0)
+		return fd;
+	size_t written = 0;
+	while (written < size) {
+		int res = sceIoWrite(fd, data + written, size - written);
+		if (res <= 0)
+			break;
+		written += res;
+	}
+	sceIoClose(fd);
+	if (written < size) {
+		sceIoRemove(tmp_path);
+		return -1;
+	}
+
+	// sceIoRename doesn't replace existing files, a crash in between is recovered on next read
+	sceIoRemove(path);
+	return sceIoRename(tmp_path, path);
+}
+
+static int save_writer_thread(SceSize args, void *argp) {
+	for (;;) {
+		sceKernelWaitSema(save_sema, 1, NULL);
+		for (;;) {
+			sceKernelLockMutex(save_mtx, 1, NULL);
+			save_entry *e = pending;
+			while (e && !e->dirty)
+				e = e->next;
+			if (!e) {
+				sceKernelUnlockMutex(save_mtx, 1);
+				break;
+			}
+			save_buf *buf = e->buf;
+			buf->refs++;
+			e->dirty = 0;
+			char path[256];
+			strcpy(path, e->path);
+			sceKernelUnlockMutex(save_mtx, 1);
+
+			// Skip the commit if the content on disk is already the same
+			BYTE hash[SHA1_BLOCK_SIZE];
+			SHA1_CTX ctx;
+			sha1_init(&ctx);
+			sha1_update(&ctx, buf->data, buf->size);
+			sha1_final(&ctx, hash);
+			sceKernelLockMutex(save_mtx, 1, NULL);
+			save_digest *d = digest_find(path);
+			int same = d && !memcmp(d->hash, hash, SHA1_BLOCK_SIZE);
+			sceKernelUnlockMutex(save_mtx, 1);
+			int res = same ? 0 : commit_file(path, buf->data, buf->size);
+			if (res < 0)
+				debugPrintf("save_writer: failed to commit %s\n", path);
+
+			sceKernelLockMutex(save_mtx, 1, NULL);
+			if (!same && res >= 0) {
+				// Digests are shared with the callers writing directly, see save_forget
+				d = digest_find(path);
+				if (!d) {
+					d = &committed[committed_idx];
+					committed_idx = (committed_idx + 1) % MAX_COMMITTED;
+					strcpy(d->path, path);
+				}
+				memcpy(d->hash, hash, SHA1_BLOCK_SIZE);
+			}
+			buf_release(buf);
+			if (!e->dirty)
+				entry_remove(e);
+			sceKernelUnlockMutex(save_mtx, 1);
+		}
+	}
+	return 0;
+}
+
+static void save_sync(const char *path) {
+	for (;;) {
+		sceKernelLockMutex(save_mtx, 1, NULL);
+		save_entry *e = entry_find(path);
+		sceKernelUnlockMutex(save_mtx, 1);
+		if (!e)
+			return;
+		sceKernelDelayThread(1000);
+	}
+}
+
+// Lets the caller write the file itself, nothing queued for it is left to overwrite what it writes
+static void save_forget(const char *path) {
+	save_sync(path);
+	sceKernelLockMutex(save_mtx, 1, NULL);
+	save_digest *d = digest_find(path);
+	if (d)
+		d->path[0] = 0;
+	sceKernelUnlockMutex(save_mtx, 1);
+}
+
+// Without memory to queue a save it's committed from the caller's thread
+static void save_direct(const char *path, const uint8_t *data, size_t size) {
+	save_forget(path);
+	if (commit_file(path, data, size) < 0)
+		debugPrintf("save_writer: failed to commit %s\n", path);
+}
+
+static void save_submit(const char *path, uint8_t *data, size_t size) {
+	save_buf *buf = malloc(sizeof(save_buf) + size);
+	if (!buf) {
+		save_direct(path, data, size);
+		return;
+	}
+	buf->refs = 1;
+	buf->size = size;
+	memcpy(buf->data, data, size);
+
+	sceKernelLockMutex(save_mtx, 1, NULL);
+	save_entry *e = entry_find(path);
+	if (e) {
+		if (e->buf->size == size && !memcmp(e->buf->data, data, size)) {
+			sceKernelUnlockMutex(save_mtx, 1);
+			free(buf);
+			return;
+		}
+		buf_release(e->buf);
+	} else {
+		e = malloc(sizeof(save_entry));
+		if (!e) {
+			sceKernelUnlockMutex(save_mtx, 1);
+			free(buf);
+			save_direct(path, data, size);
+			return;
+		}
+		strncpy(e->path, path, sizeof(e->path) - 1);
+		e->path[sizeof(e->path) - 1] = 0;
+		e->next = pending;
+		pending = e;
+	}
+	e->buf = buf;
+	e->dirty = 1;
+	sceKernelUnlockMutex(save_mtx, 1);
+
+	sceKernelSignalSema(save_sema, 1);
+}
+
+void save_writer_recover(const char *path) {
+	char tmp_path[260];
+	SceIoStat st;
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	if (save_mtx < 0) {
+		if (sceIoGetstat(path, &st) < 0 && sceIoGetstat(tmp_path, &st) >= 0)
+			sceIoRename(tmp_path, path);
+		return;
+	}
+
+	// While a save is pending the .tmp may be the writer's own, and no commit can start with the lock held
+	sceKernelLockMutex(save_mtx, 1, NULL);
+	if (!entry_find(path) && sceIoGetstat(path, &st) < 0 && sceIoGetstat(tmp_path, &st) >= 0)
+		sceIoRename(tmp_path, path);
+	sceKernelUnlockMutex(save_mtx, 1);
+}
+
+static ssize_t stream_read(void *cookie, char *buf, size_t size) {
+	save_stream *s = (save_stream *)cookie;
+	if (s->pos >= s->size)
+		return 0;
+	if (size > s->size - s->pos)
+		size = s->size - s->pos;
+	memcpy(buf, s->data + s->pos, size);
+	s->pos += size;
+	return size;
+}
+
+static ssize_t stream_write(void *cookie, const char *buf, size_t size) {
+	save_stream *s = (save_stream *)cookie;
+	if (s->pos + size > s->cap) {
+		size_t cap = s->cap ? s->cap : 0x1000;
+		while (cap < s->pos + size)
+			cap *= 2;
+		uint8_t *data = realloc(s->data, cap);
+		if (!data)
+			return -1;
+		s->data = data;
+		s->cap = cap;
+	}
+	if (s->pos > s->size)
+		memset(s->data + s->size, 0, s->pos - s->size);
+	memcpy(s->data + s->pos, buf, size);
+	s->pos += size;
+	if (s->pos > s->size)
+		s->size = s->pos;
+	return size;
+}
+
+static int seek_pos(size_t *pos, size_t size, _off64_t *off, int whence) {
+	_off64_t base = whence == SEEK_SET ? 0 : (whence == SEEK_CUR ? *pos : size);
+	if (base + *off < 0)
+		return -1;
+	*pos = base + *off;
+	*off = *pos;
+	return 0;
+}
+
+static int stream_seek(void *cookie, _off64_t *off, int whence) {
+	save_stream *s = (save_stream *)cookie;
+	return seek_pos(&s->pos, s->size, off, whence);
+}
+
+static int stream_close(void *cookie) {
+	save_stream *s = (save_stream *)cookie;
+	save_submit(s->path, s->data, s->size);
+	free(s->data);
+	free(s);
+	return 0;
+}
+
+static ssize_t view_read(void *cookie, char *buf, size_t size) {
+	save_view *v = (save_view *)cookie;
+	if (v->pos >= v->buf->size)
+		return 0;
+	if (size > v->buf->size - v->pos)
+		size = v->buf->size - v->pos;
+	memcpy(buf, v->buf->data + v->pos, size);
+	v->pos += size;
+	return size;
+}
+
+static int view_seek(void *cookie, _off64_t *off, int whence) {
+	save_view *v = (save_view *)cookie;
+	return seek_pos(&v->pos, v->buf->size, off, whence);
+}
+
+static int view_close(void *cookie) {
+	save_view *v = (save_view *)cookie;
+	sceKernelLockMutex(save_mtx, 1, NULL);
+	buf_release(v->buf);
+	sceKernelUnlockMutex(save_mtx, 1);
+	free(v);
+	return 0;
+}
+
+static cookie_io_functions_t stream_funcs = { stream_read, stream_write, stream_seek, stream_close };
+static cookie_io_functions_t view_funcs = { view_read, NULL, view_seek, view_close };
+
+int save_writer_is_save_path(const char *path) {
+	return !strncmp(path, DATA_PATH "/", sizeof(DATA_PATH)) && strncmp(path, DATA_PATH "/assets/", sizeof(DATA_PATH "/assets/") - 1);
+}
+
+FILE *save_writer_fopen(const char *path, const char *mode) {
+	if (save_mtx < 0)
+		return fopen(path, mode);
+
+	if (mode[0] == 'w') {
+		save_stream *s = calloc(1, sizeof(save_stream));
+		if (s) {
+			strncpy(s->path, path, sizeof(s->path) - 1);
+			FILE *f = fopencookie(s, mode, stream_funcs);
+			if (f)
+				return f;
+			free(s);
+		}
+		save_forget(path);
+		return fopen(path, mode);
+	}
+
+	if (mode[0] == 'r' && !strchr(mode, '+')) {
+		sceKernelLockMutex(save_mtx, 1, NULL);
+		save_entry *e = entry_find(path);
+		save_view *v = e ? malloc(sizeof(save_view)) : NULL;
+		if (v) {
+			v->buf = e->buf;
+			v->buf->refs++;
+			v->pos = 0;
+			sceKernelUnlockMutex(save_mtx, 1);
+			return fopencookie(v, mode, view_funcs);
+		}
+		sceKernelUnlockMutex(save_mtx, 1);
+		// Without a view the file on disk has to catch up first
+		if (e)
+			save_sync(path);
+	} else {
+		// Appending or updating in place needs the file on disk to be up to date
+		save_forget(path);
+	}
+
+	save_writer_recover(path);
+	return fopen(path, mode);
+}
+
+int save_writer_pending_size(const char *path, size_t *size) {
+	int found = 0;
+	if (save_mtx < 0)
+		return 0;
+	sceKernelLockMutex(save_mtx, 1, NULL);
+	save_entry *e = entry_find(path);
+	if (e) {
+		*size = e->buf->size;
+		found = 1;
+	}
+	sceKernelUnlockMutex(save_mtx, 1);
+	return found;
+}
+
+void save_writer_flush(void) {
+	for (;;) {
+		sceKernelLockMutex(save_mtx, 1, NULL);
+		save_entry *e = pending;
+		sceKernelUnlockMutex(save_mtx, 1);
+		if (!e)
+			return;
+		sceKernelDelayThread(1000);
+	}
+}
+
+// Suspended apps can be closed without atexit running, so pending saves are written out before suspending
+static int save_power_callback(int notify_id, int notify_count, int power_info, void *common) {
+	if (power_info & (SCE_POWER_CB_APP_SUSPEND | SCE_POWER_CB_SUSPENDING))
+		save_writer_flush();
+	return 0;
+}
+
+static int save_power_thread(SceSize args, void *argp) {
+	SceUID cb = sceKernelCreateCallback("save_writer power", 0, save_power_callback, NULL);
+	scePowerRegisterCallback(cb);
+	for (;;)
+		sceKernelDelayThreadCB(0x10000000);
+	return 0;
+}
+
+void save_writer_init(void) {
+	save_mtx = sceKernelCreateMutex("save_writer mutex", 0, 0, NULL);
+	save_sema = sceKernelCreateSema("save_writer sema", 0, 0, 1, NULL);
+	save_thd = sceKernelCreateThread("save_writer", &save_writer_thread, 0x10000100 + 10, 0x10000, 0, 0, NULL);
+	sceKernelStartThread(save_thd, 0, NULL);
+	SceUID power_thd = sceKernelCreateThread("save_writer power", &save_power_thread, 0x10000100, 0x1000, 0, 0, NULL);
+	sceKernelStartThread(power_thd, 0, NULL);
+	atexit(save_writer_flush);
+}
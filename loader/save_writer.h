@@ -0,0 +1,14 @@
+#ifndef __SAVE_WRITER_H__
+#define __SAVE_WRITER_H__
+
+#include <stdio.h>
+
+void save_writer_init(void);
+void save_writer_flush(void);
+
+int save_writer_is_save_path(const char *path);
+FILE *save_writer_fopen(const char *path, const char *mode);
+int save_writer_pending_size(const char *path, size_t *size);
+void save_writer_recover(const char *path);
+
+#endif
@@ -0,0 +1,257 @@
+/* sdl_batch.c -- merges the game's SDL_Renderer sprites into few geometry submissions
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <vitasdk.h>
+#include <SDL2/SDL.h>
+
+#include <string.h>
+
+#include "main.h"
+#include "config.h"
+#include "gl_state.h"
+#include "gl_stream.h"
+#include "sdl_batch.h"
+
+#define MAX_SPRITES 4096
+#define MAX_RUNS 512
+#define LOOKBACK 16 // Runs a sprite may skip over to join one with the same texture and blending
+#define STATS_INTERVAL 600
+
+typedef struct {
+	float x0, y0, x1, y1;
+	float u0, v0, u1, v1;
+	SDL_Color color;
+	int next;
+} sprite;
+
+// Sprites drawn with the same texture and blending, in the order the game drew them
+typedef struct {
+	SDL_Texture *texture;
+	SDL_BlendMode blend;
+	float x0, y0, x1, y1; // Bounds of all its sprites
+	int first, last, count;
+} run;
+
+static SDL_Renderer *batch_renderer = NULL;
+static sprite sprites[MAX_SPRITES];
+static int sprites_num = 0;
+static run runs[MAX_RUNS];
+static int runs_num = 0;
+
+static SDL_Vertex verts[MAX_SPRITES * 4];
+static int indices[MAX_SPRITES * 6];
+
+static int draw_known = 0;
+static SDL_Color draw_color;
+static SDL_BlendMode draw_blend;
+
+#ifdef SDL_BATCHING
+static int batching = 1;
+#else
+static int batching = 0;
+#endif
+
+static sdl_batch_stats stats, frame_stats;
+
+static void submit(run *r) {
+	int n = 0;
+	for (int i = r->first; i >= 0; i = sprites[i].next, n++) {
+		sprite *s = &sprites[i];
+		SDL_Vertex *v = &verts[n * 4];
+		v[0] = (SDL_Vertex){{s->x0, s->y0}, s->color, {s->u0, s->v0}};
+		v[1] = (SDL_Vertex){{s->x1, s->y0}, s->color, {s->u1, s->v0}};
+		v[2] = (SDL_Vertex){{s->x0, s->y1}, s->color, {s->u0, s->v1}};
+		v[3] = (SDL_Vertex){{s->x1, s->y1}, s->color, {s->u1, s->v1}};
+		int *idx = &indices[n * 6];
+		idx[0] = n * 4;
+		idx[1] = n * 4 + 1;
+		idx[2] = n * 4 + 2;
+		idx[3] = n * 4 + 1;
+		idx[4] = n * 4 + 3;
+		idx[5] = n * 4 + 2;
+	}
+
+	if (!r->texture) {
+		SDL_SetRenderDrawBlendMode(batch_renderer, r->blend);
+		SDL_RenderGeometry(batch_renderer, NULL, verts, n * 4, indices, n * 6);
+		frame_stats.submissions++;
+		return;
+	}
+
+	// Modulation is baked in the vertex colors, the texture's own is neutral while they're drawn
+	SDL_Texture *texture = gl_stream_sdl_front(r->texture);
+	SDL_BlendMode blend;
+	Uint8 cr, cg, cb, ca;
+	SDL_GetTextureBlendMode(texture, &blend);
+	SDL_GetTextureColorMod(texture, &cr, &cg, &cb);
+	SDL_GetTextureAlphaMod(texture, &ca);
+	SDL_SetTextureBlendMode(texture, r->blend);
+	SDL_SetTextureColorMod(texture, 255, 255, 255);
+	SDL_SetTextureAlphaMod(texture, 255);
+	SDL_RenderGeometry(batch_renderer, texture, verts, n * 4, indices, n * 6);
+	SDL_SetTextureBlendMode(texture, blend);
+	SDL_SetTextureColorMod(texture, cr, cg, cb);
+	SDL_SetTextureAlphaMod(texture, ca);
+	frame_stats.submissions++;
+}
+
+void sdl_batch_flush(void) {
+	if (!runs_num)
+		return;
+	gl_state_sync();
+	for (int i = 0; i < runs_num; i++)
+		submit(&runs[i]);
+	if (draw_known)
+		SDL_SetRenderDrawBlendMode(batch_renderer, draw_blend);
+	runs_num = sprites_num = 0;
+}
+
+static void queue(SDL_Renderer *renderer, SDL_Texture *texture, SDL_BlendMode blend, const sprite *s) {
+	if (renderer != batch_renderer || sprites_num == MAX_SPRITES || runs_num == MAX_RUNS) {
+		sdl_batch_flush();
+		batch_renderer = renderer;
+	}
+	frame_stats.sprites++;
+
+	// A sprite can only be drawn earlier than runs it doesn't overlap with
+	run *r = NULL;
+	for (int i = runs_num - 1; i >= 0 && i >= runs_num - LOOKBACK; i--) {
+		run *c = &runs[i];
+		if (c->texture == texture && c->blend == blend) {
+			r = c;
+			break;
+		}
+		if (s->x0 < c->x1 && c->x0 < s->x1 && s->y0 < c->y1 && c->y0 < s->y1)
+			break;
+	}
+
+	int n = sprites_num++;
+	sprites[n] = *s;
+	sprites[n].next = -1;
+	if (r) {
+		sprites[r->last].next = n;
+		r->last = n;
+		r->count++;
+		if (s->x0 < r->x0) r->x0 = s->x0;
+		if (s->y0 < r->y0) r->y0 = s->y0;
+		if (s->x1 > r->x1) r->x1 = s->x1;
+		if (s->y1 > r->y1) r->y1 = s->y1;
+	} else {
+		r = &runs[runs_num++];
+		r->texture = texture;
+		r->blend = blend;
+		r->x0 = s->x0;
+		r->y0 = s->y0;
+		r->x1 = s->x1;
+		r->y1 = s->y1;
+		r->first = r->last = n;
+		r->count = 1;
+	}
+}
+
+static void target_rect(SDL_Renderer *renderer, const SDL_Rect *rect, sprite *s) {
+	if (rect) {
+		s->x0 = rect->x;
+		s->y0 = rect->y;
+		s->x1 = rect->x + rect->w;
+		s->y1 = rect->y + rect->h;
+	} else {
+		// Like SDL, a null rect covers the viewport, coordinates being relative to it
+		SDL_Rect viewport;
+		SDL_RenderGetViewport(renderer, &viewport);
+		s->x0 = s->y0 = 0.0f;
+		s->x1 = viewport.w;
+		s->y1 = viewport.h;
+	}
+}
+
+int sdl_batch_copy(SDL_Renderer *renderer, SDL_Texture *texture, const SDL_Rect *srcrect, const SDL_Rect *dstrect) {
+	int w, h;
+	if (!batching || !texture || SDL_QueryTexture(texture, NULL, NULL, &w, &h) < 0) {
+		sdl_batch_flush();
+		gl_state_sync();
+		return SDL_RenderCopy(renderer, gl_stream_sdl_front(texture), srcrect, dstrect);
+	}
+	if (dstrect && (dstrect->w <= 0 || dstrect->h <= 0))
+		return 0;
+
+	sprite s;
+	target_rect(renderer, dstrect, &s);
+	if (srcrect) {
+		s.u0 = (float)srcrect->x / w;
+		s.v0 = (float)srcrect->y / h;
+		s.u1 = (float)(srcrect->x + srcrect->w) / w;
+		s.v1 = (float)(srcrect->y + srcrect->h) / h;
+	} else {
+		s.u0 = s.v0 = 0.0f;
+		s.u1 = s.v1 = 1.0f;
+	}
+
+	SDL_BlendMode blend;
+	SDL_GetTextureBlendMode(texture, &blend);
+	SDL_GetTextureColorMod(texture, &s.color.r, &s.color.g, &s.color.b);
+	SDL_GetTextureAlphaMod(texture, &s.color.a);
+	queue(renderer, texture, blend, &s);
+	return 0;
+}
+
+int sdl_batch_fill(SDL_Renderer *renderer, const SDL_Rect *rect) {
+	if (!batching) {
+		gl_state_sync();
+		return SDL_RenderFillRect(renderer, rect);
+	}
+	if (rect && (rect->w <= 0 || rect->h <= 0))
+		return 0;
+
+	if (!draw_known) {
+		SDL_GetRenderDrawColor(renderer, &draw_color.r, &draw_color.g, &draw_color.b, &draw_color.a);
+		SDL_GetRenderDrawBlendMode(renderer, &draw_blend);
+		draw_known = 1;
+	}
+
+	sprite s;
+	target_rect(renderer, rect, &s);
+	s.u0 = s.v0 = s.u1 = s.v1 = 0.0f;
+	s.color = draw_color;
+	queue(renderer, NULL, draw_blend, &s);
+	return 0;
+}
+
+int sdl_batch_set_draw_color(SDL_Renderer *renderer, Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
+	// Queued fills carry their color, SDL's own draw color doesn't need to wait for them
+	if (draw_known)
+		draw_color = (SDL_Color){r, g, b, a};
+	return SDL_SetRenderDrawColor(renderer, r, g, b, a);
+}
+
+int sdl_batch_set_draw_blend_mode(SDL_Renderer *renderer, SDL_BlendMode mode) {
+	if (draw_known)
+		draw_blend = mode;
+	return SDL_SetRenderDrawBlendMode(renderer, mode);
+}
+
+void sdl_batch_texture_changed(SDL_Texture *texture) {
+	for (int i = 0; i < runs_num; i++) {
+		if (runs[i].texture == texture) {
+			sdl_batch_flush();
+			return;
+		}
+	}
+}
+
+void sdl_batch_frame(void) {
+	frame_stats.frames = stats.frames + 1;
+	stats = frame_stats;
+	memset(&frame_stats, 0, sizeof(frame_stats));
+	if (stats.sprites && stats.frames % STATS_INTERVAL == 0)
+		debugPrintf("sdl_batch: %u sprites -> %u submissions\n", stats.sprites, stats.submissions);
+}
+
+void sdl_batch_get_stats(sdl_batch_stats *out) {
+	*out = stats;
+}
@@ -0,0 +1,22 @@
+#ifndef __SDL_BATCH_H__
+#define __SDL_BATCH_H__
+
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+typedef struct {
+	uint32_t frames;
+	uint32_t sprites;     // SDL_RenderCopy/SDL_RenderFillRect calls made by the game in the last frame
+	uint32_t submissions; // SDL_RenderGeometry calls they were merged into in the last frame
+} sdl_batch_stats;
+
+int sdl_batch_copy(SDL_Renderer *renderer, SDL_Texture *texture, const SDL_Rect *srcrect, const SDL_Rect *dstrect);
+int sdl_batch_fill(SDL_Renderer *renderer, const SDL_Rect *rect);
+int sdl_batch_set_draw_color(SDL_Renderer *renderer, Uint8 r, Uint8 g, Uint8 b, Uint8 a);
+int sdl_batch_set_draw_blend_mode(SDL_Renderer *renderer, SDL_BlendMode mode);
+void sdl_batch_texture_changed(SDL_Texture *texture);
+void sdl_batch_flush(void);
+void sdl_batch_frame(void);
+void sdl_batch_get_stats(sdl_batch_stats *stats);
+
+#endif
@@ -625,6 +625,27 @@ uintptr_t so_symbol(so_module *mod, const char *symbol) {
 	return mod->text_base + mod->dynsym[index].st_value;
 }
 
+const char *so_symbol_at(so_module *mod, uintptr_t addr, uintptr_t *offset) {
+	if (addr < mod->text_base || addr >= mod->text_base + mod->text_size)
+		return NULL;
+	addr -= mod->text_base;
+
+	// The closest function starting at or before addr, Thumb symbols have their low bit set
+	Elf32_Sym *best = NULL;
+	for (int i = 0; i < mod->num_dynsym; i++) {
+		Elf32_Sym *sym = &mod->dynsym[i];
+		if (sym->st_shndx == SHN_UNDEF || ELF32_ST_TYPE(sym->st_info) != STT_FUNC || (sym->st_value & ~1) > addr)
+			continue;
+		if (!best || (sym->st_value & ~1) > (best->st_value & ~1))
+			best = sym;
+	}
+	if (!best)
+		return NULL;
+	if (offset)
+		*offset = addr - (best->st_value & ~1);
+	return mod->dynstr + best->st_name;
+}
+
 void so_symbol_fix_ldmia(so_module *mod, const char *symbol) {
 	// This is meant to work around crashes due to unaligned accesses (SIGBUS :/) due to certain
 	// kernels not having the fault trap enabled, e.g. certain RK3326 Odroid Go Advance clone distros.
@@ -0,0 +1,418 @@
+/* sort.c -- qsort and bsearch for the game
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * The unstable sort follows pdqsort: median of three pivots (ninther past
+ * 128 elements), insertion sort under 24 elements, a cheap insertion pass
+ * whenever a partition needed no swaps, shuffles after unbalanced partitions
+ * and heapsort once too many of them happened. Equal elements get grouped
+ * so runs of the same key cost linear time.
+ *
+ * The game sorts its draw lists every frame and they barely change between
+ * frames, so a first pass counts out of order neighbours: sorted input
+ * returns right away, reversed input gets reversed, and input with few
+ * misplaced elements goes through a bounded insertion sort.
+ *
+ * The stable sort is a bottom up merge sort over insertion sorted runs of
+ * 16, skipping merges whose halves are already in order. It returns right
+ * away on sorted input too, reversed input can't just be reversed there.
+ *
+ * The file also builds on the host for tools/sort_bench.c.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __vita__
+#include "config.h"
+#endif
+#include "sort.h"
+
+#define INSERTION_MAX 24
+#define NINTHER_MIN 128
+#define PARTIAL_INSERTION_LIMIT 8
+#define RUN_SIZE 16
+
+enum {
+	ELEM_WORD,  // 4 bytes, aligned
+	ELEM_PAIR,  // 8 bytes, aligned to 4
+	ELEM_WORDS, // multiple of 4, aligned
+	ELEM_BYTES,
+};
+
+typedef uint32_t __attribute__((may_alias)) word;
+
+typedef struct {
+	size_t size;
+	int type;
+	sort_cmp cmp;
+} sorter;
+
+#ifdef SORT_STABLE
+static int stable_enabled = 1;
+#else
+static int stable_enabled = 0;
+#endif
+
+static int elem_type(const void *base, size_t size) {
+	if ((uintptr_t)base & 3 || size & 3)
+		return ELEM_BYTES;
+	return size == 4 ? ELEM_WORD : (size == 8 ? ELEM_PAIR : ELEM_WORDS);
+}
+
+static inline void swap(const sorter *s, char *a, char *b) {
+	word *x = (word *)a, *y = (word *)b, t;
+	switch (s->type) {
+	case ELEM_WORD:
+		t = x[0];
+		x[0] = y[0];
+		y[0] = t;
+		break;
+	case ELEM_PAIR:
+		t = x[0];
+		x[0] = y[0];
+		y[0] = t;
+		t = x[1];
+		x[1] = y[1];
+		y[1] = t;
+		break;
+	case ELEM_WORDS:
+		for (size_t i = 0; i < s->size / 4; i++) {
+			t = x[i];
+			x[i] = y[i];
+			y[i] = t;
+		}
+		break;
+	default:
+		for (size_t i = 0; i < s->size; i++) {
+			char c = a[i];
+			a[i] = b[i];
+			b[i] = c;
+		}
+		break;
+	}
+}
+
+static inline void copy(const sorter *s, char *dst, const char *src) {
+	switch (s->type) {
+	case ELEM_WORD:
+		*(word *)dst = *(const word *)src;
+		break;
+	case ELEM_PAIR:
+		((word *)dst)[0] = ((const word *)src)[0];
+		((word *)dst)[1] = ((const word *)src)[1];
+		break;
+	default:
+		memcpy(dst, src, s->size);
+		break;
+	}
+}
+
+static inline int less(const sorter *s, const char *a, const char *b) {
+	return s->cmp(a, b) < 0;
+}
+
+// Plain insertion sort, every element sifts down until it meets a smaller or equal one
+static void insertion_sort(const sorter *s, char *begin, char *end) {
+	size_t size = s->size;
+	for (char *cur = begin + size; cur < end; cur += size) {
+		for (char *p = cur; p > begin && less(s, p, p - size); p -= size)
+			swap(s, p, p - size);
+	}
+}
+
+// Gives up once more than limit elements were moved, returns whether the range got sorted
+static int partial_insertion_sort(const sorter *s, char *begin, char *end, size_t limit) {
+	size_t size = s->size, moves = 0;
+	for (char *cur = begin + size; cur < end; cur += size) {
+		char *p = cur;
+		for (; p > begin && less(s, p, p - size); p -= size)
+			swap(s, p, p - size);
+		moves += (cur - p) / size;
+		if (moves > limit)
+			return 0;
+	}
+	return 1;
+}
+
+static void sort3(const sorter *s, char *a, char *b, char *c) {
+	if (less(s, b, a))
+		swap(s, a, b);
+	if (less(s, c, b)) {
+		swap(s, b, c);
+		if (less(s, b, a))
+			swap(s, a, b);
+	}
+}
+
+static void sift_down(const sorter *s, char *base, size_t root, size_t num) {
+	size_t size = s->size;
+	for (;;) {
+		size_t child = root * 2 + 1;
+		if (child >= num)
+			return;
+		if (child + 1 < num && less(s, base + child * size, base + (child + 1) * size))
+			child++;
+		if (!less(s, base + root * size, base + child * size))
+			return;
+		swap(s, base + root * size, base + child * size);
+		root = child;
+	}
+}
+
+static void heap_sort(const sorter *s, char *begin, char *end) {
+	size_t num = (end - begin) / s->size;
+	for (size_t i = num / 2; i-- > 0;)
+		sift_down(s, begin, i, num);
+	for (size_t i = num - 1; i > 0; i--) {
+		swap(s, begin, begin + i * s->size);
+		sift_down(s, begin, 0, i);
+	}
+}
+
+// Pivot at begin, elements equal to it go right. Returns its final place
+static char *partition_right(const sorter *s, char *begin, char *end, int *already_partitioned) {
+	size_t size = s->size;
+	char *first = begin, *last = end;
+	while (less(s, first += size, begin))
+		;
+	if (first - size == begin) {
+		while (first < last && !less(s, last -= size, begin))
+			;
+	} else {
+		while (!less(s, last -= size, begin))
+			;
+	}
+	*already_partitioned = first >= last;
+	while (first < last) {
+		swap(s, first, last);
+		while (less(s, first += size, begin))
+			;
+		while (!less(s, last -= size, begin))
+			;
+	}
+	char *pivot = first - size;
+	if (pivot != begin)
+		swap(s, begin, pivot);
+	return pivot;
+}
+
+// Pivot at begin, elements equal to it go left. Used when the pivot equals the element before
+// the range, so everything equal ends up in place at once
+static char *partition_left(const sorter *s, char *begin, char *end) {
+	size_t size = s->size;
+	char *first = begin, *last = end;
+	while (less(s, begin, last -= size))
+		;
+	if (last + size == end) {
+		while (first < last && !less(s, begin, first += size))
+			;
+	} else {
+		while (!less(s, begin, first += size))
+			;
+	}
+	while (first < last) {
+		swap(s, first, last);
+		while (less(s, begin, last -= size))
+			;
+		while (!less(s, begin, first += size))
+			;
+	}
+	if (last != begin)
+		swap(s, begin, last);
+	return last;
+}
+
+// Breaks patterns that made a partition unbalanced
+static void shuffle(const sorter *s, char *begin, char *end) {
+	size_t size = s->size, num = (end - begin) / size, q = num / 4;
+	if (num < INSERTION_MAX)
+		return;
+	swap(s, begin, begin + q * size);
+	swap(s, end - size, end - (q + 1) * size);
+	if (num > NINTHER_MIN) {
+		swap(s, begin + size, begin + (q + 1) * size);
+		swap(s, begin + 2 * size, begin + (q + 2) * size);
+		swap(s, end - 2 * size, end - (q + 2) * size);
+		swap(s, end - 3 * size, end - (q + 3) * size);
+	}
+}
+
+static void pdq_loop(const sorter *s, char *begin, char *end, int bad_allowed, int leftmost) {
+	size_t size = s->size;
+	for (;;) {
+		size_t num = (end - begin) / size;
+		if (num < INSERTION_MAX) {
+			insertion_sort(s, begin, end);
+			return;
+		}
+
+		size_t half = num / 2;
+		if (num > NINTHER_MIN) {
+			sort3(s, begin, begin + half * size, end - size);
+			sort3(s, begin + size, begin + (half - 1) * size, end - 2 * size);
+			sort3(s, begin + 2 * size, begin + (half + 1) * size, end - 3 * size);
+			sort3(s, begin + (half - 1) * size, begin + half * size, begin + (half + 1) * size);
+			swap(s, begin, begin + half * size);
+		} else
+			sort3(s, begin + half * size, begin, end - size);
+
+		// Everything before the range is <= pivot, when it's equal there's a run of equal keys
+		if (!leftmost && !less(s, begin - size, begin)) {
+			begin = partition_left(s, begin, end) + size;
+			continue;
+		}
+
+		int already_partitioned;
+		char *pivot = partition_right(s, begin, end, &already_partitioned);
+		size_t left = (pivot - begin) / size, right = (end - pivot) / size - 1;
+		if (left < num / 8 || right < num / 8) {
+			if (--bad_allowed == 0) {
+				heap_sort(s, begin, end);
+				return;
+			}
+			shuffle(s, begin, pivot);
+			shuffle(s, pivot + size, end);
+		} else if (already_partitioned && partial_insertion_sort(s, begin, pivot, PARTIAL_INSERTION_LIMIT) &&
+			partial_insertion_sort(s, pivot + size, end, PARTIAL_INSERTION_LIMIT))
+			return;
+
+		pdq_loop(s, begin, pivot, bad_allowed, leftmost);
+		begin = pivot + size;
+		leftmost = 0;
+	}
+}
+
+static void reverse(const sorter *s, char *begin, char *end) {
+	for (end -= s->size; begin < end; begin += s->size, end -= s->size)
+		swap(s, begin, end);
+}
+
+// Counts neighbours out of order, and whether every neighbour is strictly descending
+static size_t descents(const sorter *s, char *begin, char *end, int *strictly_descending) {
+	size_t size = s->size, count = 0;
+	*strictly_descending = 1;
+	for (char *p = begin + size; p < end; p += size) {
+		int c = s->cmp(p - size, p);
+		if (c > 0)
+			count++;
+		else
+			*strictly_descending = 0;
+	}
+	return count;
+}
+
+void sort_unstable(void *base, size_t num, size_t size, sort_cmp cmp) {
+	if (num < 2 || !size)
+		return;
+	sorter s = { size, elem_type(base, size), cmp };
+	char *begin = base, *end = begin + num * size;
+	if (num < INSERTION_MAX) {
+		insertion_sort(&s, begin, end);
+		return;
+	}
+
+	int strictly_descending;
+	size_t out_of_order = descents(&s, begin, end, &strictly_descending);
+	if (!out_of_order)
+		return;
+	if (strictly_descending) {
+		reverse(&s, begin, end);
+		return;
+	}
+	// A few elements moved since the last frame, each costs about how far it went
+	if (out_of_order <= num / 32 && partial_insertion_sort(&s, begin, end, num))
+		return;
+
+	int bad_allowed = 1;
+	while (num >>= 1)
+		bad_allowed++;
+	pdq_loop(&s, begin, end, bad_allowed, 1);
+}
+
+static void merge(const sorter *s, const char *left, const char *mid, const char *end, char *out) {
+	size_t size = s->size;
+	const char *right = mid;
+	while (left < mid && right < end) {
+		// Ties take from the left, which is what keeps the sort stable
+		if (less(s, right, left)) {
+			copy(s, out, right);
+			right += size;
+		} else {
+			copy(s, out, left);
+			left += size;
+		}
+		out += size;
+	}
+	if (left < mid)
+		memcpy(out, left, mid - left);
+	else if (right < end)
+		memcpy(out, right, end - right);
+}
+
+void sort_stable(void *base, size_t num, size_t size, sort_cmp cmp) {
+	if (num < 2 || !size)
+		return;
+	sorter s = { size, elem_type(base, size), cmp };
+	char *begin = base, *end = begin + num * size;
+	int strictly_descending;
+	if (!descents(&s, begin, end, &strictly_descending))
+		return;
+	size_t run = RUN_SIZE * size;
+	for (char *p = begin; p < end; p += run)
+		insertion_sort(&s, p, p + run < end ? p + run : end);
+	if (num <= RUN_SIZE)
+		return;
+
+	char *tmp = malloc(num * size);
+	if (!tmp) {
+		// Only the order of equal elements is lost
+		sort_unstable(base, num, size, cmp);
+		return;
+	}
+	char *src = begin, *dst = tmp;
+	size_t total = num * size;
+	for (size_t width = run; width < total; width *= 2) {
+		for (size_t lo = 0; lo < total; lo += 2 * width) {
+			size_t mid = lo + width < total ? lo + width : total, hi = lo + 2 * width < total ? lo + 2 * width : total;
+			// Halves already in order only need moving
+			if (mid == hi || !less(&s, src + mid, src + mid - size))
+				memcpy(dst + lo, src + lo, hi - lo);
+			else
+				merge(&s, src + lo, src + mid, src + hi, dst + lo);
+		}
+		char *t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != begin)
+		memcpy(begin, src, total);
+	free(tmp);
+}
+
+void sort_qsort(void *base, size_t num, size_t size, sort_cmp cmp) {
+	if (stable_enabled)
+		sort_stable(base, num, size, cmp);
+	else
+		sort_unstable(base, num, size, cmp);
+}
+
+void *sort_bsearch(const void *key, const void *base, size_t num, size_t size, sort_cmp cmp) {
+	const char *lo = base;
+	while (num) {
+		const char *mid = lo + (num / 2) * size;
+		int c = cmp(key, mid);
+		if (!c)
+			return (void *)mid;
+		if (c > 0) {
+			lo = mid + size;
+			num -= num / 2 + 1;
+		} else
+			num /= 2;
+	}
+	return NULL;
+}
@@ -0,0 +1,15 @@
+#ifndef __SORT_H__
+#define __SORT_H__
+
+#include <stddef.h>
+
+typedef int (*sort_cmp)(const void *, const void *);
+
+void sort_unstable(void *base, size_t num, size_t size, sort_cmp cmp);
+void sort_stable(void *base, size_t num, size_t size, sort_cmp cmp);
+
+// What the game's qsort gets, stable or not following SORT_STABLE
+void sort_qsort(void *base, size_t num, size_t size, sort_cmp cmp);
+void *sort_bsearch(const void *key, const void *base, size_t num, size_t size, sort_cmp cmp);
+
+#endif
@@ -0,0 +1,309 @@
+/* str_ops.c -- string routines for the game's str and wcs imports
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * The scans go a word at a time: once the pointer is aligned, four bytes are
+ * tested for a terminator or a match with a couple of ALU ops. Aligned loads
+ * never cross a page, so reading up to three bytes past the end of a string
+ * is harmless. Case folding is ASCII only, like bionic in the C locale.
+ *
+ * The file also builds on the host for tools/str_ops_check.c.
+ */
+
+// These loops must not be turned back into calls to strlen/memset
+#pragma GCC optimize("no-tree-loop-distribute-patterns")
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mem_ops.h"
+#include "str_ops.h"
+
+#define ONES 0x01010101u
+#define HIGHS 0x80808080u
+
+typedef uint32_t __attribute__((may_alias)) word;
+
+// Flags the zero bytes of v, the lowest flag is always exact
+static inline uint32_t zero_bytes(uint32_t v) {
+	return (v - ONES) & ~v & HIGHS;
+}
+
+// Index of the lowest flagged byte (little endian)
+static inline int first_byte(uint32_t flags) {
+	return __builtin_ctz(flags) >> 3;
+}
+
+static inline int fold(int c) {
+	return (unsigned)(c - 'A') < 26 ? c + 32 : c;
+}
+
+static inline int aligned(const void *p) {
+	return !((uintptr_t)p & 3);
+}
+
+size_t str_ops_strlen(const char *s) {
+	const char *p = s;
+	for (; !aligned(p); p++) {
+		if (!*p)
+			return p - s;
+	}
+	const word *w = (const word *)p;
+	uint32_t z;
+	while (!(z = zero_bytes(*w)))
+		w++;
+	return (const char *)w + first_byte(z) - s;
+}
+
+size_t str_ops_strnlen(const char *s, size_t n) {
+	const char *p = str_ops_memchr(s, 0, n);
+	return p ? p - s : n;
+}
+
+// First byte that's either the terminator or one of the two given ones
+static const char *find_either(const char *s, uint8_t a, uint8_t b) {
+	const uint8_t *p = (const uint8_t *)s;
+	for (; !aligned(p); p++) {
+		if (!*p || *p == a || *p == b)
+			return (const char *)p;
+	}
+	uint32_t ma = ONES * a, mb = ONES * b;
+	const word *w = (const word *)p;
+	for (;; w++) {
+		uint32_t v = *w, z = zero_bytes(v) | zero_bytes(v ^ ma) | zero_bytes(v ^ mb);
+		if (z)
+			return (const char *)w + first_byte(z);
+	}
+}
+
+char *str_ops_strchr(const char *s, int c) {
+	const char *p = find_either(s, c, c);
+	return *p == (char)c ? (char *)p : NULL;
+}
+
+char *str_ops_strrchr(const char *s, int c) {
+	const char *last = NULL;
+	for (;;) {
+		const char *p = find_either(s, c, c);
+		if (*p != (char)c)
+			return (char *)last;
+		if (!*p)
+			return (char *)p;
+		last = p;
+		s = p + 1;
+	}
+}
+
+void *str_ops_memchr(const void *s, int c, size_t n) {
+	const uint8_t *p = s;
+	uint8_t ch = c;
+	for (; n && !aligned(p); n--, p++) {
+		if (*p == ch)
+			return (void *)p;
+	}
+	uint32_t m = ONES * ch;
+	for (; n >= 4; n -= 4, p += 4) {
+		uint32_t z = zero_bytes(*(const word *)p ^ m);
+		if (z)
+			return (void *)(p + first_byte(z));
+	}
+	for (; n; n--, p++) {
+		if (*p == ch)
+			return (void *)p;
+	}
+	return NULL;
+}
+
+int str_ops_memcmp(const void *a, const void *b, size_t n) {
+	const uint8_t *p = a, *q = b;
+	// Both bounded by n, unaligned loads are fine here
+	for (; n >= 4; n -= 4, p += 4, q += 4) {
+		uint32_t x, y;
+		__builtin_memcpy(&x, p, 4);
+		__builtin_memcpy(&y, q, 4);
+		if (x != y)
+			break;
+	}
+	for (; n; n--, p++, q++) {
+		if (*p != *q)
+			return *p - *q;
+	}
+	return 0;
+}
+
+int str_ops_strcmp(const char *a, const char *b) {
+	const uint8_t *p = (const uint8_t *)a, *q = (const uint8_t *)b;
+	// Words only when both strings reach alignment together, else a load of b could cross a page
+	if ((((uintptr_t)p ^ (uintptr_t)q) & 3) == 0) {
+		for (; !aligned(p); p++, q++) {
+			if (!*p || *p != *q)
+				return *p - *q;
+		}
+		const word *wp = (const word *)p, *wq = (const word *)q;
+		while (*wp == *wq && !zero_bytes(*wp)) {
+			wp++;
+			wq++;
+		}
+		p = (const uint8_t *)wp;
+		q = (const uint8_t *)wq;
+	}
+	for (; *p && *p == *q; p++, q++)
+		;
+	return *p - *q;
+}
+
+int str_ops_strncmp(const char *a, const char *b, size_t n) {
+	const uint8_t *p = (const uint8_t *)a, *q = (const uint8_t *)b;
+	for (; n; n--, p++, q++) {
+		if (!*p || *p != *q)
+			return *p - *q;
+	}
+	return 0;
+}
+
+int str_ops_strcasecmp(const char *a, const char *b) {
+	const uint8_t *p = (const uint8_t *)a, *q = (const uint8_t *)b;
+	for (;; p++, q++) {
+		int x = fold(*p), y = fold(*q);
+		if (x != y || !x)
+			return x - y;
+	}
+}
+
+int str_ops_strncasecmp(const char *a, const char *b, size_t n) {
+	const uint8_t *p = (const uint8_t *)a, *q = (const uint8_t *)b;
+	for (; n; n--, p++, q++) {
+		int x = fold(*p), y = fold(*q);
+		if (x != y || !x)
+			return x - y;
+	}
+	return 0;
+}
+
+char *str_ops_strstr(const char *h, const char *n) {
+	if (!*n)
+		return (char *)h;
+	size_t len = str_ops_strlen(n);
+	for (h = find_either(h, *n, *n); *h; h = find_either(h + 1, *n, *n)) {
+		if (!str_ops_strncmp(h + 1, n + 1, len - 1))
+			return (char *)h;
+	}
+	return NULL;
+}
+
+char *str_ops_strcasestr(const char *h, const char *n) {
+	if (!*n)
+		return (char *)h;
+	size_t len = str_ops_strlen(n);
+	uint8_t lower = fold((uint8_t)*n), upper = (unsigned)(lower - 'a') < 26 ? lower - 32 : lower;
+	for (h = find_either(h, lower, upper); *h; h = find_either(h + 1, lower, upper)) {
+		if (!str_ops_strncasecmp(h + 1, n + 1, len - 1))
+			return (char *)h;
+	}
+	return NULL;
+}
+
+size_t str_ops_strcspn(const char *s, const char *reject) {
+	uint32_t set[8] = {1}; // The terminator always stops the scan
+	for (const uint8_t *r = (const uint8_t *)reject; *r; r++)
+		set[*r >> 5] |= 1u << (*r & 31);
+	const uint8_t *p = (const uint8_t *)s;
+	while (!(set[*p >> 5] & (1u << (*p & 31))))
+		p++;
+	return (const char *)p - s;
+}
+
+char *str_ops_strpbrk(const char *s, const char *accept) {
+	s += str_ops_strcspn(s, accept);
+	return *s ? (char *)s : NULL;
+}
+
+char *str_ops_strcpy(char *dst, const char *src) {
+	mem_ops_memcpy(dst, src, str_ops_strlen(src) + 1);
+	return dst;
+}
+
+char *str_ops_strncpy(char *dst, const char *src, size_t n) {
+	size_t len = str_ops_strnlen(src, n);
+	mem_ops_memcpy(dst, src, len);
+	mem_ops_memset(dst + len, 0, n - len);
+	return dst;
+}
+
+char *str_ops_strcat(char *dst, const char *src) {
+	str_ops_strcpy(dst + str_ops_strlen(dst), src);
+	return dst;
+}
+
+char *str_ops_strncat(char *dst, const char *src, size_t n) {
+	char *end = dst + str_ops_strlen(dst);
+	size_t len = str_ops_strnlen(src, n);
+	mem_ops_memcpy(end, src, len);
+	end[len] = 0;
+	return dst;
+}
+
+size_t str_ops_strlcpy(char *dst, const char *src, size_t size) {
+	size_t len = str_ops_strlen(src);
+	if (size) {
+		size_t n = len < size ? len : size - 1;
+		mem_ops_memcpy(dst, src, n);
+		dst[n] = 0;
+	}
+	return len;
+}
+
+size_t str_ops_wcslen(const wchar_t *s) {
+	const wchar_t *p = s;
+	while (*p)
+		p++;
+	return p - s;
+}
+
+int str_ops_wcscmp(const wchar_t *a, const wchar_t *b) {
+	for (; *a && *a == *b; a++, b++)
+		;
+	return *a < *b ? -1 : *a > *b;
+}
+
+wchar_t *str_ops_wcsncpy(wchar_t *dst, const wchar_t *src, size_t n) {
+	size_t len = 0;
+	while (len < n && src[len])
+		len++;
+	mem_ops_memcpy(dst, src, len * sizeof(wchar_t));
+	mem_ops_memset(dst + len, 0, (n - len) * sizeof(wchar_t));
+	return dst;
+}
+
+wchar_t *str_ops_wmemchr(const wchar_t *s, wchar_t c, size_t n) {
+	for (; n; n--, s++) {
+		if (*s == c)
+			return (wchar_t *)s;
+	}
+	return NULL;
+}
+
+int str_ops_wmemcmp(const wchar_t *a, const wchar_t *b, size_t n) {
+	for (; n; n--, a++, b++) {
+		if (*a != *b)
+			return *a < *b ? -1 : 1;
+	}
+	return 0;
+}
+
+wchar_t *str_ops_wmemcpy(wchar_t *dst, const wchar_t *src, size_t n) {
+	return mem_ops_memcpy(dst, src, n * sizeof(wchar_t));
+}
+
+wchar_t *str_ops_wmemmove(wchar_t *dst, const wchar_t *src, size_t n) {
+	return mem_ops_memmove(dst, src, n * sizeof(wchar_t));
+}
+
+wchar_t *str_ops_wmemset(wchar_t *dst, wchar_t c, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		dst[i] = c;
+	return dst;
+}
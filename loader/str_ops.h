@@ -0,0 +1,36 @@
+#ifndef __STR_OPS_H__
+#define __STR_OPS_H__
+
+#include <stddef.h>
+#include <wchar.h>
+
+size_t str_ops_strlen(const char *s);
+size_t str_ops_strnlen(const char *s, size_t n);
+char *str_ops_strchr(const char *s, int c);
+char *str_ops_strrchr(const char *s, int c);
+void *str_ops_memchr(const void *s, int c, size_t n);
+int str_ops_memcmp(const void *a, const void *b, size_t n);
+int str_ops_strcmp(const char *a, const char *b);
+int str_ops_strncmp(const char *a, const char *b, size_t n);
+int str_ops_strcasecmp(const char *a, const char *b);
+int str_ops_strncasecmp(const char *a, const char *b, size_t n);
+char *str_ops_strstr(const char *h, const char *n);
+char *str_ops_strcasestr(const char *h, const char *n);
+size_t str_ops_strcspn(const char *s, const char *reject);
+char *str_ops_strpbrk(const char *s, const char *accept);
+char *str_ops_strcpy(char *dst, const char *src);
+char *str_ops_strncpy(char *dst, const char *src, size_t n);
+char *str_ops_strcat(char *dst, const char *src);
+char *str_ops_strncat(char *dst, const char *src, size_t n);
+size_t str_ops_strlcpy(char *dst, const char *src, size_t size);
+
+size_t str_ops_wcslen(const wchar_t *s);
+int str_ops_wcscmp(const wchar_t *a, const wchar_t *b);
+wchar_t *str_ops_wcsncpy(wchar_t *dst, const wchar_t *src, size_t n);
+wchar_t *str_ops_wmemchr(const wchar_t *s, wchar_t c, size_t n);
+int str_ops_wmemcmp(const wchar_t *a, const wchar_t *b, size_t n);
+wchar_t *str_ops_wmemcpy(wchar_t *dst, const wchar_t *src, size_t n);
+wchar_t *str_ops_wmemmove(wchar_t *dst, const wchar_t *src, size_t n);
+wchar_t *str_ops_wmemset(wchar_t *dst, wchar_t c, size_t n);
+
+#endif
@@ -0,0 +1,503 @@
+/* zlib_fast.c -- faster crc32 and whole buffer inflate for the game's zlib imports
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+#include "zlib_fast.h"
+
+// z_stream::reserved is unused by zlib, we keep the init parameters of our streams there
+#define ZF_TAG 0x5A460000
+#define ZF_TAG_MASK 0xFFFF0000
+#define ZF_DONE 0x100
+#define ZF_WBITS(x) ((int)((x) & 0xFF) - 64)
+
+#define FAST_BITS 10
+
+enum {
+	ZF_OK = 0,
+	ZF_NEED_INPUT,
+	ZF_NEED_OUTPUT,
+	ZF_BAD_DATA,
+};
+
+typedef struct {
+	uint16_t fast[1 << FAST_BITS]; // symbol | (length << 9), 0 for codes longer than FAST_BITS
+	uint16_t count[16];
+	uint16_t symbol[288];
+} huff_table;
+
+typedef struct {
+	const uint8_t *in, *in_start, *in_end;
+	uint8_t *out, *out_start, *out_end;
+	uint64_t bitbuf;
+	uint32_t bitcnt;
+} inflate_ctx;
+
+static const uint16_t len_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t len_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t codelen_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static huff_table fixed_lit, fixed_dist;
+static int fixed_ready = 0;
+
+static uint32_t crc_table[8][256];
+static int crc_ready = 0;
+
+static int huff_build(huff_table *h, const uint8_t *lengths, int n, int lone_ok) {
+	uint16_t offs[16];
+	memset(h->count, 0, sizeof(h->count));
+	for (int i = 0; i < n; i++)
+		h->count[lengths[i]]++;
+	h->count[0] = 0;
+
+	int left = 1, max = 0;
+	for (int len = 1; len < 16; len++) {
+		left = (left << 1) - h->count[len];
+		if (left < 0)
+			return -1;
+		if (h->count[len])
+			max = len;
+	}
+	// Like zlib, an incomplete code is only valid as a lone one bit code of a literal/length or distance table
+	if (left > 0 && max && (!lone_ok || max != 1))
+		return -1;
+
+	offs[1] = 0;
+	for (int len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (int i = 0; i < n; i++) {
+		if (lengths[i])
+			h->symbol[offs[lengths[i]]++] = i;
+	}
+
+	memset(h->fast, 0, sizeof(h->fast));
+	uint32_t code = 0, idx = 0;
+	for (int len = 1; len <= FAST_BITS; len++) {
+		for (int i = 0; i < h->count[len]; i++, idx++, code++) {
+			uint32_t rev = 0;
+			for (int b = 0; b < len; b++)
+				rev |= ((code >> b) & 1) << (len - 1 - b);
+			uint16_t entry = h->symbol[idx] | (len << 9);
+			for (uint32_t j = rev; j < (1 << FAST_BITS); j += (1 << len))
+				h->fast[j] = entry;
+		}
+		code <<= 1;
+	}
+	return 0;
+}
+
+static void fixed_build(void) {
+	uint8_t lengths[288];
+	int i = 0;
+	for (; i < 144; i++) lengths[i] = 8;
+	for (; i < 256; i++) lengths[i] = 9;
+	for (; i < 280; i++) lengths[i] = 7;
+	for (; i < 288; i++) lengths[i] = 8;
+	huff_build(&fixed_lit, lengths, 288, 0);
+	for (i = 0; i < 32; i++) lengths[i] = 5;
+	huff_build(&fixed_dist, lengths, 32, 0);
+	fixed_ready = 1;
+}
+
+static inline void refill(inflate_ctx *c) {
+	if (c->in_end - c->in >= 8) {
+		uint64_t v;
+		memcpy(&v, c->in, 8);
+		c->bitbuf |= v << c->bitcnt;
+		c->in += (63 - c->bitcnt) >> 3;
+		c->bitcnt |= 56;
+	} else {
+		while (c->bitcnt <= 56 && c->in < c->in_end) {
+			c->bitbuf |= (uint64_t)*c->in++ << c->bitcnt;
+			c->bitcnt += 8;
+		}
+	}
+}
+
+static inline int need(inflate_ctx *c, uint32_t n) {
+	if (c->bitcnt < n) {
+		refill(c);
+		if (c->bitcnt < n)
+			return 0;
+	}
+	return 1;
+}
+
+static inline uint32_t bits(inflate_ctx *c, uint32_t n) {
+	uint32_t v = c->bitbuf & ((1ULL << n) - 1);
+	c->bitbuf >>= n;
+	c->bitcnt -= n;
+	return v;
+}
+
+// Returns the decoded symbol, -1 on bad code, -2 on missing input
+static inline int decode(inflate_ctx *c, const huff_table *h) {
+	if (c->bitcnt < 15)
+		refill(c);
+	uint16_t entry = h->fast[c->bitbuf & ((1 << FAST_BITS) - 1)];
+	if (entry) {
+		uint32_t len = entry >> 9;
+		if (len > c->bitcnt)
+			return -2;
+		c->bitbuf >>= len;
+		c->bitcnt -= len;
+		return entry & 0x1FF;
+	}
+
+	// Canonical decoding for codes longer than FAST_BITS
+	int code = 0, first = 0, index = 0;
+	for (uint32_t len = 1; len < 16; len++) {
+		if (len > c->bitcnt)
+			return -2;
+		code |= (c->bitbuf >> (len - 1)) & 1;
+		int count = h->count[len];
+		if (code - count < first) {
+			c->bitbuf >>= len;
+			c->bitcnt -= len;
+			return h->symbol[index + (code - first)];
+		}
+		index += count;
+		first += count;
+		first <<= 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+static inline void copy_match(uint8_t *out, uint32_t dist, uint32_t len, const uint8_t *out_end) {
+	const uint8_t *from = out - dist;
+	if (dist >= 16 && out_end - out >= (ptrdiff_t)len + 16) {
+		// Chunks never read bytes they are about to write, the tail may overshoot len
+		do {
+#ifdef __ARM_NEON__
+			vst1q_u8(out, vld1q_u8(from));
+#else
+			memcpy(out, from, 16);
+#endif
+			out += 16;
+			from += 16;
+		} while (len > 16 && (len -= 16));
+	} else if (dist >= 8 && out_end - out >= (ptrdiff_t)len + 8) {
+		do {
+#ifdef __ARM_NEON__
+			vst1_u8(out, vld1_u8(from));
+#else
+			memcpy(out, from, 8);
+#endif
+			out += 8;
+			from += 8;
+		} while (len > 8 && (len -= 8));
+	} else if (dist == 1) {
+		memset(out, *from, len);
+	} else {
+		while (len--)
+			*out++ = *from++;
+	}
+}
+
+static int inflate_codes(inflate_ctx *c, const huff_table *lit, const huff_table *dist) {
+	for (;;) {
+		int sym = decode(c, lit);
+		if (sym < 0)
+			return sym == -2 ? ZF_NEED_INPUT : ZF_BAD_DATA;
+		if (sym < 256) {
+			if (c->out == c->out_end)
+				return ZF_NEED_OUTPUT;
+			*c->out++ = sym;
+			continue;
+		}
+		if (sym == 256)
+			return ZF_OK;
+
+		sym -= 257;
+		if (sym >= 29)
+			return ZF_BAD_DATA;
+		if (!need(c, len_extra[sym]))
+			return ZF_NEED_INPUT;
+		uint32_t len = len_base[sym] + bits(c, len_extra[sym]);
+
+		int dsym = decode(c, dist);
+		if (dsym < 0)
+			return dsym == -2 ? ZF_NEED_INPUT : ZF_BAD_DATA;
+		if (dsym >= 30)
+			return ZF_BAD_DATA;
+		if (!need(c, dist_extra[dsym]))
+			return ZF_NEED_INPUT;
+		uint32_t d = dist_base[dsym] + bits(c, dist_extra[dsym]);
+
+		if (d > c->out - c->out_start)
+			return ZF_BAD_DATA;
+		if (c->out_end - c->out < len)
+			return ZF_NEED_OUTPUT;
+		copy_match(c->out, d, len, c->out_end);
+		c->out += len;
+	}
+}
+
+static int inflate_stored(inflate_ctx *c) {
+	// Give back the whole bytes still held in the bit buffer
+	bits(c, c->bitcnt & 7);
+	c->in -= c->bitcnt >> 3;
+	c->bitbuf = 0;
+	c->bitcnt = 0;
+
+	if (c->in_end - c->in < 4)
+		return ZF_NEED_INPUT;
+	uint32_t len = c->in[0] | (c->in[1] << 8);
+	uint32_t nlen = c->in[2] | (c->in[3] << 8);
+	if (len != (~nlen & 0xFFFF))
+		return ZF_BAD_DATA;
+	c->in += 4;
+	if (c->in_end - c->in < len)
+		return ZF_NEED_INPUT;
+	if (c->out_end - c->out < len)
+		return ZF_NEED_OUTPUT;
+	memcpy(c->out, c->in, len);
+	c->in += len;
+	c->out += len;
+	return ZF_OK;
+}
+
+static int inflate_dynamic(inflate_ctx *c) {
+	huff_table lit, dist, codelen;
+	uint8_t lengths[288 + 32];
+
+	if (!need(c, 14))
+		return ZF_NEED_INPUT;
+	int nlen = bits(c, 5) + 257;
+	int ndist = bits(c, 5) + 1;
+	int ncode = bits(c, 4) + 4;
+	if (nlen > 286 || ndist > 30)
+		return ZF_BAD_DATA;
+
+	memset(lengths, 0, 19);
+	for (int i = 0; i < ncode; i++) {
+		if (!need(c, 3))
+			return ZF_NEED_INPUT;
+		lengths[codelen_order[i]] = bits(c, 3);
+	}
+	if (huff_build(&codelen, lengths, 19, 0) < 0)
+		return ZF_BAD_DATA;
+
+	int i = 0;
+	while (i < nlen + ndist) {
+		int sym = decode(c, &codelen);
+		if (sym < 0)
+			return sym == -2 ? ZF_NEED_INPUT : ZF_BAD_DATA;
+		if (sym < 16) {
+			lengths[i++] = sym;
+			continue;
+		}
+		uint8_t val = 0;
+		int rep;
+		if (sym == 16) {
+			if (!i)
+				return ZF_BAD_DATA;
+			val = lengths[i - 1];
+			if (!need(c, 2))
+				return ZF_NEED_INPUT;
+			rep = 3 + bits(c, 2);
+		} else if (sym == 17) {
+			if (!need(c, 3))
+				return ZF_NEED_INPUT;
+			rep = 3 + bits(c, 3);
+		} else {
+			if (!need(c, 7))
+				return ZF_NEED_INPUT;
+			rep = 11 + bits(c, 7);
+		}
+		if (i + rep > nlen + ndist)
+			return ZF_BAD_DATA;
+		memset(&lengths[i], val, rep);
+		i += rep;
+	}
+	if (!lengths[256])
+		return ZF_BAD_DATA;
+
+	if (huff_build(&lit, lengths, nlen, 1) < 0 || huff_build(&dist, &lengths[nlen], ndist, 1) < 0)
+		return ZF_BAD_DATA;
+	return inflate_codes(c, &lit, &dist);
+}
+
+int zfast_uncompress_raw(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len, size_t *consumed, size_t *produced) {
+	inflate_ctx c;
+	c.in = c.in_start = src;
+	c.in_end = src + src_len;
+	c.out = c.out_start = dst;
+	c.out_end = dst + dst_len;
+	c.bitbuf = 0;
+	c.bitcnt = 0;
+
+	if (!fixed_ready)
+		fixed_build();
+
+	int last, res;
+	do {
+		if (!need(&c, 3))
+			return ZF_NEED_INPUT;
+		last = bits(&c, 1);
+		switch (bits(&c, 2)) {
+		case 0:
+			res = inflate_stored(&c);
+			break;
+		case 1:
+			res = inflate_codes(&c, &fixed_lit, &fixed_dist);
+			break;
+		case 2:
+			res = inflate_dynamic(&c);
+			break;
+		default:
+			res = ZF_BAD_DATA;
+			break;
+		}
+		if (res != ZF_OK)
+			return res;
+	} while (!last);
+
+	// Unused whole bytes in the bit buffer belong to the trailer
+	*consumed = (c.in - c.in_start) - (c.bitcnt >> 3);
+	*produced = c.out - c.out_start;
+	return ZF_OK;
+}
+
+static int inflate_whole(z_streamp strm, int wbits) {
+	const uint8_t *in = strm->next_in;
+	size_t in_len = strm->avail_in;
+	size_t consumed, produced;
+	int zlib_wrap = wbits >= 0;
+
+	if (wbits >= 16 && wbits < 32)
+		return -1; // gzip, leave it to zlib
+	if (wbits >= 32 && in_len >= 2 && in[0] == 0x1F && in[1] == 0x8B)
+		return -1;
+
+	if (zlib_wrap) {
+		if (in_len < 6 || (in[0] & 0x0F) != 8 || ((in[0] << 8) | in[1]) % 31 || (in[1] & 0x20))
+			return -1;
+		in += 2;
+		in_len -= 2;
+	}
+
+	if (zfast_uncompress_raw(in, in_len, strm->next_out, strm->avail_out, &consumed, &produced) != ZF_OK)
+		return -1;
+
+	if (zlib_wrap) {
+		if (in_len - consumed < 4)
+			return -1;
+		const uint8_t *t = in + consumed;
+		uLong check = ((uLong)t[0] << 24) | (t[1] << 16) | (t[2] << 8) | t[3];
+		uLong adler = adler32(adler32(0, NULL, 0), strm->next_out, produced);
+		if (check != adler)
+			return -1;
+		strm->adler = adler;
+		consumed += 6;
+	}
+
+	strm->next_in += consumed;
+	strm->avail_in -= consumed;
+	strm->total_in += consumed;
+	strm->next_out += produced;
+	strm->avail_out -= produced;
+	strm->total_out += produced;
+	strm->reserved |= ZF_DONE;
+	return 0;
+}
+
+int zfast_inflateInit_(z_streamp strm, const char *version, int stream_size) {
+	int res = inflateInit_(strm, version, stream_size);
+	if (res == Z_OK)
+		strm->reserved = ZF_TAG | (MAX_WBITS + 64);
+	return res;
+}
+
+int zfast_inflateInit2_(z_streamp strm, int windowBits, const char *version, int stream_size) {
+	int res = inflateInit2_(strm, windowBits, version, stream_size);
+	if (res == Z_OK)
+		strm->reserved = ZF_TAG | (windowBits + 64);
+	return res;
+}
+
+int zfast_inflateReset(z_streamp strm) {
+	strm->reserved &= ~ZF_DONE;
+	return inflateReset(strm);
+}
+
+int zfast_inflate(z_streamp strm, int flush) {
+	if ((strm->reserved & ZF_TAG_MASK) == ZF_TAG) {
+		if (strm->reserved & ZF_DONE)
+			return Z_STREAM_END;
+		// Whole buffer fast path, zlib restarts from scratch if the data doesn't fit in a single call
+		if (!strm->total_in && !strm->total_out && strm->avail_in && strm->avail_out) {
+			if (inflate_whole(strm, ZF_WBITS(strm->reserved)) == 0)
+				return Z_STREAM_END;
+		}
+	}
+	return inflate(strm, flush);
+}
+
+static void crc_build(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+		for (int k = 0; k < 8; k++)
+			c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		crc_table[0][i] = c;
+	}
+	for (uint32_t i = 0; i < 256; i++) {
+		for (int t = 1; t < 8; t++)
+			crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^ crc_table[0][crc_table[t - 1][i] & 0xFF];
+	}
+	crc_ready = 1;
+}
+
+uLong zfast_crc32(uLong crc, const Bytef *buf, uInt len) {
+	if (!buf)
+		return 0;
+	if (!crc_ready)
+		crc_build();
+
+	uint32_t c = ~(uint32_t)crc;
+	while (len && ((uintptr_t)buf & 3)) {
+		c = crc_table[0][(c ^ *buf++) & 0xFF] ^ (c >> 8);
+		len--;
+	}
+	// Slicing-by-8
+	while (len >= 8) {
+		uint32_t a = *(const uint32_t *)buf ^ c;
+		uint32_t b = *(const uint32_t *)(buf + 4);
+		c = crc_table[7][a & 0xFF] ^ crc_table[6][(a >> 8) & 0xFF] ^
+			crc_table[5][(a >> 16) & 0xFF] ^ crc_table[4][a >> 24] ^
+			crc_table[3][b & 0xFF] ^ crc_table[2][(b >> 8) & 0xFF] ^
+			crc_table[1][(b >> 16) & 0xFF] ^ crc_table[0][b >> 24];
+		buf += 8;
+		len -= 8;
+	}
+	while (len--)
+		c = crc_table[0][(c ^ *buf++) & 0xFF] ^ (c >> 8);
+	return ~c;
+}
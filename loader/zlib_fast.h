@@ -0,0 +1,16 @@
+#ifndef __ZLIB_FAST_H__
+#define __ZLIB_FAST_H__
+
+#include <stdint.h>
+#include <zlib.h>
+
+uLong zfast_crc32(uLong crc, const Bytef *buf, uInt len);
+
+int zfast_inflateInit_(z_streamp strm, const char *version, int stream_size);
+int zfast_inflateInit2_(z_streamp strm, int windowBits, const char *version, int stream_size);
+int zfast_inflate(z_streamp strm, int flush);
+int zfast_inflateReset(z_streamp strm);
+
+int zfast_uncompress_raw(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len, size_t *consumed, size_t *produced);
+
+#endif
@@ -0,0 +1,153 @@
+/* audio_check.c -- runs the loader's mixer output on SDL's dummy audio driver
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o audio_check audio_check.c ../loader/audio_out.c $(sdl2-config --cflags --libs) -lSDL2_mixer
+ * Usage: audio_check
+ *
+ * The mixer is opened through audio_out with SDL_AUDIODRIVER=dummy, which
+ * paces callbacks like a real device without needing one, from a scratch
+ * directory holding an audio.cfg that asks for 2048 frames. A looping tone
+ * plays for a few seconds while the stats are read as fast as possible from
+ * the main thread: the configured buffer must be in use, callbacks must come
+ * at about the rate it implies and every copy read must be consistent. Then
+ * a post effect stalls every callback by a whole buffer, and once the
+ * overrun window has passed the buffer must have been raised to 4096 frames
+ * for the next boot.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_mixer.h>
+
+#include "../loader/audio_out.h"
+
+#define CLEAN_MS 3000
+#define STALL_MS 12000 // Past the loader's 10 s overrun window
+
+static int failures = 0;
+static volatile uint32_t stall_us = 0;
+
+static void fail(const char *what) {
+	failures++;
+	fprintf(stderr, "failed: %s\n", what);
+}
+
+static void stall(int chan, void *stream, int len, void *udata) {
+	if (stall_us)
+		usleep(stall_us);
+}
+
+static int config_chunk(void) {
+	int chunk = 0;
+	FILE *f = fopen("audio.cfg", "r");
+	if (f) {
+		if (fscanf(f, "chunk=%d", &chunk) != 1)
+			chunk = 0;
+		fclose(f);
+	}
+	return chunk;
+}
+
+// Reads the stats in a tight loop for ms milliseconds, every copy must hold together
+static audio_out_stats watch(int ms, const audio_out_stats *first) {
+	audio_out_stats s = *first, prev = *first;
+	uint32_t reads = 0, start = SDL_GetTicks();
+	while (SDL_GetTicks() - start < ms) {
+		audio_out_get_stats(&s);
+		reads++;
+		if (s.frequency != first->frequency || s.chunk != first->chunk || s.latency_us != first->latency_us) {
+			fail("torn stats: configuration changed");
+			break;
+		}
+		if (s.callbacks < prev.callbacks || s.overruns < prev.overruns || s.cpu_us < prev.cpu_us || s.overruns > s.callbacks) {
+			fail("torn stats: counters went back");
+			break;
+		}
+		prev = s;
+	}
+	printf("  %u reads, %u callbacks, %u overruns, longest period %u us, mixer cpu %llu us (max %u us)\n", reads, s.callbacks,
+		s.overruns, s.period_max_us, (unsigned long long)s.cpu_us, s.cpu_max_us);
+	return s;
+}
+
+int main(int argc, char *argv[]) {
+	char dir[] = "/tmp/audio_checkXXXXXX";
+	if (!mkdtemp(dir) || chdir(dir)) {
+		perror("scratch directory");
+		return 1;
+	}
+	FILE *f = fopen("audio.cfg", "w");
+	fprintf(f, "chunk=2048\n");
+	fclose(f);
+
+	setenv("SDL_AUDIODRIVER", "dummy", 1);
+	if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+		fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+		return 1;
+	}
+	if (audio_out_open() < 0) {
+		fprintf(stderr, "audio_out_open: %s\n", Mix_GetError());
+		return 1;
+	}
+
+	audio_out_stats s;
+	audio_out_get_stats(&s);
+	printf("opened at %d Hz, %d frames, %u us per buffer\n", s.frequency, s.chunk, s.latency_us);
+	if (s.chunk != 2048)
+		fail("audio.cfg buffer size not used");
+	if (!s.frequency || s.latency_us != (uint64_t)s.chunk * 1000000 / s.frequency)
+		fail("latency doesn't match the buffer");
+
+	// A second of 440 Hz, looped
+	int frames = s.frequency;
+	int16_t *tone = malloc(frames * 4);
+	for (int i = 0; i < frames; i++)
+		tone[i * 2] = tone[i * 2 + 1] = 8000 * sinf(i * 2 * M_PI * 440 / s.frequency);
+	Mix_Chunk *chunk = Mix_QuickLoad_RAW((Uint8 *)tone, frames * 4);
+	Mix_PlayChannel(-1, chunk, -1);
+	Mix_RegisterEffect(MIX_CHANNEL_POST, stall, NULL, NULL);
+
+	printf("clean playback, %d ms\n", CLEAN_MS);
+	audio_out_stats clean = watch(CLEAN_MS, &s);
+	uint32_t expected = (uint64_t)CLEAN_MS * 1000 / s.latency_us;
+	if (clean.callbacks < expected / 2 || clean.callbacks > expected * 2)
+		fail("callback rate far from the buffer size");
+
+	printf("mixer stalled by a buffer per callback, %d ms\n", STALL_MS);
+	stall_us = s.latency_us;
+	audio_out_stats stalled = watch(STALL_MS, &s);
+	stall_us = 0;
+	if (stalled.overruns - clean.overruns < 3)
+		fail("stalled callbacks not counted as overruns");
+	if (stalled.period_max_us < s.latency_us * 3 / 2)
+		fail("longest period shorter than the stall");
+	printf("audio.cfg now asks for %d frames\n", config_chunk());
+	if (config_chunk() != 4096)
+		fail("buffer not raised after overruns");
+
+	Mix_HaltChannel(-1);
+	Mix_CloseAudio();
+	Mix_FreeChunk(chunk);
+	free(tone);
+	SDL_Quit();
+	unlink("audio.cfg");
+	chdir("/");
+	rmdir(dir);
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,245 @@
+/* fmt_check.c -- differential fuzz of the loader's sprintf against glibc
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o fmt_check fmt_check.c ../loader/fmt.c -lm
+ * Usage: fmt_check [rounds] [-b]
+ *
+ * Every round builds a format of up to three random conversions (flags,
+ * widths and precisions given inline or through *, every length modifier)
+ * between bits of literal text, and prints it with both implementations
+ * into buffers of random size, down to zero. Doubles are drawn from random
+ * bit patterns, exact ties at every precision, short decimals the way the
+ * game writes them and values around powers of ten, with most of them in
+ * the range the fast paths handle. Outputs and return values must match
+ * byte for byte. Rounds that never reached newlib are counted apart, so a
+ * pass says how much of the fast path was actually compared. With -b common
+ * formats are timed.
+ *
+ * Needs an x86-64 host: integer arguments travel in general registers and
+ * doubles in vector registers, so one call with three of each serves any
+ * mix of up to three conversions of either kind.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../loader/fmt.h"
+
+#define BUF_SIZE 1024
+
+static int failures = 0, fast_rounds = 0, fast_float_rounds = 0, fast_failures = 0;
+static uint64_t seed = 1;
+static const char *strings[] = { "", "a", "Score", "Level 12 complete", "\xc3\xa9t\xc3\xa9" };
+
+static uint32_t rnd(void) {
+	seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+	return seed >> 33;
+}
+
+static uint64_t rnd64(void) {
+	return (uint64_t)rnd() << 32 ^ rnd() << 1 ^ rnd();
+}
+
+static double random_double(void) {
+	double v;
+	uint64_t bits;
+	switch (rnd() % 12) {
+	case 0: // Any bit pattern, inf and nan included
+		bits = rnd64();
+		memcpy(&v, &bits, sizeof(v));
+		return v;
+	case 1: // Exact ties: odd multiples of a power of two
+		return ldexp((double)(rnd() | 1), -(int)(rnd() % 30));
+	case 2: // Short decimals, as in scores, timers and coordinates
+		return (double)((int)(rnd() % 2000000) - 1000000) / (double)(1 << ((rnd() % 4) * 3 + 1)) / 100.0;
+	case 3: // Around powers of ten, where the exponent and digit count move
+		v = pow(10, (int)(rnd() % 60) - 30);
+		return rnd() & 1 ? nextafter(v, 0) : rnd() & 1 ? nextafter(v, INFINITY) : v;
+	case 4:
+		return (double)(int)rnd() * (rnd() & 1 ? 1 : -1);
+	case 5: {
+		static const double special[] = { 0.0, -0.0, 0.5, 1.5, 2.5, 9.5, 99.5, 0.05, 0.15, 1e22, 1e23, DBL_MAX, DBL_MIN, 5e-324, 1e-320, 9.999999e-5 };
+		return special[rnd() % (sizeof(special) / sizeof(*special))];
+	}
+	case 6:
+		return (double)rnd() / (rnd() | 1) * (rnd() & 1 ? 1 : -1);
+	// The rest stays where the fast paths don't give up: below 1e7 with a few decimals
+	case 7:
+	case 8: // Decimals with up to six places
+		return (double)((int64_t)(rnd64() % 20000000000001ull) - 10000000000000ll) / pow(10, 6 + rnd() % 7);
+	case 9: // Binary fractions, ties at many precisions
+		return ldexp((double)(int)(rnd() % 20000001) - 10000000, -(int)(rnd() % 24));
+	case 10: // Halfway between two decimals
+		v = floor((double)(rnd() % 10000000) / 1000) + (rnd() % 1000) / 1000.0;
+		return (v + pow(10, -(int)(rnd() % 6) - 1) / 2) * (rnd() & 1 ? 1 : -1);
+	default:
+		return (double)(rnd() % 100000) / (rnd() % 1000 + 1);
+	}
+}
+
+// Appends a random conversion, says whether it takes a double
+static int random_conversion(char *f, uint64_t *ints, int *ints_num) {
+	static const char *lengths[] = { "", "", "", "hh", "h", "l", "ll", "j", "z", "t" };
+	static const char int_convs[] = "diouxXc";
+	static const char float_convs[] = "feEgGaF";
+	char *p = f + strlen(f);
+	*p++ = '%';
+	int flags = rnd() % 32;
+	if (flags & 1)
+		*p++ = '-';
+	if (flags & 2)
+		*p++ = '+';
+	if (flags & 4)
+		*p++ = ' ';
+	if (flags & 8)
+		*p++ = '#';
+	if ((flags & 16) && rnd() % 2)
+		*p++ = '0';
+	switch (rnd() % 4) {
+	case 1:
+		p += sprintf(p, "%u", rnd() % 30);
+		break;
+	case 2:
+		if (*ints_num < 2) {
+			*p++ = '*';
+			ints[(*ints_num)++] = (int)(rnd() % 40) - 20;
+		}
+		break;
+	}
+	switch (rnd() % 4) {
+	case 1:
+		p += sprintf(p, ".%u", rnd() % 4 ? rnd() % 9 : rnd() % 25); // Mostly what games ask for
+		break;
+	case 2:
+		*p++ = '.';
+		break;
+	case 3:
+		if (*ints_num < 2) {
+			p += sprintf(p, ".*");
+			ints[(*ints_num)++] = (int)(rnd() % 30) - 5;
+		}
+		break;
+	}
+	int kind = rnd() % 8;
+	if (kind < 3 && *ints_num < 3) {
+		char c = int_convs[rnd() % (sizeof(int_convs) - 1)];
+		if (c != 'c')
+			p += sprintf(p, "%s", lengths[rnd() % (sizeof(lengths) / sizeof(*lengths))]);
+		*p++ = c;
+		uint64_t v = rnd64();
+		ints[(*ints_num)++] = rnd() % 2 ? v : rnd() % 4 ? (int64_t)(int)v >> (rnd() % 32) : 0;
+	} else if (kind < 5 && *ints_num < 3) {
+		*p++ = rnd() % 8 ? 's' : 'p';
+		ints[(*ints_num)++] = rnd() % 16 ? (uintptr_t)strings[rnd() % (sizeof(strings) / sizeof(*strings))] : 0;
+	} else if (kind < 6) {
+		*p++ = '%';
+		*p = 0;
+		return 0;
+	} else {
+		char c = float_convs[rnd() % (sizeof(float_convs) - 1)];
+		// glibc loses the zeros %#g keeps when rounding carries into a new digit
+		if ((c == 'g' || c == 'G') && (flags & 8))
+			c = 'e';
+		*p++ = c;
+		*p = 0;
+		return 1;
+	}
+	*p = 0;
+	return 0;
+}
+
+static void check_round(void) {
+	static const char *literals[] = { "", "x", "Score: ", " / ", "\n" };
+	char f[128] = "";
+	uint64_t ints[3] = { 0 };
+	double dbls[3] = { 0 };
+	int ints_num = 0, dbls_num = 0;
+	int convs = 1 + rnd() % 3;
+	for (int i = 0; i < convs; i++) {
+		strcat(f, literals[rnd() % 5]);
+		if (dbls_num < 3 && random_conversion(f, ints, &ints_num))
+			dbls[dbls_num++] = random_double();
+	}
+	strcat(f, literals[rnd() % 5]);
+
+	char ours[BUF_SIZE], theirs[BUF_SIZE];
+	uint32_t fallbacks = fmt_fallbacks();
+	size_t size = rnd() % 4 ? BUF_SIZE : rnd() % 24;
+	memset(ours, 0x55, sizeof(ours));
+	memset(theirs, 0x55, sizeof(theirs));
+	int a = fmt_snprintf(ours, size, f, ints[0], ints[1], ints[2], dbls[0], dbls[1], dbls[2]);
+	int b = snprintf(theirs, size, f, ints[0], ints[1], ints[2], dbls[0], dbls[1], dbls[2]);
+	int fast = fmt_fallbacks() == fallbacks;
+	fast_rounds += fast;
+	fast_float_rounds += fast && dbls_num;
+	if (a != b || memcmp(ours, theirs, sizeof(ours))) {
+		fast_failures += fast;
+		if (failures++ < 20) {
+			fprintf(stderr, "\"%s\" size %zu (%llx %llx %llx %a %a %a)\n", f, size,
+				(unsigned long long)ints[0], (unsigned long long)ints[1], (unsigned long long)ints[2], dbls[0], dbls[1], dbls[2]);
+			fprintf(stderr, "  ours   %d \"%.*s\"\n  glibc  %d \"%.*s\"\n", a, size ? (int)strnlen(ours, size) : 0, ours, b, size ? (int)strnlen(theirs, size) : 0, theirs);
+		}
+	}
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+#define TIME(label, call) do { \
+	double t0 = now(); \
+	for (int i = 0; i < iters; i++) \
+		call; \
+	printf("  %-8s %8.1f ns\n", label, (now() - t0) * 1e6 / iters); \
+} while (0)
+
+static void bench(void) {
+	const int iters = 1000000;
+	char buf[128];
+	volatile double d = 1234.5678;
+	volatile int n = 98765;
+	printf("\"Score: %%d\"\n");
+	TIME("ours", fmt_snprintf(buf, sizeof(buf), "Score: %d", n));
+	TIME("glibc", snprintf(buf, sizeof(buf), "Score: %d", n));
+	printf("\"%%s x%%02d %%08X\"\n");
+	TIME("ours", fmt_snprintf(buf, sizeof(buf), "%s x%02d %08X", "Item", n % 100, n));
+	TIME("glibc", snprintf(buf, sizeof(buf), "%s x%02d %08X", "Item", n % 100, n));
+	printf("\"%%.2f\"\n");
+	TIME("ours", fmt_snprintf(buf, sizeof(buf), "%.2f", d));
+	TIME("glibc", snprintf(buf, sizeof(buf), "%.2f", d));
+	printf("\"%%f %%f\"\n");
+	TIME("ours", fmt_snprintf(buf, sizeof(buf), "%f %f", d, -d / 7));
+	TIME("glibc", snprintf(buf, sizeof(buf), "%f %f", d, -d / 7));
+	printf("\"%%g\"\n");
+	TIME("ours", fmt_snprintf(buf, sizeof(buf), "%g", d / 3));
+	TIME("glibc", snprintf(buf, sizeof(buf), "%g", d / 3));
+}
+
+int main(int argc, char **argv) {
+	int rounds = 1000000, timing = 0;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-b"))
+			timing = 1;
+		else
+			rounds = atoi(argv[i]);
+	}
+	for (int i = 0; i < rounds; i++)
+		check_round();
+	printf("%d rounds, %d mismatches, %u conversions left to glibc\n", rounds, failures, fmt_fallbacks());
+	printf("%d rounds entirely on the fast path (%.1f%%), %d of them with doubles, %d mismatches there\n", fast_rounds,
+		rounds ? 100.0 * fast_rounds / rounds : 0.0, fast_float_rounds, fast_failures);
+	if (timing)
+		bench();
+	return failures != 0;
+}
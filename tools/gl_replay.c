@@ -0,0 +1,702 @@
+/* gl_replay.c -- replays a gl_trace.bin capture against a null or a software backend
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o gl_replay gl_replay.c -lm
+ * Usage: gl_replay <gl_trace.bin> [null|soft] [-q] [-o last_frame.ppm]
+ *
+ * The null backend only decodes the stream, which measures the cost of the
+ * calls themselves. The soft backend rasterizes every draw the way the game's
+ * fixed function pipeline would (modulate texturing, nearest sampling, blending
+ * and scissoring), giving a hardware independent benchmark of a heavy scene.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../loader/gl_trace.h"
+
+#define GL_TRIANGLES 0x0004
+#define GL_TRIANGLE_STRIP 0x0005
+#define GL_TRIANGLE_FAN 0x0006
+#define GL_ZERO 0
+#define GL_ONE 1
+#define GL_SRC_COLOR 0x0300
+#define GL_ONE_MINUS_SRC_COLOR 0x0301
+#define GL_SRC_ALPHA 0x0302
+#define GL_ONE_MINUS_SRC_ALPHA 0x0303
+#define GL_DST_ALPHA 0x0304
+#define GL_ONE_MINUS_DST_ALPHA 0x0305
+#define GL_DST_COLOR 0x0306
+#define GL_ONE_MINUS_DST_COLOR 0x0307
+#define GL_BYTE 0x1400
+#define GL_UNSIGNED_BYTE 0x1401
+#define GL_SHORT 0x1402
+#define GL_UNSIGNED_SHORT 0x1403
+#define GL_UNSIGNED_INT 0x1405
+#define GL_FLOAT 0x1406
+#define GL_FIXED 0x140C
+#define GL_ALPHA 0x1906
+#define GL_RGB 0x1907
+#define GL_RGBA 0x1908
+#define GL_LUMINANCE 0x1909
+#define GL_LUMINANCE_ALPHA 0x190A
+#define GL_UNSIGNED_SHORT_4_4_4_4 0x8033
+#define GL_UNSIGNED_SHORT_5_5_5_1 0x8034
+#define GL_UNSIGNED_SHORT_5_6_5 0x8363
+#define GL_BLEND 0x0BE2
+#define GL_SCISSOR_TEST 0x0C11
+#define GL_TEXTURE_2D 0x0DE1
+#define GL_TEXTURE_WRAP_S 0x2802
+#define GL_TEXTURE_WRAP_T 0x2803
+#define GL_REPEAT 0x2901
+#define GL_COLOR_BUFFER_BIT 0x4000
+#define GL_MODELVIEW 0x1700
+#define GL_PROJECTION 0x1701
+#define GL_TEXTURE 0x1702
+#define GL_VERTEX_ARRAY 0x8074
+#define GL_COLOR_ARRAY 0x8076
+#define GL_TEXTURE_COORD_ARRAY 0x8078
+
+#define FB_W SCREEN_W
+#define FB_H SCREEN_H
+#define MAX_CAPS 32
+
+enum {
+	BACKEND_NULL,
+	BACKEND_SOFT,
+};
+
+typedef struct {
+	uint32_t calls;
+	uint32_t draws;
+	uint32_t triangles;
+	uint64_t bytes;
+	double ms;
+} frame_stats;
+
+typedef struct {
+	int w, h;
+	uint32_t *pixels; // RGBA8, first row is the bottom one as in GL
+	int repeat_s, repeat_t;
+} soft_texture;
+
+typedef struct {
+	float x, y, r, g, b, a, u, v;
+} soft_vertex;
+
+static uint8_t *trace;
+static size_t trace_size;
+static int backend = BACKEND_SOFT;
+
+// Software backend state
+static uint32_t fb[FB_W * FB_H];
+static soft_texture *textures;
+static uint32_t textures_num;
+static uint32_t bound;
+static uint32_t caps[MAX_CAPS];
+static int caps_num;
+static uint32_t blend_src = GL_ONE, blend_dst = GL_ZERO;
+static int client_mask;
+static float matrices[3][16];
+static int matrix_slot;
+static int viewport[4] = { 0, 0, FB_W, FB_H };
+static int scissor[4] = { 0, 0, FB_W, FB_H };
+static float clear_color[4];
+static soft_vertex *verts_buf;
+static size_t verts_cap;
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static inline float ufloat(uint32_t u) {
+	float f;
+	memcpy(&f, &u, 4);
+	return f;
+}
+
+static void load_trace(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "Cannot open %s\n", path);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	trace_size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	trace = malloc(trace_size);
+	if (fread(trace, 1, trace_size, f) != trace_size) {
+		fprintf(stderr, "Cannot read %s\n", path);
+		exit(1);
+	}
+	fclose(f);
+
+	gl_trace_header *hdr = (gl_trace_header *)trace;
+	if (trace_size < sizeof(*hdr) || hdr->magic != GL_TRACE_MAGIC || hdr->version != GL_TRACE_VERSION) {
+		fprintf(stderr, "%s is not a valid trace\n", path);
+		exit(1);
+	}
+}
+
+static soft_texture *texture_get(uint32_t name) {
+	if (name >= textures_num) {
+		uint32_t num = name + 64;
+		textures = realloc(textures, num * sizeof(soft_texture));
+		memset(&textures[textures_num], 0, (num - textures_num) * sizeof(soft_texture));
+		textures_num = num;
+	}
+	return &textures[name];
+}
+
+static uint32_t convert_texel(const uint8_t *src, uint32_t format, uint32_t type) {
+	uint32_t r, g, b, a;
+	if (type == GL_UNSIGNED_SHORT_5_6_5 || type == GL_UNSIGNED_SHORT_4_4_4_4 || type == GL_UNSIGNED_SHORT_5_5_5_1) {
+		uint16_t p = src[0] | (src[1] << 8);
+		if (type == GL_UNSIGNED_SHORT_5_6_5) {
+			r = (p >> 11) * 255 / 31;
+			g = ((p >> 5) & 63) * 255 / 63;
+			b = (p & 31) * 255 / 31;
+			a = 255;
+		} else if (type == GL_UNSIGNED_SHORT_4_4_4_4) {
+			r = (p >> 12) * 17;
+			g = ((p >> 8) & 15) * 17;
+			b = ((p >> 4) & 15) * 17;
+			a = (p & 15) * 17;
+		} else {
+			r = (p >> 11) * 255 / 31;
+			g = ((p >> 6) & 31) * 255 / 31;
+			b = ((p >> 1) & 31) * 255 / 31;
+			a = (p & 1) * 255;
+		}
+	} else {
+		switch (format) {
+		case GL_RGBA:
+			r = src[0], g = src[1], b = src[2], a = src[3];
+			break;
+		case GL_RGB:
+			r = src[0], g = src[1], b = src[2], a = 255;
+			break;
+		case GL_LUMINANCE_ALPHA:
+			r = g = b = src[0], a = src[1];
+			break;
+		case GL_ALPHA:
+			r = g = b = 0, a = src[0];
+			break;
+		default:
+			r = g = b = src[0], a = 255;
+			break;
+		}
+	}
+	return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+static void texture_upload(soft_texture *t, int x, int y, int w, int h, uint32_t format, uint32_t type, const uint8_t *data) {
+	uint32_t bpp = type == GL_UNSIGNED_BYTE ? (format == GL_RGBA ? 4 : format == GL_RGB ? 3 : format == GL_LUMINANCE_ALPHA ? 2 : 1) : 2;
+	uint32_t pitch = (w * bpp + 3) & ~3;
+	for (int j = 0; j < h; j++) {
+		if (y + j < 0 || y + j >= t->h)
+			continue;
+		for (int i = 0; i < w; i++) {
+			if (x + i < 0 || x + i >= t->w)
+				continue;
+			t->pixels[(y + j) * t->w + x + i] = convert_texel(data + j * pitch + i * bpp, format, type);
+		}
+	}
+}
+
+static int cap_enabled(uint32_t cap) {
+	for (int i = 0; i < caps_num; i++) {
+		if (caps[i] == cap)
+			return 1;
+	}
+	return 0;
+}
+
+static void cap_set(uint32_t cap, int enabled) {
+	for (int i = 0; i < caps_num; i++) {
+		if (caps[i] == cap) {
+			if (!enabled)
+				caps[i] = caps[--caps_num];
+			return;
+		}
+	}
+	if (enabled && caps_num < MAX_CAPS)
+		caps[caps_num++] = cap;
+}
+
+static void matrix_identity(float *m) {
+	memset(m, 0, 16 * sizeof(float));
+	m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+static void matrix_mul(float *m, const float *r) {
+	float t[16];
+	for (int c = 0; c < 4; c++) {
+		for (int row = 0; row < 4; row++) {
+			t[c * 4 + row] = m[row] * r[c * 4] + m[4 + row] * r[c * 4 + 1] + m[8 + row] * r[c * 4 + 2] + m[12 + row] * r[c * 4 + 3];
+		}
+	}
+	memcpy(m, t, sizeof(t));
+}
+
+static float read_component(const uint8_t *p, uint32_t type, int i) {
+	switch (type) {
+	case GL_FLOAT:
+		return ((const float *)p)[i];
+	case GL_SHORT:
+		return ((const int16_t *)p)[i];
+	case GL_BYTE:
+		return ((const int8_t *)p)[i];
+	case GL_UNSIGNED_BYTE:
+		return ((const uint8_t *)p)[i] / 255.0f;
+	case GL_FIXED:
+		return ((const int32_t *)p)[i] / 65536.0f;
+	default:
+		return 0.0f;
+	}
+}
+
+static float blend_factor(uint32_t factor, int channel, const float *src, const float *dst) {
+	switch (factor) {
+	case GL_ZERO:
+		return 0.0f;
+	case GL_ONE:
+		return 1.0f;
+	case GL_SRC_COLOR:
+		return src[channel];
+	case GL_ONE_MINUS_SRC_COLOR:
+		return 1.0f - src[channel];
+	case GL_SRC_ALPHA:
+		return src[3];
+	case GL_ONE_MINUS_SRC_ALPHA:
+		return 1.0f - src[3];
+	case GL_DST_ALPHA:
+		return dst[3];
+	case GL_ONE_MINUS_DST_ALPHA:
+		return 1.0f - dst[3];
+	case GL_DST_COLOR:
+		return dst[channel];
+	case GL_ONE_MINUS_DST_COLOR:
+		return 1.0f - dst[channel];
+	default:
+		return 1.0f;
+	}
+}
+
+static uint32_t sample(const soft_texture *t, float u, float v) {
+	int x = (int)floorf(u * t->w), y = (int)floorf(v * t->h);
+	if (t->repeat_s)
+		x = ((x % t->w) + t->w) % t->w;
+	else
+		x = x < 0 ? 0 : (x >= t->w ? t->w - 1 : x);
+	if (t->repeat_t)
+		y = ((y % t->h) + t->h) % t->h;
+	else
+		y = y < 0 ? 0 : (y >= t->h ? t->h - 1 : y);
+	return t->pixels[y * t->w + x];
+}
+
+static inline float edge(const soft_vertex *a, const soft_vertex *b, float x, float y) {
+	return (b->x - a->x) * (y - a->y) - (b->y - a->y) * (x - a->x);
+}
+
+static void raster_triangle(const soft_vertex *v0, const soft_vertex *v1, const soft_vertex *v2, const soft_texture *tex, int blend) {
+	float area = edge(v0, v1, v2->x, v2->y);
+	if (area == 0.0f)
+		return;
+
+	int x0 = 0, y0 = 0, x1 = FB_W, y1 = FB_H;
+	if (cap_enabled(GL_SCISSOR_TEST)) {
+		x0 = scissor[0] > 0 ? scissor[0] : 0;
+		y0 = scissor[1] > 0 ? scissor[1] : 0;
+		x1 = scissor[0] + scissor[2] < FB_W ? scissor[0] + scissor[2] : FB_W;
+		y1 = scissor[1] + scissor[3] < FB_H ? scissor[1] + scissor[3] : FB_H;
+	}
+	int minx = (int)floorf(fminf(v0->x, fminf(v1->x, v2->x))), maxx = (int)ceilf(fmaxf(v0->x, fmaxf(v1->x, v2->x)));
+	int miny = (int)floorf(fminf(v0->y, fminf(v1->y, v2->y))), maxy = (int)ceilf(fmaxf(v0->y, fmaxf(v1->y, v2->y)));
+	if (minx < x0) minx = x0;
+	if (miny < y0) miny = y0;
+	if (maxx > x1) maxx = x1;
+	if (maxy > y1) maxy = y1;
+
+	for (int y = miny; y < maxy; y++) {
+		for (int x = minx; x < maxx; x++) {
+			float px = x + 0.5f, py = y + 0.5f;
+			float w0 = edge(v1, v2, px, py) / area;
+			float w1 = edge(v2, v0, px, py) / area;
+			float w2 = edge(v0, v1, px, py) / area;
+			if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+				continue;
+
+			float src[4] = {
+				w0 * v0->r + w1 * v1->r + w2 * v2->r,
+				w0 * v0->g + w1 * v1->g + w2 * v2->g,
+				w0 * v0->b + w1 * v1->b + w2 * v2->b,
+				w0 * v0->a + w1 * v1->a + w2 * v2->a,
+			};
+			if (tex) {
+				uint32_t texel = sample(tex, w0 * v0->u + w1 * v1->u + w2 * v2->u, w0 * v0->v + w1 * v1->v + w2 * v2->v);
+				for (int c = 0; c < 4; c++)
+					src[c] *= ((texel >> (c * 8)) & 0xFF) / 255.0f;
+			}
+
+			uint32_t *out = &fb[y * FB_W + x];
+			float res[4];
+			if (blend) {
+				float dst[4];
+				for (int c = 0; c < 4; c++)
+					dst[c] = ((*out >> (c * 8)) & 0xFF) / 255.0f;
+				for (int c = 0; c < 4; c++)
+					res[c] = src[c] * blend_factor(blend_src, c, src, dst) + dst[c] * blend_factor(blend_dst, c, src, dst);
+			} else
+				memcpy(res, src, sizeof(res));
+
+			uint32_t pixel = 0;
+			for (int c = 0; c < 4; c++) {
+				float f = res[c] < 0.0f ? 0.0f : (res[c] > 1.0f ? 1.0f : res[c]);
+				pixel |= (uint32_t)(f * 255.0f + 0.5f) << (c * 8);
+			}
+			*out = pixel;
+		}
+	}
+}
+
+static inline uint32_t index_at(const uint8_t *idx, uint32_t type, uint32_t i) {
+	if (type == GL_UNSIGNED_INT)
+		return ((const uint32_t *)idx)[i];
+	return type == GL_UNSIGNED_SHORT ? ((const uint16_t *)idx)[i] : idx[i];
+}
+
+static uint32_t soft_draw(const uint32_t *args, const uint8_t *data) {
+	uint32_t mode = args[0], count = args[1], type = args[2], first = args[3], verts = args[4];
+	const uint8_t *idx = data;
+	data += (count * gl_trace_type_size(type) + 3) & ~3;
+
+	const uint8_t *arrays[3] = { NULL, NULL, NULL };
+	for (int i = 0; i < 3; i++) {
+		if (!args[5 + i * 2])
+			continue;
+		arrays[i] = data;
+		data += (verts * args[5 + i * 2] * gl_trace_type_size(args[6 + i * 2]) + 3) & ~3;
+	}
+	if (!arrays[0] || !(client_mask & 1))
+		return 0;
+
+	if (verts > verts_cap) {
+		verts_cap = verts;
+		verts_buf = realloc(verts_buf, verts_cap * sizeof(soft_vertex));
+	}
+
+	float mvp[16];
+	memcpy(mvp, matrices[1], sizeof(mvp));
+	matrix_mul(mvp, matrices[0]);
+	for (uint32_t i = 0; i < verts; i++) {
+		soft_vertex *v = &verts_buf[i];
+		uint32_t size = args[5], stride = size * gl_trace_type_size(args[6]);
+		float p[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		for (uint32_t c = 0; c < size && c < 4; c++)
+			p[c] = read_component(arrays[0] + i * stride, args[6], c);
+		float cx = mvp[0] * p[0] + mvp[4] * p[1] + mvp[8] * p[2] + mvp[12] * p[3];
+		float cy = mvp[1] * p[0] + mvp[5] * p[1] + mvp[9] * p[2] + mvp[13] * p[3];
+		float cw = mvp[3] * p[0] + mvp[7] * p[1] + mvp[11] * p[2] + mvp[15] * p[3];
+		if (cw == 0.0f)
+			cw = 1.0f;
+		v->x = viewport[0] + (cx / cw + 1.0f) * 0.5f * viewport[2];
+		v->y = viewport[1] + (cy / cw + 1.0f) * 0.5f * viewport[3];
+
+		v->r = v->g = v->b = v->a = 1.0f;
+		if (arrays[1] && (client_mask & 2)) {
+			stride = args[7] * gl_trace_type_size(args[8]);
+			v->r = read_component(arrays[1] + i * stride, args[8], 0);
+			v->g = read_component(arrays[1] + i * stride, args[8], 1);
+			v->b = read_component(arrays[1] + i * stride, args[8], 2);
+			v->a = args[7] > 3 ? read_component(arrays[1] + i * stride, args[8], 3) : 1.0f;
+		}
+
+		v->u = v->v = 0.0f;
+		if (arrays[2] && (client_mask & 4)) {
+			stride = args[9] * gl_trace_type_size(args[10]);
+			float s = read_component(arrays[2] + i * stride, args[10], 0);
+			float t = read_component(arrays[2] + i * stride, args[10], 1);
+			const float *m = matrices[2];
+			v->u = m[0] * s + m[4] * t + m[12];
+			v->v = m[1] * s + m[5] * t + m[13];
+		}
+	}
+
+	const soft_texture *tex = NULL;
+	if (cap_enabled(GL_TEXTURE_2D) && bound < textures_num && textures[bound].pixels)
+		tex = &textures[bound];
+	int blend = cap_enabled(GL_BLEND);
+
+	uint32_t tris = 0, n[3];
+	uint32_t num = mode == GL_TRIANGLES ? count / 3 : (count > 2 ? count - 2 : 0);
+	for (uint32_t i = 0; i < num; i++) {
+		if (mode == GL_TRIANGLES) {
+			n[0] = index_at(idx, type, i * 3);
+			n[1] = index_at(idx, type, i * 3 + 1);
+			n[2] = index_at(idx, type, i * 3 + 2);
+		} else if (mode == GL_TRIANGLE_FAN) {
+			n[0] = index_at(idx, type, 0);
+			n[1] = index_at(idx, type, i + 1);
+			n[2] = index_at(idx, type, i + 2);
+		} else if (mode == GL_TRIANGLE_STRIP) {
+			// Odd triangles are flipped to keep the winding consistent
+			n[0] = index_at(idx, type, i + (i & 1));
+			n[1] = index_at(idx, type, i + 1 - (i & 1));
+			n[2] = index_at(idx, type, i + 2);
+		} else
+			break;
+		n[0] -= first;
+		n[1] -= first;
+		n[2] -= first;
+		if (n[0] >= verts || n[1] >= verts || n[2] >= verts)
+			continue;
+		raster_triangle(&verts_buf[n[0]], &verts_buf[n[1]], &verts_buf[n[2]], tex, blend);
+		tris++;
+	}
+	return tris;
+}
+
+static void soft_clear(uint32_t mask) {
+	if (!(mask & GL_COLOR_BUFFER_BIT))
+		return;
+	uint32_t pixel = 0;
+	for (int c = 0; c < 4; c++) {
+		float f = clear_color[c] < 0.0f ? 0.0f : (clear_color[c] > 1.0f ? 1.0f : clear_color[c]);
+		pixel |= (uint32_t)(f * 255.0f + 0.5f) << (c * 8);
+	}
+	int x0 = 0, y0 = 0, x1 = FB_W, y1 = FB_H;
+	if (cap_enabled(GL_SCISSOR_TEST)) {
+		x0 = scissor[0] > 0 ? scissor[0] : 0;
+		y0 = scissor[1] > 0 ? scissor[1] : 0;
+		x1 = scissor[0] + scissor[2] < FB_W ? scissor[0] + scissor[2] : FB_W;
+		y1 = scissor[1] + scissor[3] < FB_H ? scissor[1] + scissor[3] : FB_H;
+	}
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++)
+			fb[y * FB_W + x] = pixel;
+	}
+}
+
+static int client_bit(uint32_t array) {
+	return array == GL_VERTEX_ARRAY ? 1 : (array == GL_COLOR_ARRAY ? 2 : (array == GL_TEXTURE_COORD_ARRAY ? 4 : 0));
+}
+
+// Returns the number of triangles rasterized
+static uint32_t soft_execute(const gl_trace_record *r, const uint32_t *args, const uint8_t *data) {
+	soft_texture *t;
+	float m[16];
+
+	switch (r->op) {
+	case GL_OP_DELETE_TEXTURES:
+		for (int i = 0; i < r->argc; i++) {
+			t = texture_get(args[i]);
+			free(t->pixels);
+			memset(t, 0, sizeof(*t));
+		}
+		break;
+	case GL_OP_TEX_PARAMETERI:
+		t = texture_get(args[0]);
+		if (args[1] == GL_TEXTURE_WRAP_S)
+			t->repeat_s = args[2] == GL_REPEAT;
+		else if (args[1] == GL_TEXTURE_WRAP_T)
+			t->repeat_t = args[2] == GL_REPEAT;
+		break;
+	case GL_OP_TEX_IMAGE_2D:
+		if (args[1] != 0)
+			break;
+		t = texture_get(args[0]);
+		free(t->pixels);
+		t->w = args[3];
+		t->h = args[4];
+		t->pixels = calloc(t->w * t->h + 1, 4);
+		if (args[7])
+			texture_upload(t, 0, 0, t->w, t->h, args[5], args[6], data);
+		break;
+	case GL_OP_TEX_SUB_IMAGE_2D:
+		t = texture_get(args[0]);
+		if (args[1] == 0 && t->pixels)
+			texture_upload(t, args[2], args[3], args[4], args[5], args[6], args[7], data);
+		break;
+	case GL_OP_BIND_TEXTURE:
+		bound = args[0];
+		break;
+	case GL_OP_ENABLE:
+	case GL_OP_DISABLE:
+		cap_set(args[0], r->op == GL_OP_ENABLE);
+		break;
+	case GL_OP_BLEND_FUNC:
+		blend_src = args[0];
+		blend_dst = args[1];
+		break;
+	case GL_OP_ENABLE_CLIENT_STATE:
+		client_mask |= client_bit(args[0]);
+		break;
+	case GL_OP_DISABLE_CLIENT_STATE:
+		client_mask &= ~client_bit(args[0]);
+		break;
+	case GL_OP_MATRIX_MODE:
+		matrix_slot = args[0] == GL_PROJECTION ? 1 : (args[0] == GL_TEXTURE ? 2 : 0);
+		break;
+	case GL_OP_LOAD_IDENTITY:
+		matrix_identity(matrices[matrix_slot]);
+		break;
+	case GL_OP_SCALEF:
+		matrix_identity(m);
+		m[0] = ufloat(args[0]);
+		m[5] = ufloat(args[1]);
+		m[10] = ufloat(args[2]);
+		matrix_mul(matrices[matrix_slot], m);
+		break;
+	case GL_OP_ORTHOF: {
+		float l = ufloat(args[0]), rt = ufloat(args[1]), b = ufloat(args[2]), tp = ufloat(args[3]), n = ufloat(args[4]), f = ufloat(args[5]);
+		matrix_identity(m);
+		m[0] = 2.0f / (rt - l);
+		m[5] = 2.0f / (tp - b);
+		m[10] = -2.0f / (f - n);
+		m[12] = -(rt + l) / (rt - l);
+		m[13] = -(tp + b) / (tp - b);
+		m[14] = -(f + n) / (f - n);
+		matrix_mul(matrices[matrix_slot], m);
+		break;
+	}
+	case GL_OP_VIEWPORT:
+		memcpy(viewport, args, sizeof(viewport));
+		break;
+	case GL_OP_SCISSOR:
+		memcpy(scissor, args, sizeof(scissor));
+		break;
+	case GL_OP_CLEAR_COLOR:
+		for (int i = 0; i < 4; i++)
+			clear_color[i] = ufloat(args[i]);
+		break;
+	case GL_OP_CLEAR:
+		soft_clear(args[0]);
+		break;
+	case GL_OP_DRAW_ELEMENTS:
+		return soft_draw(args, data);
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void write_ppm(const char *path) {
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		fprintf(stderr, "Cannot write %s\n", path);
+		return;
+	}
+	fprintf(f, "P6\n%d %d\n255\n", FB_W, FB_H);
+	for (int y = FB_H - 1; y >= 0; y--) {
+		for (int x = 0; x < FB_W; x++) {
+			uint32_t p = fb[y * FB_W + x];
+			uint8_t rgb[3] = { p & 0xFF, (p >> 8) & 0xFF, (p >> 16) & 0xFF };
+			fwrite(rgb, 1, 3, f);
+		}
+	}
+	fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+	const char *ppm = NULL;
+	int quiet = 0;
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <gl_trace.bin> [null|soft] [-q] [-o last_frame.ppm]\n", argv[0]);
+		return 1;
+	}
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "null"))
+			backend = BACKEND_NULL;
+		else if (!strcmp(argv[i], "soft"))
+			backend = BACKEND_SOFT;
+		else if (!strcmp(argv[i], "-q"))
+			quiet = 1;
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+			ppm = argv[++i];
+	}
+
+	load_trace(argv[1]);
+	for (int i = 0; i < 3; i++)
+		matrix_identity(matrices[i]);
+
+	frame_stats cur = {0}, total = {0}, worst = {0};
+	uint64_t op_count[GL_OP_NUM] = {0};
+	uint64_t setup_bytes = 0;
+	int frames = 0, capturing = 0;
+	double setup_ms = 0.0, t = now_ms();
+
+	size_t pos = sizeof(gl_trace_header);
+	while (pos + sizeof(gl_trace_record) <= trace_size) {
+		const gl_trace_record *r = (const gl_trace_record *)(trace + pos);
+		const uint32_t *args = (const uint32_t *)(r + 1);
+		const uint8_t *data = (const uint8_t *)(args + r->argc);
+		pos += sizeof(*r) + r->argc * 4 + ((r->size + 3) & ~3);
+		if (pos > trace_size || r->op >= GL_OP_NUM)
+			break;
+		op_count[r->op]++;
+
+		if (r->op == GL_OP_CAPTURE_START) {
+			setup_ms = now_ms() - t;
+			t = now_ms();
+			capturing = 1;
+			continue;
+		}
+		if (r->op == GL_OP_FRAME) {
+			double end = now_ms();
+			cur.ms = end - t;
+			t = end;
+			if (!quiet)
+				printf("frame %4d: %5u calls, %4u draws, %6u tris, %8lu bytes, %8.3f ms\n", frames, cur.calls, cur.draws, cur.triangles, cur.bytes, cur.ms);
+			total.calls += cur.calls;
+			total.draws += cur.draws;
+			total.triangles += cur.triangles;
+			total.bytes += cur.bytes;
+			total.ms += cur.ms;
+			if (cur.ms > worst.ms)
+				worst = cur;
+			memset(&cur, 0, sizeof(cur));
+			frames++;
+			continue;
+		}
+
+		uint32_t tris = backend == BACKEND_SOFT ? soft_execute(r, args, data) : 0;
+		if (!capturing) {
+			setup_bytes += r->size;
+			continue;
+		}
+		cur.calls++;
+		cur.bytes += r->size;
+		if (r->op == GL_OP_DRAW_ELEMENTS) {
+			cur.draws++;
+			cur.triangles += backend == BACKEND_SOFT ? tris : (args[0] == GL_TRIANGLES ? args[1] / 3 : (args[1] > 2 ? args[1] - 2 : 0));
+		}
+	}
+
+	printf("backend:       %s\n", backend == BACKEND_SOFT ? "soft" : "null");
+	printf("setup:         %lu texture ops, %lu bytes, %.2f ms\n",
+		op_count[GL_OP_GEN_TEXTURES] + op_count[GL_OP_DELETE_TEXTURES] + op_count[GL_OP_TEX_IMAGE_2D] + op_count[GL_OP_TEX_SUB_IMAGE_2D] + op_count[GL_OP_TEX_PARAMETERI],
+		setup_bytes, setup_ms);
+	if (!frames) {
+		printf("frames:        none captured\n");
+		return 0;
+	}
+	printf("frames:        %d\n", frames);
+	printf("per frame:     %.1f calls, %.1f draws, %.1f tris, %.1f KB\n", (double)total.calls / frames, (double)total.draws / frames,
+		(double)total.triangles / frames, total.bytes / 1024.0 / frames);
+	printf("cpu time:      %.3f ms avg, %.3f ms worst (%u draws)\n", total.ms / frames, worst.ms, worst.draws);
+	if (ppm && backend == BACKEND_SOFT)
+		write_ppm(ppm);
+	return 0;
+}
@@ -0,0 +1,214 @@
+/* gl_state_check.c -- checks which GL state calls the loader's shadow state forwards
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o gl_state_check gl_state_check.c ../loader/gl_state.c
+ * Usage: gl_state_check
+ *
+ * gl_state sits between the game and the atlas and batching layers. Here
+ * those layers are replaced by a recorder, and sequences of state calls are
+ * played through it: repeats must be dropped, changes, untracked values and
+ * everything after an SDL sync must go through, in order. The per frame
+ * counters must match what was played.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../loader/gl_state.h"
+#include "../loader/gl_batch.h"
+#include "../loader/gl_atlas.h"
+
+#define LOG_SIZE 4096
+
+static char log_buf[LOG_SIZE];
+static int failures = 0;
+
+static void record(const char *fmt, ...) {
+	size_t len = strlen(log_buf);
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(log_buf + len, sizeof(log_buf) - len, fmt, ap);
+	va_end(ap);
+	strncat(log_buf, " ", sizeof(log_buf) - strlen(log_buf) - 1);
+}
+
+// What the layers below would have received
+void glBindTexture_atlas(GLenum target, GLuint texture) { record("bind:%x:%u", target, texture); }
+void glDeleteTextures_atlas(GLsizei n, const GLuint *textures) { record("delete:%u", textures[0]); }
+void glTexParameteri_atlas(GLenum target, GLenum pname, GLint param) { record("param:%x:%x:%x", target, pname, param); }
+void gl_atlas_sync(void) { record("sync"); }
+void glEnable_batch(GLenum cap) { record("enable:%x", cap); }
+void glDisable_batch(GLenum cap) { record("disable:%x", cap); }
+void glBlendFunc_batch(GLenum sfactor, GLenum dfactor) { record("blend:%x:%x", sfactor, dfactor); }
+void glEnableClientState_batch(GLenum array) { record("client+:%x", array); }
+void glDisableClientState_batch(GLenum array) { record("client-:%x", array); }
+void glViewport_batch(GLint x, GLint y, GLsizei width, GLsizei height) { record("viewport:%d,%d,%d,%d", x, y, width, height); }
+void glScissor_batch(GLint x, GLint y, GLsizei width, GLsizei height) { record("scissor:%d,%d,%d,%d", x, y, width, height); }
+void glMatrixMode(GLenum mode) { record("matrix:%x", mode); }
+
+static void expect(const char *what, const char *forwarded) {
+	size_t len = strlen(log_buf);
+	if (len && log_buf[len - 1] == ' ')
+		log_buf[len - 1] = 0;
+	if (strcmp(log_buf, forwarded) && failures++ < 20)
+		fprintf(stderr, "%s:\n  forwarded \"%s\"\n  expected  \"%s\"\n", what, log_buf, forwarded);
+	log_buf[0] = 0;
+}
+
+static void check_textures(void) {
+	glBindTexture_state(GL_TEXTURE_2D, 5);
+	glBindTexture_state(GL_TEXTURE_2D, 5);
+	glBindTexture_state(GL_TEXTURE_2D, 6);
+	glBindTexture_state(GL_TEXTURE_2D, 5);
+	expect("bind", "bind:de1:5 bind:de1:6 bind:de1:5");
+
+	glBindTexture_state(GL_TEXTURE_1D, 5);
+	glBindTexture_state(GL_TEXTURE_1D, 5);
+	expect("bind other targets", "bind:de0:5 bind:de0:5");
+
+	// Parameters are remembered per texture
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glBindTexture_state(GL_TEXTURE_2D, 6);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glBindTexture_state(GL_TEXTURE_2D, 5);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	expect("tex parameters", "param:de1:2801:2601 param:de1:2802:812f bind:de1:6 param:de1:2801:2601 bind:de1:5 param:de1:2801:2600");
+
+	glTexParameteri_state(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+	glTexParameteri_state(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	expect("untracked parameters", "param:de1:8191:1 param:de1:8191:1 param:de0:2801:2600");
+
+	glBindTexture_state(GL_TEXTURE_2D, 9000);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	expect("names past the table", "bind:de1:9000 param:de1:2801:2601 param:de1:2801:2601");
+
+	// A deleted texture leaves 0 bound and its name comes back with default parameters
+	GLuint name = 5;
+	glBindTexture_state(GL_TEXTURE_2D, 5);
+	glDeleteTextures_state(1, &name);
+	glBindTexture_state(GL_TEXTURE_2D, 0);
+	glBindTexture_state(GL_TEXTURE_2D, 5);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	expect("delete", "bind:de1:5 delete:5 bind:de1:5 param:de1:2801:2600");
+}
+
+static void check_caps(void) {
+	glEnable_state(GL_BLEND);
+	glEnable_state(GL_BLEND);
+	glDisable_state(GL_BLEND);
+	glDisable_state(GL_BLEND);
+	glEnable_state(GL_SCISSOR_TEST);
+	glEnable_state(GL_BLEND);
+	expect("caps", "enable:be2 disable:be2 enable:c11 enable:be2");
+
+	// Only so many caps are tracked, the others always go through
+	for (GLenum cap = 0x7000; cap < 0x7010; cap++)
+		glEnable_state(cap);
+	log_buf[0] = 0;
+	glEnable_state(0x7000 + 13);
+	glEnable_state(0x7000 + 14);
+	glEnable_state(0x7000 + 14);
+	expect("caps past the table", "enable:700e enable:700e");
+
+	glBlendFunc_state(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glBlendFunc_state(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glBlendFunc_state(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	expect("blend func", "blend:302:303 blend:1:303");
+}
+
+static void check_arrays(void) {
+	glEnableClientState_state(GL_VERTEX_ARRAY);
+	glEnableClientState_state(GL_VERTEX_ARRAY);
+	glEnableClientState_state(GL_TEXTURE_COORD_ARRAY);
+	glDisableClientState_state(GL_VERTEX_ARRAY);
+	glDisableClientState_state(GL_COLOR_ARRAY);
+	glDisableClientState_state(GL_COLOR_ARRAY);
+	glEnableClientState_state(GL_NORMAL_ARRAY);
+	glEnableClientState_state(GL_NORMAL_ARRAY);
+	expect("client states", "client+:8074 client+:8078 client-:8074 client-:8076 client+:8075 client+:8075");
+}
+
+static void check_transform(void) {
+	glMatrixMode_state(GL_PROJECTION);
+	glMatrixMode_state(GL_PROJECTION);
+	glMatrixMode_state(GL_MODELVIEW);
+	glViewport_state(0, 0, 960, 544);
+	glViewport_state(0, 0, 960, 544);
+	glViewport_state(0, 0, 480, 272);
+	glScissor_state(10, 20, 30, 40);
+	glScissor_state(10, 20, 30, 40);
+	glScissor_state(10, 20, 30, 41);
+	expect("transform", "matrix:1701 matrix:1700 viewport:0,0,960,544 viewport:0,0,480,272 scissor:10,20,30,40 scissor:10,20,30,41");
+}
+
+// After SDL touched GL nothing is known, the same calls must all go through again
+static void check_sync(void) {
+	glBindTexture_state(GL_TEXTURE_2D, 7);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glEnable_state(GL_BLEND);
+	glBlendFunc_state(GL_ONE, GL_ONE);
+	glEnableClientState_state(GL_COLOR_ARRAY);
+	glMatrixMode_state(GL_MODELVIEW);
+	glViewport_state(1, 2, 3, 4);
+	glScissor_state(5, 6, 7, 8);
+	log_buf[0] = 0;
+
+	gl_state_sync();
+	glBindTexture_state(GL_TEXTURE_2D, 7);
+	glTexParameteri_state(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glEnable_state(GL_BLEND);
+	glBlendFunc_state(GL_ONE, GL_ONE);
+	glEnableClientState_state(GL_COLOR_ARRAY);
+	glMatrixMode_state(GL_MODELVIEW);
+	glViewport_state(1, 2, 3, 4);
+	glScissor_state(5, 6, 7, 8);
+	expect("sync", "sync bind:de1:7 param:de1:2800:2601 enable:be2 blend:1:1 client+:8076 matrix:1700 viewport:1,2,3,4 scissor:5,6,7,8");
+}
+
+static void check_stats(void) {
+	gl_state_frame();
+	glBindTexture_state(GL_TEXTURE_2D, 3);
+	glBindTexture_state(GL_TEXTURE_2D, 3);
+	glBindTexture_state(GL_TEXTURE_2D, 3);
+	glEnable_state(GL_DEPTH_TEST);
+	glViewport_state(0, 0, 1, 1);
+	glViewport_state(0, 0, 1, 1);
+	gl_state_frame();
+	log_buf[0] = 0;
+
+	gl_state_stats s;
+	gl_state_get_stats(&s);
+	if ((s.calls[GL_STATE_BIND_TEXTURE] != 3 || s.redundant[GL_STATE_BIND_TEXTURE] != 2 ||
+		s.calls[GL_STATE_ENABLE] != 1 || s.redundant[GL_STATE_ENABLE] != 0 ||
+		s.calls[GL_STATE_VIEWPORT] != 2 || s.redundant[GL_STATE_VIEWPORT] != 1 ||
+		s.calls[GL_STATE_BLEND_FUNC] != 0) && failures++ < 20)
+		fprintf(stderr, "stats: bind %u/%u, enable %u/%u, viewport %u/%u\n", s.redundant[GL_STATE_BIND_TEXTURE], s.calls[GL_STATE_BIND_TEXTURE],
+			s.redundant[GL_STATE_ENABLE], s.calls[GL_STATE_ENABLE], s.redundant[GL_STATE_VIEWPORT], s.calls[GL_STATE_VIEWPORT]);
+}
+
+int main(int argc, char *argv[]) {
+	check_textures();
+	check_caps();
+	check_arrays();
+	check_transform();
+	check_sync();
+	check_stats();
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,396 @@
+/* io_replay.c -- replays an io_trace.bin capture against a local copy of the data folder
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o io_replay io_replay.c
+ * Usage: io_replay <io_trace.bin> <data dir> [loose|pack|preload|cache] [cache size in KB]
+ *
+ * <data dir> must mirror ux0:data/canada. Every strategy is timed with the
+ * page cache of the touched files dropped beforehand (best effort) so that
+ * results resemble a cold memory card more than a warm workstation disk.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../loader/io_trace.h"
+
+#define VITA_PREFIX "ux0:data/canada/"
+#define MAX_HANDLES 256
+#define BLOCK_SIZE (64 * 1024)
+
+enum {
+	STRATEGY_LOOSE,
+	STRATEGY_PACK,
+	STRATEGY_PRELOAD,
+	STRATEGY_CACHE,
+};
+
+static const char *strategy_names[] = { "loose", "pack", "preload", "cache" };
+
+typedef struct {
+	char *path;      // host path
+	off_t size;      // -1 if missing on the host
+	off_t pack_offs; // offset inside the pack file
+	uint8_t *data;   // preloaded content
+} replay_file;
+
+typedef struct {
+	uint16_t path_id;
+	int fd;
+	off_t pos;
+	uint64_t seq; // open order
+	int used;
+} replay_handle;
+
+typedef struct {
+	uint16_t path_id;
+	uint32_t block;
+	uint64_t last_use;
+	uint8_t *data;
+	size_t size;
+} cache_block;
+
+static io_trace_record *records;
+static size_t num_records;
+static replay_file *files;
+static size_t num_files;
+
+static int strategy = STRATEGY_LOOSE;
+static int pack_fd = -1;
+static char pack_path[] = "/tmp/io_replay_pack_XXXXXX";
+static cache_block *cache;
+static size_t cache_blocks;
+static uint64_t cache_tick, cache_hits, cache_misses;
+static uint64_t open_seq;
+static replay_handle handles[MAX_HANDLES];
+
+static uint64_t bytes_read, op_count[IO_OP_STAT + 1];
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void load_trace(const char *trace_path, const char *root) {
+	FILE *f = fopen(trace_path, "rb");
+	if (!f) {
+		fprintf(stderr, "Cannot open %s\n", trace_path);
+		exit(1);
+	}
+	io_trace_header hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != IO_TRACE_MAGIC || hdr.version != IO_TRACE_VERSION) {
+		fprintf(stderr, "%s is not a valid trace\n", trace_path);
+		exit(1);
+	}
+
+	size_t cap = 0x10000;
+	records = malloc(cap * sizeof(io_trace_record));
+	io_trace_record r;
+	while (fread(&r, sizeof(r), 1, f) == 1) {
+		if (r.op == IO_OP_PATH) {
+			char vita_path[1024];
+			if (r.size >= sizeof(vita_path) || fread(vita_path, 1, r.size, f) != r.size)
+				break;
+			vita_path[r.size] = 0;
+			if (r.path_id >= num_files) {
+				files = realloc(files, (r.path_id + 1) * sizeof(replay_file));
+				memset(&files[num_files], 0, (r.path_id + 1 - num_files) * sizeof(replay_file));
+				num_files = r.path_id + 1;
+			}
+			const char *rel = strncmp(vita_path, VITA_PREFIX, strlen(VITA_PREFIX)) ? vita_path : vita_path + strlen(VITA_PREFIX);
+			replay_file *rf = &files[r.path_id];
+			rf->path = malloc(strlen(root) + strlen(rel) + 2);
+			sprintf(rf->path, "%s/%s", root, rel);
+			struct stat st;
+			rf->size = stat(rf->path, &st) ? -1 : st.st_size;
+			continue;
+		}
+		if (num_records == cap) {
+			cap *= 2;
+			records = realloc(records, cap * sizeof(io_trace_record));
+		}
+		records[num_records++] = r;
+	}
+	fclose(f);
+}
+
+static void drop_caches(void) {
+	for (size_t i = 0; i < num_files; i++) {
+		if (!files[i].path || files[i].size < 0)
+			continue;
+		int fd = open(files[i].path, O_RDONLY);
+		if (fd >= 0) {
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+	if (pack_fd >= 0)
+		posix_fadvise(pack_fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static uint8_t *read_whole(const char *path, off_t size) {
+	uint8_t *data = malloc(size ? size : 1);
+	int fd = open(path, O_RDONLY);
+	off_t done = 0;
+	while (fd >= 0 && done < size) {
+		ssize_t res = read(fd, data + done, size - done);
+		if (res <= 0)
+			break;
+		done += res;
+	}
+	if (fd >= 0)
+		close(fd);
+	return data;
+}
+
+static double prepare(void) {
+	double start = now_ms();
+	if (strategy == STRATEGY_PACK) {
+		pack_fd = mkstemp(pack_path);
+		off_t offs = 0;
+		for (size_t i = 0; i < num_files; i++) {
+			if (files[i].size <= 0)
+				continue;
+			uint8_t *data = read_whole(files[i].path, files[i].size);
+			files[i].pack_offs = offs;
+			offs += pwrite(pack_fd, data, files[i].size, offs);
+			free(data);
+		}
+		fsync(pack_fd);
+		unlink(pack_path);
+		return 0.0; // Building the pack is an offline step
+	} else if (strategy == STRATEGY_PRELOAD) {
+		drop_caches();
+		start = now_ms();
+		for (size_t i = 0; i < num_files; i++) {
+			if (files[i].size > 0)
+				files[i].data = read_whole(files[i].path, files[i].size);
+		}
+	}
+	return now_ms() - start;
+}
+
+static size_t cache_read(uint16_t path_id, int fd, uint8_t *dst, off_t offs, size_t size) {
+	size_t done = 0;
+	while (done < size) {
+		uint32_t block = (offs + done) / BLOCK_SIZE;
+		size_t in_block = (offs + done) % BLOCK_SIZE;
+		cache_block *hit = NULL, *victim = &cache[0];
+		for (size_t i = 0; i < cache_blocks; i++) {
+			if (cache[i].data && cache[i].path_id == path_id && cache[i].block == block) {
+				hit = &cache[i];
+				break;
+			}
+			if (cache[i].last_use < victim->last_use)
+				victim = &cache[i];
+		}
+		if (hit) {
+			cache_hits++;
+		} else {
+			cache_misses++;
+			hit = victim;
+			if (!hit->data)
+				hit->data = malloc(BLOCK_SIZE);
+			ssize_t res = pread(fd, hit->data, BLOCK_SIZE, (off_t)block * BLOCK_SIZE);
+			hit->size = res > 0 ? res : 0;
+			hit->path_id = path_id;
+			hit->block = block;
+		}
+		hit->last_use = ++cache_tick;
+		if (in_block >= hit->size)
+			break;
+		size_t chunk = hit->size - in_block;
+		if (chunk > size - done)
+			chunk = size - done;
+		memcpy(dst + done, hit->data + in_block, chunk);
+		done += chunk;
+	}
+	return done;
+}
+
+static size_t replay_read(replay_handle *h, uint8_t *dst, off_t offs, size_t size) {
+	replay_file *rf = &files[h->path_id];
+	if (rf->size < 0 || offs >= rf->size)
+		return 0;
+	if (offs + (off_t)size > rf->size)
+		size = rf->size - offs;
+	switch (strategy) {
+	case STRATEGY_PACK:
+		return pread(pack_fd, dst, size, rf->pack_offs + offs);
+	case STRATEGY_PRELOAD:
+		memcpy(dst, rf->data + offs, size);
+		return size;
+	case STRATEGY_CACHE:
+		return cache_read(h->path_id, h->fd, dst, offs, size);
+	default:
+		return pread(h->fd, dst, size, offs);
+	}
+}
+
+static replay_handle *handle_open(uint16_t path_id) {
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		if (!handles[i].used) {
+			replay_handle *h = &handles[i];
+			h->used = 1;
+			h->path_id = path_id;
+			h->pos = 0;
+			h->seq = ++open_seq;
+			h->fd = -1;
+			if (strategy == STRATEGY_LOOSE || strategy == STRATEGY_CACHE)
+				h->fd = open(files[path_id].path, O_RDONLY);
+			return h;
+		}
+	}
+	return NULL;
+}
+
+static replay_handle *handle_find(uint16_t path_id) {
+	// Traces only carry the path, so pick the most recently opened handle of that file
+	replay_handle *found = NULL;
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		if (handles[i].used && handles[i].path_id == path_id && (!found || handles[i].seq > found->seq))
+			found = &handles[i];
+	}
+	return found;
+}
+
+static void handle_close(replay_handle *h) {
+	if (h->fd >= 0)
+		close(h->fd);
+	h->used = 0;
+}
+
+static void replay_whole_file(uint16_t path_id, uint8_t *scratch) {
+	replay_handle *h = handle_open(path_id);
+	if (!h)
+		return;
+	off_t offs = 0;
+	while (offs < files[path_id].size) {
+		size_t res = replay_read(h, scratch, offs, BLOCK_SIZE);
+		if (!res)
+			break;
+		bytes_read += res;
+		offs += res;
+	}
+	handle_close(h);
+}
+
+static double replay(void) {
+	uint8_t *scratch = malloc(BLOCK_SIZE);
+	size_t scratch_size = BLOCK_SIZE;
+	double start = now_ms();
+
+	for (size_t i = 0; i < num_records; i++) {
+		io_trace_record *r = &records[i];
+		if (r->op > IO_OP_STAT || r->path_id >= num_files || !files[r->path_id].path || (r->flags & (IO_FLAG_FAILED | IO_FLAG_WRITE)))
+			continue;
+		op_count[r->op]++;
+		replay_handle *h;
+		switch (r->op) {
+		case IO_OP_FOPEN:
+			handle_open(r->path_id);
+			break;
+		case IO_OP_FREAD:
+			h = handle_find(r->path_id);
+			if (!h)
+				break;
+			if (r->size > scratch_size) {
+				scratch_size = r->size;
+				scratch = realloc(scratch, scratch_size);
+			}
+			bytes_read += replay_read(h, scratch, r->offset, r->size);
+			h->pos = r->offset + r->size;
+			break;
+		case IO_OP_FSEEK:
+			h = handle_find(r->path_id);
+			if (h)
+				h->pos = r->offset;
+			break;
+		case IO_OP_FCLOSE:
+			h = handle_find(r->path_id);
+			if (h)
+				handle_close(h);
+			break;
+		case IO_OP_RWOPEN:
+		case IO_OP_IMG_LOAD:
+		case IO_OP_MUS_LOAD:
+			replay_whole_file(r->path_id, scratch);
+			break;
+		case IO_OP_OPENDIR:
+			if (strategy != STRATEGY_PRELOAD) {
+				DIR *d = opendir(files[r->path_id].path);
+				if (d) {
+					while (readdir(d));
+					closedir(d);
+				}
+			}
+			break;
+		case IO_OP_STAT:
+			if (strategy == STRATEGY_LOOSE || strategy == STRATEGY_CACHE) {
+				struct stat st;
+				stat(files[r->path_id].path, &st);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (int i = 0; i < MAX_HANDLES; i++) {
+		if (handles[i].used)
+			handle_close(&handles[i]);
+	}
+	free(scratch);
+	return now_ms() - start;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <io_trace.bin> <data dir> [loose|pack|preload|cache] [cache size in KB]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 3) {
+		for (int i = 0; i < sizeof(strategy_names) / sizeof(*strategy_names); i++) {
+			if (!strcmp(argv[3], strategy_names[i]))
+				strategy = i;
+		}
+	}
+	size_t cache_kb = argc > 4 ? strtoul(argv[4], NULL, 10) : 4096;
+	cache_blocks = (cache_kb * 1024) / BLOCK_SIZE;
+	if (!cache_blocks)
+		cache_blocks = 1;
+	cache = calloc(cache_blocks, sizeof(cache_block));
+
+	load_trace(argv[1], argv[2]);
+	uint64_t duration_us = num_records ? records[num_records - 1].timestamp - records[0].timestamp : 0;
+
+	double setup_ms = prepare();
+	drop_caches();
+	double replay_ms = replay();
+
+	printf("strategy:      %s\n", strategy_names[strategy]);
+	printf("records:       %zu over %zu files (%.2f s on device)\n", num_records, num_files, duration_us / 1000000.0);
+	printf("ops:           fopen %lu, fread %lu, fseek %lu, fclose %lu, rwopen %lu, img %lu, mus %lu, opendir %lu, stat %lu\n",
+		op_count[IO_OP_FOPEN], op_count[IO_OP_FREAD], op_count[IO_OP_FSEEK], op_count[IO_OP_FCLOSE], op_count[IO_OP_RWOPEN],
+		op_count[IO_OP_IMG_LOAD], op_count[IO_OP_MUS_LOAD], op_count[IO_OP_OPENDIR], op_count[IO_OP_STAT]);
+	printf("bytes read:    %lu\n", bytes_read);
+	if (strategy == STRATEGY_CACHE)
+		printf("cache:         %lu hits, %lu misses (%zu KB)\n", cache_hits, cache_misses, cache_blocks * BLOCK_SIZE / 1024);
+	if (strategy == STRATEGY_PRELOAD)
+		printf("preload:       %.2f ms\n", setup_ms);
+	printf("replay:        %.2f ms\n", replay_ms);
+	return 0;
+}
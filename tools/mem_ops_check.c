@@ -0,0 +1,176 @@
+/* mem_ops_check.c -- checks the loader's memcpy, memmove and memset against libc and times them
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o mem_ops_check mem_ops_check.c ../loader/mem_ops.c
+ * Usage: mem_ops_check [-b]
+ *
+ * Every size up to 320 bytes and a few larger ones is run at every source and
+ * destination alignment within 16 bytes, with guard bytes around the target.
+ * With -b the functions are timed against the host's libc for common sizes.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../loader/mem_ops.h"
+
+#define BUF_SIZE (64 * 1024)
+#define GUARD 0xEE
+
+static const size_t large_sizes[] = { 511, 512, 1000, 1024, 4095, 4096, 4097, 10000, 30000 };
+
+static uint8_t src_buf[BUF_SIZE], dst_buf[BUF_SIZE], ref_buf[BUF_SIZE];
+static int failures = 0;
+
+static void fail(const char *op, size_t n, int a, int b) {
+	if (failures++ < 20)
+		fprintf(stderr, "%s failed: size %zu, alignments %d/%d\n", op, n, a, b);
+}
+
+static void fill(uint8_t *p, size_t n, uint32_t seed) {
+	for (size_t i = 0; i < n; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = seed >> 16;
+	}
+}
+
+static void check_size(size_t n) {
+	if (n > BUF_SIZE - 256)
+		return;
+	for (int sa = 0; sa < 16; sa++) {
+		for (int da = 0; da < 16; da++) {
+			uint8_t *s = src_buf + 64 + sa, *d = dst_buf + 64 + da, *r = ref_buf + 64 + da;
+			size_t span = n + 128;
+
+			fill(src_buf, span + 16, n * 31 + sa);
+			memset(dst_buf, GUARD, span + 16);
+			memset(ref_buf, GUARD, span + 16);
+			memcpy(r, s, n);
+			if (mem_ops_memcpy(d, s, n) != d || memcmp(dst_buf, ref_buf, span + 16))
+				fail("memcpy", n, sa, da);
+
+			memset(dst_buf, GUARD, span + 16);
+			mem_ops_aeabi_memcpy(d, s, n);
+			if (memcmp(dst_buf, ref_buf, span + 16))
+				fail("__aeabi_memcpy", n, sa, da);
+
+			if (!(sa & 3) && !(da & 3)) {
+				memset(dst_buf, GUARD, span + 16);
+				mem_ops_aeabi_memcpy4(d, s, n);
+				if (memcmp(dst_buf, ref_buf, span + 16))
+					fail("__aeabi_memcpy4", n, sa, da);
+			}
+
+			memset(dst_buf, GUARD, span + 16);
+			mem_ops_memmove(d, s, n);
+			if (memcmp(dst_buf, ref_buf, span + 16))
+				fail("memmove", n, sa, da);
+
+			int c = (n + sa) & 0xFF;
+			memset(dst_buf, GUARD, span + 16);
+			memset(ref_buf, GUARD, span + 16);
+			memset(r, c, n);
+			if (mem_ops_memset(d, c | 0x100, n) != d || memcmp(dst_buf, ref_buf, span + 16))
+				fail("memset", n, sa, da);
+
+			memset(dst_buf, GUARD, span + 16);
+			mem_ops_aeabi_memset(d, n, c);
+			if (memcmp(dst_buf, ref_buf, span + 16))
+				fail("__aeabi_memset", n, sa, da);
+
+			memset(dst_buf, GUARD, span + 16);
+			memset(ref_buf, GUARD, span + 16);
+			memset(r, 0, n);
+			mem_ops_aeabi_memclr(d, n);
+			if (memcmp(dst_buf, ref_buf, span + 16))
+				fail("__aeabi_memclr", n, sa, da);
+		}
+	}
+}
+
+// Source and destination within the same buffer, shifted both ways
+static void check_overlap(size_t n) {
+	if (n > BUF_SIZE - 2048)
+		return;
+	for (int shift = -40; shift <= 40; shift++) {
+		uint8_t *s = src_buf + 1024, *d = s + shift;
+		fill(src_buf, n + 2048, n + shift);
+		memcpy(ref_buf, src_buf, n + 2048);
+		memmove(ref_buf + 1024 + shift, ref_buf + 1024, n);
+		mem_ops_memmove(d, s, n);
+		if (memcmp(src_buf, ref_buf, n + 2048))
+			fail("memmove overlap", n, 0, shift);
+
+		fill(src_buf, n + 2048, n - shift);
+		memcpy(ref_buf, src_buf, n + 2048);
+		memmove(ref_buf + 1024 + shift, ref_buf + 1024, n);
+		mem_ops_aeabi_memmove(d, s, n);
+		if (memcmp(src_buf, ref_buf, n + 2048))
+			fail("__aeabi_memmove overlap", n, 0, shift);
+	}
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(void) {
+	static const size_t sizes[] = { 4, 8, 12, 16, 24, 32, 64, 128, 256, 1024, 4096, 16384 };
+	void *(*volatile lib_memcpy)(void *, const void *, size_t) = memcpy;
+	void *(*volatile lib_memset)(void *, int, size_t) = memset;
+
+	printf("size      memcpy ns  libc ns   memset ns  libc ns\n");
+	for (int i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		size_t n = sizes[i];
+		int iters = (int)(200000000 / (n + 64));
+		double t[4], start;
+
+		start = now_ns();
+		for (int j = 0; j < iters; j++)
+			mem_ops_memcpy(dst_buf + (j & 7), src_buf + (j & 3), n);
+		t[0] = now_ns() - start;
+		start = now_ns();
+		for (int j = 0; j < iters; j++)
+			lib_memcpy(dst_buf + (j & 7), src_buf + (j & 3), n);
+		t[1] = now_ns() - start;
+		start = now_ns();
+		for (int j = 0; j < iters; j++)
+			mem_ops_memset(dst_buf + (j & 7), j, n);
+		t[2] = now_ns() - start;
+		start = now_ns();
+		for (int j = 0; j < iters; j++)
+			lib_memset(dst_buf + (j & 7), j, n);
+		t[3] = now_ns() - start;
+
+		printf("%-8zu %10.2f %8.2f %11.2f %8.2f\n", n, t[0] / iters, t[1] / iters, t[2] / iters, t[3] / iters);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	for (size_t n = 0; n <= 320; n++) {
+		check_size(n);
+		check_overlap(n);
+	}
+	for (int i = 0; i < sizeof(large_sizes) / sizeof(*large_sizes); i++) {
+		check_size(large_sizes[i]);
+		check_overlap(large_sizes[i]);
+	}
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	return 0;
+}
@@ -0,0 +1,274 @@
+/* mem_replay.c -- replays a mem_trace.bin capture against the host's malloc or the loader's slab allocator
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o mem_replay mem_replay.c ../loader/mem_alloc.c -lpthread
+ * Usage: mem_replay <mem_trace.bin> [system|slab] [-r] [-n repeats]
+ *
+ * Calls are replayed in their recorded order on a single host thread, the
+ * slab allocator is told which traced thread made each one so that its per
+ * thread caches behave as they did on the device. Every block gets its first
+ * bytes written, the way the game would initialize an object. With -r the
+ * slab allocator's fragmentation report is printed once the replay ends.
+ */
+
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../loader/mem_alloc.h"
+
+#define TOUCH_BYTES 64
+
+enum {
+	ALLOCATOR_SYSTEM,
+	ALLOCATOR_SLAB,
+};
+
+static const char *allocator_names[] = { "system", "slab" };
+
+typedef struct {
+	uint32_t key; // pointer on the device
+	void *ptr;
+	uint32_t size;
+} live_block;
+
+static mem_trace_record *records;
+static size_t num_records;
+
+static live_block *live;
+static size_t live_mask;
+static uint64_t live_bytes, peak_bytes;
+static uint32_t live_num, peak_num;
+
+static int allocator = ALLOCATOR_SYSTEM;
+static uint32_t current_thread;
+static uint64_t op_count[MEM_OP_FREE + 1], missing_frees;
+
+uint32_t mem_replay_thread(void) {
+	return current_thread;
+}
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void load_trace(const char *trace_path) {
+	FILE *f = fopen(trace_path, "rb");
+	if (!f) {
+		fprintf(stderr, "Cannot open %s\n", trace_path);
+		exit(1);
+	}
+	mem_trace_header hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != MEM_TRACE_MAGIC || hdr.version != MEM_TRACE_VERSION) {
+		fprintf(stderr, "%s is not a valid trace\n", trace_path);
+		exit(1);
+	}
+
+	size_t cap = 0x10000;
+	records = malloc(cap * sizeof(mem_trace_record));
+	mem_trace_record r;
+	while (fread(&r, sizeof(r), 1, f) == 1) {
+		if (num_records == cap) {
+			cap *= 2;
+			records = realloc(records, cap * sizeof(mem_trace_record));
+		}
+		records[num_records++] = r;
+	}
+	fclose(f);
+}
+
+static size_t live_slot(uint32_t key) {
+	size_t slot = (key * 2654435761u) & live_mask;
+	while (live[slot].key && live[slot].key != key)
+		slot = (slot + 1) & live_mask;
+	return slot;
+}
+
+static void live_insert(uint32_t key, void *ptr, uint32_t size) {
+	if (!key || !ptr)
+		return;
+	live_block *b = &live[live_slot(key)];
+	b->key = key;
+	b->ptr = ptr;
+	b->size = size;
+	live_bytes += size;
+	live_num++;
+	if (live_bytes > peak_bytes)
+		peak_bytes = live_bytes;
+	if (live_num > peak_num)
+		peak_num = live_num;
+}
+
+static void *live_remove(uint32_t key) {
+	size_t slot = live_slot(key);
+	if (!live[slot].key)
+		return NULL;
+	void *ptr = live[slot].ptr;
+	live_bytes -= live[slot].size;
+	live_num--;
+
+	// Backward shift deletion keeps probe chains intact without tombstones
+	size_t hole = slot;
+	for (size_t i = (hole + 1) & live_mask; live[i].key; i = (i + 1) & live_mask) {
+		size_t home = (live[i].key * 2654435761u) & live_mask;
+		if (((i - home) & live_mask) >= ((i - hole) & live_mask)) {
+			live[hole] = live[i];
+			hole = i;
+		}
+	}
+	live[hole].key = 0;
+	return ptr;
+}
+
+static void touch(void *p, uint32_t size) {
+	memset(p, 0xA5, size < TOUCH_BYTES ? size : TOUCH_BYTES);
+}
+
+static double replay(void) {
+	void *(*do_malloc)(size_t) = allocator == ALLOCATOR_SLAB ? mem_malloc : malloc;
+	void *(*do_calloc)(size_t, size_t) = allocator == ALLOCATOR_SLAB ? mem_calloc : calloc;
+	void *(*do_realloc)(void *, size_t) = allocator == ALLOCATOR_SLAB ? mem_realloc : realloc;
+	void *(*do_memalign)(size_t, size_t) = allocator == ALLOCATOR_SLAB ? mem_memalign : memalign;
+	void (*do_free)(void *) = allocator == ALLOCATOR_SLAB ? mem_free : free;
+	double start = now_ms();
+
+	for (size_t i = 0; i < num_records; i++) {
+		mem_trace_record *r = &records[i];
+		if (r->op > MEM_OP_FREE)
+			continue;
+		current_thread = r->thread;
+		op_count[r->op]++;
+		void *p, *old;
+		switch (r->op) {
+		case MEM_OP_MALLOC:
+			if (!r->ptr)
+				break;
+			p = do_malloc(r->size);
+			touch(p, r->size);
+			live_insert(r->ptr, p, r->size);
+			break;
+		case MEM_OP_CALLOC:
+			if (!r->ptr)
+				break;
+			p = do_calloc(1, r->size);
+			live_insert(r->ptr, p, r->size);
+			break;
+		case MEM_OP_MEMALIGN:
+			if (!r->ptr)
+				break;
+			p = do_memalign(r->arg, r->size);
+			touch(p, r->size);
+			live_insert(r->ptr, p, r->size);
+			break;
+		case MEM_OP_REALLOC:
+			if (!r->ptr)
+				break;
+			old = r->arg ? live_remove(r->arg) : NULL;
+			if (r->arg && !old)
+				missing_frees++;
+			p = do_realloc(old, r->size);
+			if (!old)
+				touch(p, r->size);
+			live_insert(r->ptr, p, r->size);
+			break;
+		case MEM_OP_FREE:
+			old = live_remove(r->ptr);
+			// Blocks from before the trace started, or from libc calls that allocate on their own
+			if (!old)
+				missing_frees++;
+			else
+				do_free(old);
+			break;
+		}
+	}
+	return now_ms() - start;
+}
+
+static void release_all(void) {
+	void (*do_free)(void *) = allocator == ALLOCATOR_SLAB ? mem_free : free;
+	for (size_t i = 0; i <= live_mask; i++) {
+		if (live[i].key) {
+			current_thread = 0;
+			do_free(live[i].ptr);
+			live[i].key = 0;
+		}
+	}
+	live_bytes = live_num = 0;
+}
+
+int main(int argc, char *argv[]) {
+	int report = 0, repeats = 1;
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <mem_trace.bin> [system|slab] [-r] [-n repeats]\n", argv[0]);
+		return 1;
+	}
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "-r"))
+			report = 1;
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+			repeats = atoi(argv[++i]);
+		else {
+			for (int j = 0; j < sizeof(allocator_names) / sizeof(*allocator_names); j++) {
+				if (!strcmp(argv[i], allocator_names[j]))
+					allocator = j;
+			}
+		}
+	}
+	if (repeats < 1)
+		repeats = 1;
+
+	load_trace(argv[1]);
+	size_t slots = 1024;
+	while (slots < num_records * 2)
+		slots *= 2;
+	live = calloc(slots, sizeof(live_block));
+	live_mask = slots - 1;
+	if (allocator == ALLOCATOR_SLAB)
+		mem_alloc_init(0);
+
+	double best_ms = 0.0;
+	uint64_t held_bytes = 0;
+	for (int i = 0; i < repeats; i++) {
+		memset(op_count, 0, sizeof(op_count));
+		missing_frees = 0;
+		double ms = replay();
+		if (!i || ms < best_ms)
+			best_ms = ms;
+		if (i == repeats - 1) {
+			// What the allocator holds for the blocks still alive at the end of the trace
+			if (allocator == ALLOCATOR_SLAB) {
+				mem_alloc_stats s;
+				mem_alloc_get_stats(&s);
+				held_bytes = (uint64_t)s.slabs_used * 64 * 1024 + s.large_bytes;
+			} else {
+				struct mallinfo2 mi = mallinfo2();
+				held_bytes = mi.uordblks + mi.hblkhd;
+			}
+			break;
+		}
+		release_all();
+	}
+
+	printf("allocator:     %s\n", allocator_names[allocator]);
+	printf("records:       %zu\n", num_records);
+	printf("ops:           malloc %lu, calloc %lu, realloc %lu, memalign %lu, free %lu (%lu unmatched)\n", op_count[MEM_OP_MALLOC],
+		op_count[MEM_OP_CALLOC], op_count[MEM_OP_REALLOC], op_count[MEM_OP_MEMALIGN], op_count[MEM_OP_FREE], missing_frees);
+	printf("live at end:   %u blocks, %lu KB requested, %lu KB held\n", live_num, live_bytes / 1024, held_bytes / 1024);
+	printf("peak:          %u blocks, %lu KB requested\n", peak_num, peak_bytes / 1024);
+	printf("replay:        %.2f ms (best of %d), %.1f ns per call\n", best_ms, repeats, best_ms * 1000000.0 / (num_records ? num_records : 1));
+	if (report && allocator == ALLOCATOR_SLAB) {
+		printf("\n");
+		mem_alloc_report(stdout);
+	}
+	return 0;
+}
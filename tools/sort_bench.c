@@ -0,0 +1,184 @@
+/* sort_bench.c -- checks and times the loader's qsort against the host's
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o sort_bench sort_bench.c ../loader/sort.c
+ * Usage: sort_bench [num]
+ *
+ * Arrays of 4 byte pointers, 8 byte key/index pairs, 16 byte and 28 byte
+ * records are sorted by an int key at their start, like the game's depth
+ * sorts. Each layout gets sorted, nearly sorted (the previous frame's order
+ * with a few percent of the keys moved), random, reversed and few distinct
+ * keys inputs. Every result is checked to be ordered and to hold the same
+ * elements, and the stable sort to keep equal keys in input order.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../loader/sort.h"
+
+#define REPEATS 20
+
+typedef struct {
+	int key;
+	uint32_t serial; // input position, checks stability
+} record;
+
+static const size_t sizes[] = { 4, 8, 16, 28 };
+static const char *pattern_names[] = { "sorted", "nearly sorted", "random", "reversed", "few keys" };
+static int failures = 0;
+static uint32_t seed = 1;
+static size_t current_size;
+
+static uint32_t rnd(void) {
+	seed = seed * 1664525 + 1013904223;
+	return seed >> 8;
+}
+
+static record *targets;
+
+// 4 byte elements stand for pointers to records, like a list of entities. They're indices
+// here, pointers don't fit in 4 bytes on a 64-bit host
+static int cmp_ptr(const void *a, const void *b) {
+	const record *x = &targets[*(const uint32_t *)a], *y = &targets[*(const uint32_t *)b];
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static int cmp_key(const void *a, const void *b) {
+	int x = ((const record *)a)->key, y = ((const record *)b)->key;
+	return (x > y) - (x < y);
+}
+
+static void fill(char *buf, size_t num, size_t size, int pattern) {
+	for (size_t i = 0; i < num; i++) {
+		int key;
+		switch (pattern) {
+		case 0:
+			key = i;
+			break;
+		case 1:
+			key = rnd() % 32 ? (int)i : (int)(i + rnd() % 64) - 32;
+			break;
+		case 2:
+			key = rnd();
+			break;
+		case 3:
+			key = num - i;
+			break;
+		default:
+			key = rnd() % 16;
+			break;
+		}
+		record r = { key, i };
+		if (size == 4) {
+			uint32_t index = i;
+			targets[i] = r;
+			memcpy(buf + i * 4, &index, 4);
+		} else {
+			memset(buf + i * size, 0, size);
+			memcpy(buf + i * size, &r, sizeof(r));
+		}
+	}
+}
+
+static const record *at(const char *buf, size_t i, size_t size) {
+	if (size == 4) {
+		uint32_t index;
+		memcpy(&index, buf + i * 4, 4);
+		return &targets[index];
+	}
+	return (const record *)(buf + i * size);
+}
+
+static void check(const char *what, const char *buf, size_t num, size_t size, int stable) {
+	uint64_t serials = 0;
+	for (size_t i = 0; i < num; i++) {
+		const record *r = at(buf, i, size);
+		serials += r->serial;
+		if (i) {
+			const record *p = at(buf, i - 1, size);
+			if (p->key > r->key || (stable && p->key == r->key && p->serial > r->serial)) {
+				if (failures++ < 10)
+					fprintf(stderr, "%s: out of order at %zu (size %zu)\n", what, i, size);
+				return;
+			}
+		}
+	}
+	if (serials != (uint64_t)num * (num - 1) / 2 && failures++ < 10)
+		fprintf(stderr, "%s: elements lost (size %zu)\n", what, size);
+}
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static double run(void (*sorter)(void *, size_t, size_t, sort_cmp), char *work, const char *input, size_t num, size_t size) {
+	sort_cmp cmp = size == 4 ? cmp_ptr : cmp_key;
+	double best = 1e9;
+	for (int r = 0; r < REPEATS; r++) {
+		memcpy(work, input, num * size);
+		double start = now_ms();
+		sorter(work, num, size, cmp);
+		double t = now_ms() - start;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+static void host_qsort(void *base, size_t num, size_t size, sort_cmp cmp) {
+	qsort(base, num, size, cmp);
+}
+
+int main(int argc, char *argv[]) {
+	size_t num = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000;
+	char *input = malloc(num * 32), *work = malloc(num * 32);
+	targets = malloc((num > 300 ? num : 300) * sizeof(record));
+
+	// Sizes around the insertion sort cutoff and the ninther threshold, where bugs hide
+	for (size_t n = 0; n < 300; n++) {
+		for (int s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+			for (int p = 0; p < 5; p++) {
+				size_t size = sizes[s];
+				fill(input, n, size, p);
+				memcpy(work, input, n * size);
+				sort_unstable(work, n, size, size == 4 ? cmp_ptr : cmp_key);
+				check("unstable", work, n, size, 0);
+				memcpy(work, input, n * size);
+				sort_stable(work, n, size, size == 4 ? cmp_ptr : cmp_key);
+				check("stable", work, n, size, 1);
+			}
+		}
+	}
+
+	printf("%zu elements, best of %d        unstable ms  stable ms   host ms\n", num, REPEATS);
+	for (int s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+		for (int p = 0; p < 5; p++) {
+			current_size = sizes[s];
+			fill(input, num, current_size, p);
+			double t[3];
+			t[0] = run(sort_unstable, work, input, num, current_size);
+			check("unstable", work, num, current_size, 0);
+			t[1] = run(sort_stable, work, input, num, current_size);
+			check("stable", work, num, current_size, 1);
+			t[2] = run(host_qsort, work, input, num, current_size);
+			printf("%2zu bytes, %-24s %10.3f %10.3f %9.3f\n", current_size, pattern_names[p], t[0], t[1], t[2]);
+		}
+	}
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
@@ -0,0 +1,290 @@
+/* str_ops_check.c -- checks the loader's string routines against glibc and times them
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o str_ops_check str_ops_check.c ../loader/str_ops.c ../loader/mem_ops.c
+ * Usage: str_ops_check [-b]
+ *
+ * Random strings over a small alphabet, so that matches and near matches are
+ * common, are placed at every alignment and right before an unmapped page,
+ * which catches any read past a terminator that crosses into the next page.
+ * With -b the routines are timed on short names and long text, next to plain
+ * byte loops and glibc.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../loader/str_ops.h"
+
+#define ROUNDS 200000
+#define MAX_LEN 80
+
+static char *page_end; // first byte of the unmapped page
+static int failures = 0;
+static uint32_t seed = 1;
+
+static uint32_t rnd(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static int sign(int v) {
+	return (v > 0) - (v < 0);
+}
+
+static void fail(const char *op, const char *a, const char *b) {
+	if (failures++ < 20)
+		fprintf(stderr, "%s failed: \"%s\" \"%s\"\n", op, a ? a : "", b ? b : "");
+}
+
+static void random_string(char *s, int len) {
+	static const char alphabet[] = "abcABC_-. \x80\xff";
+	for (int i = 0; i < len; i++)
+		s[i] = alphabet[rnd() % (sizeof(alphabet) - 1)];
+	s[len] = 0;
+}
+
+// Places a copy of s so that its terminator is the last mapped byte, or at a given misalignment
+static char *place(const char *s, int at_end, int align, char *area) {
+	size_t len = strlen(s) + 1;
+	char *p = at_end ? page_end - len : area + align;
+	memcpy(p, s, len);
+	return p;
+}
+
+static void check_round(void) {
+	static char area_a[256], area_b[256];
+	char a_src[MAX_LEN + 1], b_src[MAX_LEN + 1];
+	random_string(a_src, rnd() % MAX_LEN);
+	if (rnd() % 4 == 0) {
+		// Derived from a, to get long common prefixes and case variations
+		strcpy(b_src, a_src);
+		for (char *p = b_src; *p; p++) {
+			if (rnd() % 8 == 0)
+				*p ^= 0x20;
+		}
+		b_src[rnd() % (strlen(b_src) + 1)] = 0;
+	} else
+		random_string(b_src, rnd() % 6);
+
+	char *a = place(a_src, rnd() % 3 == 0, rnd() % 8, area_a);
+	char *b = place(b_src, 0, rnd() % 8, area_b);
+	int c = "aAbB_\x80\xff\0"[rnd() % 8];
+	size_t n = rnd() % (MAX_LEN + 8);
+
+	if (str_ops_strlen(a) != strlen(a))
+		fail("strlen", a, NULL);
+	if (str_ops_strnlen(a, n) != strnlen(a, n))
+		fail("strnlen", a, NULL);
+	if (str_ops_strchr(a, c) != strchr(a, c))
+		fail("strchr", a, NULL);
+	if (str_ops_strrchr(a, c) != strrchr(a, c))
+		fail("strrchr", a, NULL);
+	size_t m = n < strlen(a) + 1 ? n : strlen(a) + 1;
+	if (str_ops_memchr(a, c, m) != memchr(a, c, m))
+		fail("memchr", a, NULL);
+	if (sign(str_ops_memcmp(a, b, m < strlen(b) + 1 ? m : strlen(b) + 1)) != sign(memcmp(a, b, m < strlen(b) + 1 ? m : strlen(b) + 1)))
+		fail("memcmp", a, b);
+	if (sign(str_ops_strcmp(a, b)) != sign(strcmp(a, b)) || sign(str_ops_strcmp(b, a)) != sign(strcmp(b, a)))
+		fail("strcmp", a, b);
+	if (sign(str_ops_strncmp(a, b, n)) != sign(strncmp(a, b, n)))
+		fail("strncmp", a, b);
+	if (sign(str_ops_strcasecmp(a, b)) != sign(strcasecmp(a, b)))
+		fail("strcasecmp", a, b);
+	if (sign(str_ops_strncasecmp(a, b, n)) != sign(strncasecmp(a, b, n)))
+		fail("strncasecmp", a, b);
+	if (str_ops_strstr(a, b) != strstr(a, b))
+		fail("strstr", a, b);
+	if (str_ops_strcasestr(a, b) != strcasestr(a, b))
+		fail("strcasestr", a, b);
+	if (str_ops_strcspn(a, b) != strcspn(a, b))
+		fail("strcspn", a, b);
+	if (str_ops_strpbrk(a, b) != strpbrk(a, b))
+		fail("strpbrk", a, b);
+
+	char d1[2 * MAX_LEN + 16], d2[2 * MAX_LEN + 16];
+	memset(d1, 0x55, sizeof(d1));
+	memset(d2, 0x55, sizeof(d2));
+	str_ops_strcpy(d1 + 1, a);
+	strcpy(d2 + 1, a);
+	str_ops_strcat(d1 + 1, b);
+	strcat(d2 + 1, b);
+	if (memcmp(d1, d2, sizeof(d1)))
+		fail("strcpy/strcat", a, b);
+	size_t k = n % (MAX_LEN + 1);
+	str_ops_strncpy(d1 + 1, a, k);
+	strncpy(d2 + 1, a, k);
+	str_ops_strncat(d1 + 1, b, n % 4);
+	strncat(d2 + 1, b, n % 4);
+	if (memcmp(d1, d2, sizeof(d1)))
+		fail("strncpy/strncat", a, b);
+	size_t r1 = str_ops_strlcpy(d1 + 1, a, n % 12);
+	size_t len = strlen(a), cut = n % 12 ? (len < n % 12 ? len : n % 12 - 1) : 0;
+	if (n % 12) {
+		memcpy(d2 + 1, a, cut);
+		d2[1 + cut] = 0;
+	}
+	if (r1 != len || memcmp(d1, d2, sizeof(d1)))
+		fail("strlcpy", a, NULL);
+}
+
+static void check_wide(void) {
+	wchar_t a[MAX_LEN + 1], b[MAX_LEN + 1], d1[MAX_LEN + 8], d2[MAX_LEN + 8];
+	int la = rnd() % MAX_LEN, lb = rnd() % MAX_LEN;
+	for (int i = 0; i < la; i++)
+		a[i] = rnd() % 3 ? 'a' + rnd() % 3 : 0x1000 + rnd() % 2;
+	for (int i = 0; i < lb; i++)
+		b[i] = i < la && rnd() % 4 ? a[i] : 'a' + rnd() % 3;
+	a[la] = b[lb] = 0;
+	size_t n = rnd() % (MAX_LEN + 4), m = n < (size_t)la + 1 ? n : (size_t)la + 1;
+	m = m < (size_t)lb + 1 ? m : (size_t)lb + 1;
+
+	if (str_ops_wcslen(a) != wcslen(a))
+		fail("wcslen", NULL, NULL);
+	if (sign(str_ops_wcscmp(a, b)) != sign(wcscmp(a, b)))
+		fail("wcscmp", NULL, NULL);
+	if (str_ops_wmemchr(a, b[0], m) != wmemchr(a, b[0], m))
+		fail("wmemchr", NULL, NULL);
+	if (sign(str_ops_wmemcmp(a, b, m)) != sign(wmemcmp(a, b, m)))
+		fail("wmemcmp", NULL, NULL);
+	memset(d1, 0x55, sizeof(d1));
+	memset(d2, 0x55, sizeof(d2));
+	str_ops_wcsncpy(d1, a, n);
+	wcsncpy(d2, a, n);
+	if (memcmp(d1, d2, sizeof(d1)))
+		fail("wcsncpy", NULL, NULL);
+	str_ops_wmemset(d1 + 1, b[0], m);
+	wmemset(d2 + 1, b[0], m);
+	str_ops_wmemmove(d1 + 2, d1, m);
+	wmemmove(d2 + 2, d2, m);
+	str_ops_wmemcpy(d1, b, m);
+	wmemcpy(d2, b, m);
+	if (memcmp(d1, d2, sizeof(d1)))
+		fail("wmemset/wmemmove/wmemcpy", NULL, NULL);
+}
+
+static double now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// What a plain byte at a time implementation costs, closer to the device than glibc's SIMD
+static __attribute__((noinline)) size_t byte_strlen(const char *s) {
+	const char *p = s;
+	while (*(volatile const char *)p)
+		p++;
+	return p - s;
+}
+
+static __attribute__((noinline)) const char *byte_strchr(const char *s, int c) {
+	for (; *(volatile const char *)s != (char)c; s++) {
+		if (!*s)
+			return NULL;
+	}
+	return s;
+}
+
+static __attribute__((noinline)) const void *byte_memchr(const void *s, int c, size_t n) {
+	for (volatile const uint8_t *p = s; n; n--, p++) {
+		if (*p == (uint8_t)c)
+			return (const void *)p;
+	}
+	return NULL;
+}
+
+static __attribute__((noinline)) int byte_strcmp(const char *a, const char *b) {
+	volatile const uint8_t *p = (const uint8_t *)a, *q = (const uint8_t *)b;
+	for (; *p && *p == *q; p++, q++)
+		;
+	return *p - *q;
+}
+
+static __attribute__((noinline)) int byte_strcasecmp(const char *a, const char *b) {
+	volatile const uint8_t *p = (const uint8_t *)a, *q = (const uint8_t *)b;
+	for (; *p && tolower(*p) == tolower(*q); p++, q++)
+		;
+	return tolower(*p) - tolower(*q);
+}
+
+#define TIME(label, iters, ours, bytes, theirs)                              \
+	do {                                                                     \
+		volatile uintptr_t sink = 0;                                         \
+		double t[3], start = now_ns();                                       \
+		for (int i = 0; i < (iters); i++)                                    \
+			sink += (uintptr_t)(ours);                                       \
+		t[0] = now_ns() - start;                                             \
+		start = now_ns();                                                    \
+		for (int i = 0; i < (iters); i++)                                    \
+			sink += (uintptr_t)(bytes);                                      \
+		t[1] = now_ns() - start;                                             \
+		start = now_ns();                                                    \
+		for (int i = 0; i < (iters); i++)                                    \
+			sink += (uintptr_t)(theirs);                                     \
+		t[2] = now_ns() - start;                                             \
+		printf("%-26s %9.1f %9.1f %9.1f\n", label, t[0] / (iters), t[1] / (iters), t[2] / (iters)); \
+	} while (0)
+
+static void bench(void) {
+	// Resolved at run time, so the compiler can't fold glibc's calls away
+	size_t (*volatile lib_strlen)(const char *) = strlen;
+	char *(*volatile lib_strchr)(const char *, int) = strchr;
+	int (*volatile lib_strcmp)(const char *, const char *) = strcmp;
+	void *(*volatile lib_memchr)(const void *, int, size_t) = memchr;
+	int (*volatile lib_strcasecmp)(const char *, const char *) = strcasecmp;
+	char *(*volatile lib_strcasestr)(const char *, const char *) = strcasestr;
+
+	static char text[4096], text2[4096];
+	random_string(text, sizeof(text) - 1);
+	for (char *p = text; *p; p++)
+		*p = *p == 'C' ? 'c' : *p;
+	strcpy(text2, text);
+	const char *name = "gfx/sprites/enemy_walk_01.png", *name2 = "GFX/sprites/enemy_walk_02.png";
+	int iters = 2000000;
+
+	printf("routine                      ns ours  ns bytes  ns glibc\n");
+	TIME("strlen (29 bytes)", iters, str_ops_strlen(name + (i & 1)), byte_strlen(name + (i & 1)), lib_strlen(name + (i & 1)));
+	TIME("strlen (4 KB)", iters / 100, str_ops_strlen(text + (i & 1)), byte_strlen(text + (i & 1)), lib_strlen(text + (i & 1)));
+	TIME("strchr (29 bytes, miss)", iters, str_ops_strchr(name, 'z'), byte_strchr(name, 'z'), lib_strchr(name, 'z'));
+	TIME("strchr (4 KB, miss)", iters / 100, str_ops_strchr(text, 'C'), byte_strchr(text, 'C'), lib_strchr(text, 'C'));
+	TIME("memchr (4 KB, miss)", iters / 100, str_ops_memchr(text, 'C', 4095), byte_memchr(text, 'C', 4095), lib_memchr(text, 'C', 4095));
+	TIME("strcmp (29 bytes)", iters, str_ops_strcmp(name + 3, name2 + 3), byte_strcmp(name + 3, name2 + 3), lib_strcmp(name + 3, name2 + 3));
+	TIME("strcmp (4 KB, equal)", iters / 100, str_ops_strcmp(text, text2), byte_strcmp(text, text2), lib_strcmp(text, text2));
+	TIME("strcasecmp (29 bytes)", iters, str_ops_strcasecmp(name, name2), byte_strcasecmp(name, name2), lib_strcasecmp(name, name2));
+	TIME("strcasestr (4 KB, miss)", iters / 100, str_ops_strcasestr(text, "cab_c"), 0, lib_strcasestr(text, "cab_c"));
+}
+
+int main(int argc, char *argv[]) {
+	long page = sysconf(_SC_PAGESIZE);
+	char *map = mmap(NULL, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	mprotect(map + page, page, PROT_NONE);
+	page_end = map + page;
+
+	if (str_ops_strcasestr("Loading LEVEL_03.dat", "level_03") == NULL)
+		fail("strcasestr", "Loading LEVEL_03.dat", "level_03");
+	for (int i = 0; i < ROUNDS; i++) {
+		check_round();
+		check_wide();
+	}
+
+	if (failures) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	if (argc > 1 && !strcmp(argv[1], "-b"))
+		bench();
+	return 0;
+}
@@ -0,0 +1,308 @@
+/* zlib_check.c -- checks the loader's inflate and crc32 against stock zlib and times them
+ *
+ * Copyright (C) 2022 Rinnegatamante
+ *
+ * This software may be modified and distributed under the terms
+ * of the MIT license.	See the LICENSE file for details.
+ *
+ * Build: gcc -O2 -o zlib_check zlib_check.c ../loader/zlib_fast.c -lz
+ * Usage: zlib_check [-b] [file...]
+ *
+ * Random, repetitive and text-like buffers, plus the files given (the game's
+ * assets), are compressed by stock zlib at several levels and strategies, as
+ * zlib and as raw deflate streams, then inflated through the loader's
+ * wrappers. Return codes, stream fields and the output reported must match
+ * stock inflate without a byte written past the output buffer, for whole
+ * buffers as well as for truncated and corrupted streams, output buffers too
+ * small and input fed in chunks, which the wrappers hand back to zlib. crc32
+ * is compared at every alignment. With -b inflate and crc32 are timed
+ * against zlib on every input.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "../loader/zlib_fast.h"
+
+#define MAX_INPUTS 64
+#define CHUNK 1000
+
+typedef struct {
+	const char *name;
+	uint8_t *data;
+	size_t size;
+} input;
+
+typedef struct {
+	int ret;
+	uLong total_in, total_out, adler;
+} result;
+
+static const int levels[] = { 0, 1, 6, 9 };
+static const int strategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+
+static input inputs[MAX_INPUTS];
+static int inputs_num = 0;
+static int checks = 0, failures = 0;
+static uint32_t seed = 1;
+
+static uint32_t rnd(void) {
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void add_input(const char *name, uint8_t *data, size_t size) {
+	if (inputs_num == MAX_INPUTS)
+		return;
+	inputs[inputs_num].name = name;
+	inputs[inputs_num].data = data;
+	inputs[inputs_num].size = size;
+	inputs_num++;
+}
+
+static void make_inputs(void) {
+	static const char *words[] = { "the", "sprite", "level", "score", " ", " ", "\n", "player", "0", "1", "{", "}", "\"x\": ", "texture" };
+	static const size_t sizes[] = { 1, 7, 100, 1000, 4096, 65536, 300000, 1 << 20 };
+	for (int i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		size_t n = sizes[i];
+		uint8_t *r = malloc(n), *p = malloc(n), *t = malloc(n), *z = calloc(n, 1);
+		for (size_t j = 0; j < n; j++)
+			r[j] = rnd();
+		// Repeats of a short pattern with the odd mutation, long matches at short distances
+		for (size_t j = 0; j < n; j++)
+			p[j] = rnd() % 64 ? "abcabcabd"[j % 9] : rnd();
+		for (size_t j = 0; j < n;) {
+			const char *w = words[rnd() % (sizeof(words) / sizeof(*words))];
+			for (; *w && j < n; w++)
+				t[j++] = *w;
+		}
+		add_input("random", r, n);
+		add_input("pattern", p, n);
+		add_input("text", t, n);
+		add_input("zeros", z, n);
+	}
+}
+
+static int load_file(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data = malloc(size > 0 ? size : 1);
+	if (fread(data, 1, size, f) != (size_t)size) {
+		fclose(f);
+		free(data);
+		return 0;
+	}
+	fclose(f);
+	add_input(path, data, size);
+	return 1;
+}
+
+static uint8_t *compress_stream(const input *in, int level, int strategy, int wbits, size_t *size) {
+	z_stream s;
+	memset(&s, 0, sizeof(s));
+	deflateInit2(&s, level, Z_DEFLATED, wbits, 8, strategy);
+	size_t cap = deflateBound(&s, in->size);
+	uint8_t *out = malloc(cap);
+	s.next_in = in->data;
+	s.avail_in = in->size;
+	s.next_out = out;
+	s.avail_out = cap;
+	deflate(&s, Z_FINISH);
+	*size = s.total_out;
+	deflateEnd(&s);
+	return out;
+}
+
+// Inflates in one call, or in chunks of input when chunked, with either implementation
+static void run(int fast, int wbits, const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len, int chunked, result *r) {
+	z_stream s;
+	memset(&s, 0, sizeof(s));
+	if (fast)
+		zfast_inflateInit2_(&s, wbits, ZLIB_VERSION, sizeof(s));
+	else
+		inflateInit2(&s, wbits);
+	s.next_in = (Bytef *)in;
+	s.next_out = out;
+	s.avail_out = out_len;
+	size_t left = in_len;
+	do {
+		size_t n = chunked && left > CHUNK ? CHUNK : left;
+		s.avail_in = n;
+		left -= n;
+		r->ret = fast ? zfast_inflate(&s, left ? Z_NO_FLUSH : Z_FINISH) : inflate(&s, left ? Z_NO_FLUSH : Z_FINISH);
+		left += s.avail_in;
+	} while (left && (r->ret == Z_OK || r->ret == Z_BUF_ERROR) && s.avail_out);
+	r->total_in = s.total_in;
+	r->total_out = s.total_out;
+	r->adler = s.adler;
+	inflateEnd(&s);
+}
+
+static void compare(const char *what, const input *in, int level, int strategy, int wbits, const uint8_t *stream, size_t stream_len, size_t out_len, int chunked) {
+	uint8_t *ours = malloc(out_len + 1), *theirs = malloc(out_len + 1);
+	result a, b;
+	memset(ours, 0x55, out_len + 1);
+	memset(theirs, 0x55, out_len + 1);
+	run(1, wbits, stream, stream_len, ours, out_len, chunked, &a);
+	run(0, wbits, stream, stream_len, theirs, out_len, chunked, &b);
+	checks++;
+	// Past what it reports, the output buffer is scratch space, but nothing beyond it may be written
+	if (a.ret != b.ret || a.total_in != b.total_in || a.total_out != b.total_out || a.adler != b.adler ||
+		memcmp(ours, theirs, b.total_out) || ours[out_len] != 0x55) {
+		if (failures++ < 20)
+			fprintf(stderr, "%s %s (%zu bytes) level %d strategy %d wbits %d: ret %d/%d in %lu/%lu out %lu/%lu adler %08lx/%08lx\n",
+				what, in->name, in->size, level, strategy, wbits, a.ret, b.ret, a.total_in, b.total_in, a.total_out, b.total_out, a.adler, b.adler);
+	}
+	free(ours);
+	free(theirs);
+}
+
+static void check_input(const input *in) {
+	for (int l = 0; l < sizeof(levels) / sizeof(*levels); l++) {
+		for (int st = 0; st < sizeof(strategies) / sizeof(*strategies); st++) {
+			for (int raw = 0; raw < 2; raw++) {
+				int wbits = raw ? -MAX_WBITS : MAX_WBITS;
+				size_t len;
+				uint8_t *stream = compress_stream(in, levels[l], strategies[st], wbits, &len);
+				compare("whole", in, levels[l], strategies[st], wbits, stream, len, in->size, 0);
+				if (!raw)
+					compare("auto", in, levels[l], strategies[st], MAX_WBITS + 32, stream, len, in->size, 0);
+				compare("roomy", in, levels[l], strategies[st], wbits, stream, len, in->size + 64, 0);
+				compare("short output", in, levels[l], strategies[st], wbits, stream, len, in->size - 1, 0);
+				compare("truncated", in, levels[l], strategies[st], wbits, stream, rnd() % len, in->size, 0);
+				compare("chunked", in, levels[l], strategies[st], wbits, stream, len, in->size, 1);
+				for (int i = 0; i < 4; i++) {
+					size_t at = rnd() % len;
+					uint8_t old = stream[at];
+					stream[at] ^= 1 << (rnd() % 8);
+					compare("corrupted", in, levels[l], strategies[st], wbits, stream, len, in->size, 0);
+					stream[at] = old;
+				}
+				free(stream);
+			}
+		}
+	}
+}
+
+// Streams the game resets and reuses must not keep the fast path's done flag
+static void check_reset(void) {
+	const input *a = &inputs[4 * 5 + 2], *b = &inputs[4 * 5 + 1];
+	size_t a_len, b_len;
+	uint8_t *sa = compress_stream(a, 6, Z_DEFAULT_STRATEGY, MAX_WBITS, &a_len);
+	uint8_t *sb = compress_stream(b, 6, Z_DEFAULT_STRATEGY, MAX_WBITS, &b_len);
+	uint8_t *out = malloc(b->size);
+	z_stream s;
+	memset(&s, 0, sizeof(s));
+	zfast_inflateInit_(&s, ZLIB_VERSION, sizeof(s));
+	s.next_in = sa;
+	s.avail_in = a_len;
+	s.next_out = out;
+	s.avail_out = a->size;
+	int ra = zfast_inflate(&s, Z_FINISH);
+	int ok = ra == Z_STREAM_END && !memcmp(out, a->data, a->size);
+	zfast_inflateReset(&s);
+	s.next_in = sb;
+	s.avail_in = b_len;
+	s.next_out = out;
+	s.avail_out = b->size;
+	int rb = zfast_inflate(&s, Z_FINISH);
+	ok = ok && rb == Z_STREAM_END && s.total_out == b->size && !memcmp(out, b->data, b->size);
+	inflateEnd(&s);
+	checks++;
+	if (!ok && failures++ < 20)
+		fprintf(stderr, "reset: ret %d/%d\n", ra, rb);
+	free(sa);
+	free(sb);
+	free(out);
+}
+
+static void check_crc(void) {
+	const input *in = &inputs[4 * 4];
+	for (int a = 0; a < 16; a++) {
+		for (size_t n = 0; n < 300 && a + n <= in->size; n++) {
+			checks++;
+			if (zfast_crc32(0x12345678, in->data + a, n) != crc32(0x12345678, in->data + a, n) && failures++ < 20)
+				fprintf(stderr, "crc32: alignment %d, size %zu\n", a, n);
+		}
+	}
+	checks++;
+	if (zfast_crc32(0, in->data, in->size) != crc32(0, in->data, in->size) || zfast_crc32(5, NULL, 10) != crc32(5, NULL, 10))
+		if (failures++ < 20)
+			fprintf(stderr, "crc32: whole buffer or null\n");
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double inflate_speed(int fast, const uint8_t *stream, size_t len, uint8_t *out, size_t out_len) {
+	result r;
+	int iters = 0;
+	double start = now(), t;
+	do {
+		run(fast, MAX_WBITS, stream, len, out, out_len, 0, &r);
+		iters++;
+	} while ((t = now() - start) < 0.2);
+	return out_len * (double)iters / t / 1e6;
+}
+
+static void bench(void) {
+	printf("\n%-24s %10s %10s %10s %10s %10s\n", "input (level 6)", "size", "inflate", "zlib", "crc32", "zlib");
+	for (int i = 0; i < inputs_num; i++) {
+		const input *in = &inputs[i];
+		if (in->size < 4096)
+			continue;
+		size_t len;
+		uint8_t *stream = compress_stream(in, 6, Z_DEFAULT_STRATEGY, MAX_WBITS, &len);
+		uint8_t *out = malloc(in->size);
+		double ours = inflate_speed(1, stream, len, out, in->size);
+		double theirs = inflate_speed(0, stream, len, out, in->size);
+
+		volatile uLong sink = 0;
+		double crc[2];
+		for (int k = 0; k < 2; k++) {
+			int iters = 0;
+			double start = now(), t;
+			do {
+				sink += k ? crc32(0, in->data, in->size) : zfast_crc32(0, in->data, in->size);
+				iters++;
+			} while ((t = now() - start) < 0.1);
+			crc[k] = in->size * (double)iters / t / 1e6;
+		}
+		const char *name = strrchr(in->name, '/') ? strrchr(in->name, '/') + 1 : in->name;
+		printf("%-24.24s %10zu %7.0f MB/s %5.0f MB/s %5.0f MB/s %5.0f MB/s\n", name, in->size, ours, theirs, crc[0], crc[1]);
+		free(stream);
+		free(out);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int timing = 0;
+	make_inputs();
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-b"))
+			timing = 1;
+		else if (!load_file(argv[i]))
+			fprintf(stderr, "cannot read %s\n", argv[i]);
+	}
+
+	for (int i = 0; i < inputs_num; i++)
+		check_input(&inputs[i]);
+	check_reset();
+	check_crc();
+
+	printf("%d checks on %d inputs, %d failures\n", checks, inputs_num, failures);
+	if (timing)
+		bench();
+	return failures != 0;
+}